@@ -469,6 +469,19 @@ TrackInfo::SharedPtr TrackQueue::currentTrack()
         waitForEvents(kEvtTrackLoaded);
     }
 }
+TrackInfo::SharedPtr TrackQueue::peekNextTrack()
+{
+    std::scoped_lock lock(mTracksMutex);
+    int idx = mCurrentTrackIdx + 1;
+    if (mCurrentTrackIdx < 0 || idx >= mTracks.size()) {
+        return nullptr;
+    }
+    auto& track = mTracks[idx];
+    if (!track.info || track.info->loadState() != TrackInfo::Loader::kStateComplete) {
+        return nullptr;
+    }
+    return track.info;
+}
 const char* TrackInfo::Loader::stateToStr(TrackInfo::Loader::State state) {
     switch(state) {
         case kStateComplete: return "complete";
@@ -214,6 +214,8 @@ public:
   bool nextTrack(bool nextPrev = true);
   void updateTracks(bool replace = false);
   TrackInfo::SharedPtr currentTrack();
+  /** The track after the current one, if its info is already loaded, without waiting. For prefetching */
+  TrackInfo::SharedPtr peekNextTrack();
   bool queueNextTrack(int offset = 0, uint32_t positionMs = 0);
   void notifyCurrentTrackPlaying(uint32_t pos);
 };
@@ -5,6 +5,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #ifdef BQ_DEBUG
     #define bqassert(cond) \
@@ -18,6 +19,10 @@
 extern "C" int asmBiquad_f32_df2_mono(const float* input, float* output, int len, float* coefs, float* delays);
 extern "C" int asmBiquad_f32_df2_stereo(const float* samples, int len, float* coefs,
     float* delaysL, float* delaysR);
+class BiquadMono;
+class BiquadStereo;
+extern "C" void asmBiquadCascade_f32_df2_mono(float* samples, int len, BiquadMono* const* filters, int numFilters);
+extern "C" void asmBiquadCascade_f32_df2_stereo(float* samples, int len, BiquadStereo* const* filters, int numFilters);
 
 class Biquad
 {
@@ -41,8 +46,9 @@ protected:
     };
     Biquad() {}
 public:
-    /** Calculate coefficients */
-    void recalc(Type type, uint16_t freq, float Q, uint32_t srate, int8_t dbGain)
+    enum { kNumCoeffs = 5 };
+    /** Calculates the coefficients, in the order b0, b1, b2, a1, a2 */
+    static void calcCoeffs(Type type, uint16_t freq, float Q, uint32_t srate, int8_t dbGain, Float* coeffs)
     {
         if (type != kPeaking) {
             dbGain *= 2;
@@ -54,11 +60,11 @@ public:
         double alpha = sn / (2 * Q);
         if (type == kPeaking) {
             double a0inv = 1 / (1 + alpha / A);
-            m_a1 = (-2 * cs) * a0inv;
-            m_a2 = (1 - alpha / A) * a0inv;
-            m_b0 = (1 + alpha * A) * a0inv;
-            m_b1 = (-2 * cs) * a0inv;
-            m_b2 = (1 - alpha * A) * a0inv;
+            coeffs[3] = (-2 * cs) * a0inv;
+            coeffs[4] = (1 - alpha / A) * a0inv;
+            coeffs[0] = (1 + alpha * A) * a0inv;
+            coeffs[1] = (-2 * cs) * a0inv;
+            coeffs[2] = (1 - alpha * A) * a0inv;
             return;
         }
         double appm = (A + 1) + (A - 1) * cs;
@@ -69,25 +75,36 @@ public:
         // When Q = 0.707 (= 1/sqrt(2) = 1 octave), betasn transforms to sqrt(2 * A) * sn, i.e. beta * sn
         if (type == kLowShelf) {
             double a0inv = 1 / (appm + betasn);
-            m_a1 = -2 * ampp * a0inv;
-            m_a2 = (appm - betasn) * a0inv;
-            m_b0 = A * (apmm + betasn) * a0inv;
-            m_b1 = 2 * A * ammp * a0inv;
-            m_b2 = A * (apmm - betasn) * a0inv;
+            coeffs[3] = -2 * ampp * a0inv;
+            coeffs[4] = (appm - betasn) * a0inv;
+            coeffs[0] = A * (apmm + betasn) * a0inv;
+            coeffs[1] = 2 * A * ammp * a0inv;
+            coeffs[2] = A * (apmm - betasn) * a0inv;
         }
         else if (type == kHighShelf) {
             double a0inv = 1 / (apmm + betasn);
-            m_a1 = 2 * ammp * a0inv;
-            m_a2 = (apmm - betasn) * a0inv;
-            m_b0 = A * (appm + betasn) * a0inv;
-            m_b1 = -2 * A * ampp * a0inv;
-            m_b2 = A * (appm - betasn) * a0inv;
+            coeffs[3] = 2 * ammp * a0inv;
+            coeffs[4] = (apmm - betasn) * a0inv;
+            coeffs[0] = A * (appm + betasn) * a0inv;
+            coeffs[1] = -2 * A * ampp * a0inv;
+            coeffs[2] = A * (appm - betasn) * a0inv;
         }
         else {
             bqassert(false);
         }
-        BQ_LOGD("Config band %d Hz, Q: %f, gain: %f", freq, Q, dbGain);
-        BQ_LOGD("coeffs: b0 = %f, b1 = %f, b2 = %f, a1 = %f, a2 = %f", b0, b1, b2, a1, a2);
+        BQ_LOGD("Config band %d Hz, Q: %f, gain: %d", freq, Q, dbGain);
+        BQ_LOGD("coeffs: b0 = %f, b1 = %f, b2 = %f, a1 = %f, a2 = %f", coeffs[0], coeffs[1], coeffs[2], coeffs[3], coeffs[4]);
+    }
+    /** Calculate coefficients */
+    void recalc(Type type, uint16_t freq, float Q, uint32_t srate, int8_t dbGain)
+    {
+        calcCoeffs(type, freq, Q, srate, dbGain, m_coeffs);
+    }
+    const Float* coeffs() const { return m_coeffs; }
+    /** Sets coefficients calculated by calcCoeffs() */
+    void setCoeffs(const Float* coeffs)
+    {
+        memcpy(m_coeffs, coeffs, sizeof(m_coeffs));
     }
 };
 
@@ -124,6 +141,29 @@ public:
         mDelay[0] = dly0;
         mDelay[1] = dly1;
     }
+    /** Runs each sample through all filters, keeping it in a register, instead of doing one pass
+     * over the buffer per filter. The output is identical to calling process() of each filter in turn
+     */
+    static void processCascade(BiquadMono* const* filters, int numFilters, Float* samples, int len)
+    {
+        BiquadMono* const* filtEnd = filters + numFilters;
+        Float* end = samples + len;
+        for (; samples < end; samples++) {
+            Float in = *samples;
+            for (auto it = filters; it < filtEnd; it++) {
+                auto& f = **it;
+                Float out = in * f.m_b0 + f.mDelay[0];
+                f.mDelay[0] = in * f.m_b1 + f.mDelay[1] - f.m_a1 * out;
+                f.mDelay[1] = in * f.m_b2 - f.m_a2 * out;
+                in = out;
+            }
+            *samples = in;
+        }
+    }
+    static inline void processCascade_asm(BiquadMono* const* filters, int numFilters, Float* samples, int len)
+    {
+        asmBiquadCascade_f32_df2_mono(samples, len, filters, numFilters);
+    }
 };
 
 class BiquadStereo: public Biquad {
@@ -170,6 +210,36 @@ public:
         mDelayR[0] = dlyR0;
         mDelayR[1] = dlyR1;
     }
+    /** Stereo version of BiquadMono::processCascade() */
+    static void processCascade(BiquadStereo* const* filters, int numFilters, Float* samples, int len)
+    {
+        BiquadStereo* const* filtEnd = filters + numFilters;
+        Float* end = samples + 2 * len;
+        for (; samples < end; samples += 2) {
+            Float inL = samples[0];
+            Float inR = samples[1];
+            for (auto it = filters; it < filtEnd; it++) {
+                auto& f = **it;
+                Float outL = inL * f.m_b0 + f.mDelayL[0];
+                f.mDelayL[0] = inL * f.m_b1 + f.mDelayL[1] - f.m_a1 * outL;
+                f.mDelayL[1] = inL * f.m_b2 - f.m_a2 * outL;
+                Float outR = inR * f.m_b0 + f.mDelayR[0];
+                f.mDelayR[0] = inR * f.m_b1 + f.mDelayR[1] - f.m_a1 * outR;
+                f.mDelayR[1] = inR * f.m_b2 - f.m_a2 * outR;
+                inL = outL;
+                inR = outR;
+            }
+            samples[0] = inL;
+            samples[1] = inR;
+        }
+    }
+    static inline void processCascade_asm(BiquadStereo* const* filters, int numFilters, Float* samples, int len)
+    {
+        asmBiquadCascade_f32_df2_stereo(samples, len, filters, numFilters);
+    }
 };
+// The asm cascade kernels expect the coefficients, followed by the delay line(s)
+static_assert(sizeof(BiquadMono) == 7 * sizeof(Biquad::Float), "");
+static_assert(sizeof(BiquadStereo) == 9 * sizeof(Biquad::Float), "");
 
 #endif
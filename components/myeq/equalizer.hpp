@@ -3,6 +3,7 @@
 #include "biquad.hpp"
 #include <string.h>
 #include <memory>
+#include <algorithm>
 
 struct EqBandConfig {
     uint16_t freq = 0;
@@ -19,6 +20,9 @@ struct EqBandConfig {
     static const EqBandConfig* defaultCfg(int n) {
         return (n < 3 || n > 10) ? nullptr : kBandPresets[n - 3];
     }
+    static Biquad::Type filterType(uint8_t band, uint8_t numBands) {
+        return band == 0 ? Biquad::kLowShelf : ((band == numBands - 1) ? Biquad::kHighShelf : Biquad::kPeaking);
+    }
 };
 
 static_assert(sizeof(EqBandConfig) == 4, "");
@@ -35,14 +39,23 @@ protected:
     uint8_t mBandCount;
     uint32_t mSampleRate;
     std::unique_ptr<BiquadType[]> mFilters;
+    std::unique_ptr<BiquadType*[]> mActiveFilters; // of the bands with non-zero gain, in band order
+    uint8_t mNumActiveFilters = 0;
     // Need to have filter configs and gains in continguous arrays instead of members of each filter,
     // because it's simpler and more efficient to load and store them in NVS
     std::unique_ptr<EqBandConfig[]> mBandConfigs;
     std::unique_ptr<Gain[]> mGains;
+    // Gradual change of the coefficients, set up by setCoeffs()
+    enum { kRampBlockFrames = 32 };
+    std::unique_ptr<Biquad::Float[]> mRampCoeffs; // start and target coefficients of each band
+    uint32_t mRampActive = 0; // bands that are active when the ramp ends
+    int mRampFrames = 0;
+    int mRampPos = 0;
 public:
     Equalizer(uint8_t nBands, uint32_t sampleRate):
         mBandCount(nBands), mSampleRate(sampleRate),
         mFilters(new BiquadType[nBands]),
+        mActiveFilters(new BiquadType*[nBands]),
         mBandConfigs(new EqBandConfig[nBands]),
         mGains(new Gain[nBands])
     {
@@ -53,12 +66,11 @@ public:
     EqBandConfig* bandConfigs() { return mBandConfigs.get(); }
     EqBandConfig& bandConfig(uint8_t band) { return mBandConfigs[band]; }
     Gain* gains() { return mGains.get(); }
-    void setSampleRate(uint32_t sampleRate) { mSampleRate = sampleRate; updateAllFilters(); }
     // This class is not constructed directly via the ctor, but instead with a ::create factory function,
     // since additional runtime-determined amount of memory needs to be allocated at the end,
     // for the Biquad filters and the band configs
     static uint32_t instSize(uint8_t nBands) {
-        return sizeof(Equalizer<IsStereo>) + nBands * (sizeof(BiquadType) + sizeof(EqBandConfig) + sizeof(Gain));
+        return sizeof(Equalizer<IsStereo>) + nBands * (sizeof(BiquadType) + sizeof(BiquadType*) + sizeof(EqBandConfig) + sizeof(Gain));
     }
     void resetState()
     {
@@ -66,14 +78,68 @@ public:
             mFilters[i].clearState();
         }
     }
-    void process(float* input, int len)
+    /** Runs the samples through the filters of all bands with non-zero gain, in a single pass */
+    void process(float* samples, int len)
+    {
+        if (mRampFrames) {
+            int done = processRamp(samples, len);
+            samples += done * (IsStereo ? 2 : 1);
+            len -= done;
+        }
+        processActive(samples, len);
+    }
+    void processActive(float* samples, int len)
+    {
+        if (!mNumActiveFilters || len <= 0) {
+            return;
+        }
+#if defined(__XTENSA__) && !defined(BQ_NO_ASM)
+        BiquadType::processCascade_asm(mActiveFilters.get(), mNumActiveFilters, samples, len);
+#else
+        BiquadType::processCascade(mActiveFilters.get(), mNumActiveFilters, samples, len);
+#endif
+    }
+    /** Processes the samples in small blocks, moving the coefficients of the active filters from the start
+     * to the target values after each block. Returns the number of frames processed */
+    int processRamp(float* samples, int len)
+    {
+        int done = 0;
+        while (done < len && mRampPos < mRampFrames) {
+            int n = std::min(std::min(len - done, (int)kRampBlockFrames), mRampFrames - mRampPos);
+            mRampPos += n;
+            Biquad::Float t = (Biquad::Float)mRampPos / mRampFrames;
+            for (int i = 0; i < mNumActiveFilters; i++) {
+                int band = mActiveFilters[i] - mFilters.get();
+                auto from = mRampCoeffs.get() + band * 2 * Biquad::kNumCoeffs;
+                auto to = from + Biquad::kNumCoeffs;
+                Biquad::Float coeffs[Biquad::kNumCoeffs];
+                for (int j = 0; j < Biquad::kNumCoeffs; j++) {
+                    coeffs[j] = from[j] + (to[j] - from[j]) * t;
+                }
+                mActiveFilters[i]->setCoeffs(coeffs);
+            }
+            processActive(samples + done * (IsStereo ? 2 : 1), n);
+            done += n;
+        }
+        if (mRampPos >= mRampFrames) {
+            mRampFrames = 0;
+            for (int i = 0; i < mBandCount; i++) {
+                mFilters[i].setCoeffs(mRampCoeffs.get() + (i * 2 + 1) * Biquad::kNumCoeffs);
+            }
+            setActiveFilters(mRampActive);
+        }
+        return done;
+    }
+    /** Runs the samples through all bands, with one pass over the buffer per band. Used as a reference
+     * in benchmarks */
+    void processBandByBand(float* samples, int len)
     {
         for (int i = 0; i < mBandCount; i++) {
-            mFilters[i].process(input, len);
+            mFilters[i].process(samples, len);
         }
     }
     Biquad::Type filterTypeOfBand(uint8_t band) const {
-        return band == 0 ? Biquad::kLowShelf : ((band == mBandCount - 1) ? Biquad::kHighShelf : Biquad::kPeaking);
+        return EqBandConfig::filterType(band, mBandCount);
     }
     void updateFilter(uint8_t band, bool clearState)
     {
@@ -85,6 +151,71 @@ public:
         if (clearState) {
             filter.clearState();
         }
+        updateActiveFilters();
+    }
+    // A band with 0 dB gain doesn't change the signal, so it's skipped. Its state is cleared, so that it
+    // starts from silence when its gain is changed, rather than from a stale delay line
+    void updateActiveFilters()
+    {
+        setActiveFilters(activeMask(mGains.get()));
+    }
+    uint32_t activeMask(const Gain* gains) const
+    {
+        uint32_t mask = 0;
+        for (int i = 0; i < mBandCount; i++) {
+            if (gains[i]) {
+                mask |= 1 << i;
+            }
+        }
+        return mask;
+    }
+    void setActiveFilters(uint32_t mask)
+    {
+        mRampFrames = 0;
+        mNumActiveFilters = 0;
+        for (int i = 0; i < mBandCount; i++) {
+            if (mask & (1 << i)) {
+                mActiveFilters[mNumActiveFilters++] = &mFilters[i];
+            }
+            else {
+                mFilters[i].clearState();
+            }
+        }
+    }
+    /** Sets the coefficients of all bands, Biquad::kNumCoeffs per band, as calculated by calcBandCoeffs(),
+     * and the bands that are active, according to \c gains. Doesn't use the gains and band configs of this
+     * object, so it can be called by the audio thread while another thread changes them.
+     * With \c rampFrames, the coefficients move to the new values gradually, during that many frames of
+     * the following process() calls, which avoids the clicks of an abrupt change. During the ramp, the
+     * bands that are active before or after it are processed */
+    void setCoeffs(const Biquad::Float* coeffs, const Gain* gains, int rampFrames = 0)
+    {
+        uint32_t active = activeMask(gains);
+        if (rampFrames <= 0) {
+            for (int i = 0; i < mBandCount; i++) {
+                mFilters[i].setCoeffs(coeffs + i * Biquad::kNumCoeffs);
+            }
+            setActiveFilters(active);
+            return;
+        }
+        if (!mRampCoeffs) {
+            mRampCoeffs.reset(new Biquad::Float[mBandCount * 2 * Biquad::kNumCoeffs]);
+        }
+        // a ramp in progress continues from the coefficients it has reached
+        uint32_t current = 0;
+        for (int i = 0; i < mNumActiveFilters; i++) {
+            current |= 1 << (mActiveFilters[i] - mFilters.get());
+        }
+        for (int i = 0; i < mBandCount; i++) {
+            auto from = mRampCoeffs.get() + i * 2 * Biquad::kNumCoeffs;
+            memcpy(from, mFilters[i].coeffs(), Biquad::kNumCoeffs * sizeof(Biquad::Float));
+            memcpy(from + Biquad::kNumCoeffs, coeffs + i * Biquad::kNumCoeffs, Biquad::kNumCoeffs * sizeof(Biquad::Float));
+        }
+        // bands that were not active start from a cleared state, with their 0 dB (pass-through) coefficients
+        setActiveFilters(current | active);
+        mRampActive = active;
+        mRampFrames = rampFrames;
+        mRampPos = 0;
     }
     void updateAllFilters(bool clearState)
     {
@@ -92,6 +223,29 @@ public:
             updateFilter(i, clearState);
         }
     }
+    /** Calculates the coefficients of a band for another sample rate, without changing the filter */
+    void calcBandCoeffs(uint8_t band, uint32_t sampleRate, Biquad::Float* coeffs) const
+    {
+        bqassert(band < mBandCount);
+        auto& cfg = mBandConfigs[band];
+        Biquad::calcCoeffs(filterTypeOfBand(band), cfg.freq, (float)cfg.Q / 1000, sampleRate, mGains[band], coeffs);
+    }
+    /** Switches to another sample rate and clears the filter states. If \c coeffs is not null, it has
+     * Biquad::kNumCoeffs coefficients per band for the new rate, as calculated by calcBandCoeffs(),
+     * otherwise they are calculated here */
+    void setSampleRate(uint32_t sampleRate, const Biquad::Float* coeffs = nullptr)
+    {
+        mSampleRate = sampleRate;
+        if (!coeffs) {
+            updateAllFilters(true);
+            return;
+        }
+        for (int i = 0; i < mBandCount; i++) {
+            mFilters[i].setCoeffs(coeffs + i * Biquad::kNumCoeffs);
+            mFilters[i].clearState();
+        }
+        updateActiveFilters();
+    }
     void setBandGain(uint8_t band, Gain gain) {
         mGains[band] = gain;
         updateFilter(band, false);
@@ -13,6 +13,7 @@
 #include "a2dpInputNode.hpp"
 #include "audioPlayer.hpp"
 #include "magic_enum.hpp"
+#include <buffer.hpp>
 
 static constexpr const char* TAG = "a2dp-in";
 static constexpr const char* TAG_AVRC = "a2dp-in:avrc";
@@ -173,6 +174,7 @@ void A2dpInputNode::postStreamStart(StreamFormat fmt)
     }
     mSourceFormat = fmt;
     mStreamId = mPipeline.getNewStreamId();
+    mNextPts = 0;
     mRingBuf.pushBack(new NewStreamEvent(mStreamId, fmt, 16));
     if (!mRingBuf.dataSize()) {
         mWaitingPrefill = mSourceFormat.prefillAmount();
@@ -348,9 +350,12 @@ void A2dpInputNode::sDataCallback(const uint8_t* data, uint32_t len)
 }
 void A2dpInputNode::onData(DataPacket* pkt)
 {
+    auto len = pkt->dataLen;
+    pkt->pts = mNextPts;
+    mNextPts += len / (2 * sizeof(int16_t)); // always 16-bit stereo
     mRingBuf.pushBack(pkt);
     MutexLocker locker(mMutex);
-    mSpeedProbe.onTraffic(pkt->dataLen);
+    mSpeedProbe.onTraffic(len);
     if (mWaitingPrefill && mRingBuf.dataSize() > mWaitingPrefill) {
         ESP_LOGI(mTag, "Prefill %lu complete", mWaitingPrefill);
         mWaitingPrefill = 0;
@@ -435,8 +440,14 @@ A2dpInputNode::~A2dpInputNode()
     esp_avrc_tg_register_callback(nullptr);
     gSelf = nullptr;
 }
+void A2dpInputNode::perfExtraToJson(DynBuffer& buf)
+{
+    buf.printf(",\"queue\":");
+    mQueueTrace.toJson(buf);
+}
 StreamEvent A2dpInputNode::pullData(PacketResult& dpr)
 {
+    mQueueTrace.sample(mRingBuf.size(), mRingBuf.dataSize());
     if (!mRingBuf.dataSize()) {
         ESP_LOGW(mTag, "Underrun");
     }
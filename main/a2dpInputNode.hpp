@@ -28,9 +28,11 @@ protected:
     static A2dpInputNode* gSelf; // bluetooth callbacks don't have a user pointer
     AudioPlayer& mPlayer;
     StreamRingQueue<10> mRingBuf;
+    QueueDepthTrace mQueueTrace;
     StreamFormat mSourceFormat;
     LinkSpeedProbe mSpeedProbe;
     uint32_t mWaitingPrefill = 0;
+    uint32_t mNextPts = 0; // accessed only by the A2DP data callback and on stream start, before any data
     unique_ptr_mfree<const char> mTrackTitle;
     unique_ptr_mfree<const char> mTrackArtist;
     esp_avrc_rn_evt_cap_mask_t mAvrcPeerCaps = (esp_avrc_rn_evt_cap_mask_t)0;
@@ -68,6 +70,7 @@ public:
     A2dpInputNode(AudioPlayer& player, bool manageDiscoverable);
     ~A2dpInputNode();
     virtual StreamEvent pullData(PacketResult& dpr) override;
+    virtual void perfExtraToJson(DynBuffer& buf) override;
     virtual IInputAudioNode* inputNodeIntf() override { return static_cast<IInputAudioNode*>(this); }
     virtual uint32_t pollSpeed() override;
     virtual uint32_t bufferedDataSize() const override { return mRingBuf.dataSize(); }
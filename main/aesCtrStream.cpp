@@ -0,0 +1,48 @@
+#include "aesCtrStream.hpp"
+#include <string.h>
+#include <esp_log.h>
+
+static const char* TAG = "aes-ctr";
+
+bool AesCtrStream::setKey(const uint8_t* key, int keyLen, const uint8_t* iv)
+{
+    mHasKey = mbedtls_aes_setkey_enc(&mCtx, key, keyLen * 8) == 0;
+    if (!mHasKey) {
+        ESP_LOGE(TAG, "Invalid key of %d bytes", keyLen);
+        return false;
+    }
+    memcpy(mIv, iv, kBlockSize);
+    seek(0);
+    return true;
+}
+void AesCtrStream::seek(uint32_t pos)
+{
+    // the counter is big-endian, over the whole block
+    memcpy(mCounter, mIv, kBlockSize);
+    uint32_t carry = pos / kBlockSize;
+    for (int i = kBlockSize - 1; i >= 0 && carry; i--) {
+        carry += mCounter[i];
+        mCounter[i] = carry & 0xff;
+        carry >>= 8;
+    }
+    mPos = pos;
+    mBlockOffset = pos % kBlockSize;
+    if (mBlockOffset) {
+        // as mbedtls_aes_crypt_ctr() leaves it in the middle of a block: the keystream block of the
+        // current counter, and the counter incremented
+        mbedtls_aes_crypt_ecb(&mCtx, MBEDTLS_AES_ENCRYPT, mCounter, mStreamBlock);
+        for (int i = kBlockSize - 1; i >= 0 && ++mCounter[i] == 0; i--);
+    }
+}
+bool AesCtrStream::xcrypt(uint8_t* data, size_t len)
+{
+    if (!mHasKey) {
+        return false;
+    }
+    if (mbedtls_aes_crypt_ctr(&mCtx, len, &mBlockOffset, mCounter, mStreamBlock, data, data) != 0) {
+        ESP_LOGE(TAG, "mbedtls_aes_crypt_ctr failed");
+        return false;
+    }
+    mPos += len;
+    return true;
+}
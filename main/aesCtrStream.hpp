@@ -0,0 +1,38 @@
+#ifndef AES_CTR_STREAM_HPP
+#define AES_CTR_STREAM_HPP
+#include <mbedtls/aes.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/** AES-CTR decryption of a stream, with the counter and the position within the keystream block kept across
+ * calls, so that data can be decrypted in place, in chunks of any size, as received. The key is expanded once
+ * per stream, instead of for every chunk. With CONFIG_MBEDTLS_HARDWARE_AES, mbedtls runs the block cipher on
+ * the AES peripheral.
+ */
+class AesCtrStream
+{
+public:
+    enum { kBlockSize = 16 };
+protected:
+    mbedtls_aes_context mCtx;
+    uint8_t mIv[kBlockSize]; // the counter at stream position 0
+    uint8_t mCounter[kBlockSize]; // of the next keystream block
+    uint8_t mStreamBlock[kBlockSize]; // the current keystream block
+    size_t mBlockOffset = 0; // position in mStreamBlock, 0 if the next byte starts a new block
+    uint32_t mPos = 0;
+    bool mHasKey = false;
+public:
+    AesCtrStream() { mbedtls_aes_init(&mCtx); }
+    ~AesCtrStream() { mbedtls_aes_free(&mCtx); }
+    AesCtrStream(const AesCtrStream&) = delete;
+    /** Sets the key and the initial counter, and positions the stream at its start. \c keyLen is in bytes */
+    bool setKey(const uint8_t* key, int keyLen, const uint8_t* iv);
+    bool hasKey() const { return mHasKey; }
+    /** Positions the stream at \c pos bytes from its start, which needs not be a multiple of the block size */
+    void seek(uint32_t pos);
+    uint32_t pos() const { return mPos; }
+    /** Decrypts (or encrypts) \c len bytes at the current position, in place, and advances the position */
+    bool xcrypt(uint8_t* data, size_t len);
+};
+
+#endif
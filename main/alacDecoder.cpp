@@ -0,0 +1,296 @@
+#include "alacDecoder.hpp"
+#include <string.h>
+#include <algorithm>
+#include <esp_log.h>
+
+static const char* TAG = "alac";
+
+static inline uint32_t readBE32(const uint8_t* ptr)
+{
+    return (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+}
+static inline int log2Floor(uint32_t val) // 0 for 0, as av_log2()
+{
+    return 31 - __builtin_clz(val | 1);
+}
+static inline int32_t signExtend(uint32_t val, int bits)
+{
+    int shift = 32 - bits;
+    return (int32_t)(val << shift) >> shift;
+}
+static inline int signOnly(int32_t val)
+{
+    return (val > 0) - (val < 0);
+}
+bool AlacDecoder::init(const uint8_t* cookie, int len)
+{
+    if (len < kConfigSize) {
+        ESP_LOGE(TAG, "ALACSpecificConfig is too short: %d bytes", len);
+        return false;
+    }
+    auto& cfg = mConfig;
+    cfg.frameLength = readBE32(cookie);
+    cfg.compatibleVersion = cookie[4];
+    cfg.bitDepth = cookie[5];
+    cfg.pb = cookie[6];
+    cfg.mb = cookie[7];
+    cfg.kb = cookie[8];
+    cfg.numChannels = cookie[9];
+    cfg.maxRun = (cookie[10] << 8) | cookie[11];
+    cfg.maxFrameBytes = readBE32(cookie + 12);
+    cfg.avgBitRate = readBE32(cookie + 16);
+    cfg.sampleRate = readBE32(cookie + 20);
+    ESP_LOGI(TAG, "%d-bit %s, %lu Hz, frame length %lu", cfg.bitDepth, cfg.numChannels == 2 ? "stereo" : "mono",
+        (unsigned long)cfg.sampleRate, (unsigned long)cfg.frameLength);
+    if (cfg.compatibleVersion != 0 || !cfg.frameLength || cfg.frameLength > kMaxFrameLength || !cfg.kb || cfg.kb > 25) {
+        ESP_LOGE(TAG, "Unsupported stream parameters");
+        return false;
+    }
+    if (cfg.numChannels < 1 || cfg.numChannels > kMaxChannels) {
+        ESP_LOGE(TAG, "Unsupported number of channels: %d", cfg.numChannels);
+        return false;
+    }
+    if (cfg.bitDepth != 16 && cfg.bitDepth != 20 && cfg.bitDepth != 24 && cfg.bitDepth != 32) {
+        ESP_LOGE(TAG, "Unsupported bit depth: %d", cfg.bitDepth);
+        return false;
+    }
+    for (int ch = 0; ch < cfg.numChannels; ch++) {
+        mSamples[ch].reset(new int32_t[cfg.frameLength]);
+        if (cfg.bitDepth > 16) {
+            mExtraBits[ch].reset(new uint16_t[cfg.frameLength]);
+        }
+    }
+    return true;
+}
+int AlacDecoder::decode(const uint8_t* data, int len)
+{
+    BitReader br(data, len);
+    int ch = 0;
+    int nSamples = 0;
+    for (;;) {
+        int type = br.read(3);
+        if (type == kIdEnd) {
+            break;
+        }
+        if (type != kIdSce && type != kIdCpe) {
+            ESP_LOGW(TAG, "Unsupported element type %d", type);
+            return kErrUnsupported;
+        }
+        int numChans = (type == kIdCpe) ? 2 : 1;
+        if (ch + numChans > mConfig.numChannels) {
+            ESP_LOGW(TAG, "Too many channels in frame");
+            return kErrData;
+        }
+        int ret = decodeElement(br, ch, numChans);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ch && ret != nSamples) {
+            ESP_LOGW(TAG, "Elements in frame have different number of samples");
+            return kErrData;
+        }
+        nSamples = ret;
+        ch += numChans;
+    }
+    if (br.overrun() || ch != mConfig.numChannels) {
+        ESP_LOGW(TAG, "Truncated frame");
+        return kErrData;
+    }
+    return nSamples;
+}
+int AlacDecoder::decodeElement(BitReader& br, int ch, int numChans)
+{
+    br.skip(4 + 12); // element instance tag, unused header bits
+    bool hasSize = br.read(1);
+    int extraBits = br.read(2) << 3;
+    bool isCompressed = !br.read(1);
+    uint32_t nSamples = hasSize ? br.readLong(32) : mConfig.frameLength;
+    if (!nSamples || nSamples > mConfig.frameLength) {
+        ESP_LOGW(TAG, "Invalid number of samples in frame: %lu", (unsigned long)nSamples);
+        return kErrData;
+    }
+    int bps = mConfig.bitDepth - extraBits + numChans - 1;
+    if (bps < 1 || bps > 32 || extraBits > 16) {
+        ESP_LOGW(TAG, "Invalid sample size");
+        return kErrData;
+    }
+    int decorrShift = 0;
+    int decorrWeight = 0;
+    if (isCompressed) {
+        decorrShift = br.read(8);
+        decorrWeight = br.read(8);
+        if (numChans == 2 && decorrWeight && decorrShift > 31) {
+            return kErrData;
+        }
+        uint8_t predType[kMaxChannels];
+        uint8_t quant[kMaxChannels];
+        uint8_t historyMult[kMaxChannels];
+        uint8_t order[kMaxChannels];
+        int16_t coefs[kMaxChannels][kMaxLpcOrder];
+        for (int i = 0; i < numChans; i++) {
+            predType[i] = br.read(4);
+            quant[i] = br.read(4);
+            historyMult[i] = br.read(3);
+            order[i] = br.read(5);
+            if (!quant[i] || order[i] >= mConfig.frameLength) {
+                return kErrData;
+            }
+            for (int j = order[i] - 1; j >= 0; j--) {
+                coefs[i][j] = (int16_t)br.read(16);
+            }
+        }
+        if (extraBits) {
+            if (!mExtraBits[ch]) {
+                return kErrData;
+            }
+            for (uint32_t s = 0; s < nSamples; s++) {
+                for (int i = 0; i < numChans; i++) {
+                    mExtraBits[ch + i][s] = br.read(extraBits);
+                }
+            }
+        }
+        for (int i = 0; i < numChans; i++) {
+            auto buf = mSamples[ch + i].get();
+            if (!riceDecompress(br, buf, nSamples, bps, historyMult[i] * mConfig.pb / 4)) {
+                return kErrData;
+            }
+            if (predType[i] == 15) { // not used by the reference encoder
+                lpcPredict(buf, nSamples, bps, nullptr, 31, 0);
+            }
+            else if (predType[i] != 0) {
+                ESP_LOGW(TAG, "Unknown prediction type %d", predType[i]);
+            }
+            lpcPredict(buf, nSamples, bps, coefs[i], order[i], quant[i]);
+        }
+    }
+    else {
+        for (uint32_t s = 0; s < nSamples; s++) {
+            for (int i = 0; i < numChans; i++) {
+                mSamples[ch + i][s] = signExtend(br.readLong(mConfig.bitDepth), mConfig.bitDepth);
+            }
+        }
+        extraBits = 0;
+    }
+    if (br.overrun()) {
+        return kErrData;
+    }
+    if (numChans == 2 && decorrWeight) {
+        auto left = mSamples[ch].get();
+        auto right = mSamples[ch + 1].get();
+        for (uint32_t s = 0; s < nSamples; s++) {
+            int32_t a = left[s];
+            int32_t b = right[s];
+            a -= (int32_t)((uint32_t)b * decorrWeight) >> decorrShift;
+            b += a;
+            left[s] = b;
+            right[s] = a;
+        }
+    }
+    if (extraBits) {
+        for (int i = 0; i < numChans; i++) {
+            auto buf = mSamples[ch + i].get();
+            auto extra = mExtraBits[ch + i].get();
+            for (uint32_t s = 0; s < nSamples; s++) {
+                buf[s] = ((uint32_t)buf[s] << extraBits) | extra[s];
+            }
+        }
+    }
+    return nSamples;
+}
+bool AlacDecoder::riceDecompress(BitReader& br, int32_t* out, int nSamples, int bps, int historyMult)
+{
+    const int kLimit = mConfig.kb;
+    uint32_t history = mConfig.mb;
+    int signModifier = 0;
+    // Adaptive Golomb-Rice code. The escape for values that don't fit in the code is 9 leading ones
+    auto decodeScalar = [&br](int k, int bps) -> uint32_t {
+        uint32_t ones = __builtin_clz(~(br.show(9) << 23));
+        if (ones >= 9) {
+            br.skip(9);
+            return br.readLong(bps);
+        }
+        br.skip(ones + 1);
+        if (k == 1) {
+            return ones;
+        }
+        uint32_t x = (ones << k) - ones;
+        uint32_t extra = br.show(k);
+        if (extra > 1) {
+            br.skip(k);
+            return x + extra - 1;
+        }
+        br.skip(k - 1);
+        return x;
+    };
+    for (int i = 0; i < nSamples; i++) {
+        int k = std::min(log2Floor((history >> 9) + 3), kLimit);
+        uint32_t x = decodeScalar(k, bps) + signModifier;
+        signModifier = 0;
+        out[i] = (x >> 1) ^ -(x & 1);
+        if (x > 0xffff) {
+            history = 0xffff;
+        }
+        else {
+            history += x * historyMult - ((history * historyMult) >> 9);
+        }
+        if (history < 128 && i + 1 < nSamples) { // run of zeros
+            k = std::min(7 - log2Floor(history) + (int)((history + 16) >> 6), kLimit);
+            uint32_t blockSize = decodeScalar(k, 16);
+            if (blockSize > 0) {
+                if (blockSize >= (uint32_t)(nSamples - i)) {
+                    ESP_LOGW(TAG, "Zero run exceeds frame: %lu", (unsigned long)blockSize);
+                    return false;
+                }
+                memset(out + i + 1, 0, blockSize * sizeof(int32_t));
+                i += blockSize;
+            }
+            if (blockSize <= 0xffff) {
+                signModifier = 1;
+            }
+            history = 0;
+        }
+        if (br.overrun()) {
+            return false;
+        }
+    }
+    return true;
+}
+// Adaptive FIR prediction, in place: buf contains the prediction errors on entry, and the samples on exit.
+// Arithmetic wraps around like in the reference decoder
+void AlacDecoder::lpcPredict(int32_t* buf, int nSamples, int bps, int16_t* coefs, int order, int quant)
+{
+    if (nSamples <= 1 || !order) {
+        return;
+    }
+    if (order == 31) { // first order prediction
+        for (int i = 1; i < nSamples; i++) {
+            buf[i] = signExtend((uint32_t)buf[i - 1] + buf[i], bps);
+        }
+        return;
+    }
+    int i = 1;
+    for (; i <= order && i < nSamples; i++) { // warm-up
+        buf[i] = signExtend((uint32_t)buf[i - 1] + buf[i], bps);
+    }
+    for (; i < nSamples; i++) {
+        const int32_t* pred = buf + i - order; // the previous order samples
+        int32_t d = pred[-1];
+        uint32_t errorVal = buf[i];
+        uint32_t sum = 0;
+        for (int j = 0; j < order; j++) {
+            sum += ((uint32_t)pred[j] - d) * coefs[j];
+        }
+        int32_t val = ((int64_t)(int32_t)sum + (1LL << (quant - 1))) >> quant;
+        buf[i] = signExtend(val + d + errorVal, bps);
+        int errorSign = signOnly(errorVal);
+        if (errorSign) {
+            for (int j = 0; j < order && (int32_t)(errorVal * errorSign) > 0; j++) {
+                int32_t diff = (uint32_t)d - pred[j];
+                int sign = signOnly(diff) * errorSign;
+                coefs[j] -= sign;
+                diff = (uint32_t)diff * sign;
+                errorVal -= (uint32_t)(diff >> quant) * (j + 1);
+            }
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef ALAC_DECODER_HPP
+#define ALAC_DECODER_HPP
+
+#include <stdint.h>
+#include <memory>
+
+/** MSB-first bit reader over a memory buffer. Reading past the end returns zero bits
+ * and sets the overrun flag, checked once per decoded element instead of per read
+ */
+class BitReader
+{
+protected:
+    const uint8_t* mData;
+    uint32_t mLen;
+    uint32_t mPos = 0; // in bits
+public:
+    BitReader(const uint8_t* data, uint32_t len): mData(data), mLen(len) {}
+    bool overrun() const { return mPos > (mLen << 3); }
+    uint32_t bitPos() const { return mPos; }
+    /** Returns the next n bits, n <= 25, without consuming them */
+    uint32_t show(int n) const
+    {
+        uint32_t idx = mPos >> 3;
+        uint32_t word;
+        if (idx + 4 <= mLen) {
+            word = (mData[idx] << 24) | (mData[idx + 1] << 16) | (mData[idx + 2] << 8) | mData[idx + 3];
+        }
+        else {
+            word = 0;
+            for (int i = 0; i < 4; i++) {
+                word = (word << 8) | ((idx + i < mLen) ? mData[idx + i] : 0);
+            }
+        }
+        return (word << (mPos & 7)) >> (32 - n);
+    }
+    void skip(int n) { mPos += n; }
+    uint32_t read(int n)
+    {
+        if (!n) {
+            return 0;
+        }
+        auto val = show(n);
+        mPos += n;
+        return val;
+    }
+    /** n <= 32 */
+    uint32_t readLong(int n)
+    {
+        if (n <= 25) {
+            return read(n);
+        }
+        uint32_t hi = read(n - 16);
+        return (hi << 16) | read(16);
+    }
+    void alignToByte() { mPos = (mPos + 7) & ~7; }
+};
+
+/** Apple Lossless decoder, for mono and stereo streams. Decodes into per-channel buffers of
+ * right-aligned 32-bit samples, from which the caller produces the interleaved output
+ */
+class AlacDecoder
+{
+public:
+    /** ALACSpecificConfig, the 'magic cookie' in the MP4 sample description */
+    struct Config {
+        uint32_t frameLength;
+        uint8_t compatibleVersion;
+        uint8_t bitDepth;
+        uint8_t pb; // rice history multiplier
+        uint8_t mb; // rice initial history
+        uint8_t kb; // rice parameter limit
+        uint8_t numChannels;
+        uint16_t maxRun;
+        uint32_t maxFrameBytes;
+        uint32_t avgBitRate;
+        uint32_t sampleRate;
+    };
+    enum { kConfigSize = 24, kMaxChannels = 2, kMaxFrameLength = 16384, kMaxLpcOrder = 32 };
+    enum: int8_t { kErrData = -1, kErrUnsupported = -2 };
+protected:
+    enum { kIdSce = 0, kIdCpe = 1, kIdEnd = 7 }; // element types
+    Config mConfig = {};
+    std::unique_ptr<int32_t[]> mSamples[kMaxChannels];
+    std::unique_ptr<uint16_t[]> mExtraBits[kMaxChannels]; // only for streams wider than 16 bits
+    int decodeElement(BitReader& br, int ch, int numChans);
+    bool riceDecompress(BitReader& br, int32_t* out, int nSamples, int bps, int historyMult);
+    static void lpcPredict(int32_t* buf, int nSamples, int bps, int16_t* coefs, int order, int quant);
+public:
+    /** Parses the ALACSpecificConfig and allocates the sample buffers */
+    bool init(const uint8_t* cookie, int len);
+    const Config& config() const { return mConfig; }
+    /** Decodes a frame. Returns the number of samples per channel, or a negative error code */
+    int decode(const uint8_t* data, int len);
+    const int32_t* samples(int ch) const { return mSamples[ch].get(); }
+};
+
+#endif
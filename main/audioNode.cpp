@@ -11,14 +11,19 @@
 #include "esp_log.h"
 #include "errno.h"
 #include "esp_system.h"
-#include <esp_http_client.h>
 #include <strings.h>
-#include "ringbuf.hpp"
 #include "queue.hpp"
 #include "utils.hpp"
-#include "playlist.hpp"
 #include "audioNode.hpp"
+#include <buffer.hpp>
 
+void AudioNode::perfToJson(DynBuffer& buf)
+{
+    buf.printf("{\"node\":\"%s\",\"pull\":", mTag);
+    mPullStats.toJson(buf);
+    perfExtraToJson(buf);
+    buf.printf("}");
+}
 void AudioNodeWithState::setState(State newState)
 {
     MutexLocker locker(mMutex);
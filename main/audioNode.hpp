@@ -17,6 +17,7 @@
 #include "queue.hpp"
 #include "utils.hpp"
 #include "task.hpp"
+#include "nodeProfiler.hpp"
 #include <atomic>
 #ifdef ALT_TASK_PINNING
     #define ALT_TASK_PIN(deflt, alt) alt
@@ -26,6 +27,7 @@
 
 class AudioNode;
 class IInputAudioNode;
+class DynBuffer;
 
 class IAudioPipeline {
 protected:
@@ -86,6 +88,8 @@ protected:
     const char* mTag;
     Mutex mMutex;
     AudioNode* mPrev = nullptr;
+    LatencyStats mPullStats; // updated by the consumer, via pullDataProfiled() or peekBytesProfiled()
+    uint32_t mConsumedBytes = 0; // via consumeBytesProfiled() since the last peekBytesProfiled()
     inline bool plSendEvent(uint32_t type, uintptr_t arg1 = 0, uintptr_t arg2 = 0);
     inline void plSendError(int error, uintptr_t arg);
     AudioNode(IAudioPipeline& parent, const char* tag): mPipeline(parent), mTag(tag) {}
@@ -98,6 +102,27 @@ public:
     virtual void notifyFormatDetails(StreamFormat fmt) {}
     virtual DataPacket* peekData(bool& preceded) { return nullptr; }
     virtual StreamPacket* peek() { return nullptr; }
+    struct PacketResult;
+    /** Zero-copy byte stream API, used by decoders instead of pullData() when byteStreamActive()
+     * returns true. byteStreamActive() is constant for the current stream, i.e. until the next
+     * kEvtStreamChanged event is returned to the caller.
+     * peekBytes() returns kEvtData and sets data/len to at least minLen contiguous bytes,
+     * less only if an event follows them. Otherwise it returns the event or error, with the
+     * event packet in pr. The returned data stays valid until consumeBytes() is called.
+     * minLen must not exceed kMaxPeekBytes
+     */
+    enum { kMaxPeekBytes = 4096 };
+    virtual bool byteStreamActive() const { return false; }
+    virtual StreamEvent peekBytes(int minLen, const uint8_t*& data, int& len, PacketResult& pr) { return kErrStreamFmt; }
+    virtual void consumeBytes(int len) {}
+    /** Random access within the current input stream, for demuxers that need data out of order,
+     * i.e. the index of an MP4 file that is stored after the media data. On success, the data
+     * following the current read position is discarded, and a kEvtSeek event is delivered,
+     * followed by the stream data from byte offset \c pos. If the source had reached the end of the
+     * stream before processing the request, its kEvtStreamEnd may precede the kEvtSeek.
+     * Returns false if the source can't seek
+     */
+    virtual bool seekStream(uint32_t pos) { return false; }
     void linkToPrev(AudioNode* prev) { mPrev = prev; }
     AudioNode* prev() const { return mPrev; }
     struct PacketResult
@@ -141,6 +166,92 @@ public:
 
     /** @returns a packet or a stream event */
     virtual StreamEvent pullData(PacketResult& pr) = 0;
+    /** Calls pullData() and records the call in the node's pull stats. The latency includes the
+     * time blocked waiting for data, and the time spent in upstream nodes that run in the caller's thread.
+     * Used by consumer nodes instead of calling pullData() directly */
+    StreamEvent pullDataProfiled(PacketResult& pr)
+    {
+        LatencyStats::Timer timer(mPullStats);
+        auto evt = pullData(pr);
+        if (evt == kEvtData) {
+            timer.bytes = pr.dataPacket().dataLen;
+        }
+        return evt;
+    }
+    /** Calls peekBytes() and records the call in the node's pull stats, as pullDataProfiled(). The bytes
+     * recorded are those consumed via consumeBytesProfiled() since the previous call, so that data that
+     * is peeked more than once is counted once */
+    StreamEvent peekBytesProfiled(int minLen, const uint8_t*& data, int& len, PacketResult& pr)
+    {
+        LatencyStats::Timer timer(mPullStats);
+        timer.bytes = mConsumedBytes;
+        mConsumedBytes = 0;
+        return peekBytes(minLen, data, len, pr);
+    }
+    void consumeBytesProfiled(int len)
+    {
+        mConsumedBytes += len;
+        consumeBytes(len);
+    }
+    /** Consecutive data packets of one stream, as returned by pullBatch(). Owns the packets */
+    struct PacketBatch
+    {
+        enum { kMaxPackets = 8 };
+        DataPacket* packets[kMaxPackets];
+        uint8_t count = 0;
+        ~PacketBatch() { clear(); }
+        DataPacket& operator[](int idx) { return *packets[idx]; }
+        void add(DataPacket* pkt)
+        {
+            myassert(count < kMaxPackets);
+            packets[count++] = pkt;
+        }
+        int dataSize() const
+        {
+            int len = 0;
+            for (int i = 0; i < count; i++) {
+                len += packets[i]->dataLen;
+            }
+            return len;
+        }
+        void clear()
+        {
+            for (int i = 0; i < count; i++) {
+                packets[i]->destroy();
+            }
+            count = 0;
+        }
+    };
+    /** Batched variant of pullData(), for consumers that handle several data packets per call.
+     * Blocks until a packet is available, then returns kEvtData with the (empty on entry) batch
+     * filled with up to maxPackets consecutive data packets that are already available, or returns
+     * the event or error, with the event packet in pr. Stops before the first non-data packet.
+     * The default implementation returns at most one packet per call, nodes with an output queue
+     * override it */
+    virtual StreamEvent pullBatch(PacketResult& pr, PacketBatch& batch, int maxPackets)
+    {
+        auto evt = pullData(pr);
+        if (evt == kEvtData) {
+            batch.add(static_cast<DataPacket*>(pr.packet.release()));
+        }
+        return evt;
+    }
+    /** Calls pullBatch() and records the call in the node's pull stats, as pullDataProfiled() */
+    StreamEvent pullBatchProfiled(PacketResult& pr, PacketBatch& batch, int maxPackets)
+    {
+        LatencyStats::Timer timer(mPullStats);
+        auto evt = pullBatch(pr, batch, maxPackets);
+        if (evt == kEvtData) {
+            timer.bytes = batch.dataSize();
+        }
+        return evt;
+    }
+    const LatencyStats& pullStats() const { return mPullStats; }
+    /** Outputs the node's profiling stats as a JSON object. Nodes with more stats, i.e. decoding time or
+     * queue depth, override it and append them via perfExtraToJson() */
+    void perfToJson(DynBuffer& buf);
+    virtual void perfExtraToJson(DynBuffer& buf) {}
+    virtual void perfReset() { mPullStats.requestReset(); }
 };
 
 class AudioNodeWithState: public AudioNode
@@ -161,7 +161,13 @@ bool AudioPlayer::createPipeline(AudioNode::Type inType, AudioNode::Type outType
         mStreamIn.reset(inType == AudioNode::kTypeHttpIn
                         ? (AudioNodeWithState*)new HttpNode(*this)
                         : (AudioNodeWithState*)new SpotifyNode(*this));
+        if (inType == AudioNode::kTypeHttpIn) {
+            auto http = static_cast<HttpNode*>(mStreamIn.get());
+            http->enableByteStream(mNvsHandle.readDefault<uint8_t>("byteRing", 1));
+            http->setBufferGovernorStore(mNvsHandle);
+        }
         mDecoder.reset(new DecoderNode(*this));
+        mDecoder->setFlacParallel(mNvsHandle.readDefault<uint8_t>("flacMt", DecoderNode::kFlacParallelHiRes));
         mDecoder->linkToPrev(mStreamIn.get());
         pcmSource = mDecoder.get();
         break;
@@ -410,6 +416,9 @@ void AudioPlayer::switchMode(PlayerMode playerMode, bool persist)
         }
     }
     setPlayerMode(playerMode); // must be after the pipeline update, because it gets info from input nodes
+    if (playerMode != kModeRadio) {
+        mPrewarmer.reset();
+    }
 }
 
 void AudioPlayer::loadSettings()
@@ -434,12 +443,15 @@ void AudioPlayer::destroyPipeline()
     mStreamOut.reset();
 }
 
-bool AudioPlayer::doPlayUrl(TrackInfo* trackInfo, PlayerMode playerMode, const char* record)
+bool AudioPlayer::doPlayUrl(TrackInfo* trackInfo, PlayerMode playerMode, const char* record,
+    StationPrewarmer::SessionPtr warm)
 {
     myassert(trackInfo);
     myassert(playerMode & (int)AudioNode::kTypeHttpIn);
     switchMode(playerMode, false);
     mTrackInfo.reset(trackInfo);
+    mNextTrackInfo.reset();
+    mNextStreamId = 0;
     lcdClearAudioFormat();
     auto& http = *static_cast<HttpNode*>(mStreamIn.get());
     // setUrl will start the http node, if it's stopped. However, this may take a while.
@@ -448,7 +460,8 @@ bool AudioPlayer::doPlayUrl(TrackInfo* trackInfo, PlayerMode playerMode, const c
     stop("");
     lcdUpdateTrackDisplay();
     lcdUpdateNetSpeed();
-    http.setUrlAndStart(HttpNode::UrlInfo::create(trackInfo->url(), getNewStreamId(), record));
+    mTrackStreamId = getNewStreamId();
+    http.setUrlAndStart(HttpNode::UrlInfo::create(trackInfo->url(), mTrackStreamId, record), std::move(warm));
     if (http.waitForState(AudioNode::kStateRunning, 10000) != AudioNode::kStateRunning) {
         return false;
     }
@@ -463,6 +476,16 @@ bool AudioPlayer::playUrl(TrackInfo* trackInfo, PlayerMode playerMode, const cha
 {
     return doPlayUrl(trackInfo, playerMode, record);
 }
+void AudioPlayer::playNextUrl(TrackInfo* trackInfo)
+{
+    myassert(mStreamIn && mStreamIn->type() == AudioNode::kTypeHttpIn);
+    mNextTrackInfo.reset(trackInfo);
+    mNextStreamId = trackInfo ? getNewStreamId() : 0;
+    ESP_LOGI(TAG, "Next url set to %s", trackInfo ? trackInfo->url() : "(none)");
+    static_cast<HttpNode*>(mStreamIn.get())->setNextUrl(trackInfo
+        ? HttpNode::UrlInfo::create(trackInfo->url(), mNextStreamId, nullptr)
+        : nullptr);
+}
 const char* AudioPlayer::url() const // needed by DLNA
 {
     if (!mStreamIn || mStreamIn->type() != AudioNode::kTypeHttpIn) {
@@ -491,17 +514,59 @@ esp_err_t AudioPlayer::playStation(const char* id)
             return ESP_ERR_NOT_FOUND;
         }
     }
+    else if (strcmp(id, "-") == 0) { // "-" = previous station
+        if (!this->stationList->prev()) {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
     else if (!this->stationList->setCurrent(id)) {
         return ESP_ERR_NOT_FOUND;
     }
 
     auto& station = this->stationList->currStation;
     assert(station.isValid());
-    if (!playUrl(station.url(), kModeRadio, (station.flags() & station.kFlagRecord) ? station.id() : nullptr)) {
+    auto warm = mPrewarmer ? mPrewarmer->take(station.url()) : nullptr;
+    mStationSwitchWarm = (bool)warm;
+    mTsStationSwitch = esp_timer_get_time();
+    if (!doPlayUrl(TrackInfo::create(station.url(), nullptr, nullptr, 0), kModeRadio,
+        (station.flags() & station.kFlagRecord) ? station.id() : nullptr, std::move(warm))) {
         return ESP_ERR_NOT_SUPPORTED; // stream source node is not http client
     }
+    updatePrewarm();
     return ESP_OK;
 }
+void AudioPlayer::updatePrewarm()
+{
+    int count = mNvsHandle.readDefault<uint8_t>("prewarm", 0);
+    auto& curr = stationList->currStation;
+    if (!count || mPlayerMode != kModeRadio || !curr.isValid()) {
+        mPrewarmer.reset();
+        return;
+    }
+    if (!mPrewarmer || mPrewarmer->maxSessions() != std::min(count, (int)StationPrewarmer::kMaxSessions)) {
+        mPrewarmer.reset(new StationPrewarmer(count, mNvsHandle.readDefault<uint16_t>("prewarmKB", kDefPrewarmKB) * 1024,
+            HttpNode::setClientHeaders));
+    }
+    // The next and the previous stations, alternating, nearest first
+    std::string urls[StationPrewarmer::kMaxSessions];
+    const char* urlPtrs[StationPrewarmer::kMaxSessions] = {};
+    std::string nextId = curr.id(), prevId = curr.id();
+    Station station(*stationList);
+    count = mPrewarmer->maxSessions();
+    for (int i = 0; i < count; i++) {
+        auto& id = (i & 1) ? prevId : nextId;
+        bool ok = (i & 1) ? stationList->prevOf(id.c_str(), station) : stationList->nextOf(id.c_str(), station);
+        if (!ok) {
+            break;
+        }
+        id = station.id();
+        if (id != curr.id()) { // a short list wraps around to the current station
+            urls[i] = station.url();
+            urlPtrs[i] = urls[i].c_str();
+        }
+    }
+    mPrewarmer->setStations(urlPtrs, count);
+}
 
 bool AudioPlayer::isStopped() const
 {
@@ -549,6 +614,10 @@ void AudioPlayer::pipelineStop()
     }
     mStreamIn->waitForStop();
     mStreamOut->waitForStop();
+    if (mEqualizer) {
+        mEqualizer->reset();
+    }
+    PacketPool::trim();
     mStopping = false;
 }
 void AudioPlayer::pause()
@@ -577,7 +646,7 @@ uint32_t AudioPlayer::positionTenthSec() const
     }
     auto& i2sOut = *static_cast<I2sOutputNode*>(mStreamOut.get());
     MutexLocker locker(i2sOut.mutex);
-    if (i2sOut.mStreamId != mCurrentStreamId) {
+    if (i2sOut.mStreamId != mCurrentStreamId && i2sOut.mStreamId != mTrackStreamId) {
         return 0;
     }
     return i2sOut.positionTenthSec();
@@ -923,6 +992,35 @@ esp_err_t AudioPlayer::getStatusUrlHandler(httpd_req_t* req)
     httpd_resp_sendstr(req, buf.buf());
     return ESP_OK;
 }
+// Returns the profiling stats of the pipeline nodes, in source to sink order.
+// Latencies are in microseconds. With reset=1, the stats are cleared after being returned
+esp_err_t AudioPlayer::perfUrlHandler(httpd_req_t* req)
+{
+    auto self = static_cast<AudioPlayer*>(req->user_ctx);
+    UrlParams params(req);
+    bool reset = params.intVal("reset", 0);
+    MutexLocker locker(self->mutex);
+    DynBuffer buf(1024);
+    buf.printf("{\"uptime\":%lld,\"nodes\":[", esp_timer_get_time() / 1000);
+    AudioNode* nodes[] = { self->mStreamIn.get(), self->mDecoder.get(), self->mEqualizer.get(), self->mStreamOut.get() };
+    bool first = true;
+    for (auto node: nodes) {
+        if (!node) {
+            continue;
+        }
+        if (!first) {
+            buf.printf(",");
+        }
+        first = false;
+        node->perfToJson(buf);
+        if (reset) {
+            node->perfReset();
+        }
+    }
+    buf.printf("]}");
+    httpd_resp_sendstr(req, buf.buf());
+    return ESP_OK;
+}
 esp_err_t AudioPlayer::nvsSetParamUrlHandler(httpd_req_t* req)
 {
     UrlParams params(req);
@@ -1062,6 +1160,7 @@ void AudioPlayer::registerUrlHanlers()
     mHttpServer.on("/eqget", HTTP_GET, &equalizerDumpUrlHandler, this);
     mHttpServer.on("/eqset", HTTP_GET, &equalizerSetUrlHandler, this);
     mHttpServer.on("/status", HTTP_GET, &getStatusUrlHandler, this);
+    mHttpServer.on("/perf", HTTP_GET, &perfUrlHandler, this);
     mHttpServer.on("/nvget", HTTP_GET, &nvsGetParamUrlHandler, this);
     mHttpServer.on("/nvset", HTTP_GET, &nvsSetParamUrlHandler, this);
     mHttpServer.on("/inmode", HTTP_GET, &changeInputUrlHandler, this);
@@ -1102,11 +1201,20 @@ bool AudioPlayer::onNodeEvent(AudioNode& node, uint32_t event, uintptr_t arg1, u
     }
     else if (event == AudioNode::kEventNewStream) {
         auto& evt = *(NewStreamEvent*)arg2;
-        asyncCall([this, streamId = evt.streamId, fmt = evt.fmt, sourceBps = evt.sourceBps]() {
+        asyncCall([this, streamId = evt.streamId, fmt = evt.fmt, sourceBps = evt.sourceBps, pos = evt.seekTime]() {
             LOCK_PLAYER();
+            if (mNextStreamId && streamId == mNextStreamId) { // gapless transition to the next url
+                mTrackInfo = std::move(mNextTrackInfo);
+                mTrackStreamId = streamId;
+                mNextStreamId = 0;
+                lcdUpdateTrackDisplay();
+                if (mDlna) {
+                    mDlna->notifyPlayStart();
+                }
+            }
             onNewStream(fmt, sourceBps);
             if (mStreamIn) {
-                mStreamIn->inputNodeIntf()->onTrackPlaying(streamId, 0);
+                mStreamIn->inputNodeIntf()->onTrackPlaying(streamId, pos);
             }
         });
     }
@@ -1132,6 +1240,11 @@ bool AudioPlayer::onNodeEvent(AudioNode& node, uint32_t event, uintptr_t arg1, u
                 case AudioNode::kEventConnecting:
                     return lcdUpdatePlayState(arg1 ? "Reconnecting..." : "Connecting...");
                 case AudioNode::kEventPlaying:
+                    if (mTsStationSwitch) {
+                        ESP_LOGI(TAG, "Station switch: first audio after %d ms (%s connection)",
+                            (int)((esp_timer_get_time() - mTsStationSwitch) / 1000), mStationSwitchWarm ? "pre-connected" : "new");
+                        mTsStationSwitch = 0;
+                    }
                     return lcdUpdatePlayState(nullptr);
                 case HttpNode::kEventRecording:
                     return lcdUpdatePlayState(nullptr, arg1);
@@ -1296,7 +1409,8 @@ void AudioPlayer::onNewStream(StreamFormat fmt, int sourceBps)
 }
 void AudioPlayer::onStreamEnd(StreamId streamId)
 {
-    if (streamId != mCurrentStreamId) {
+    // while a next url is set, the end of the current track is followed by the next one
+    if (streamId != mCurrentStreamId && (mNextStreamId || streamId != mTrackStreamId)) {
         ESP_LOGI(TAG, "Discarding stream end event for a previous streamId %d", streamId);
         return;
     }
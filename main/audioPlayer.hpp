@@ -8,6 +8,7 @@
 #include <lcdColor.hpp>
 #include <font.hpp>
 #include "stationList.hpp"
+#include "stationPrewarmer.hpp"
 #include "recorder.hpp"
 #include "vuDisplay.hpp"
 #include "dlna.hpp"
@@ -56,6 +57,7 @@ public:
         kHttpBufSizeSpiRam = 800 * 1024,
         kHttpBufPrefillSpiRam = 65536,
         kDefTitleScrollFps = 50,
+        kDefPrewarmKB = 96, // buffer memory of all pre-connected stations
         kLcdNetSpeedUpdateIntervalUs = 1 * 1000000,
         kNvsCommitDelay = 20
     };
@@ -108,6 +110,12 @@ protected:
     http::Server& mHttpServer;
     std::unique_ptr<DlnaHandler> mDlna;
     TrackInfo::unique_ptr mTrackInfo;
+    TrackInfo::unique_ptr mNextTrackInfo; // gapless next url, becomes mTrackInfo when its stream starts
+    StreamId mTrackStreamId = 0; // stream of mTrackInfo, is not the current stream id while a next url is set
+    StreamId mNextStreamId = 0;
+    std::unique_ptr<StationPrewarmer> mPrewarmer; // keeps the neighbours of the current station connected
+    int64_t mTsStationSwitch = 0; // for measuring the time from a station switch to the first audio
+    bool mStationSwitchWarm = false;
     PlayerMode mPlayerMode;
     int mBufLowThreshold = 0;
     uint16_t mBufLowDisplayGradient = 0;
@@ -178,13 +186,16 @@ protected:
     static esp_err_t equalizerSetUrlHandler(httpd_req_t *req);
     static esp_err_t equalizerDumpUrlHandler(httpd_req_t *req);
     static esp_err_t getStatusUrlHandler(httpd_req_t *req);
+    static esp_err_t perfUrlHandler(httpd_req_t *req);
     static esp_err_t resetSubsystemUrlHandler(httpd_req_t *req);
     static esp_err_t nvsGetParamUrlHandler(httpd_req_t* req);
     static esp_err_t nvsSetParamUrlHandler(httpd_req_t* req);
     static esp_err_t changeInputUrlHandler(httpd_req_t *req);
     static AudioNode::Type playerModeToInNodeType(PlayerMode mode);
     void registerHttpGetHandler(const char* path, esp_err_t(*handler)(httpd_req_t*));
-    bool doPlayUrl(TrackInfo* track, PlayerMode playerMode, const char* record=nullptr);
+    bool doPlayUrl(TrackInfo* track, PlayerMode playerMode, const char* record=nullptr,
+        StationPrewarmer::SessionPtr warm=nullptr);
+    void updatePrewarm();
 public:
     Mutex mutex;
     http::Server& httpServer() const { return mHttpServer; }
@@ -201,6 +212,8 @@ public:
     void switchMode(PlayerMode playerMode, bool persist=false);
     bool playUrl(const char* url, PlayerMode playerMode, const char* record=nullptr);
     bool playUrl(TrackInfo* trackInfo, PlayerMode playerMode, const char* record=nullptr);
+    /** Sets the url that is played after the current one, without a gap. Requires http input. Null clears it */
+    void playNextUrl(TrackInfo* trackInfo);
     const char* url() const; // needed by DLNA
     esp_err_t playStation(const char* id);
     bool isStopped() const;
@@ -0,0 +1,215 @@
+#include "bufferGovernor.hpp"
+#include <string.h>
+#include <algorithm>
+#include <esp_log.h>
+
+static const char* TAG = "bufgov";
+
+uint32_t BufferGovernor::keyFromUrl(const char* url)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (; *url; url++) {
+        hash = (hash ^ (uint8_t)*url) * 16777619u;
+    }
+    return hash;
+}
+BufferGovernor::StationStats* BufferGovernor::findStation(uint32_t key)
+{
+    for (int i = 0; i < mNumStations; i++) {
+        if (mStations[i].key == key) {
+            return &mStations[i];
+        }
+    }
+    return nullptr;
+}
+void BufferGovernor::startSession(uint32_t key)
+{
+    mKey = key;
+    mStats = findStation(key);
+    mStaticPrefill = StreamFormat(Codec::kCodecMp3).prefillAmount();
+    mTypicalByteRate = StreamFormat(Codec::kCodecMp3).typicalByteRate();
+    mIcyKbps = 0;
+    mUnderrunNeedMs = 0;
+    mNumUnderruns = 0;
+    mStartUs = -1;
+    mLastUs = 0;
+    mMeasureStartUs = 0;
+    mMeasureBytes = 0;
+    mMeasuredRate = 0;
+    mRate = 0;
+    mSurplus = mSurplusPeak = mMaxDrawdown = 0;
+    mGapAvgUs = mGapDevUs = mMaxGapUs = 0;
+    mDiscontinuity = kNoDiscontinuity;
+    updateRate();
+    if (mStats) {
+        ESP_LOGI(TAG, "Station %08lx: learned need %u ms, %u kbps", (unsigned long)key, mStats->needMs, mStats->kbps);
+    }
+}
+void BufferGovernor::setFormat(StreamFormat fmt)
+{
+    mStaticPrefill = fmt.prefillAmount();
+    mTypicalByteRate = fmt.typicalByteRate();
+}
+void BufferGovernor::updateRate()
+{
+    int rate = mIcyKbps ? mIcyKbps * 125
+        : mMeasuredRate ? mMeasuredRate
+        : (mStats && mStats->kbps) ? mStats->kbps * 125 : 0;
+    if (rate == mRate) {
+        return;
+    }
+    // measure the dips against the new playout line from here on
+    mRate = rate;
+    mSurplus = mSurplusPeak = 0;
+}
+int BufferGovernor::currentByteRate() const
+{
+    return mRate ? mRate : mTypicalByteRate;
+}
+void BufferGovernor::onDiscontinuity(bool countStall)
+{
+    mDiscontinuity = countStall ? kReconnect : kSeek;
+}
+void BufferGovernor::onData(int bytes, int64_t tsUs)
+{
+    if (mStartUs < 0) {
+        mStartUs = mLastUs = tsUs;
+        mMeasureStartUs = tsUs + kBurstSkipMs * 1000;
+        mSurplus = mSurplusPeak = bytes;
+        return;
+    }
+    int64_t gap = tsUs - mLastUs;
+    mLastUs = tsUs;
+    if (mDiscontinuity == kSeek) {
+        // the buffer was cleared, and the server may burst again
+        mDiscontinuity = kNoDiscontinuity;
+        mSurplus = mSurplusPeak = bytes;
+        if (!mMeasuredRate) {
+            mMeasureStartUs = tsUs + kBurstSkipMs * 1000;
+            mMeasureBytes = 0;
+        }
+        return;
+    }
+    // jitter of the inter-arrival gaps, as in TCP round-trip time estimation
+    if (!mGapAvgUs) {
+        mGapAvgUs = gap;
+        mGapDevUs = gap / 2;
+    }
+    else {
+        int32_t err = gap - mGapAvgUs;
+        mGapAvgUs += err / 8;
+        mGapDevUs += (std::abs(err) - mGapDevUs) / 4;
+    }
+    if (gap > mMaxGapUs) {
+        mMaxGapUs = gap;
+    }
+    if (mRate) {
+        // the lowest point is just before the data arrives
+        mSurplus -= mRate * gap / 1000000;
+        auto drawdown = mSurplusPeak - mSurplus;
+        if (drawdown > mMaxDrawdown) {
+            mMaxDrawdown = drawdown;
+        }
+        // beyond the max buffer size, the data would have stayed in the network
+        mSurplus = std::min<int64_t>(mSurplus + bytes, maxBufferSize());
+        if (mSurplus > mSurplusPeak || mDiscontinuity == kReconnect) {
+            mSurplusPeak = mSurplus;
+        }
+    }
+    mDiscontinuity = kNoDiscontinuity;
+    if (tsUs > mMeasureStartUs) {
+        mMeasureBytes += bytes;
+        auto elapsed = tsUs - mMeasureStartUs;
+        if (!mMeasuredRate && elapsed >= kRateSettleMs * 1000) {
+            mMeasuredRate = mMeasureBytes * 1000000 / elapsed;
+            ESP_LOGI(TAG, "Measured stream rate: %d bytes/s", mMeasuredRate);
+            updateRate();
+        }
+    }
+}
+int BufferGovernor::sessionNeedMs() const
+{
+    int rate = currentByteRate();
+    int drawdownMs = rate ? mMaxDrawdown * 1000 / rate : 0;
+    int jitterMs = (mGapAvgUs + 4 * mGapDevUs) / 1000;
+    return std::max(drawdownMs, jitterMs);
+}
+int BufferGovernor::needMs() const
+{
+    return std::max(sessionNeedMs(), mStats ? (int)mStats->needMs : 0);
+}
+int BufferGovernor::prefillFromNeed() const
+{
+    int ms = std::max(needMs() * 5 / 4 + kMarginMs, (int)kMinPrefillMs);
+    return (int64_t)ms * currentByteRate() / 1000;
+}
+int BufferGovernor::prefillAmount() const
+{
+    if (!mStats && !mNumUnderruns) { // nothing learned yet
+        return mStaticPrefill;
+    }
+    return std::min(prefillFromNeed(), mStaticPrefill * 2);
+}
+int BufferGovernor::maxBufferSize() const
+{
+    if (!mStats && !mNumUnderruns) {
+        return mStaticPrefill * 4;
+    }
+    return std::min(std::max(prefillFromNeed() * 4, mStaticPrefill * 2), mStaticPrefill * 4);
+}
+int BufferGovernor::onUnderrun()
+{
+    mNumUnderruns++;
+    // The stall that caused it is in the drawdown if the rate is known, otherwise take the longest gap.
+    // Repeated underruns mean that the estimate is too low
+    int need = std::max(std::max(needMs(), mUnderrunNeedMs), (int)(mMaxGapUs / 1000));
+    if (mNumUnderruns > 1) {
+        need = need * 3 / 2;
+    }
+    mUnderrunNeedMs = std::min(need, (int)kMaxNeedMs);
+    // The raised estimate is for the next session. Refilling for it now would turn a short stall into a
+    // long gap, so the refill is at most the static prefill
+    auto amount = std::min(prefillAmount(), mStaticPrefill);
+    ESP_LOGW(TAG, "Underrun #%d, need estimate raised to %d ms, refilling %d bytes", mNumUnderruns, mUnderrunNeedMs, amount);
+    return amount;
+}
+bool BufferGovernor::endSession()
+{
+    if (mStartUs < 0 || ((mLastUs - mStartUs) < kMinSessionMs * 1000LL && !mNumUnderruns)) {
+        return false;
+    }
+    int need = std::min(std::max(sessionNeedMs(), mUnderrunNeedMs), (int)kMaxNeedMs);
+    int kbps = mIcyKbps ? mIcyKbps : (mMeasuredRate + 62) / 125;
+    StationStats stats = { mKey, (uint16_t)need, (uint16_t)std::min(kbps, 65535) };
+    if (mStats) {
+        if (need < mStats->needMs) { // attack fast, decay slowly
+            stats.needMs = (mStats->needMs * 3 + need) / 4;
+        }
+        if (!kbps) {
+            stats.kbps = mStats->kbps;
+        }
+    }
+    bool changed = !mStats || memcmp(mStats, &stats, sizeof(stats)) || mStats != mStations;
+    // move to the front, evicting the least recently used if full
+    int idx = mStats ? (mStats - mStations) : std::min(mNumStations, (int)kMaxStations - 1);
+    memmove(mStations + 1, mStations, idx * sizeof(StationStats));
+    mStations[0] = stats;
+    if (!mStats && mNumStations < kMaxStations) {
+        mNumStations++;
+    }
+    mStats = mStations;
+    ESP_LOGI(TAG, "Station %08lx: learned need %u ms, %u kbps, %d underruns", (unsigned long)mKey,
+        stats.needMs, stats.kbps, mNumUnderruns);
+    mStartUs = -1; // don't learn twice from the same session
+    return changed;
+}
+bool BufferGovernor::loadStats(const void* data, int len)
+{
+    if (len % sizeof(StationStats) || len > (int)sizeof(mStations)) {
+        return false;
+    }
+    memcpy(mStations, data, len);
+    mNumStations = len / sizeof(StationStats);
+    mStats = findStation(mKey);
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef BUFFER_GOVERNOR_HPP
+#define BUFFER_GOVERNOR_HPP
+#include <stdint.h>
+#include "streamDefs.hpp"
+
+/** Sets the prefill amount and the max buffer size of a network stream from the measured link
+ * behavior, instead of from the per-codec static tables. The stream's byte rate is taken from the
+ * icy-br header, learned from a previous session, or measured once the initial burst of the server
+ * is over. Against that rate, the arrival times give the deepest dip of the received data below the
+ * playout line, i.e. the buffer that would have ridden out the stalls of the session, and the jitter
+ * of the inter-arrival gaps. The result is kept per station, as milliseconds of audio, so that the
+ * next session starts with a prefill sized for that link. A station with no history starts with the
+ * static prefill.
+ * Not thread-safe, the owner serializes the calls
+ */
+class BufferGovernor
+{
+public:
+    struct StationStats
+    {
+        uint32_t key; // hash of the station url
+        uint16_t needMs; // buffer needed to ride out the stalls of the link, in ms of audio
+        uint16_t kbps; // measured stream bitrate, 0 if not known
+    };
+    enum {
+        kMaxStations = 16, // most recently used are kept
+        kMinPrefillMs = 400, kMarginMs = 200,
+        kBurstSkipMs = 5000, // the server's initial burst is excluded from rate measurement
+        kRateSettleMs = 10000, // measurement time before the measured rate is trusted
+        kMinSessionMs = 30000, // shorter sessions without underruns are not learned from
+        kMaxNeedMs = 20000
+    };
+protected:
+    StationStats mStations[kMaxStations];
+    int mNumStations = 0;
+    // session
+    uint32_t mKey = 0;
+    StationStats* mStats = nullptr; // history of the current station, if any
+    int mStaticPrefill = 0;
+    int mTypicalByteRate = 0; // of the codec, used until the actual rate is known
+    uint32_t mIcyKbps = 0;
+    int mUnderrunNeedMs = 0; // raised by underruns, learned by endSession()
+    int mNumUnderruns = 0;
+    int64_t mStartUs = -1; // time of the first arrival
+    int64_t mLastUs = 0;
+    int64_t mMeasureStartUs = 0; // rate measurement starts after the server's initial burst
+    int64_t mMeasureBytes = 0;
+    int mMeasuredRate = 0; // bytes per second, once settled
+    int mRate = 0; // rate used for the drawdown, 0 until known
+    int64_t mSurplus = 0; // bytes received minus bytes played out at mRate, since mRate became known
+    int64_t mSurplusPeak = 0;
+    int64_t mMaxDrawdown = 0; // bytes
+    int32_t mGapAvgUs = 0;
+    int32_t mGapDevUs = 0;
+    int32_t mMaxGapUs = 0;
+    enum Discontinuity: uint8_t { kNoDiscontinuity, kSeek, kReconnect };
+    Discontinuity mDiscontinuity = kNoDiscontinuity;
+    StationStats* findStation(uint32_t key);
+    void updateRate();
+    int sessionNeedMs() const;
+    int needMs() const;
+    int prefillFromNeed() const;
+    int currentByteRate() const;
+public:
+    static uint32_t keyFromUrl(const char* url);
+    /** Starts tracking a new connection to the station, ending the current session (without saving).
+     * The previous stats of the station, if any, are used for the prefill */
+    void startSession(uint32_t key);
+    /** Learns from the current session. Returns true if the station stats changed and should be saved */
+    bool endSession();
+    /** Sets the codec, for the static prefill and the typical bitrate of the codec */
+    void setFormat(StreamFormat fmt);
+    void setIcyBitrate(uint32_t kbps) { mIcyKbps = kbps; updateRate(); }
+    void onData(int bytes, int64_t tsUs);
+    /** The connection was re-established. After a seek, the stall while reconnecting is not a property
+     * of the link, but after a reconnect due to a network error, it is. In both cases, the stream may
+     * continue with a burst, and the dips are measured from there */
+    void onDiscontinuity(bool countStall);
+    int prefillAmount() const;
+    /** Called when the buffer ran empty. Raises the need learned at the end of the session, and returns
+     * the amount to refill, which is at most the static prefill */
+    int onUnderrun();
+    int maxBufferSize() const;
+    int numUnderruns() const { return mNumUnderruns; }
+    int byteRate() const { return currentByteRate(); }
+    // Persistence, as a blob of StationStats, most recent first
+    const void* statsData(int& len) const { len = mNumStations * sizeof(StationStats); return mStations; }
+    bool loadStats(const void* data, int len);
+    static constexpr int kMaxStatsSize = kMaxStations * sizeof(StationStats);
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "byteRing.hpp"
+#include <string.h>
+#include <stdlib.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <algorithm>
+#include "utils.hpp"
+
+static const char* TAG = "bytering";
+
+bool ByteRing::allocBuf(uint32_t size)
+{
+    uint32_t pow2 = 4096;
+    while (pow2 < size) {
+        pow2 <<= 1;
+    }
+    if (mBuf && pow2 == mSize) {
+        clear();
+        return true;
+    }
+    freeBuf();
+    mBuf = (uint8_t*)heap_caps_malloc(pow2 + kMirrorSize, MALLOC_CAP_SPIRAM);
+    if (!mBuf) {
+        ESP_LOGE(TAG, "Out of memory allocating %lu byte ring buffer", (unsigned long)pow2);
+        return false;
+    }
+    mSize = pow2;
+    mMask = pow2 - 1;
+    clear();
+    ESP_LOGI(TAG, "Allocated %lu byte ring buffer", (unsigned long)pow2);
+    return true;
+}
+void ByteRing::freeBuf()
+{
+    if (!mBuf) {
+        return;
+    }
+    free(mBuf);
+    mBuf = nullptr;
+    mSize = mMask = 0;
+}
+void ByteRing::setMaxDataSize(uint32_t size)
+{
+    auto prev = mMaxDataSize.exchange(size ? std::max<uint32_t>(size, kMirrorSize) : 0);
+    // a writer waiting for space may have it now
+    if ((!size || size > prev) && mWriterWaiting.exchange(false)) {
+        mEvents.setBits(kFlagReadOp);
+    }
+}
+uint32_t ByteRing::usableSize() const
+{
+    auto max = mMaxDataSize.load(std::memory_order_relaxed);
+    return (max && max < mSize) ? max : mSize;
+}
+void ByteRing::clear()
+{
+    mReadPos.store(0);
+    mWritePos.store(0);
+    mMirrorBase = 0;
+    mMirrorLen = 0;
+    mWriteSeq++;
+    if (mWriterWaiting.exchange(false)) {
+        mEvents.setBits(kFlagReadOp);
+    }
+}
+void ByteRing::wakeReader()
+{
+    if (mReaderWaiting.load() && mReaderWaiting.exchange(false)) {
+        mEvents.setBits(kFlagWriteOp);
+    }
+}
+uint8_t* ByteRing::writePtr(int& len)
+{
+    for (;;) {
+        auto wpos = mWritePos.load(std::memory_order_relaxed);
+        int avail = usableSize() - (wpos - mReadPos.load(std::memory_order_acquire));
+        if (avail > 0) {
+            auto idx = wpos & mMask;
+            len = std::min<int>(avail, mSize - idx);
+            return mBuf + idx;
+        }
+        // announce that we are about to sleep, then re-check, so that a concurrent consume can't be missed
+        mEvents.clearBits(kFlagReadOp);
+        mWriterWaiting.store(true);
+        if ((int)(usableSize() - (wpos - mReadPos.load())) > 0) {
+            mWriterWaiting.store(false);
+            continue;
+        }
+        if (waitFor(kFlagReadOp, -1) <= 0) {
+            mWriterWaiting.store(false);
+            return nullptr;
+        }
+    }
+}
+void ByteRing::commitWrite(int len)
+{
+    mWritePos.fetch_add(len, std::memory_order_release);
+    mWriteSeq++;
+    wakeReader();
+}
+const uint8_t* ByteRing::peek(int len)
+{
+    auto rpos = mReadPos.load(std::memory_order_relaxed);
+    auto idx = rpos & mMask;
+    int wrapped = (int)(idx + len) - (int)mSize;
+    if (wrapped <= 0) {
+        return mBuf + idx;
+    }
+    myassert(wrapped <= kMirrorSize);
+    // Copy the start of the ring past its end. The bytes are already written, so the producer won't touch them
+    uint32_t base = rpos + (mSize - idx);
+    if (base != mMirrorBase) {
+        mMirrorBase = base;
+        mMirrorLen = 0;
+    }
+    if ((uint32_t)wrapped > mMirrorLen) {
+        memcpy(mBuf + mSize + mMirrorLen, mBuf + mMirrorLen, wrapped - mMirrorLen);
+        mMirrorLen = wrapped;
+    }
+    return mBuf + idx;
+}
+void ByteRing::consume(int len)
+{
+    mReadPos.fetch_add(len, std::memory_order_release);
+    if (mWriterWaiting.load() && mWriterWaiting.exchange(false)) {
+        mEvents.setBits(kFlagReadOp);
+    }
+}
+int8_t ByteRing::waitForWrite(uint32_t seq)
+{
+    for (;;) {
+        mEvents.clearBits(kFlagWriteOp);
+        mReaderWaiting.store(true);
+        if (mWriteSeq.load() != seq) {
+            mReaderWaiting.store(false);
+            return 1;
+        }
+        if (waitFor(kFlagWriteOp, -1) < 0) {
+            mReaderWaiting.store(false);
+            return -1;
+        }
+        if (mWriteSeq.load() != seq) {
+            return 1;
+        }
+    }
+}
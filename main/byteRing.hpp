@@ -0,0 +1,70 @@
+#ifndef BYTERING_HPP
+#define BYTERING_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <waitable.hpp>
+
+/** Single-producer/single-consumer byte ring buffer in PSRAM, used as a zero-copy transport
+ * between an input node and a decoder. The producer receives directly into the ring, and the
+ * consumer decodes directly out of it via peek()/consume().
+ * The buffer is allocated with kMirrorSize extra bytes past its end. When a peek crosses the
+ * end of the ring, the wrapped part is copied there, so the consumer always sees a contiguous
+ * region. This is the only copy, and it happens once per ring cycle.
+ * Read and write positions are free-running byte counters, the ring size is a power of 2
+ */
+class ByteRing: public Waitable {
+public:
+    enum { kMirrorSize = 4096 }; // max length of a contiguous peek that crosses the ring end
+protected:
+    uint8_t* mBuf = nullptr;
+    uint32_t mSize = 0;
+    uint32_t mMask = 0;
+    std::atomic<uint32_t> mWritePos = {0};
+    std::atomic<uint32_t> mReadPos = {0};
+    std::atomic<uint32_t> mMaxDataSize = {0}; // limit of buffered data, below the capacity, 0 if none
+    std::atomic<uint32_t> mWriteSeq = {0}; // incremented on every write and reader notification
+    std::atomic<bool> mReaderWaiting = {false};
+    std::atomic<bool> mWriterWaiting = {false};
+    // Absolute stream position of ring index 0 whose start is mirrored, and the length mirrored
+    uint32_t mMirrorBase = 0;
+    uint32_t mMirrorLen = 0;
+    void wakeReader();
+public:
+    ~ByteRing() { freeBuf(); }
+    /** Allocates a buffer of at least \c size bytes, rounded up to a power of 2. Must not be called
+     * while the ring is in use */
+    bool allocBuf(uint32_t size);
+    void freeBuf();
+    bool isAllocated() const { return mBuf != nullptr; }
+    uint32_t capacity() const { return mSize; }
+    /** Limits the buffered data to less than the capacity, for the producer's buffering policy. It is
+     * not lower than kMirrorSize, so that a max-size peek is always possible. 0 removes the limit */
+    void setMaxDataSize(uint32_t size);
+    uint32_t usableSize() const;
+    int dataSize() const { return mWritePos.load(std::memory_order_acquire) - mReadPos.load(std::memory_order_acquire); }
+    int freeSpace() const { return usableSize() - dataSize(); }
+    uint32_t readPos() const { return mReadPos.load(std::memory_order_acquire); }
+    uint32_t writePos() const { return mWritePos.load(std::memory_order_acquire); }
+    /** Resets the ring. Must be called by the producer, and the consumer must not be holding a peeked region */
+    void clear();
+// producer
+    /** Waits for free space and returns the contiguous writable region, its length is returned in \c len.
+     *  Returns null on stop signal */
+    uint8_t* writePtr(int& len);
+    void commitWrite(int len);
+    /** Wakes a consumer blocked in waitForWrite(), i.e. when an out-of-band event is posted */
+    void notifyReader() { mWriteSeq++; wakeReader(); }
+// consumer
+    /** Returns a pointer to \c len contiguous bytes at the read position, \c len must not be
+     * larger than dataSize() and kMirrorSize. Doesn't block */
+    const uint8_t* peek(int len);
+    void consume(int len);
+    /** Use the returned value as a token for waitForWrite() */
+    uint32_t writeSeq() const { return mWriteSeq.load(); }
+    /** Blocks until something is written or notifyReader() is called after writeSeq() returned \c seq.
+     * @returns -1 on stop signal, 1 otherwise */
+    int8_t waitForWrite(uint32_t seq);
+};
+
+#endif // BYTERING_HPP
@@ -1,6 +1,7 @@
 #include "decoderAac.hpp"
 #define HELIX_FEATURE_AUDIO_CODEC_AAC_SBR 1
 #include <aacdec.h>
+#include <algorithm>
 
 static const char* TAG = "aacdec";
 
@@ -39,6 +40,9 @@ void DecoderAac::reset()
 
 StreamEvent DecoderAac::decode(AudioNode::PacketResult& dpr)
 {
+    if (mSrcNode.byteStreamActive()) {
+        return decodeByteStream(dpr);
+    }
     bool needMoreData = (mInputLen == 0);
     DataPacket::unique_ptr output;
     for(;;) {
@@ -55,7 +59,7 @@ StreamEvent DecoderAac::decode(AudioNode::PacketResult& dpr)
                 mNextFramePtr = mInputBuf;
                 return kErrDecode;
             }
-            auto event = mSrcNode.pullData(dpr);
+            auto event = mSrcNode.pullDataProfiled(dpr);
             if (event) {
                 return event;
             }
@@ -79,22 +83,7 @@ StreamEvent DecoderAac::decode(AudioNode::PacketResult& dpr)
             continue;
         }
         else if (err == 0) { // decode success
-            if (!mOutputLen) { // we haven't yet initialized output format info
-                getStreamFormat();
-            }
-            if (mOutputLen <= 2048) {
-                output->dataLen = mOutputLen;
-                return mParent.codecPostOutput(output.release()) ? kNoError : kErrStreamStopped;
-            }
-            else {
-                output->dataLen = 2048;
-                auto out2len = mOutputLen - 2048;
-                DataPacket::unique_ptr output2(DataPacket::create<true>(out2len * 2, DataPacket::kHasSpaceFor32Bit));
-                memcpy(output2->data, output->data + 2048, out2len);
-                output2->dataLen = out2len;
-                bool ok = mParent.codecPostOutput(output.release()) && mParent.codecPostOutput(output2.release());
-                return ok ? kNoError : kErrStreamStopped;
-            }
+            return postOutput(output);
         }
         else { //err < 0 - error, try to re-sync
             // mNextFramePtr and mInputLen are guaranteed to not be updated if AACDecode() failed
@@ -124,6 +113,73 @@ StreamEvent DecoderAac::decode(AudioNode::PacketResult& dpr)
     }
 }
 
+StreamEvent DecoderAac::postOutput(DataPacket::unique_ptr& output)
+{
+    if (!mOutputLen) { // we haven't yet initialized output format info
+        getStreamFormat();
+    }
+    if (mOutputLen <= 2048) {
+        output->dataLen = mOutputLen;
+        return mParent.codecPostOutput(output.release()) ? kNoError : kErrStreamStopped;
+    }
+    else {
+        output->dataLen = 2048;
+        auto out2len = mOutputLen - 2048;
+        DataPacket::unique_ptr output2(DataPacket::create<true>(out2len * 2, DataPacket::kHasSpaceFor32Bit));
+        memcpy(output2->data, output->data + 2048, out2len);
+        output2->dataLen = out2len;
+        bool ok = mParent.codecPostOutput(output.release()) && mParent.codecPostOutput(output2.release());
+        return ok ? kNoError : kErrStreamStopped;
+    }
+}
+// Decodes directly from the source node's buffer, without copying to mInputBuf
+StreamEvent DecoderAac::decodeByteStream(AudioNode::PacketResult& dpr)
+{
+    DataPacket::unique_ptr output;
+    for(;;) {
+        const uint8_t* data;
+        int len;
+        auto event = mSrcNode.peekBytesProfiled(mPeekLen, data, len, dpr);
+        if (event) {
+            return event;
+        }
+        if (!output) {
+            output.reset(DataPacket::create(mOutputLen ? mOutputLen * 2 : kOutputMaxSize, StreamPacket::kHasSpaceFor32Bit));
+        }
+        auto ptr = const_cast<unsigned char*>(data);
+        int bytesLeft = len;
+        auto err = AACDecode(mDecoder, &ptr, &bytesLeft, (int16_t*)output->data);
+        if (err == ERR_AAC_INDATA_UNDERFLOW) {
+            if (len < mPeekLen) { // incomplete frame before a stream event, skip it
+                mSrcNode.consumeBytesProfiled(len);
+            }
+            else if (mPeekLen < AudioNode::kMaxPeekBytes) {
+                mPeekLen = std::min(mPeekLen * 2, (int)AudioNode::kMaxPeekBytes);
+            }
+            else {
+                ESP_LOGE(TAG, "Can't decode a frame, even though max peek size is available");
+                return kErrDecode;
+            }
+            continue;
+        }
+        else if (err == 0) {
+            mSrcNode.consumeBytesProfiled(ptr - data);
+            mPeekLen = kMinAllowedAacInputSize;
+            return postOutput(output);
+        }
+        else { // input is not consumed on error, try to re-sync
+            ESP_LOGW(TAG, "Decode error %d, looking for next sync word", err);
+            auto pos = AACFindSyncWord(ptr + 1, len - 1);
+            if (pos >= 0) {
+                mSrcNode.consumeBytesProfiled(pos + 1);
+            }
+            else { // preserve a trailing 0xff, it can be the first byte of a sync word
+                mSrcNode.consumeBytesProfiled((len > 1 && data[len - 1] == 0xff) ? len - 1 : len);
+            }
+            continue;
+        }
+    }
+}
 void DecoderAac::getStreamFormat()
 {
     AACFrameInfo info;
@@ -141,5 +197,5 @@ void DecoderAac::getStreamFormat()
         isSbr ? " SBR" : "",
         info.nChans == 2 ? "stereo" : "mono", info.sampRateOut,
         info.bitRate, info.outputSamps);
-    mParent.codecOnFormatDetected(outputFormat, 16);
+    mParent.codecOnFormatDetected(outputFormat, 16, mOutputLen * 2);
 }
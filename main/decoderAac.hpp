@@ -15,9 +15,12 @@ protected:
     unsigned char* mNextFramePtr;
     int mInputLen;
     int mOutputLen;
+    int mPeekLen = kMinAllowedAacInputSize;
     void initDecoder();
     void freeDecoder();
     void getStreamFormat();
+    StreamEvent postOutput(DataPacket::unique_ptr& output);
+    StreamEvent decodeByteStream(AudioNode::PacketResult& dpr);
 public:
     virtual Codec::Type type() const { return Codec::kCodecAac; }
     DecoderAac(DecoderNode& parent, AudioNode& src);
@@ -38,13 +38,13 @@ FLAC__StreamDecoderReadStatus DecoderFlac::readCb(const FLAC__StreamDecoder *dec
 //  printf("readCb\n");
     auto& self = *static_cast<DecoderFlac*>(userp);
     if (!self.mInputPacket) {
-        auto event = self.mLastInputEvent = self.mSrcNode.pullData(*self.mLastInputPr);
+        auto event = self.mLastInputEvent = self.mSrcNode.pullDataProfiled(*self.mLastInputPr);
         if (event) {
             *bytes = 0;
             if (event < 0) {
                 return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
             }
-            else if (event == kEvtStreamChanged || event == kEvtStreamChanged) {
+            else if (event == kEvtStreamChanged || event == kEvtStreamEnd) {
                 return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
             }
             else {
@@ -119,46 +119,9 @@ StreamEvent DecoderFlac::decode(AudioNode::PacketResult& dpr)
 template <typename T, bool isMono>
 bool DecoderFlac::outputSamples(int nSamples, const FLAC__int32* const channels[])
 {
-    auto ch0 = channels[0];
-    auto ch1 = channels[isMono ? 0 : 1]; // in mono mode, output the same channel on both left and right
-    int maxPktSamples;
-    if ((nSamples & 0x3ff) == 0) { // multiple of 1024
-        maxPktSamples = 1024;
-    }
-    else {
-        int nPackets = (nSamples + 1023) >> 10; // divide by 1024
-        maxPktSamples = nSamples / nPackets;
-    }
-    int maxPktAlloc = maxPktSamples * 8; // we always allocate for 32bit samples
-    int maxPktLen = maxPktSamples * 2 * sizeof(T);
-    int remainSamples = nSamples;
-    int sidx = 0;
-    while(remainSamples > 0) {
-        int pktSamples, pktAlloc, pktLen;
-        if (remainSamples >= maxPktSamples) {
-            pktSamples = maxPktSamples;
-            pktAlloc = maxPktAlloc;
-            pktLen = maxPktLen;
-        }
-        else {
-            pktSamples = remainSamples;
-            pktAlloc = pktSamples * 8;
-            pktLen = pktSamples * 2 * sizeof(T);
-        }
-        DataPacket::unique_ptr output(DataPacket::create(pktAlloc, StreamPacket::kHasSpaceFor32Bit));
-        T* wptr = (T*)output->data;
-        int eidx = sidx + pktSamples;
-        for (; sidx < eidx; sidx++) {
-            *(wptr++) = ch0[sidx];
-            *(wptr++) = ch1[sidx];
-        }
-        output->dataLen = pktLen;
-        remainSamples -= pktSamples;
-        if (!mParent.codecPostOutput(output.release())) {
-            return false;
-        }
-    }
-    return true;
+    return flacInterleave<T, isMono>(nSamples, channels, [this](DataPacket* pkt) {
+        return mParent.codecPostOutput(pkt);
+    });
 }
 FLAC__StreamDecoderWriteStatus DecoderFlac::writeCb(const FLAC__StreamDecoder *decoder,
     const FLAC__Frame* frame, const FLAC__int32* const buffer[], void *userp)
@@ -183,7 +146,7 @@ FLAC__StreamDecoderWriteStatus DecoderFlac::writeCb(const FLAC__StreamDecoder *d
         if (!self.selectOutputFunc(nChans, bps)) {
             return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
         }
-        self.mParent.codecOnFormatDetected(self.outputFormat, bps);
+        self.mParent.codecOnFormatDetected(self.outputFormat, bps, kFlacPacketMaxBufSize);
     }
     if ((self.*self.mOutputFunc)(nSamples, buffer) == false) {
         ESP_LOGE(TAG, "output: ringbuf aborted, aborting decode");
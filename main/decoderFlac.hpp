@@ -3,6 +3,55 @@
 #include "decoderNode.hpp"
 #include <FLAC/stream_decoder.h>
 
+enum { kFlacPacketMaxBufSize = 1024 * 8 }; // of the packets output by flacInterleave()
+/** Interleaves the channels of a decoded frame into output packets of up to 1024 samples, and
+ * passes each to post(), which returns false to abort. Mono is output on both left and right
+ */
+template <typename T, bool isMono, class F>
+bool flacInterleave(int nSamples, const FLAC__int32* const channels[], F&& post)
+{
+    auto ch0 = channels[0];
+    auto ch1 = channels[isMono ? 0 : 1];
+    int maxPktSamples;
+    if ((nSamples & 0x3ff) == 0) { // multiple of 1024
+        maxPktSamples = 1024;
+    }
+    else {
+        int nPackets = (nSamples + 1023) >> 10; // divide by 1024
+        maxPktSamples = nSamples / nPackets;
+    }
+    int maxPktAlloc = maxPktSamples * 8; // we always allocate for 32bit samples
+    int maxPktLen = maxPktSamples * 2 * sizeof(T);
+    int remainSamples = nSamples;
+    int sidx = 0;
+    while(remainSamples > 0) {
+        int pktSamples, pktAlloc, pktLen;
+        if (remainSamples >= maxPktSamples) {
+            pktSamples = maxPktSamples;
+            pktAlloc = maxPktAlloc;
+            pktLen = maxPktLen;
+        }
+        else {
+            pktSamples = remainSamples;
+            pktAlloc = pktSamples * 8;
+            pktLen = pktSamples * 2 * sizeof(T);
+        }
+        DataPacket::unique_ptr output(DataPacket::create(pktAlloc, StreamPacket::kHasSpaceFor32Bit));
+        T* wptr = (T*)output->data;
+        int eidx = sidx + pktSamples;
+        for (; sidx < eidx; sidx++) {
+            *(wptr++) = ch0[sidx];
+            *(wptr++) = ch1[sidx];
+        }
+        output->dataLen = pktLen;
+        remainSamples -= pktSamples;
+        if (!post(output.release())) {
+            return false;
+        }
+    }
+    return true;
+}
+
 class DecoderFlac: public Decoder
 {
 protected:
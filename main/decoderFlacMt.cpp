@@ -0,0 +1,567 @@
+#include "decoderFlacMt.hpp"
+#include <algorithm>
+
+static const char* TAG = "flac-mt";
+
+static uint8_t crc8(const uint8_t* data, int len) // polynomial x^8 + x^2 + x + 1, of frame headers
+{
+    uint8_t crc = 0;
+    for (int i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+        }
+    }
+    return crc;
+}
+void DecoderFlacMt::Job::clearOutput()
+{
+    for (int i = 0; i < numPackets; i++) {
+        packets[i]->destroy();
+    }
+    numPackets = 0;
+}
+DecoderFlacMt::Worker::~Worker()
+{
+    stop();
+    if (mDecoder) {
+        FLAC__stream_decoder_delete(mDecoder);
+    }
+}
+bool DecoderFlacMt::Worker::init(const uint8_t* streamHeader, int len)
+{
+    if (!mDecoder) {
+        mDecoder = FLAC__stream_decoder_new();
+        if (!mDecoder) {
+            ESP_LOGE(TAG, "Out of memory allocating FLAC decoder");
+            return false;
+        }
+    }
+    else {
+        FLAC__stream_decoder_finish(mDecoder);
+    }
+    auto ret = FLAC__stream_decoder_init_stream(mDecoder, readCb, nullptr, nullptr, nullptr, nullptr,
+        writeCb, nullptr, errorCb, this);
+    if (ret != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        ESP_LOGE(TAG, "Error %s initializing FLAC decoder", FLAC__StreamDecoderInitStatusString[ret]);
+        return false;
+    }
+    mReadPtr = streamHeader;
+    mReadLen = len;
+    if (!FLAC__stream_decoder_process_until_end_of_metadata(mDecoder) || mReadLen) {
+        ESP_LOGE(TAG, "Error parsing stream header");
+        return false;
+    }
+    return true;
+}
+FLAC__StreamDecoderReadStatus DecoderFlacMt::Worker::readCb(const FLAC__StreamDecoder* decoder,
+    FLAC__byte buffer[], size_t* bytes, void* userp)
+{
+    auto& self = *static_cast<Worker*>(userp);
+    if (!self.mReadLen) { // only on a broken frame, the input is exactly one frame
+        *bytes = 0;
+        return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+    }
+    size_t len = std::min(*bytes, (size_t)self.mReadLen);
+    memcpy(buffer, self.mReadPtr, len);
+    self.mReadPtr += len;
+    self.mReadLen -= len;
+    *bytes = len;
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+void DecoderFlacMt::Worker::errorCb(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status, void* userp)
+{
+    ESP_LOGE(TAG, "FLAC decode error: %s(%d)", FLAC__StreamDecoderErrorStatusString[status], status);
+}
+FLAC__StreamDecoderWriteStatus DecoderFlacMt::Worker::writeCb(const FLAC__StreamDecoder* decoder,
+    const FLAC__Frame* frame, const FLAC__int32* const buffer[], void* userp)
+{
+    auto& self = *static_cast<Worker*>(userp);
+    auto& job = *self.mJob;
+    auto& header = frame->header;
+    auto nChans = header.channels;
+    auto nSamples = header.blocksize;
+    if (!nChans || !nSamples) {
+        ESP_LOGE(TAG, "No channels or samples on output");
+        return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+    }
+    auto bps = header.bits_per_sample;
+    if ((nChans != 1 && nChans != 2) || (bps != 16 && bps != 24 && bps != 32)) {
+        ESP_LOGE(TAG, "Unsupported format: %lu channels, %lu-bit", (unsigned long)nChans, (unsigned long)bps);
+        job.error = true;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+    job.numChannels = nChans;
+    job.bps = bps;
+    job.sampleRate = header.sample_rate;
+    auto post = [&job](DataPacket* pkt) {
+        if (job.numPackets >= kMaxOutPackets) {
+            pkt->destroy();
+            return false;
+        }
+        job.packets[job.numPackets++] = pkt;
+        return true;
+    };
+    bool ok = (bps == 16)
+        ? ((nChans == 2) ? flacInterleave<int16_t, false>(nSamples, buffer, post) : flacInterleave<int16_t, true>(nSamples, buffer, post))
+        : ((nChans == 2) ? flacInterleave<int32_t, false>(nSamples, buffer, post) : flacInterleave<int32_t, true>(nSamples, buffer, post));
+    if (!ok) {
+        job.error = true;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+void DecoderFlacMt::Worker::decodeJob(Job& job)
+{
+    job.error = false;
+    job.clearOutput();
+    mJob = &job;
+    mReadPtr = job.data.get();
+    mReadLen = job.len;
+    bool ok = FLAC__stream_decoder_process_single(mDecoder);
+    auto state = FLAC__stream_decoder_get_state(mDecoder);
+    if (!ok && !job.error) {
+        ESP_LOGW(TAG, "Decoder returned error %s(%d)", FLAC__StreamDecoderStateString[state], state);
+        job.error = true;
+    }
+    else if (ok && mReadLen) {
+        ESP_LOGW(TAG, "%d bytes left after decoding frame", mReadLen);
+    }
+    // Back to searching for a frame, with the stream info kept. This also makes libFLAC forget the
+    // previous frame, otherwise it would fill the gap of the frames decoded by the other worker with silence
+    FLAC__stream_decoder_flush(mDecoder);
+    mJob = nullptr;
+}
+void DecoderFlacMt::Worker::sTaskFunc(void* ctx)
+{
+    auto& self = *static_cast<Worker*>(ctx);
+    for (;;) {
+        Job* job;
+        self.mQueue.get(job, -1);
+        if (!job) {
+            return;
+        }
+        self.decodeJob(*job);
+        self.mDoneEvents->setBits(1 << job->slot);
+    }
+}
+bool DecoderFlacMt::Worker::start(int core, EventGroup& doneEvents)
+{
+    mDoneEvents = &doneEvents;
+    if (!mTask.createTask("flac-worker", false, kWorkerStackSize, core, kWorkerPrio, this, sTaskFunc)) {
+        ESP_LOGE(TAG, "Out of memory creating worker task");
+        mDoneEvents = nullptr;
+        return false;
+    }
+    return true;
+}
+void DecoderFlacMt::Worker::stop()
+{
+    if (!mDoneEvents) {
+        return;
+    }
+    mQueue.post(nullptr);
+    mTask.waitToEnd();
+    mDoneEvents = nullptr;
+}
+DecoderFlacMt::DecoderFlacMt(DecoderNode& parent, AudioNode& src, bool alwaysParallel)
+: Decoder(parent, src, Codec(Codec::kCodecFlac, Codec::kTransportDefault)), mAlwaysParallel(alwaysParallel)
+{
+    for (int i = 0; i < kNumJobs; i++) {
+        mJobs[i].slot = i;
+    }
+}
+DecoderFlacMt::~DecoderFlacMt()
+{
+    stopWorkers();
+}
+void DecoderFlacMt::stopWorkers()
+{
+    for (auto& worker: mWorkers) {
+        worker.stop();
+    }
+    mParallel = false;
+    mDoneEvents.clearBits((1 << kNumJobs) - 1);
+    for (auto& job: mJobs) {
+        job.clearOutput();
+    }
+    mNumPending = 0;
+}
+void DecoderFlacMt::reset()
+{
+    ESP_LOGI(TAG, "Resetting decoder");
+    stopWorkers();
+    outputFormat.clear();
+    mState = kStateMagic;
+    mHasStreamInfo = false;
+    mSkipBytes = 0;
+    mBufLen = 0;
+    mHasFrameStart = false;
+    mScanPos = 0;
+    mHeadSlot = 0;
+    mPendingEvent = kNoError;
+    mPendingEventPkt.reset();
+}
+void DecoderFlacMt::appendInput(const uint8_t* data, int len)
+{
+    if (mSkipBytes) {
+        int n = std::min<uint32_t>(mSkipBytes, len);
+        mSkipBytes -= n;
+        data += n;
+        len -= n;
+    }
+    if (mBufLen + len > mBufSize) {
+        int newSize = std::max(mBufLen + len, mBufSize ? mBufSize * 2 : 32768);
+        mBuf.reset((uint8_t*)realloc(mBuf.release(), newSize));
+        myassert(mBuf);
+        mBufSize = newSize;
+    }
+    memcpy(mBuf.get() + mBufLen, data, len);
+    mBufLen += len;
+}
+void DecoderFlacMt::consumeInput(int len)
+{
+    if (len > mBufLen) { // skip the rest with the next input
+        mSkipBytes += len - mBufLen;
+        len = mBufLen;
+    }
+    mBufLen -= len;
+    memmove(mBuf.get(), mBuf.get() + len, mBufLen);
+    mScanPos = std::max(mScanPos - len, 0);
+}
+StreamEvent DecoderFlacMt::parseStreamHeader()
+{
+    for (;;) {
+        auto buf = mBuf.get();
+        if (mState == kStateMagic) {
+            if (mBufLen < 10) {
+                return kNoError;
+            }
+            if (memcmp(buf, "ID3", 3) == 0) {
+                int len = 10 + ((buf[6] & 0x7f) << 21) + ((buf[7] & 0x7f) << 14) + ((buf[8] & 0x7f) << 7) + (buf[9] & 0x7f);
+                if (buf[5] & 0x10) { // footer
+                    len += 10;
+                }
+                ESP_LOGI(TAG, "Skipping ID3 tag of %d bytes", len);
+                consumeInput(len);
+                continue;
+            }
+            if (memcmp(buf, "fLaC", 4)) {
+                ESP_LOGE(TAG, "No fLaC stream marker, not a native FLAC stream");
+                return kErrStreamFmt;
+            }
+            consumeInput(4);
+            mState = kStateMetadata;
+            continue;
+        }
+        if (mState != kStateMetadata) {
+            return kNoError;
+        }
+        if (mBufLen < 4 || ((buf[0] & 0x7f) == 0 && mBufLen < 4 + kStreamInfoLen)) {
+            return kNoError;
+        }
+        bool isLast = buf[0] & 0x80;
+        int type = buf[0] & 0x7f;
+        uint32_t len = (buf[1] << 16) | (buf[2] << 8) | buf[3];
+        if (type == 0) { // STREAMINFO
+            if (len != kStreamInfoLen) {
+                ESP_LOGE(TAG, "Invalid STREAMINFO size %lu", (unsigned long)len);
+                return kErrStreamFmt;
+            }
+            memcpy(mStreamHeader, "fLaC", 4);
+            mStreamHeader[4] = 0x80; // last metadata block
+            memcpy(mStreamHeader + 5, buf + 1, 3 + kStreamInfoLen);
+            auto info = buf + 4;
+            uint32_t maxFrameLen = (info[7] << 16) | (info[8] << 8) | info[9];
+            if (maxFrameLen) {
+                mMaxFrameLen = maxFrameLen;
+            }
+            mHasStreamInfo = true;
+        }
+        consumeInput(4 + len);
+        if (isLast) {
+            if (!mHasStreamInfo) {
+                ESP_LOGE(TAG, "Stream has no STREAMINFO block");
+                return kErrStreamFmt;
+            }
+            if (!startDecoding()) {
+                return kErrDecode;
+            }
+            mState = kStateFrames;
+            return kNoError;
+        }
+    }
+}
+bool DecoderFlacMt::startDecoding()
+{
+    auto info = mStreamHeader + 8;
+    uint32_t sampleRate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+    int bps = (((info[12] & 1) << 4) | (info[13] >> 4)) + 1;
+    mParallel = mAlwaysParallel || sampleRate > 48000 || bps > 16;
+    ESP_LOGI(TAG, "%d-bit, %lu Hz stream, decoding %s", bps, (unsigned long)sampleRate,
+        mParallel ? "in parallel on both cores" : "on the decoder task");
+    int numWorkers = mParallel ? kNumWorkers : 1;
+    for (int i = 0; i < numWorkers; i++) {
+        if (!mWorkers[i].init(mStreamHeader, sizeof(mStreamHeader))) {
+            return false;
+        }
+    }
+    if (mParallel) {
+        for (int i = 0; i < kNumWorkers; i++) {
+            if (!mWorkers[i].start(i, mDoneEvents)) { // worker n is pinned to core n
+                stopWorkers();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+// Returns the header length, 0 if there is no valid frame header at ptr, or -1 if more data is needed
+int DecoderFlacMt::parseFrameHeader(const uint8_t* ptr, int avail, FrameHeader& hdr)
+{
+    if (avail < 6) {
+        return -1;
+    }
+    if (ptr[0] != 0xff || (ptr[1] & 0xfe) != 0xf8) {
+        return 0;
+    }
+    int bsCode = ptr[2] >> 4;
+    int srCode = ptr[2] & 0x0f;
+    int chCode = ptr[3] >> 4;
+    int bpsCode = (ptr[3] >> 1) & 0x07;
+    if (bsCode == 0 || srCode == 15 || chCode > 10 || bpsCode == 3 || (ptr[3] & 1)) {
+        return 0;
+    }
+    hdr.variableSize = ptr[1] & 1;
+    // frame or sample number, UTF-8 style coded
+    uint8_t first = ptr[4];
+    int numExtra;
+    uint64_t number;
+    if (!(first & 0x80)) {
+        numExtra = 0;
+        number = first;
+    }
+    else if (first == 0xff) {
+        return 0;
+    }
+    else if (first == 0xfe && hdr.variableSize) {
+        numExtra = 6;
+        number = 0;
+    }
+    else {
+        numExtra = __builtin_clz((uint32_t)(uint8_t)~first << 24) - 1;
+        if (numExtra < 1 || numExtra > 5) {
+            return 0;
+        }
+        number = first & (0x3f >> numExtra);
+    }
+    int pos = 5;
+    if (avail < pos + numExtra + 5) { // extra number bytes, max block size and sample rate bytes, crc
+        return -1;
+    }
+    for (int i = 0; i < numExtra; i++) {
+        uint8_t byte = ptr[pos++];
+        if ((byte & 0xc0) != 0x80) {
+            return 0;
+        }
+        number = (number << 6) | (byte & 0x3f);
+    }
+    if (bsCode == 1) {
+        hdr.blockSize = 192;
+    }
+    else if (bsCode <= 5) {
+        hdr.blockSize = 576 << (bsCode - 2);
+    }
+    else if (bsCode == 6) {
+        hdr.blockSize = ptr[pos++] + 1;
+    }
+    else if (bsCode == 7) {
+        hdr.blockSize = ((ptr[pos] << 8) | ptr[pos + 1]) + 1;
+        pos += 2;
+    }
+    else {
+        hdr.blockSize = 256 << (bsCode - 8);
+    }
+    if (srCode == 12) {
+        pos++;
+    }
+    else if (srCode == 13 || srCode == 14) {
+        pos += 2;
+    }
+    if (crc8(ptr, pos) != ptr[pos]) {
+        return 0;
+    }
+    hdr.number = number;
+    hdr.numChannels = (chCode < 8) ? chCode + 1 : 2;
+    hdr.codes = (srCode << 4) | bpsCode;
+    return pos + 1;
+}
+bool DecoderFlacMt::isNextFrame(const FrameHeader& hdr, bool relaxed) const
+{
+    auto& cur = mFrameHdr;
+    if (hdr.variableSize != cur.variableSize || hdr.codes != cur.codes || hdr.numChannels != cur.numChannels) {
+        return false;
+    }
+    if (relaxed) { // resync after a corrupt or lost frame
+        return true;
+    }
+    return hdr.number == cur.number + (cur.variableSize ? cur.blockSize : 1);
+}
+// A frame ends where the next one starts. A sync code in the frame data is not taken for the next
+// header unless it has a valid CRC and the expected frame number
+bool DecoderFlacMt::splitFrame(bool isLast)
+{
+    auto buf = mBuf.get();
+    if (!mHasFrameStart) {
+        for (int pos = 0; pos < mBufLen - 1; pos++) {
+            if (buf[pos] != 0xff) {
+                continue;
+            }
+            int ret = parseFrameHeader(buf + pos, mBufLen - pos, mFrameHdr);
+            if (ret < 0) {
+                if (pos) {
+                    consumeInput(pos);
+                }
+                return false;
+            }
+            if (ret > 0) {
+                if (pos) {
+                    ESP_LOGW(TAG, "Skipped %d bytes to sync to a frame", pos);
+                    consumeInput(pos);
+                }
+                mHasFrameStart = true;
+                mScanPos = ret;
+                break;
+            }
+        }
+        if (!mHasFrameStart) {
+            consumeInput(std::max(mBufLen - 1, 0)); // keep a trailing 0xff
+            return false;
+        }
+    }
+    for (;;) {
+        auto start = buf + mScanPos;
+        auto ptr = (const uint8_t*)memchr(start, 0xff, mBufLen - mScanPos);
+        if (!ptr) {
+            mScanPos = mBufLen;
+            break;
+        }
+        int pos = ptr - buf;
+        FrameHeader hdr;
+        int ret = parseFrameHeader(ptr, mBufLen - pos, hdr);
+        if (ret < 0) { // need more data to check the candidate
+            mScanPos = pos;
+            break;
+        }
+        if (ret > 0 && isNextFrame(hdr, pos > (int)mMaxFrameLen)) {
+            dispatchFrame(pos);
+            mFrameHdr = hdr;
+            mScanPos = ret;
+            return true;
+        }
+        mScanPos = pos + 1;
+    }
+    if (isLast && mBufLen) {
+        dispatchFrame(mBufLen);
+        mHasFrameStart = false;
+        return true;
+    }
+    return false;
+}
+void DecoderFlacMt::dispatchFrame(int len)
+{
+    myassert(mNumPending < kNumJobs);
+    auto& job = mJobs[(mHeadSlot + mNumPending) % kNumJobs];
+    if (job.capacity < len) {
+        job.data.reset((uint8_t*)realloc(job.data.release(), len));
+        myassert(job.data);
+        job.capacity = len;
+    }
+    memcpy(job.data.get(), mBuf.get(), len);
+    job.len = len;
+    consumeInput(len);
+    mNumPending++;
+    if (mParallel) {
+        mWorkers[job.slot % kNumWorkers].post(&job);
+    }
+    else {
+        mWorkers[0].decodeJob(job);
+        mDoneEvents.setBits(1 << job.slot);
+    }
+}
+StreamEvent DecoderFlacMt::postJobOutput()
+{
+    auto& job = mJobs[mHeadSlot];
+    mDoneEvents.waitForOneAndReset(1 << job.slot, -1);
+    mHeadSlot = (mHeadSlot + 1) % kNumJobs;
+    mNumPending--;
+    if (job.error) {
+        job.clearOutput();
+        return kErrDecode;
+    }
+    if (!job.numPackets) {
+        return kNoError;
+    }
+    if (job.numChannels != outputFormat.numChannels() || job.bps != outputFormat.bitsPerSample() ||
+        job.sampleRate != outputFormat.sampleRate()) {
+        outputFormat.setNumChannels(job.numChannels);
+        outputFormat.setBitsPerSample(job.bps);
+        outputFormat.setSampleRate(job.sampleRate);
+        ESP_LOGI(TAG, "Output format is %d-bit, %.1fkHz %s", job.bps, (float)job.sampleRate / 1000,
+            (job.numChannels == 2) ? "stereo" : "mono");
+        mParent.codecOnFormatDetected(outputFormat, job.bps, kFlacPacketMaxBufSize);
+    }
+    int i = 0;
+    for (; i < job.numPackets; i++) {
+        if (!mParent.codecPostOutput(job.packets[i])) {
+            break;
+        }
+    }
+    bool ok = (i == job.numPackets);
+    for (i++; i < job.numPackets; i++) { // the packet that failed to post is freed by the node
+        job.packets[i]->destroy();
+    }
+    job.numPackets = 0;
+    return ok ? kNoError : kErrStreamStopped;
+}
+StreamEvent DecoderFlacMt::decode(AudioNode::PacketResult& pr)
+{
+    for (;;) {
+        bool canDispatch = mNumPending < kNumJobs;
+        // at the end of the stream, the last frame ends with the data
+        bool isLast = mPendingEvent == kEvtStreamEnd || mPendingEvent == kEvtStreamChanged;
+        if (canDispatch && mState == kStateFrames && splitFrame(isLast)) {
+            continue;
+        }
+        // post the oldest frame when decoded, or wait for it if no more frames can be started
+        if (mNumPending && (!canDispatch || mPendingEvent || (mDoneEvents.get() & (1 << mJobs[mHeadSlot].slot)))) {
+            return postJobOutput();
+        }
+        if (mPendingEvent) { // the output of all preceding frames is posted
+            auto event = mPendingEvent;
+            mPendingEvent = kNoError;
+            pr.packet.reset(mPendingEventPkt.release());
+            pr.streamId = mPendingEventStreamId;
+            return event;
+        }
+        auto event = mSrcNode.pullDataProfiled(pr);
+        if (event) {
+            if (event < 0) {
+                return event;
+            }
+            mPendingEvent = event;
+            mPendingEventPkt.reset(pr.packet.release());
+            mPendingEventStreamId = pr.streamId;
+            continue;
+        }
+        auto& pkt = pr.dataPacket();
+        appendInput((uint8_t*)pkt.data, pkt.dataLen);
+        pr.clear();
+        if (mState != kStateFrames) {
+            auto err = parseStreamHeader();
+            if (err) {
+                return err;
+            }
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef DECODER_FLAC_MT_HPP
+#define DECODER_FLAC_MT_HPP
+#include "decoderFlac.hpp"
+#include <eventGroup.hpp>
+
+/** Frame-parallel decoder for native FLAC streams. The decoder task splits the stream on frame
+ * boundaries, and alternate frames are decoded by two worker tasks pinned to different cores, each
+ * with its own libFLAC instance. The output is posted by the decoder task, in stream order.
+ * Frames are independently decodable, so the output is identical to that of DecoderFlac.
+ * If \c alwaysParallel is false, the workers are only started for hi-res streams, and lighter
+ * streams are decoded on the decoder task
+ */
+class DecoderFlacMt: public Decoder
+{
+protected:
+    enum {
+        kNumWorkers = 2,
+        kNumJobs = 4, // frames in flight. Consecutive jobs are decoded by alternate workers
+        kMaxOutPackets = 64, // max FLAC block size is 65535 samples, output packets are up to 1024 samples
+        kStreamInfoLen = 34,
+        kStreamHeaderLen = 8 + kStreamInfoLen, // 'fLaC' marker and a STREAMINFO block, to prime the workers
+        kMaxFrameHeaderLen = 16,
+        kDefaultMaxFrameLen = 64 * 1024, // if not specified in STREAMINFO
+        kWorkerStackSize = 6144, kWorkerPrio = DecoderNode::kPrio
+    };
+    enum State: uint8_t { kStateMagic, kStateMetadata, kStateFrames };
+    struct FrameHeader
+    {
+        uint64_t number; // frame number for fixed block size streams, sample number otherwise
+        uint32_t blockSize;
+        uint8_t numChannels;
+        uint8_t codes; // sample rate and sample size codes, constant in a stream
+        bool variableSize;
+    };
+    struct Job
+    {
+        unique_ptr_mfree<uint8_t> data;
+        int len = 0;
+        int capacity = 0;
+        uint8_t slot = 0;
+        // set by the worker
+        bool error = false;
+        uint8_t numPackets = 0;
+        uint8_t numChannels = 0;
+        uint8_t bps = 0;
+        uint32_t sampleRate = 0;
+        DataPacket* packets[kMaxOutPackets];
+        void clearOutput();
+        ~Job() { clearOutput(); }
+    };
+    class Worker
+    {
+    protected:
+        FLAC__StreamDecoder* mDecoder = nullptr;
+        Task mTask;
+        Queue<Job*, kNumJobs> mQueue;
+        EventGroup* mDoneEvents = nullptr;
+        const uint8_t* mReadPtr = nullptr;
+        int mReadLen = 0;
+        Job* mJob = nullptr;
+        static FLAC__StreamDecoderReadStatus readCb(const FLAC__StreamDecoder* decoder, FLAC__byte buffer[], size_t* bytes, void* userp);
+        static FLAC__StreamDecoderWriteStatus writeCb(const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame, const FLAC__int32* const buffer[], void* userp);
+        static void errorCb(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status, void* userp);
+        static void sTaskFunc(void* ctx);
+    public:
+        ~Worker();
+        /** Creates the libFLAC decoder, and feeds it the stream header */
+        bool init(const uint8_t* streamHeader, int len);
+        void decodeJob(Job& job);
+        bool start(int core, EventGroup& doneEvents);
+        bool isStarted() { return mDoneEvents != nullptr; }
+        void post(Job* job) { mQueue.post(job); }
+        void stop();
+    };
+    Worker mWorkers[kNumWorkers];
+    Job mJobs[kNumJobs];
+    EventGroup mDoneEvents; // bit n is set when mJobs[n] is decoded
+    bool mAlwaysParallel;
+    bool mParallel = false;
+    State mState = kStateMagic;
+    uint8_t mStreamHeader[kStreamHeaderLen];
+    bool mHasStreamInfo = false;
+    uint32_t mMaxFrameLen = kDefaultMaxFrameLen;
+    uint32_t mSkipBytes = 0; // of metadata blocks that we don't need
+    // splitter input
+    unique_ptr_mfree<uint8_t> mBuf;
+    int mBufLen = 0;
+    int mBufSize = 0;
+    bool mHasFrameStart = false; // a frame header was found at the start of mBuf
+    FrameHeader mFrameHdr; // of the frame at the start of mBuf
+    int mScanPos = 0; // where to continue searching for the next frame header
+    // jobs in flight, in stream order
+    uint8_t mHeadSlot = 0;
+    uint8_t mNumPending = 0;
+    // input event that is returned after the frames before it are output
+    StreamEvent mPendingEvent = kNoError;
+    StreamPacket::unique_ptr mPendingEventPkt;
+    StreamId mPendingEventStreamId = 0;
+    static int parseFrameHeader(const uint8_t* ptr, int avail, FrameHeader& hdr);
+    bool isNextFrame(const FrameHeader& hdr, bool relaxed) const;
+    void appendInput(const uint8_t* data, int len);
+    void consumeInput(int len);
+    StreamEvent parseStreamHeader();
+    bool startDecoding();
+    bool splitFrame(bool isLast);
+    void dispatchFrame(int len);
+    StreamEvent postJobOutput();
+    void stopWorkers();
+public:
+    virtual Codec::Type type() const { return Codec::kCodecFlac; }
+    DecoderFlacMt(DecoderNode& parent, AudioNode& src, bool alwaysParallel);
+    ~DecoderFlacMt();
+    virtual StreamEvent decode(AudioNode::PacketResult& pr);
+    virtual void reset();
+};
+
+#endif
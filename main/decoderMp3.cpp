@@ -1,5 +1,6 @@
 #include "decoderMp3.hpp"
 #include <mad.h>
+#include <algorithm>
 
 static const char* TAG = "mp3dec";
 
@@ -34,6 +35,9 @@ void DecoderMp3::reset()
 
 StreamEvent DecoderMp3::decode(AudioNode::PacketResult& dpr)
 {
+    if (mSrcNode.byteStreamActive()) {
+        return decodeByteStream(dpr);
+    }
     bool needMoreData = !mMadStream.buffer;
     for (;;) {
         if (needMoreData) {
@@ -47,7 +51,7 @@ StreamEvent DecoderMp3::decode(AudioNode::PacketResult& dpr)
                 ESP_LOGE(TAG, "Input buffer full, but can't decode frame");
                 return kErrDecode;
             }
-            auto event = mSrcNode.pullData(dpr);
+            auto event = mSrcNode.pullDataProfiled(dpr);
             if (event) {
                 return event;
             }
@@ -95,6 +99,48 @@ void DecoderMp3::logEncodingInfo()
         mMadFrame.header.bitrate / 1000);
 }
 
+// Decodes directly from the source node's buffer, without copying to mInputBuf
+StreamEvent DecoderMp3::decodeByteStream(AudioNode::PacketResult& dpr)
+{
+    for (;;) {
+        const uint8_t* data;
+        int len;
+        auto event = mSrcNode.peekBytesProfiled(mPeekLen, data, len, dpr);
+        if (event) {
+            return event;
+        }
+        mad_stream_buffer(&mMadStream, data, len);
+        auto ret = mad_frame_decode(&mMadFrame, &mMadStream);
+        int consumed = mMadStream.next_frame - data;
+        if (ret) { // returns 0 on success, -1 on error
+            if (mMadStream.error == MAD_ERROR_BUFLEN) {
+                if (len < mPeekLen) { // incomplete frame before a stream event, skip it
+                    consumed = len;
+                }
+                else if (mPeekLen < AudioNode::kMaxPeekBytes) {
+                    mPeekLen = std::min(mPeekLen * 2, (int)AudioNode::kMaxPeekBytes);
+                }
+                else {
+                    ESP_LOGE(TAG, "Can't decode frame, even though max peek size is available");
+                    return kErrDecode;
+                }
+                mSrcNode.consumeBytesProfiled(consumed);
+                continue;
+            } else if (MAD_RECOVERABLE(mMadStream.error)) {
+                ESP_LOGW(TAG, "mad_frame_decode: recoverable '%s'", mad_stream_errorstr(&mMadStream));
+                mSrcNode.consumeBytesProfiled(consumed ? consumed : 1);
+                continue;
+            } else { // unrecoverable error
+                ESP_LOGW(TAG, "mad_frame_decode: Unrecoverable '%s'", mad_stream_errorstr(&mMadStream));
+                return kErrDecode;
+            }
+        }
+        mSrcNode.consumeBytesProfiled(consumed);
+        mPeekLen = kMinPeekLen;
+        mad_synth_frame(&mMadSynth, &mMadFrame);
+        return output(mMadSynth.pcm);
+    }
+}
 StreamEvent DecoderMp3::output(const mad_pcm& pcmData)
 {
     int nsamples = pcmData.length;
@@ -115,7 +161,7 @@ StreamEvent DecoderMp3::output(const mad_pcm& pcmData)
         outputFormat.setNumChannels(chans);
         outputFormat.setBitsPerSample(24);
         logEncodingInfo();
-        if (!mParent.codecOnFormatDetected(outputFormat, 16)) {
+        if (!mParent.codecOnFormatDetected(outputFormat, 16, nsamples * chans * 4)) {
             return kErrStreamStopped;
         }
     }
@@ -9,13 +9,16 @@ protected:
     enum {
         kInputBufSize = 4096,
         kSamplesPerFrame = 1152,
-        kOutputFrameSize = kSamplesPerFrame * 4 // each mp3 packet decodes to 1152 samples, for 16 bit stereo, multiply by 4
+        kOutputFrameSize = kSamplesPerFrame * 4, // each mp3 packet decodes to 1152 samples, for 16 bit stereo, multiply by 4
+        kMinPeekLen = 2048 // max mp3 frame size is 1441 bytes (320 kbps, 32 kHz)
     };
     struct mad_stream mMadStream;
     struct mad_frame mMadFrame;
     struct mad_synth mMadSynth;
     unsigned char mInputBuf[kInputBufSize];
     int mInputLen = 0;
+    int mPeekLen = kMinPeekLen;
+    StreamEvent decodeByteStream(AudioNode::PacketResult& dpr);
     StreamEvent output(const mad_pcm& pcm);
     void initMadState();
     void freeMadState();
@@ -0,0 +1,747 @@
+#include "decoderMp4.hpp"
+#define HELIX_FEATURE_AUDIO_CODEC_AAC_SBR 1
+#include <aacdec.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+
+static const char* TAG = "mp4dec";
+
+static constexpr uint32_t fourcc(const char* str)
+{
+    return ((uint8_t)str[0] << 24) | ((uint8_t)str[1] << 16) | ((uint8_t)str[2] << 8) | (uint8_t)str[3];
+}
+static inline uint32_t readBE32(const uint8_t* ptr)
+{
+    return (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+}
+static inline uint16_t readBE16(const uint8_t* ptr)
+{
+    return (ptr[0] << 8) | ptr[1];
+}
+static inline uint64_t readBE64(const uint8_t* ptr)
+{
+    return ((uint64_t)readBE32(ptr) << 32) | readBE32(ptr + 4);
+}
+static void* allocTable(uint32_t size)
+{
+    // sample tables of long files can be large, prefer SPI RAM
+    auto ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    return ptr ? ptr : malloc(size);
+}
+DecoderMp4::DecoderMp4(DecoderNode& parent, AudioNode& src)
+: Decoder(parent, src)
+{
+}
+DecoderMp4::~DecoderMp4()
+{
+    reset();
+}
+void DecoderMp4::reset()
+{
+    if (mAacDecoder) {
+        AACFreeDecoder(mAacDecoder);
+        mAacDecoder = nullptr;
+    }
+    mAlac.reset();
+    clearTrack();
+    mState = kStateBoxHeader;
+    mCodecType = Codec::kCodecAac;
+    mInput.reset();
+    mInputOfs = 0;
+    mStreamPos = 0;
+    mSeekPending = false;
+    mReadOfs = 0;
+    mBoxDepth = 0;
+    mBoxPayload.reset();
+    mHasTrack = false;
+    mSampleIdx = mChunkIdx = mStscIdx = mChunkSamplesLeft = 0;
+    mSampleOfs = 0;
+    mSampleBuf.reset();
+    mAacOutputLen = 0;
+    outputFormat.clear();
+}
+void DecoderMp4::clearTrack()
+{
+    mStsz.reset();
+    mStsc.reset();
+    mChunkOffsets.reset();
+    mHandlerType = 0;
+    mHasCodec = false;
+    mNumSamples = mNumStscEntries = mNumChunks = 0;
+}
+StreamEvent DecoderMp4::fillInput(AudioNode::PacketResult& pr)
+{
+    for (;;) {
+        mInput.reset();
+        mInputOfs = 0;
+        auto event = mSrcNode.pullDataProfiled(pr);
+        if (event == kEvtSeek) { // only we request seeks
+            pr.clear();
+            mSeekPending = false;
+            continue;
+        }
+        if (event == kEvtStreamEnd && mSeekPending) {
+            // the source reached the end before it got the seek request, the kEvtSeek follows
+            pr.clear();
+            continue;
+        }
+        if (event) {
+            return event;
+        }
+        if (mSeekPending) { // data from before the seek
+            pr.clear();
+            continue;
+        }
+        mInput.reset((DataPacket*)pr.packet.release());
+        return kNoError;
+    }
+}
+StreamEvent DecoderMp4::readBytes(uint8_t* dest, int len, AudioNode::PacketResult& pr)
+{
+    while (mReadOfs < len) {
+        if (!inputAvail()) {
+            auto event = fillInput(pr);
+            if (event) {
+                return event;
+            }
+            continue;
+        }
+        int n = std::min(len - mReadOfs, inputAvail());
+        memcpy(dest + mReadOfs, mInput->data + mInputOfs, n);
+        consume(n);
+        mReadOfs += n;
+    }
+    mReadOfs = 0;
+    return kNoError;
+}
+StreamEvent DecoderMp4::skipTo(uint64_t pos, AudioNode::PacketResult& pr)
+{
+    if (pos - mStreamPos >= kMinSeekDistance && requestSeek(pos)) {
+        return kNoError;
+    }
+    while (mStreamPos < pos) {
+        if (!inputAvail()) {
+            auto event = fillInput(pr);
+            if (event) {
+                return event;
+            }
+            continue;
+        }
+        consume(std::min<uint64_t>(pos - mStreamPos, inputAvail()));
+    }
+    return kNoError;
+}
+bool DecoderMp4::requestSeek(uint64_t pos)
+{
+    if (pos > UINT32_MAX || !mSrcNode.seekStream(pos)) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Seeking source to offset %llu", (unsigned long long)pos);
+    mInput.reset();
+    mInputOfs = 0;
+    mReadOfs = 0;
+    mStreamPos = pos;
+    mSeekPending = true;
+    return true;
+}
+StreamEvent DecoderMp4::onBoxHeader(int hdrLen)
+{
+    uint64_t start = mStreamPos - hdrLen;
+    uint64_t size = readBE32(mBoxHdr);
+    mBoxType = readBE32(mBoxHdr + 4);
+    if (hdrLen == 16) {
+        size = readBE64(mBoxHdr + 8);
+    }
+    else if (size == 1) {
+        mState = kStateBoxLargeSize;
+        return kNoError;
+    }
+    uint64_t parentEnd = mBoxDepth ? mBoxStack[mBoxDepth - 1].end : UINT64_MAX;
+    if (size == 0) { // extends to the end of the file
+        if (mBoxDepth) {
+            ESP_LOGE(TAG, "Unsupported box size 0 inside a container");
+            return kErrStreamFmt;
+        }
+        size = UINT64_MAX - start;
+    }
+    else if (size < (uint64_t)hdrLen || size > parentEnd - start) {
+        ESP_LOGE(TAG, "Invalid size %llu of box '%.4s'", (unsigned long long)size, mBoxHdr + 4);
+        return kErrStreamFmt;
+    }
+    mBoxEnd = start + size;
+    ESP_LOGD(TAG, "Box '%.4s' at %llu, size %llu", mBoxHdr + 4, (unsigned long long)start, (unsigned long long)size);
+    uint32_t payloadLen = (uint32_t)std::min<uint64_t>(mBoxEnd - mStreamPos, UINT32_MAX);
+    switch (mBoxType) {
+    case fourcc("trak"):
+        if (mHasTrack) { // only the first audio track is played
+            mState = kStateSkipBox;
+            return kNoError;
+        }
+        // fall through
+    case fourcc("moov"):
+    case fourcc("mdia"):
+    case fourcc("minf"):
+    case fourcc("stbl"):
+        if (mBoxDepth >= kMaxBoxDepth) {
+            ESP_LOGE(TAG, "Boxes nested too deep");
+            return kErrStreamFmt;
+        }
+        mBoxStack[mBoxDepth++] = Box{mBoxEnd, mBoxType};
+        mState = kStateBoxHeader;
+        return kNoError;
+    case fourcc("hdlr"):
+    case fourcc("stsd"):
+    case fourcc("stsz"):
+    case fourcc("stsc"):
+    case fourcc("stco"):
+    case fourcc("co64"):
+        if (!mBoxDepth || mBoxStack[0].type != fourcc("moov") || mHasTrack) {
+            mState = kStateSkipBox;
+            return kNoError;
+        }
+        if (payloadLen > ((mBoxType == fourcc("stsd")) ? kMaxStsdSize : kMaxTableSize)) {
+            ESP_LOGE(TAG, "Box '%.4s' too large: %lu bytes", mBoxHdr + 4, (unsigned long)payloadLen);
+            return kErrStreamFmt;
+        }
+        mBoxPayload.reset((uint8_t*)allocTable(payloadLen + 1));
+        if (!mBoxPayload) {
+            ESP_LOGE(TAG, "Out of memory for box '%.4s' of %lu bytes", mBoxHdr + 4, (unsigned long)payloadLen);
+            return kErrDecode;
+        }
+        mBoxPayloadLen = payloadLen;
+        mState = kStateBoxPayload;
+        return kNoError;
+    case fourcc("mdat"):
+        if (!mHasTrack && !mBoxDepth) {
+            // the moov box is at the end of the file, skip the media data to get to it
+            if (size == UINT64_MAX - start || !requestSeek(mBoxEnd)) {
+                ESP_LOGE(TAG, "The index of the file is after the media data, and the source can't seek to it");
+                return kErrStreamFmt;
+            }
+            ESP_LOGI(TAG, "Media data precedes the index, skipping %llu bytes", (unsigned long long)size);
+            mState = kStateBoxHeader;
+            return kNoError;
+        }
+        // fall through
+    default:
+        mState = kStateSkipBox;
+        return kNoError;
+    }
+}
+StreamEvent DecoderMp4::onBoxPayload()
+{
+    auto data = mBoxPayload.get();
+    auto len = mBoxPayloadLen;
+    if (mBoxType == fourcc("hdlr")) {
+        // QuickTime files also have a data handler hdlr in minf
+        if (len >= 12 && mBoxStack[mBoxDepth - 1].type == fourcc("mdia")) {
+            mHandlerType = readBE32(data + 8);
+        }
+        return kNoError;
+    }
+    if (mHandlerType != fourcc("soun")) { // mdia/hdlr precedes minf/stbl
+        return kNoError;
+    }
+    if (len < 8) {
+        ESP_LOGE(TAG, "Box '%.4s' too short", mBoxHdr + 4);
+        return kErrStreamFmt;
+    }
+    uint32_t count = readBE32(data + 4);
+    switch (mBoxType) {
+    case fourcc("stsd"):
+        mHasCodec = parseStsd(data, len);
+        break;
+    case fourcc("stsz"):
+        mFixedSampleSize = count;
+        count = (len >= 12) ? readBE32(data + 8) : 0;
+        if (!mFixedSampleSize && (count > (len - 12) / 4)) {
+            ESP_LOGE(TAG, "Truncated stsz table");
+            return kErrStreamFmt;
+        }
+        mNumSamples = count;
+        mStsz.reset(mBoxPayload.release());
+        break;
+    case fourcc("stsc"):
+        if (count > (len - 8) / 12) {
+            ESP_LOGE(TAG, "Truncated stsc table");
+            return kErrStreamFmt;
+        }
+        mNumStscEntries = count;
+        mStsc.reset(mBoxPayload.release());
+        break;
+    default: { // stco or co64
+        mCo64 = (mBoxType == fourcc("co64"));
+        if (count > (len - 8) / (mCo64 ? 8 : 4)) {
+            ESP_LOGE(TAG, "Truncated chunk offset table");
+            return kErrStreamFmt;
+        }
+        mNumChunks = count;
+        mChunkOffsets.reset(mBoxPayload.release());
+        break;
+    }
+    }
+    return kNoError;
+}
+StreamEvent DecoderMp4::onContainerEnd(uint32_t type)
+{
+    if (type == fourcc("trak")) {
+        if (mHandlerType == fourcc("soun") && mHasCodec && mStsz && mStsc && mChunkOffsets
+            && mNumSamples && mNumStscEntries && mNumChunks) {
+            mHasTrack = true;
+        }
+        else {
+            clearTrack();
+        }
+    }
+    else if (type == fourcc("moov")) {
+        if (!mHasTrack) {
+            ESP_LOGE(TAG, "No supported audio track found");
+            return kErrNoCodec;
+        }
+        if (!initCodec()) {
+            return kErrDecode;
+        }
+        mState = kStateSamples;
+    }
+    return kNoError;
+}
+bool DecoderMp4::parseStsd(const uint8_t* data, int len)
+{
+    // version/flags, entry count, then the first sample entry box
+    if (len < 16 || readBE32(data + 4) < 1) {
+        return false;
+    }
+    data += 8;
+    len -= 8;
+    uint32_t entryLen = readBE32(data);
+    uint32_t format = readBE32(data + 4);
+    if (entryLen < 36 || entryLen > (uint32_t)len) {
+        ESP_LOGE(TAG, "Invalid sample description");
+        return false;
+    }
+    if (format != fourcc("mp4a") && format != fourcc("alac")) {
+        ESP_LOGW(TAG, "Unsupported audio format '%.4s'", data + 4);
+        return false;
+    }
+    // AudioSampleEntry: 6 reserved, data reference index, version, revision, vendor, channel count,
+    // sample size, compression id, packet size, sample rate, then optional child boxes
+    int version = readBE16(data + 16);
+    int numChannels = readBE16(data + 24);
+    int ofs = 36;
+    if (version == 1) { // QuickTime sound description v1
+        ofs += 16;
+    }
+    else if (version == 2) {
+        ofs += 36;
+    }
+    if (ofs > (int)entryLen) {
+        return false;
+    }
+    mCodecType = (format == fourcc("alac")) ? Codec::kCodecAlac : Codec::kCodecAac;
+    return parseSampleEntry(data + ofs, entryLen - ofs, format, numChannels);
+}
+bool DecoderMp4::parseSampleEntry(const uint8_t* data, int len, uint32_t format, int numChannels)
+{
+    while (len >= 8) {
+        uint32_t size = readBE32(data);
+        uint32_t type = readBE32(data + 4);
+        if (size < 8 || size > (uint32_t)len) {
+            break;
+        }
+        if (type == fourcc("esds") && format == fourcc("mp4a")) {
+            mNumChannels = numChannels;
+            return parseEsds(data + 8, size - 8);
+        }
+        else if (type == fourcc("alac") && format == fourcc("alac")) {
+            if (size < 12 + AlacDecoder::kConfigSize) {
+                break;
+            }
+            memcpy(mAlacConfig, data + 12, AlacDecoder::kConfigSize); // after version/flags
+            return true;
+        }
+        else if (type == fourcc("wave")) { // QuickTime files wrap the codec config box
+            return parseSampleEntry(data + 8, size - 8, format, numChannels);
+        }
+        data += size;
+        len -= size;
+    }
+    ESP_LOGE(TAG, "Codec config not found in sample description");
+    return false;
+}
+bool DecoderMp4::parseEsds(const uint8_t* data, int len)
+{
+    auto end = data + len;
+    auto ptr = data + 4; // version/flags
+    while (ptr + 2 <= end) {
+        int tag = *ptr++;
+        uint32_t descLen = 0;
+        for (int i = 0; i < 4 && ptr < end; i++) {
+            uint8_t byte = *ptr++;
+            descLen = (descLen << 7) | (byte & 0x7f);
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        if (descLen > end - ptr) {
+            break;
+        }
+        if (tag == 0x03) { // ES_Descriptor, the other descriptors are nested in it
+            if (descLen < 3) {
+                break;
+            }
+            uint8_t flags = ptr[2];
+            ptr += 3;
+            if (flags & 0x80) { // dependsOn_ES_ID
+                ptr += 2;
+            }
+            if ((flags & 0x40) && ptr < end) { // URL
+                ptr += 1 + *ptr;
+            }
+            if (flags & 0x20) { // OCR_ES_Id
+                ptr += 2;
+            }
+        }
+        else if (tag == 0x04) { // DecoderConfigDescriptor
+            if (descLen < 13) {
+                break;
+            }
+            uint8_t objType = ptr[0];
+            if (objType != 0x40 && objType != 0x66 && objType != 0x67) { // MPEG-4 audio, MPEG-2 AAC Main/LC
+                ESP_LOGE(TAG, "Unsupported object type 0x%x in mp4a track", objType);
+                return false;
+            }
+            ptr += 13;
+        }
+        else if (tag == 0x05) { // DecoderSpecificInfo, i.e. the AudioSpecificConfig
+            return parseAudioSpecificConfig(ptr, descLen);
+        }
+        else {
+            ptr += descLen;
+        }
+    }
+    ESP_LOGE(TAG, "AudioSpecificConfig not found");
+    return false;
+}
+bool DecoderMp4::parseAudioSpecificConfig(const uint8_t* data, int len)
+{
+    static const uint32_t sampleRates[] = {
+        96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+    };
+    BitReader br(data, len);
+    auto readAot = [&br]() -> int {
+        int aot = br.read(5);
+        return (aot == 31) ? 32 + br.read(6) : aot;
+    };
+    auto readRate = [&br]() -> uint32_t {
+        int idx = br.read(4);
+        if (idx == 15) {
+            return br.read(24);
+        }
+        return (idx < (int)(sizeof(sampleRates) / sizeof(sampleRates[0]))) ? sampleRates[idx] : 0;
+    };
+    int aot = readAot();
+    uint32_t sampleRate = readRate();
+    int chanConfig = br.read(4);
+    if (aot == 5 || aot == 29) { // explicit SBR/PS signalling. Helix detects SBR from the raw blocks
+        readRate();
+        aot = readAot();
+    }
+    if (br.overrun()) {
+        ESP_LOGE(TAG, "Truncated AudioSpecificConfig");
+        return false;
+    }
+    if (aot != 2) {
+        ESP_LOGE(TAG, "Unsupported AAC object type %d, only LC is supported", aot);
+        return false;
+    }
+    if (chanConfig) {
+        mNumChannels = chanConfig;
+    }
+    if (!sampleRate || mNumChannels < 1 || mNumChannels > 2) {
+        ESP_LOGE(TAG, "Unsupported AAC config: %d channels, %lu Hz", mNumChannels, (unsigned long)sampleRate);
+        return false;
+    }
+    mSampleRate = sampleRate;
+    mAacProfile = aot - 1;
+    return true;
+}
+bool DecoderMp4::initCodec()
+{
+    mMaxSampleSize = mFixedSampleSize;
+    if (!mFixedSampleSize) {
+        for (uint32_t i = 0; i < mNumSamples; i++) {
+            mMaxSampleSize = std::max(mMaxSampleSize, sampleSize(i));
+        }
+    }
+    if (!mMaxSampleSize || mMaxSampleSize > kMaxSampleSize) {
+        ESP_LOGE(TAG, "Invalid max sample size %lu", (unsigned long)mMaxSampleSize);
+        return false;
+    }
+    mSampleBuf.reset((uint8_t*)malloc(mMaxSampleSize));
+    if (!mSampleBuf) {
+        ESP_LOGE(TAG, "Out of memory for sample buffer");
+        return false;
+    }
+    ESP_LOGI(TAG, "Audio track: %s, %lu samples in %lu chunks, max sample size %lu",
+        Codec(mCodecType, Codec::kTransportMpeg).toString(), (unsigned long)mNumSamples, (unsigned long)mNumChunks,
+        (unsigned long)mMaxSampleSize);
+    if (mCodecType == Codec::kCodecAlac) {
+        mAlac.reset(new AlacDecoder());
+        if (!mAlac->init(mAlacConfig, sizeof(mAlacConfig))) {
+            return false;
+        }
+        auto& cfg = mAlac->config();
+        int bps = (cfg.bitDepth == 20) ? 24 : cfg.bitDepth; // 20-bit samples are output left-aligned in 24 bits
+        outputFormat = StreamFormat(Codec(Codec::kCodecAlac, Codec::kTransportMpeg), cfg.sampleRate, bps, cfg.numChannels);
+        mParent.codecOnFormatDetected(outputFormat, cfg.bitDepth, kAlacOutputSplitSamples * cfg.numChannels * 4);
+        return true;
+    }
+    mAacDecoder = AACInitDecoder();
+    if (!mAacDecoder) {
+        ESP_LOGE(TAG, "Out of memory creating AAC decoder");
+        return false;
+    }
+    AACFrameInfo info = {};
+    info.nChans = mNumChannels;
+    info.sampRateCore = mSampleRate;
+    info.profile = mAacProfile;
+    auto err = AACSetRawBlockParams(mAacDecoder, 0, &info);
+    if (err) {
+        ESP_LOGE(TAG, "Error %d configuring AAC decoder", err);
+        return false;
+    }
+    return true;
+}
+uint32_t DecoderMp4::sampleSize(uint32_t idx) const
+{
+    return mFixedSampleSize ? mFixedSampleSize : readBE32(mStsz.get() + 12 + idx * 4);
+}
+uint64_t DecoderMp4::chunkOffset(uint32_t idx) const
+{
+    auto entries = mChunkOffsets.get() + 8;
+    return mCo64 ? readBE64(entries + idx * 8) : readBE32(entries + idx * 4);
+}
+bool DecoderMp4::nextSample(uint64_t& ofs, uint32_t& size)
+{
+    if (mSampleIdx >= mNumSamples) {
+        return false;
+    }
+    auto stsc = mStsc.get() + 8; // entries of first_chunk (1-based), samples_per_chunk, sample_description_index
+    while (!mChunkSamplesLeft) {
+        if (mChunkIdx >= mNumChunks) {
+            return false;
+        }
+        while (mStscIdx + 1 < mNumStscEntries && readBE32(stsc + (mStscIdx + 1) * 12) <= mChunkIdx + 1) {
+            mStscIdx++;
+        }
+        mChunkSamplesLeft = readBE32(stsc + mStscIdx * 12 + 4);
+        mSampleOfs = chunkOffset(mChunkIdx++);
+    }
+    ofs = mSampleOfs;
+    size = sampleSize(mSampleIdx);
+    return true;
+}
+StreamEvent DecoderMp4::decodeSamples(AudioNode::PacketResult& pr)
+{
+    for (;;) {
+        uint64_t ofs;
+        uint32_t size;
+        if (!nextSample(ofs, size)) {
+            ESP_LOGI(TAG, "All samples decoded");
+            mState = kStateDrain;
+            return kNoError;
+        }
+        if (!mReadOfs && ofs != mStreamPos) {
+            if (ofs < mStreamPos) {
+                if (!requestSeek(ofs)) {
+                    ESP_LOGE(TAG, "Sample at %llu is before the current position, and the source can't seek to it",
+                        (unsigned long long)ofs);
+                    return kErrStreamFmt;
+                }
+            }
+            else {
+                auto event = skipTo(ofs, pr);
+                if (event) {
+                    return event;
+                }
+            }
+        }
+        const uint8_t* data;
+        if (!mReadOfs && inputAvail() >= (int)size) { // the whole sample is in the current packet
+            data = (const uint8_t*)mInput->data + mInputOfs;
+            consume(size);
+        }
+        else {
+            if (size > mMaxSampleSize) {
+                return kErrStreamFmt;
+            }
+            auto event = readBytes(mSampleBuf.get(), size, pr);
+            if (event) {
+                return event;
+            }
+            data = mSampleBuf.get();
+        }
+        mSampleIdx++;
+        mChunkSamplesLeft--;
+        mSampleOfs += size;
+        bool hasOutput = false;
+        auto err = (mCodecType == Codec::kCodecAlac) ? decodeAlac(data, size, hasOutput) : decodeAac(data, size, hasOutput);
+        if (err || hasOutput) {
+            return err;
+        }
+    }
+}
+StreamEvent DecoderMp4::decodeAac(const uint8_t* data, int len, bool& hasOutput)
+{
+    DataPacket::unique_ptr output(DataPacket::create(mAacOutputLen ? mAacOutputLen * 2 : kAacOutputMaxSize,
+        StreamPacket::kHasSpaceFor32Bit));
+    auto ptr = const_cast<uint8_t*>(data);
+    int bytesLeft = len;
+    auto err = AACDecode(mAacDecoder, &ptr, &bytesLeft, (int16_t*)output->data);
+    if (err) {
+        ESP_LOGW(TAG, "Decode error %d, skipping sample %lu", err, (unsigned long)(mSampleIdx - 1));
+        return kNoError;
+    }
+    if (!mAacOutputLen) {
+        AACFrameInfo info;
+        AACGetLastFrameInfo(mAacDecoder, &info);
+        outputFormat = StreamFormat(Codec(Codec::kCodecAac, Codec::kTransportMpeg), info.sampRateOut, 16, info.nChans);
+        bool isSbr = (info.sampRateOut != info.sampRateCore);
+        if (isSbr) {
+            outputFormat.codec().mode = Codec::kAacModeSbr;
+        }
+        mAacOutputLen = info.outputSamps * sizeof(int16_t);
+        ESP_LOGW(TAG, "AAC%s 16-bit %s, %d Hz, %d samples/frame", isSbr ? " SBR" : "",
+            info.nChans == 2 ? "stereo" : "mono", info.sampRateOut, info.outputSamps);
+        mParent.codecOnFormatDetected(outputFormat, 16, mAacOutputLen * 2);
+    }
+    hasOutput = true;
+    if (mAacOutputLen <= kAacOutputSplitLen) {
+        output->dataLen = mAacOutputLen;
+        return mParent.codecPostOutput(output.release()) ? kNoError : kErrStreamStopped;
+    }
+    output->dataLen = kAacOutputSplitLen;
+    auto out2len = mAacOutputLen - kAacOutputSplitLen;
+    DataPacket::unique_ptr output2(DataPacket::create<true>(out2len * 2, DataPacket::kHasSpaceFor32Bit));
+    memcpy(output2->data, output->data + kAacOutputSplitLen, out2len);
+    output2->dataLen = out2len;
+    bool ok = mParent.codecPostOutput(output.release()) && mParent.codecPostOutput(output2.release());
+    return ok ? kNoError : kErrStreamStopped;
+}
+template <typename T, int Shift>
+bool DecoderMp4::outputAlacSamples(int nSamples)
+{
+    int numChans = mAlac->config().numChannels;
+    auto left = mAlac->samples(0);
+    auto right = mAlac->samples(numChans - 1);
+    for (int start = 0; start < nSamples; start += kAlacOutputSplitSamples) {
+        int count = std::min(nSamples - start, (int)kAlacOutputSplitSamples);
+        int len = count * numChans * sizeof(T);
+        DataPacket::unique_ptr pkt(DataPacket::create<true>(len * (4 / sizeof(T)), StreamPacket::kHasSpaceFor32Bit));
+        pkt->dataLen = len;
+        auto out = (T*)pkt->data;
+        if (numChans == 2) {
+            for (int i = start; i < start + count; i++) {
+                *out++ = left[i] << Shift;
+                *out++ = right[i] << Shift;
+            }
+        }
+        else {
+            for (int i = start; i < start + count; i++) {
+                *out++ = left[i] << Shift;
+            }
+        }
+        if (!mParent.codecPostOutput(pkt.release())) {
+            return false;
+        }
+    }
+    return true;
+}
+StreamEvent DecoderMp4::decodeAlac(const uint8_t* data, int len, bool& hasOutput)
+{
+    int nSamples = mAlac->decode(data, len);
+    if (nSamples < 0) {
+        ESP_LOGW(TAG, "Decode error %d, skipping sample %lu", nSamples, (unsigned long)(mSampleIdx - 1));
+        return kNoError;
+    }
+    hasOutput = true;
+    bool ok;
+    switch (mAlac->config().bitDepth) {
+    case 16:
+        ok = outputAlacSamples<int16_t, 0>(nSamples);
+        break;
+    case 20:
+        ok = outputAlacSamples<int32_t, 4>(nSamples);
+        break;
+    default:
+        ok = outputAlacSamples<int32_t, 0>(nSamples);
+        break;
+    }
+    return ok ? kNoError : kErrStreamStopped;
+}
+StreamEvent DecoderMp4::decode(AudioNode::PacketResult& pr)
+{
+    for (;;) {
+        switch (mState) {
+        case kStateBoxHeader: {
+            if (mBoxDepth && mStreamPos >= mBoxStack[mBoxDepth - 1].end) {
+                auto err = onContainerEnd(mBoxStack[--mBoxDepth].type);
+                if (err) {
+                    return err;
+                }
+                continue;
+            }
+            auto event = readBytes(mBoxHdr, 8, pr);
+            if (event) {
+                return event;
+            }
+            auto err = onBoxHeader(8);
+            if (err) {
+                return err;
+            }
+            break;
+        }
+        case kStateBoxLargeSize: {
+            auto event = readBytes(mBoxHdr + 8, 8, pr);
+            if (event) {
+                return event;
+            }
+            auto err = onBoxHeader(16);
+            if (err) {
+                return err;
+            }
+            break;
+        }
+        case kStateBoxPayload: {
+            auto event = readBytes(mBoxPayload.get(), mBoxPayloadLen, pr);
+            if (event) {
+                return event;
+            }
+            mState = kStateBoxHeader;
+            auto err = onBoxPayload();
+            mBoxPayload.reset();
+            if (err) {
+                return err;
+            }
+            break;
+        }
+        case kStateSkipBox: {
+            auto event = skipTo(mBoxEnd, pr);
+            if (event) {
+                return event;
+            }
+            mState = kStateBoxHeader;
+            break;
+        }
+        case kStateSamples:
+            return decodeSamples(pr);
+        default: { // kStateDrain: skip any data after the last sample, until the end of the stream
+            auto event = fillInput(pr);
+            if (event) {
+                return event;
+            }
+            break;
+        }
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef DECODER_MP4_HPP
+#define DECODER_MP4_HPP
+
+#include "decoderNode.hpp"
+#include "alacDecoder.hpp"
+
+typedef void *HAACDecoder;
+/** Streaming MP4 (ISO-BMFF) demuxer, for progressive .m4a files with AAC or ALAC audio.
+ * The sample tables of the first audio track are read from the moov box, and each sample is
+ * then read from its offset in the file and passed to the codec, without any sync word scanning.
+ * If the moov box is after the media data, the source is asked to seek to it, and back
+ * to the samples, via AudioNode::seekStream()
+ */
+class DecoderMp4: public Decoder
+{
+protected:
+    enum {
+        kMaxBoxDepth = 8, kMaxTableSize = 1024 * 1024, kMaxStsdSize = 4096, kMaxSampleSize = 256 * 1024,
+        kMinSeekDistance = 256 * 1024, // forward skips shorter than this read through the data instead of seeking
+        kAacOutputMaxSize = 2 * 4 * 2048, // with SBR
+        kAacOutputSplitLen = 2048, kAlacOutputSplitSamples = 1024
+    };
+    enum State: uint8_t {
+        kStateBoxHeader, kStateBoxLargeSize, kStateBoxPayload, kStateSkipBox, kStateSamples, kStateDrain
+    };
+    struct Box {
+        uint64_t end;
+        uint32_t type;
+    };
+    State mState = kStateBoxHeader;
+    Codec::Type mCodecType = Codec::kCodecAac;
+    // input
+    DataPacket::unique_ptr mInput;
+    int mInputOfs = 0;
+    uint64_t mStreamPos = 0; // file offset of the next input byte
+    bool mSeekPending = false; // discarding input until the kEvtSeek from the source
+    int mReadOfs = 0; // progress of a readBytes() that was interrupted by an event
+    // box parsing
+    Box mBoxStack[kMaxBoxDepth];
+    int mBoxDepth = 0;
+    uint8_t mBoxHdr[16];
+    uint32_t mBoxType = 0;
+    uint64_t mBoxEnd = 0;
+    unique_ptr_mfree<uint8_t> mBoxPayload;
+    uint32_t mBoxPayloadLen = 0;
+    uint32_t mHandlerType = 0; // of the track being parsed
+    bool mHasTrack = false; // the sample tables of an audio track with a supported codec have been read
+    bool mHasCodec = false; // the track being parsed has a supported codec
+    // sample tables of the audio track, the payloads of the boxes, after the version and flags
+    unique_ptr_mfree<uint8_t> mStsz;
+    unique_ptr_mfree<uint8_t> mStsc;
+    unique_ptr_mfree<uint8_t> mChunkOffsets;
+    bool mCo64 = false;
+    uint32_t mFixedSampleSize = 0;
+    uint32_t mNumSamples = 0;
+    uint32_t mNumStscEntries = 0;
+    uint32_t mNumChunks = 0;
+    uint32_t mMaxSampleSize = 0;
+    // sample iteration
+    uint32_t mSampleIdx = 0;
+    uint32_t mChunkIdx = 0; // next chunk
+    uint32_t mStscIdx = 0;
+    uint32_t mChunkSamplesLeft = 0;
+    uint64_t mSampleOfs = 0;
+    unique_ptr_mfree<uint8_t> mSampleBuf;
+    // codecs
+    HAACDecoder mAacDecoder = nullptr;
+    uint8_t mAacProfile = 0;
+    uint8_t mNumChannels = 0;
+    uint32_t mSampleRate = 0;
+    int mAacOutputLen = 0;
+    std::unique_ptr<AlacDecoder> mAlac;
+    uint8_t mAlacConfig[AlacDecoder::kConfigSize];
+
+    int inputAvail() const { return mInput ? mInput->dataLen - mInputOfs : 0; }
+    void consume(int len) { mInputOfs += len; mStreamPos += len; }
+    StreamEvent fillInput(AudioNode::PacketResult& pr);
+    StreamEvent readBytes(uint8_t* dest, int len, AudioNode::PacketResult& pr);
+    StreamEvent skipTo(uint64_t pos, AudioNode::PacketResult& pr);
+    bool requestSeek(uint64_t pos);
+    StreamEvent onBoxHeader(int hdrLen);
+    StreamEvent onBoxPayload();
+    StreamEvent onContainerEnd(uint32_t type);
+    bool parseStsd(const uint8_t* data, int len);
+    bool parseSampleEntry(const uint8_t* data, int len, uint32_t format, int numChannels);
+    bool parseEsds(const uint8_t* data, int len);
+    bool parseAudioSpecificConfig(const uint8_t* data, int len);
+    void clearTrack();
+    bool initCodec();
+    uint32_t sampleSize(uint32_t idx) const;
+    uint64_t chunkOffset(uint32_t idx) const;
+    bool nextSample(uint64_t& ofs, uint32_t& size);
+    StreamEvent decodeSamples(AudioNode::PacketResult& pr);
+    StreamEvent decodeAac(const uint8_t* data, int len, bool& hasOutput);
+    StreamEvent decodeAlac(const uint8_t* data, int len, bool& hasOutput);
+    template <typename T, int Shift>
+    bool outputAlacSamples(int nSamples);
+public:
+    virtual Codec::Type type() const { return mCodecType; }
+    DecoderMp4(DecoderNode& parent, AudioNode& src);
+    ~DecoderMp4();
+    virtual StreamEvent decode(AudioNode::PacketResult& pr);
+    virtual void reset() override;
+};
+
+#endif
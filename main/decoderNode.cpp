@@ -2,10 +2,14 @@
 #include "decoderMp3.hpp"
 #include "decoderAac.hpp"
 #include "decoderFlac.hpp"
+#include "decoderFlacMt.hpp"
 #include "decoderWav.hpp"
 #include "decoderVorbis.hpp"
+#include "decoderOpus.hpp"
+#include "decoderMp4.hpp"
 #include "detectorOgg.hpp"
 #include "streamPackets.hpp"
+#include <buffer.hpp>
 
 bool DecoderNode::createDecoder(StreamFormat fmt)
 {
@@ -15,10 +19,23 @@ bool DecoderNode::createDecoder(StreamFormat fmt)
         mDecoder = new DecoderMp3(*this, *mPrev);
         break;
     case Codec::kCodecAac:
-        mDecoder = new DecoderAac(*this, *mPrev);
+        if (fmt.codec().transport == Codec::kTransportMpeg) { // in an MP4 container
+            mDecoder = new DecoderMp4(*this, *mPrev);
+        }
+        else {
+            mDecoder = new DecoderAac(*this, *mPrev);
+        }
+        break;
+    case Codec::kCodecAlac:
+        mDecoder = new DecoderMp4(*this, *mPrev);
         break;
     case Codec::kCodecFlac:
-        mDecoder = new DecoderFlac(*this, *mPrev, fmt.codec().transport == Codec::kTransportOgg);
+        if (fmt.codec().transport == Codec::kTransportOgg || mFlacParallel == kFlacParallelOff) {
+            mDecoder = new DecoderFlac(*this, *mPrev, fmt.codec().transport == Codec::kTransportOgg);
+        }
+        else {
+            mDecoder = new DecoderFlacMt(*this, *mPrev, mFlacParallel == kFlacParallelAlways);
+        }
         break;
     case Codec::kCodecWav:
         mDecoder = new DecoderWav(*this, *mPrev, StreamFormat(Codec::kCodecWav));
@@ -29,12 +46,17 @@ bool DecoderNode::createDecoder(StreamFormat fmt)
     case Codec::kCodecVorbis:
         mDecoder = new DecoderVorbis(*this, *mPrev);
         break;
+    case Codec::kCodecOpus:
+        mDecoder = new DecoderOpus(*this, *mPrev);
+        break;
 
     default:
         return false;
     }
+    mHeapFreeBefore = freeBefore;
+    mHeapPeak = freeBefore - heapFreeTotal();
     ESP_LOGI(mTag, "\e[34mCreated %s decoder, approx %ld bytes of RAM consumed (%zu free internal)",
-        fmt.codec().toString(), freeBefore - heapFreeTotal(), heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+        fmt.codec().toString(), mHeapPeak, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
     plSendEvent(kEventCodecChange, fmt.codec().asNumCode());
     return true;
 }
@@ -47,8 +69,9 @@ void DecoderNode::deleteDecoder()
     auto freeBefore = heapFreeTotal();
     delete mDecoder;
     mDecoder = nullptr;
-    ESP_LOGI(mTag, "\e[34mDeleted %s decoder freed %ld bytes",
-        Codec::numCodeToStr(codec), heapFreeTotal() - freeBefore);
+    poolReserveOutPackets(0); // the blocks are freed by PacketPool::trim() when the pipeline stops
+    ESP_LOGI(mTag, "\e[34mDeleted %s decoder freed %ld bytes, min free stack so far: %ld",
+        Codec::numCodeToStr(codec), heapFreeTotal() - freeBefore, (long)stackFreeMin());
 }
 StreamEvent DecoderNode::detectCodecCreateDecoder(NewStreamEvent* startPkt)
 {
@@ -107,7 +130,7 @@ StreamEvent DecoderNode::decode()
     AudioNode::PacketResult pr;
     if (!mDecoder) {
         StreamEvent evt;
-        while ((evt = mPrev->pullData(pr)) == kEvtData) {
+        while ((evt = mPrev->pullDataProfiled(pr)) == kEvtData) {
             ESP_LOGW(mTag, "Detect codec: Discarding %d bytes of stream data", pr.dataPacket().dataLen);
         }
         if (evt != kEvtStreamChanged) {
@@ -120,7 +143,23 @@ StreamEvent DecoderNode::decode()
         }
     }
     myassert(mDecoder);
-    auto evt = mDecoder->decode(pr);
+    StreamEvent evt;
+    {
+        mOutputBytes = mOutputWaitUs = 0;
+        auto tsStart = esp_timer_get_time();
+        evt = mDecoder->decode(pr);
+        uint32_t elapsed = esp_timer_get_time() - tsStart;
+        auto& fmt = mDecoder->outputFormat;
+        // samples in output packets are 16-bit, or left-aligned in 32-bit words
+        int frameSize = fmt.asNumCode() ? fmt.numChannels() * (fmt.bitsPerSample() > 16 ? 4 : 2) : 0;
+        mDecodeStats.add(elapsed > mOutputWaitUs ? elapsed - mOutputWaitUs : 0, mOutputBytes,
+            frameSize ? mOutputBytes / frameSize : 0);
+        // some codecs allocate their buffers only when they see the first frame
+        auto heapUsed = mHeapFreeBefore - heapFreeTotal();
+        if (heapUsed > mHeapPeak) {
+            mHeapPeak = heapUsed;
+        }
+    }
     if (evt) {
         if (evt < 0) {
             deleteDecoder();
@@ -140,13 +179,43 @@ StreamEvent DecoderNode::decode()
 }
 StreamEvent DecoderNode::pullData(PacketResult &pr)
 {
+    mQueueTrace.sample(mRingBuf.size(), mRingBuf.dataSize());
     auto pkt = mRingBuf.popFront();
     if (!pkt) {
         return kErrStreamStopped;
     }
     return pr.set(pkt);
 }
-bool DecoderNode::codecOnFormatDetected(StreamFormat fmt, uint8_t sourceBps)
+StreamEvent DecoderNode::pullBatch(PacketResult& pr, PacketBatch& batch, int maxPackets)
+{
+    mQueueTrace.sample(mRingBuf.size(), mRingBuf.dataSize());
+    StreamPacket* pkts[PacketBatch::kMaxPackets];
+    int n = mRingBuf.popBatch(pkts, std::min<int>(maxPackets, PacketBatch::kMaxPackets));
+    if (!n) {
+        return kErrStreamStopped;
+    }
+    if (pkts[0]->type != kEvtData) {
+        return pr.set(pkts[0]);
+    }
+    for (int i = 0; i < n; i++) {
+        batch.add(static_cast<DataPacket*>(pkts[i]));
+    }
+    return kEvtData;
+}
+void DecoderNode::poolReserveOutPackets(int bufSize)
+{
+    // Preallocate enough output packets to fill the queue without touching the heap. Beyond that,
+    // the pool grows to the peak number of packets in the pipeline by itself
+    int count = bufSize ? (int)kRingQueueLen : 0;
+    if (bufSize == mPoolRsvdSize && count == mPoolRsvdCount) {
+        return;
+    }
+    PacketPool::unreserve(mPoolRsvdSize, mPoolRsvdCount);
+    PacketPool::reserve(bufSize, count);
+    mPoolRsvdSize = bufSize;
+    mPoolRsvdCount = count;
+}
+bool DecoderNode::codecOnFormatDetected(StreamFormat fmt, uint8_t sourceBps, int outBufSize)
 {
     StreamFormat sourceFmt(fmt);
     sourceFmt.setBitsPerSample(sourceBps);
@@ -154,11 +223,41 @@ bool DecoderNode::codecOnFormatDetected(StreamFormat fmt, uint8_t sourceBps)
     myassert(mNewStreamPkt);
     mNewStreamPkt->fmt = fmt;
     mNewStreamPkt->sourceBps = sourceBps;
+    // samples wider than 16 bits are output as 32-bit words
+    mOutFrameSize = fmt.numChannels() * (fmt.bitsPerSample() <= 16 ? 2 : 4);
+    mNextPts = (uint64_t)mNewStreamPkt->seekTime * fmt.sampleRate() / 1000;
+    poolReserveOutPackets(outBufSize);
     return mRingBuf.pushBack(mNewStreamPkt.release());
 }
 bool DecoderNode::codecPostOutput(StreamPacket *pkt)
 {
-    return mRingBuf.pushBack(pkt);
+    if (pkt->type == kEvtData) {
+        auto& dataPkt = *static_cast<DataPacket*>(pkt);
+        mOutputBytes += dataPkt.dataLen;
+        myassert(mOutFrameSize);
+        dataPkt.pts = mNextPts;
+        mNextPts += dataPkt.dataLen / mOutFrameSize;
+    }
+    if (!mRingBuf.full()) {
+        return mRingBuf.pushBack(pkt);
+    }
+    auto tsStart = esp_timer_get_time();
+    bool ok = mRingBuf.pushBack(pkt);
+    mOutputWaitUs += esp_timer_get_time() - tsStart;
+    return ok;
+}
+void DecoderNode::perfExtraToJson(DynBuffer& buf)
+{
+    buf.printf(",\"decode\":");
+    mDecodeStats.toJson(buf);
+    buf.printf(",\"queue\":");
+    mQueueTrace.toJson(buf);
+    buf.printf(",\"heap\":%ld,\"stackFree\":%ld", (long)mHeapPeak, (long)stackFreeMin());
+}
+int32_t DecoderNode::stackFreeMin()
+{
+    auto task = Task::handle();
+    return task ? uxTaskGetStackHighWaterMark((TaskHandle_t)task) : -1;
 }
 int32_t DecoderNode::heapFreeTotal()
 {
@@ -1,7 +1,7 @@
 #ifndef DECODER_NODE_HPP
 #define DECODER_NODE_HPP
 #include "audioNode.hpp"
-#include "streamRingQueue.hpp"
+#include "spscStreamQueue.hpp"
 
 class DecoderNode;
 class Decoder
@@ -29,29 +29,57 @@ public:
 class DecoderNode: public AudioNodeWithTask
 {
 protected:
+    // The output sink is woken as soon as a packet is available, the decoder only when a quarter of the queue is free
+    enum { kRingQueueLen = 24, kReadWakeLevel = 1, kWriteWakeLevel = kRingQueueLen / 4 };
     Decoder* mDecoder = nullptr;
     NewStreamEvent::unique_ptr mNewStreamPkt;
-    StreamRingQueue<24> mRingBuf;
+    SpscStreamQueue<kRingQueueLen> mRingBuf; // single producer (this node's task), single consumer (next node)
+    LatencyStats mDecodeStats; // excludes time blocked on the output queue
+    QueueDepthTrace mQueueTrace;
+    uint32_t mOutputBytes = 0; // output of the current decode() call
+    uint32_t mOutputWaitUs = 0;
+    int32_t mHeapFreeBefore = 0; // total free heap before the current decoder was created
+    int32_t mHeapPeak = 0; // peak heap usage of the current decoder, sampled after each decode() call
+    uint32_t mNextPts = 0; // timestamp of the next output data packet
+    uint8_t mOutFrameSize = 0; // bytes per output sample frame, for timestamping
+    uint8_t mFlacParallel = kFlacParallelHiRes;
+    int16_t mPoolRsvdSize = 0; // output packet pool reservation currently held by us
+    int16_t mPoolRsvdCount = 0;
     // pr in case there is a stream event that needs to be propagated
     StreamEvent detectCodecCreateDecoder(NewStreamEvent* startPkt);
     bool createDecoder(StreamFormat fmt);
     StreamEvent decode();
     static int32_t heapFreeTotal(); // used to  calculate memory usage for codecs
+    int32_t stackFreeMin(); // high-water mark of the node's task stack, -1 if the task is not running
     void deleteDecoder();
+    void poolReserveOutPackets(int bufSize);
 public:
     enum { kEventCodecChange = AudioNode::kEventLast + 1 };
-    enum { kStackSize = 10000, kPrio = 20, kCore = ALT_TASK_PIN(1, 0) };
-    DecoderNode(IAudioPipeline& parent): AudioNodeWithTask(parent, "decoder", true, kStackSize, kPrio, kCore){}
+    // libopus allocates its CELT/SILK scratch arrays on the stack (VAR_ARRAYS), the other codecs need
+    // much less. The stack is in PSRAM. The minimum free stack is reported in /perf as stackFree
+    enum { kStackSize = 24576, kPrio = 20, kCore = ALT_TASK_PIN(1, 0) };
+    // Whether native FLAC streams are decoded on worker tasks on both cores, see DecoderFlacMt
+    enum FlacParallelMode: uint8_t { kFlacParallelOff, kFlacParallelHiRes, kFlacParallelAlways };
+    DecoderNode(IAudioPipeline& parent): AudioNodeWithTask(parent, "decoder", true, kStackSize, kPrio, kCore)
+    {
+        mRingBuf.setWakeLevels(kReadWakeLevel, kWriteWakeLevel);
+    }
     virtual Type type() const { return kTypeDecoder; }
+    void setFlacParallel(uint8_t mode) { mFlacParallel = mode; } // takes effect with the next stream
     virtual void nodeThreadFunc();
     virtual StreamEvent pullData(PacketResult &pr);
+    virtual StreamEvent pullBatch(PacketResult& pr, PacketBatch& batch, int maxPackets) override;
     virtual ~DecoderNode() { deleteDecoder(); terminate(true); }
     virtual void reset() override { deleteDecoder(); }
     virtual void onStopRequest() { mRingBuf.setStopSignal(); }
     virtual void onStopped() { mRingBuf.clear(); deleteDecoder(); }
+    virtual void perfExtraToJson(DynBuffer& buf) override;
+    virtual void perfReset() override { AudioNode::perfReset(); mDecodeStats.requestReset(); }
     using AudioNode::plSendEvent;
     StreamEvent forwardEvent(AudioNode::PacketResult& pr); // currently used externally only by FLAC
-    bool codecOnFormatDetected(StreamFormat fmt, uint8_t sourceBps); // called by codec when it know the sample format, and before posting any data packet
+    // called by codec when it know the sample format, and before posting any data packet. outBufSize is the
+    // buffer size of its output packets, for preallocating them in the packet pool, 0 if not known
+    bool codecOnFormatDetected(StreamFormat fmt, uint8_t sourceBps, int outBufSize = 0);
     bool codecPostOutput(StreamPacket* pkt); // called by codec to output a decoded or title change packet
     friend class Decoder;
 };
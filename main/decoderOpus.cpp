@@ -0,0 +1,274 @@
+#include "decoderOpus.hpp"
+#include <esp_heap_caps.h>
+
+static const char* TAG = "opus";
+
+static uint32_t readLE32(const uint8_t* ptr)
+{
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | (ptr[3] << 24);
+}
+DecoderOpus::DecoderOpus(DecoderNode& parent, AudioNode& src)
+: Decoder(parent, src), mOy{}, mOs{}, mOg{}, mOp{} // zero-initialize all
+{
+    ogg_sync_init(&mOy);
+}
+DecoderOpus::~DecoderOpus()
+{
+    reset();
+    ogg_sync_clear(&mOy);
+}
+void DecoderOpus::destroyDecoder()
+{
+    if (mDecoder) {
+        opus_decoder_destroy(mDecoder);
+        mDecoder = nullptr;
+    }
+    mPcmBuf.reset();
+}
+void DecoderOpus::reset()
+{
+    destroyDecoder();
+    if (mHasStream) {
+        ogg_stream_clear(&mOs);
+        mHasStream = false;
+    }
+    ogg_sync_reset(&mOy);
+    mState = kStateNeedHead;
+    mSamplePos = 0;
+    mSkipSamples = 0;
+    mChannels = 0;
+    outputFormat.clear();
+}
+StreamEvent DecoderOpus::pageIn()
+{
+    auto serial = ogg_page_serialno(&mOg);
+    if (ogg_page_bos(&mOg)) {
+        // start of the first, or of a chained logical stream. Its headers follow
+        if (mHasStream) {
+            ogg_stream_reset_serialno(&mOs, serial);
+        }
+        else {
+            if (ogg_stream_init(&mOs, serial)) {
+                ESP_LOGE(TAG, "ogg_stream_init() failed");
+                return kErrDecode;
+            }
+            mHasStream = true;
+        }
+        mState = kStateNeedHead;
+    }
+    else if (!mHasStream || serial != mOs.serialno) {
+        ESP_LOGD(TAG, "Skipping page of unknown logical stream %d", serial);
+        return kNoError;
+    }
+    ogg_stream_pagein(&mOs, &mOg); // errors become apparent at packetout
+    return kNoError;
+}
+StreamEvent DecoderOpus::parseHead()
+{
+    auto data = mOp.packet;
+    if (mOp.bytes < kOpusHeadMinLen || memcmp(data, "OpusHead", 8)) {
+        ESP_LOGE(TAG, "Missing OpusHead header, not an Opus stream");
+        return kErrDecode;
+    }
+    if (data[8] & 0xf0) {
+        ESP_LOGE(TAG, "Unsupported OpusHead version %d", data[8]);
+        return kErrDecode;
+    }
+    int channels = data[9];
+    int preSkip = data[10] | (data[11] << 8);
+    int16_t gain = data[16] | (data[17] << 8); // Q7.8 dB
+    int family = data[18];
+    // family 1 with one coupled (or a single mono) stream is equivalent to family 0
+    bool supported = (channels >= 1 && channels <= 2) && (family == 0 || (family == 1
+        && mOp.bytes >= kOpusHeadMinLen + 2 + channels && data[19] == 1 && data[20] == channels - 1));
+    if (!supported) {
+        ESP_LOGE(TAG, "Unsupported channel config: %d channels, mapping family %d", channels, family);
+        return kErrDecode;
+    }
+    if (outputFormat && channels != mChannels) {
+        ESP_LOGE(TAG, "Channel count changed between chained streams");
+        return kErrDecode;
+    }
+    if (mDecoder) {
+        opus_decoder_ctl(mDecoder, OPUS_RESET_STATE);
+    }
+    else {
+        int err;
+        mDecoder = opus_decoder_create(kSampleRate, channels, &err);
+        if (!mDecoder) {
+            ESP_LOGE(TAG, "Error %d creating decoder", err);
+            return kErrDecode;
+        }
+    }
+    if (gain) {
+        opus_decoder_ctl(mDecoder, OPUS_SET_GAIN(gain));
+    }
+    ESP_LOGI(TAG, "Opus stream: %d channels, pre-skip %d, gain %d/256 dB", channels, preSkip, gain);
+    mChannels = channels;
+    mSkipSamples = preSkip;
+    mSamplePos = 0;
+    mState = kStateNeedTags;
+    if (!outputFormat) {
+        outputFormat = StreamFormat(Codec(Codec::kCodecOpus, Codec::kTransportOgg), kSampleRate, 16, channels);
+        mParent.codecOnFormatDetected(outputFormat, 16, kOutputSplitSamples * channels * 4);
+    }
+    return kNoError;
+}
+void DecoderOpus::parseTags()
+{
+    const uint8_t* ptr = mOp.packet;
+    const uint8_t* end = ptr + mOp.bytes;
+    if (mOp.bytes < 16 || memcmp(ptr, "OpusTags", 8)) {
+        ESP_LOGW(TAG, "Missing OpusTags header");
+        return;
+    }
+    ptr += 8;
+    uint32_t len = readLE32(ptr); // vendor string
+    ptr += 4;
+    if (len > end - ptr - 4) {
+        return;
+    }
+    ptr += len;
+    uint32_t count = readLE32(ptr);
+    ptr += 4;
+    unique_ptr_mfree<const char> title;
+    unique_ptr_mfree<const char> artist;
+    for (; count && (end - ptr >= 4); count--) {
+        len = readLE32(ptr);
+        ptr += 4;
+        if (len > end - ptr) {
+            break;
+        }
+        auto comment = (const char*)ptr;
+        ptr += len;
+        if (len > 6 && strncasecmp(comment, "TITLE=", 6) == 0) {
+            title.reset(strndup(comment + 6, len - 6));
+        }
+        else if (len > 7 && strncasecmp(comment, "ARTIST=", 7) == 0) {
+            artist.reset(strndup(comment + 7, len - 7));
+        }
+    }
+    if (title || artist) {
+        mParent.codecPostOutput(new TitleChangeEvent(title.release(), artist.release()));
+    }
+}
+bool DecoderOpus::outputSamples(const int16_t* samples, int nSamples)
+{
+    for (int start = 0; start < nSamples; start += kOutputSplitSamples) {
+        int count = std::min(nSamples - start, (int)kOutputSplitSamples);
+        int len = count * mChannels * sizeof(int16_t);
+        DataPacket::unique_ptr pkt(DataPacket::create<true>(len * 2, StreamPacket::kHasSpaceFor32Bit));
+        memcpy(pkt->data, samples + start * mChannels, len);
+        pkt->dataLen = len;
+        if (!mParent.codecPostOutput(pkt.release())) {
+            return false;
+        }
+    }
+    return true;
+}
+StreamEvent DecoderOpus::decodePacket(bool& hasOutput)
+{
+    int nSamples = opus_packet_get_nb_samples(mOp.packet, mOp.bytes, kSampleRate);
+    if (nSamples <= 0 || nSamples > kMaxFrameSamples) {
+        ESP_LOGW(TAG, "Invalid packet of %ld bytes, skipping", (long)mOp.bytes);
+        return kNoError;
+    }
+    int frameSize = mChannels * sizeof(int16_t);
+    // Packets of up to kOutputSplitSamples (all frame sizes up to 20ms) are decoded directly
+    // into the output packet. Longer ones go via mPcmBuf, to be split
+    DataPacket::unique_ptr pkt;
+    int16_t* pcm;
+    if (nSamples <= kOutputSplitSamples) {
+        pkt.reset(DataPacket::create<true>(nSamples * frameSize * 2, StreamPacket::kHasSpaceFor32Bit));
+        pcm = (int16_t*)pkt->data;
+    }
+    else {
+        if (!mPcmBuf) {
+            mPcmBuf.reset((int16_t*)heap_caps_malloc(kMaxFrameSamples * 2 * sizeof(int16_t),
+                utils::haveSpiRam() ? MALLOC_CAP_SPIRAM : MALLOC_CAP_DEFAULT));
+            if (!mPcmBuf) {
+                ESP_LOGE(TAG, "Out of memory allocating decode buffer");
+                return kErrDecode;
+            }
+        }
+        pcm = mPcmBuf.get();
+    }
+    nSamples = opus_decode(mDecoder, mOp.packet, mOp.bytes, pcm, nSamples, 0);
+    if (nSamples < 0) {
+        ESP_LOGW(TAG, "Decode error %d, skipping packet", nSamples);
+        return kNoError;
+    }
+    int64_t endPos = mSamplePos + nSamples;
+    int end = nSamples;
+    // the granule position of the last page may be before the end of its last packet, to trim the
+    // padding of the final frame
+    if (mOp.e_o_s && mOp.granulepos >= 0 && mOp.granulepos < endPos) {
+        end -= std::min<int64_t>(endPos - mOp.granulepos, nSamples);
+    }
+    mSamplePos = endPos;
+    int start = std::min(mSkipSamples, nSamples);
+    mSkipSamples -= start;
+    if (start >= end) {
+        return kNoError;
+    }
+    hasOutput = true;
+    if (!pkt) {
+        return outputSamples(pcm + start * mChannels, end - start) ? kNoError : kErrStreamStopped;
+    }
+    if (start) {
+        memmove(pkt->data, pkt->data + start * frameSize, (end - start) * frameSize);
+    }
+    pkt->dataLen = (end - start) * frameSize;
+    return mParent.codecPostOutput(pkt.release()) ? kNoError : kErrStreamStopped;
+}
+StreamEvent DecoderOpus::decode(AudioNode::PacketResult& pr)
+{
+    for (;;) {
+        if (mHasStream) {
+            int ret = ogg_stream_packetout(&mOs, &mOp);
+            if (ret == 1) {
+                if (mState == kStateNeedHead) {
+                    auto err = parseHead();
+                    if (err) {
+                        return err;
+                    }
+                }
+                else if (mState == kStateNeedTags) {
+                    parseTags();
+                    mState = kStateAudio;
+                }
+                else {
+                    bool hasOutput = false;
+                    auto err = decodePacket(hasOutput);
+                    if (err || hasOutput) {
+                        return err;
+                    }
+                }
+                continue;
+            }
+            else if (ret < 0) {
+                ESP_LOGW(TAG, "Missing or corrupt data in Ogg stream, continuing...");
+                continue;
+            }
+        }
+        int ret = ogg_sync_pageout(&mOy, &mOg);
+        if (ret == 1) {
+            auto err = pageIn();
+            if (err) {
+                return err;
+            }
+            continue;
+        }
+        else if (ret < 0) {
+            ESP_LOGD(TAG, "Skipped bytes to sync to an Ogg page");
+            continue;
+        }
+        auto event = mSrcNode.pullDataProfiled(pr);
+        if (event) {
+            return event;
+        }
+        auto& pkt = pr.dataPacket();
+        memcpy(ogg_sync_buffer(&mOy, pkt.dataLen), pkt.data, pkt.dataLen);
+        ogg_sync_wrote(&mOy, pkt.dataLen);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef DECODER_OPUS_HPP
+#define DECODER_OPUS_HPP
+
+#include "decoderNode.hpp"
+#include <ogg/ogg.h>
+#include <opus.h>
+
+/** Ogg/Opus (RFC 7845) decoder. Output is always 16-bit, 48kHz, mono or stereo.
+ * Only channel mapping family 0, and family 1 with up to two channels, are supported
+ */
+class DecoderOpus: public Decoder
+{
+protected:
+    enum {
+        kSampleRate = 48000,
+        kMaxFrameSamples = kSampleRate * 120 / 1000, // max duration of an Opus packet is 120ms
+        kOpusHeadMinLen = 19,
+        // Longer packets are decoded to mPcmBuf and output split, as DataPacket::dataLen is 16-bit,
+        // and the 32-bit EQ output of a 120ms stereo packet would not fit
+        kOutputSplitSamples = 1024
+    };
+    enum State: uint8_t { kStateNeedHead, kStateNeedTags, kStateAudio };
+    ogg_sync_state mOy;
+    ogg_stream_state mOs;
+    ogg_page mOg;
+    ogg_packet mOp;
+    OpusDecoder* mDecoder = nullptr;
+    unique_ptr_mfree<int16_t> mPcmBuf; // decode buffer for packets longer than kOutputSplitSamples
+    int64_t mSamplePos = 0; // granule position of the end of the last decoded packet
+    int mSkipSamples = 0; // pre-skip samples remaining to be discarded
+    uint8_t mChannels = 0;
+    State mState = kStateNeedHead;
+    bool mHasStream = false; // mOs is initialized
+    StreamEvent pageIn();
+    StreamEvent parseHead();
+    void parseTags();
+    StreamEvent decodePacket(bool& hasOutput);
+    bool outputSamples(const int16_t* samples, int nSamples);
+    void destroyDecoder();
+public:
+    virtual Codec::Type type() const { return Codec::kCodecOpus; }
+    DecoderOpus(DecoderNode& parent, AudioNode& src);
+    ~DecoderOpus();
+    virtual StreamEvent decode(AudioNode::PacketResult& pr);
+    virtual void reset() override;
+};
+
+#endif
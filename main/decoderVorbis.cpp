@@ -40,7 +40,7 @@ StreamEvent DecoderVorbis::reinit(AudioNode::PacketResult& pr, bool isInitial)
         bytesIn = 0;
     }
     for (;;) {
-        auto event = mSrcNode.pullData(pr);
+        auto event = mSrcNode.pullDataProfiled(pr);
         if (event) {
             return event;
         }
@@ -63,7 +63,7 @@ StreamEvent DecoderVorbis::reinit(AudioNode::PacketResult& pr, bool isInitial)
     }
     if (isInitial) {
         outputFormat = getOutputFormat();
-        mParent.codecOnFormatDetected(outputFormat, 16);
+        mParent.codecOnFormatDetected(outputFormat, 16, kTargetOutputSamples * 4);
     }
     else {
         auto newFmt = getOutputFormat();
@@ -119,7 +119,7 @@ StreamEvent DecoderVorbis::decode(AudioNode::PacketResult& pr)
                 return kErrDecode;
             }
             else if (ret == 0) {
-                auto event = mSrcNode.pullData(pr);
+                auto event = mSrcNode.pullDataProfiled(pr);
                 if (event) {
                     return event;
                 }
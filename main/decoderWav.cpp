@@ -144,7 +144,7 @@ bool DecoderWav::setupOutput()
 }
 StreamEvent DecoderWav::decode(AudioNode::PacketResult& dpr)
 {
-    auto evt = mSrcNode.pullData(dpr);
+    auto evt = mSrcNode.pullDataProfiled(dpr);
     if (evt) {
         return evt;
     }
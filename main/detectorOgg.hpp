@@ -45,6 +45,8 @@ StreamEvent detectOggCodec(DataPacket& dataPkt, Codec& codec)
         codec.type = Codec::kCodecFlac;
     } else if (strncmp(magic, "vorbis", 7) == 0) {
         codec.type = Codec::kCodecVorbis;
+    } else if (strncmp(magic - 1, "OpusHead", 8) == 0) { // Opus has no packet type byte before the magic
+        codec.type = Codec::kCodecOpus;
     } else {
         ESP_LOGW("OGG", "Unrecognized codec magic signature in OGG transport stream");
         codec.type = Codec::kCodecUnknown;
@@ -1,53 +1,658 @@
 #include "dlna-parse.hpp"
-#include <tinyxml2.h>
-#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <esp_log.h>
 
+static const char* TAG = "dlna-xml";
 const char* kZeroHmsTime = "0:00:00.000";
-using namespace tinyxml2;
 
-const XMLElement* xmlFindPath(const XMLNode* node, const char* path)
+const char kSoapRespHead[] =
+    "<?xml version=\"1.0\"?>"
+    "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+        "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+    "<s:Body><u:$Response xmlns:u=\"$\">";
+const char kSoapRespTail[] = "</u:$Response></s:Body></s:Envelope>";
+// transport state
+const char kSoapRespGetTransportInfo[] =
+    "<CurrentTransportState>$</CurrentTransportState><CurrentTransportStatus>OK</CurrentTransportStatus>"
+    "<CurrentSpeed>1</CurrentSpeed>";
+// duration, URL, relative and absolute position
+const char kSoapRespGetPositionInfo[] =
+    "<Track>1</Track><TrackMetaData></TrackMetaData><TrackDuration>$</TrackDuration><TrackURI>$</TrackURI>"
+    "<RelTime>$</RelTime><AbsTime>$</AbsTime><RelCount>0</RelCount><AbsCount>0</AbsCount>";
+// no values
+const char kSoapRespGetProtocolInfo[] =
+    "<Source></Source><Sink>"
+    "http-get:*:audio/flac:*,http-get:*:audio/x-flac:*,"
+    "http-get:*:audio/mp3:*,http-get:*:audio/mpeg:*,"
+    "http-get:*:audio/aac:*,http-get:*:audio/x-aac:*,http-get:*:audio/aacp:*,"
+    "http-get:*:audio/mp4:*,http-get:*:audio/x-m4a:*,http-get:*:audio/m4a:*,"
+    "http-get:*:audio/ogg:*,http-get:*:application/ogg:*,"
+    "http-get:*:audio/wav:*,http-get:*:audio/wave:*,http-get:*:audio/x-wav:*,"
+    "http-get:*:audio/L8:*,http-get:*:audio/L16:*,http-get:*:audio/L24:*,http-get:*:audio/L32:*"
+    "</Sink>";
+
+static inline bool isSpace(char ch)
+{
+    return ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t';
+}
+const char* XmlStreamParser::localName(const char* name)
+{
+    auto colon = strchr(name, ':');
+    return colon ? colon + 1 : name;
+}
+void XmlStreamParser::reset()
+{
+    mState = kStText;
+    mHadRoot = false;
+    mDepth = 0;
+    mMatchCnt = 0;
+    mNameLen = mAttrNameLen = mAttrValLen = mEntityLen = 0;
+}
+void XmlStreamParser::appendChar(char* buf, uint8_t& len, uint8_t maxLen, char ch)
 {
-    if (!path || !node) {
-        return nullptr;
+    if (len < maxLen) {
+        buf[len++] = ch;
     }
-    char buf[32];
-    for(;;) {
-        while (*path == '/') {
-            path++;
+}
+bool XmlStreamParser::syntaxError(const char* what)
+{
+    ESP_LOGW(TAG, "Syntax error: %s", what);
+    mState = kStError;
+    return false;
+}
+void XmlStreamParser::elementStart()
+{
+    mName[mNameLen] = 0;
+    mDepth++;
+    mHadRoot = true;
+    onElementStart(mName);
+}
+void XmlStreamParser::elementEnd()
+{
+    onElementEnd(mName);
+    mDepth--;
+}
+void XmlStreamParser::decodeEntity()
+{
+    mEntity[mEntityLen] = 0;
+    char out[4];
+    int outLen = 1;
+    if (strcmp(mEntity, "lt") == 0) {
+        out[0] = '<';
+    }
+    else if (strcmp(mEntity, "gt") == 0) {
+        out[0] = '>';
+    }
+    else if (strcmp(mEntity, "amp") == 0) {
+        out[0] = '&';
+    }
+    else if (strcmp(mEntity, "quot") == 0) {
+        out[0] = '"';
+    }
+    else if (strcmp(mEntity, "apos") == 0) {
+        out[0] = '\'';
+    }
+    else if (mEntity[0] == '#' && mEntity[1]) {
+        char* end;
+        bool hex = mEntity[1] == 'x' || mEntity[1] == 'X';
+        uint32_t code = strtoul(mEntity + (hex ? 2 : 1), &end, hex ? 16 : 10);
+        if (*end || !code || code > 0x10ffff) {
+            outLen = 0;
         }
-        const char* end = strchr(path, '/');
-        int len = end ? (end - path) : strlen(path);
-        if (!len) {
-            return node->ToElement();
+        else if (code < 0x80) {
+            out[0] = code;
         }
-        if (len > sizeof(buf)-1) {
-            printf("Tag name exceeded max internal buf size\n");
-            return nullptr;
+        else if (code < 0x800) {
+            out[0] = 0xc0 | (code >> 6);
+            out[1] = 0x80 | (code & 0x3f);
+            outLen = 2;
         }
-        memcpy(buf, path, len);
-        buf[len] = 0;
-        node = node->FirstChildElement(buf);
-        if (!node) {
-            return nullptr;
+        else if (code < 0x10000) {
+            out[0] = 0xe0 | (code >> 12);
+            out[1] = 0x80 | ((code >> 6) & 0x3f);
+            out[2] = 0x80 | (code & 0x3f);
+            outLen = 3;
         }
-        if (!end) {
-            return node->ToElement();
+        else {
+            out[0] = 0xf0 | (code >> 18);
+            out[1] = 0x80 | ((code >> 12) & 0x3f);
+            out[2] = 0x80 | ((code >> 6) & 0x3f);
+            out[3] = 0x80 | (code & 0x3f);
+            outLen = 4;
         }
-        path = end + 1;
+    }
+    else {
+        outLen = 0;
+    }
+    if (mEntityRetState == kStText) {
+        if (outLen) {
+            onText(out, outLen);
+        }
+        else { // unknown entity, pass it on as is
+            onText("&", 1);
+            onText(mEntity, mEntityLen);
+            onText(";", 1);
+        }
+        return;
+    }
+    if (outLen) {
+        for (int i = 0; i < outLen; i++) {
+            appendChar(mAttrVal, mAttrValLen, kMaxAttrValLen, out[i]);
+        }
+    }
+    else {
+        appendChar(mAttrVal, mAttrValLen, kMaxAttrValLen, '&');
+        for (int i = 0; i < mEntityLen; i++) {
+            appendChar(mAttrVal, mAttrValLen, kMaxAttrValLen, mEntity[i]);
+        }
+        appendChar(mAttrVal, mAttrValLen, kMaxAttrValLen, ';');
     }
 }
+bool XmlStreamParser::feed(const char* data, int len)
+{
+    const char* end = data + len;
+    const char* pos = data;
+    while (pos < end) {
+        // text is passed on in runs, directly from the input
+        if (mState == kStText) {
+            auto start = pos;
+            while (pos < end && *pos != '<' && *pos != '&') {
+                pos++;
+            }
+            if (pos > start) {
+                onText(start, pos - start);
+            }
+            if (pos == end) {
+                return true;
+            }
+            if (*pos == '<') {
+                mState = kStTagOpen;
+            }
+            else {
+                mEntityRetState = kStText;
+                mEntityLen = 0;
+                mState = kStEntity;
+            }
+            pos++;
+            continue;
+        }
+        else if (mState == kStCdata && !mMatchCnt) {
+            auto start = pos;
+            while (pos < end && *pos != ']') {
+                pos++;
+            }
+            if (pos > start) {
+                onText(start, pos - start);
+            }
+            if (pos == end) {
+                return true;
+            }
+        }
+        char ch = *pos++;
+        switch (mState) {
+        case kStEntity:
+            if (ch == ';') {
+                decodeEntity();
+                mState = mEntityRetState;
+            }
+            else if (mEntityLen < sizeof(mEntity) - 1 && !isSpace(ch) && !strchr("<&\"'", ch)) {
+                mEntity[mEntityLen++] = ch;
+            }
+            else { // not an entity, pass on the '&' and what followed as is, and process ch again
+                if (mEntityRetState == kStText) {
+                    onText("&", 1);
+                    onText(mEntity, mEntityLen);
+                }
+                else {
+                    appendChar(mAttrVal, mAttrValLen, kMaxAttrValLen, '&');
+                    for (int i = 0; i < mEntityLen; i++) {
+                        appendChar(mAttrVal, mAttrValLen, kMaxAttrValLen, mEntity[i]);
+                    }
+                }
+                mState = mEntityRetState;
+                pos--;
+            }
+            break;
+        case kStTagOpen:
+            mNameLen = 0;
+            if (ch == '/') {
+                mState = kStEndName;
+            }
+            else if (ch == '!') {
+                mState = kStMarkup;
+            }
+            else if (ch == '?') {
+                mMatchCnt = 0;
+                mState = kStPi;
+            }
+            else if (isSpace(ch) || strchr("<>=\"'", ch)) {
+                return syntaxError("invalid char after '<'");
+            }
+            else {
+                mName[mNameLen++] = ch;
+                mState = kStStartName;
+            }
+            break;
+        case kStStartName:
+            if (isSpace(ch)) {
+                elementStart();
+                mState = kStInTag;
+            }
+            else if (ch == '>') {
+                elementStart();
+                mState = kStText;
+            }
+            else if (ch == '/') {
+                elementStart();
+                mState = kStEmptyTagEnd;
+            }
+            else {
+                appendChar(mName, mNameLen, kMaxNameLen, ch);
+            }
+            break;
+        case kStInTag:
+            if (ch == '>') {
+                mState = kStText;
+            }
+            else if (ch == '/') {
+                mState = kStEmptyTagEnd;
+            }
+            else if (!isSpace(ch)) {
+                mAttrNameLen = 0;
+                mAttrName[mAttrNameLen++] = ch;
+                mState = kStAttrName;
+            }
+            break;
+        case kStAttrName:
+            if (ch == '=') {
+                mState = kStAttrValStart;
+            }
+            else if (isSpace(ch)) {
+                mState = kStAttrEq;
+            }
+            else if (ch == '>' || ch == '/') {
+                return syntaxError("attribute without a value");
+            }
+            else {
+                appendChar(mAttrName, mAttrNameLen, kMaxNameLen, ch);
+            }
+            break;
+        case kStAttrEq:
+            if (ch == '=') {
+                mState = kStAttrValStart;
+            }
+            else if (!isSpace(ch)) {
+                return syntaxError("attribute without a value");
+            }
+            break;
+        case kStAttrValStart:
+            if (ch == '"' || ch == '\'') {
+                mQuote = ch;
+                mAttrValLen = 0;
+                mState = kStAttrVal;
+            }
+            else if (!isSpace(ch)) {
+                return syntaxError("unquoted attribute value");
+            }
+            break;
+        case kStAttrVal:
+            if (ch == mQuote) {
+                mAttrName[mAttrNameLen] = 0;
+                mAttrVal[mAttrValLen] = 0;
+                onAttribute(mAttrName, mAttrVal);
+                mState = kStInTag;
+            }
+            else if (ch == '&') {
+                mEntityRetState = kStAttrVal;
+                mEntityLen = 0;
+                mState = kStEntity;
+            }
+            else {
+                appendChar(mAttrVal, mAttrValLen, kMaxAttrValLen, ch);
+            }
+            break;
+        case kStEmptyTagEnd:
+            if (ch != '>') {
+                return syntaxError("'/' not followed by '>'");
+            }
+            elementEnd();
+            mState = kStText;
+            break;
+        case kStEndName:
+            if (ch == '>') {
+                if (mDepth <= 0) {
+                    return syntaxError("end tag without a start tag");
+                }
+                mName[mNameLen] = 0;
+                elementEnd();
+                mState = kStText;
+            }
+            else if (!isSpace(ch)) {
+                appendChar(mName, mNameLen, kMaxNameLen, ch);
+            }
+            break;
+        case kStMarkup: {
+            // after "<!", a comment, CDATA or a DOCTYPE
+            static const char kCdataStart[] = "[CDATA[";
+            mName[mNameLen++] = ch;
+            if (mNameLen == 2 && mName[0] == '-' && ch == '-') {
+                mMatchCnt = 0;
+                mState = kStComment;
+            }
+            else if (memcmp(mName, kCdataStart, mNameLen) == 0) {
+                if (mNameLen == sizeof(kCdataStart) - 1) {
+                    mMatchCnt = 0;
+                    mState = kStCdata;
+                }
+            }
+            else if (mNameLen != 1 || ch != '-') {
+                mMatchCnt = 0;
+                mState = kStDoctype;
+                pos--; // ch may already end it
+            }
+            break;
+        }
+        case kStComment:
+            if (ch == '-') {
+                mMatchCnt++;
+            }
+            else {
+                if (ch == '>' && mMatchCnt >= 2) {
+                    mState = kStText;
+                }
+                mMatchCnt = 0;
+            }
+            break;
+        case kStCdata:
+            // "]]>" ends it, the ']' chars are held back until it's clear whether they are part of it
+            if (ch == ']') {
+                if (mMatchCnt < 2) {
+                    mMatchCnt++;
+                }
+                else {
+                    onText("]", 1);
+                }
+            }
+            else {
+                if (ch == '>' && mMatchCnt == 2) {
+                    mState = kStText;
+                }
+                else {
+                    onText("]]", mMatchCnt);
+                    onText(&ch, 1);
+                }
+                mMatchCnt = 0;
+            }
+            break;
+        case kStPi:
+            if (ch == '>' && mMatchCnt) {
+                mState = kStText;
+            }
+            mMatchCnt = (ch == '?');
+            break;
+        case kStDoctype:
+            // skip the internal subset, if any
+            if (ch == '[') {
+                mMatchCnt++;
+            }
+            else if (ch == ']' && mMatchCnt) {
+                mMatchCnt--;
+            }
+            else if (ch == '>' && !mMatchCnt) {
+                mState = kStText;
+            }
+            break;
+        case kStError:
+            return false;
+        default:
+            assert(false);
+            break;
+        }
+    }
+    return mState != kStError;
+}
 
+void DidlParser::reset()
+{
+    XmlStreamParser::reset();
+    mTitle.clear();
+    mArtist.clear();
+    mDuration[0] = 0;
+    mField = kFieldNone;
+    mIsDidl = mInItem = mItemDone = mHaveTitle = mHaveArtist = mInRes = false;
+}
+void DidlParser::onElementStart(const char* name)
+{
+    mInRes = false;
+    if (mDepth == 1) {
+        mIsDidl = strcmp(name, "DIDL-Lite") == 0;
+    }
+    else if (mDepth == 2) {
+        mInItem = mIsDidl && !mItemDone && strcmp(name, "item") == 0;
+    }
+    else if (mDepth == 3 && mInItem) {
+        if (!mHaveTitle && strcmp(name, "dc:title") == 0) {
+            mField = kFieldTitle;
+            mHaveTitle = true;
+        }
+        else if (!mHaveArtist && strcmp(name, "upnp:artist") == 0) {
+            mField = kFieldArtist;
+            mHaveArtist = true;
+        }
+        else if (strcmp(name, "res") == 0) {
+            mInRes = true;
+        }
+    }
+}
+void DidlParser::onAttribute(const char* name, const char* value)
+{
+    if (mInRes && !mDuration[0] && strcmp(name, "duration") == 0) {
+        strncpy(mDuration, value, sizeof(mDuration) - 1);
+        mDuration[sizeof(mDuration) - 1] = 0;
+    }
+}
+void DidlParser::onText(const char* text, int len)
+{
+    if (mDepth != 3) {
+        return;
+    }
+    if (mField == kFieldTitle) {
+        mTitle.append(text, len);
+    }
+    else if (mField == kFieldArtist) {
+        mArtist.append(text, len);
+    }
+}
+void DidlParser::onElementEnd(const char* name)
+{
+    mInRes = false;
+    if (mDepth == 3) {
+        mField = kFieldNone;
+    }
+    else if (mDepth == 2 && mInItem) {
+        mInItem = false;
+        mItemDone = true;
+    }
+}
 
-std::string msToHmsString(uint32_t ms)
-{
-    std::ostringstream oss;
-    oss << ms / 3600000 << ':';
-    ms %= 3600000;
-    oss << ms / 60000 << ':';
-    ms %= 60000;
-    oss << ms / 1000 << '.';
-    oss << (ms % 1000);
-    return oss.str();
+void SoapRequestParser::reset()
+{
+    XmlStreamParser::reset();
+    mArgs.clear();
+    mDidl.reset();
+    mAction[0] = mServiceType[0] = 0;
+    mArgValStart = 0;
+    mInEnvelope = mInBody = mInAction = mInMetaData = mArgsTooLong = false;
+}
+void SoapRequestParser::onElementStart(const char* name)
+{
+    auto local = localName(name);
+    if (mDepth == 1) {
+        mInEnvelope = strcmp(local, "Envelope") == 0;
+    }
+    else if (mDepth == 2) {
+        mInBody = mInEnvelope && strcmp(local, "Body") == 0;
+    }
+    else if (mDepth == 3) {
+        if (mInBody && !mAction[0]) {
+            strcpy(mAction, local);
+            mInAction = true;
+        }
+    }
+    else if (mDepth == 4 && mInAction) { // an argument
+        auto nameLen = strlen(name);
+        if (!checkArgsSize(nameLen + 1)) {
+            return;
+        }
+        mArgs.append(name, nameLen + 1);
+        mArgValStart = mArgs.size();
+        mInMetaData = nameLen >= 8 && strcmp(name + nameLen - 8, "MetaData") == 0;
+        if (mInMetaData) {
+            mDidl.reset();
+        }
+    }
+}
+void SoapRequestParser::onAttribute(const char* name, const char* value)
+{
+    static const char kServiceUrnPrefix[] = "urn:schemas-upnp-org:service:";
+    // the namespace of the action may also be declared on the Envelope or Body
+    if (mDepth <= 3 && strncmp(name, "xmlns", 5) == 0 &&
+        strncmp(value, kServiceUrnPrefix, sizeof(kServiceUrnPrefix) - 1) == 0) {
+        strcpy(mServiceType, value);
+    }
+}
+bool SoapRequestParser::checkArgsSize(size_t addLen)
+{
+    if (mArgs.size() + addLen <= kMaxArgsSize) {
+        return true;
+    }
+    if (!mArgsTooLong) {
+        ESP_LOGW(TAG, "%s: Arguments exceed %d bytes", mAction, kMaxArgsSize);
+        mArgsTooLong = true;
+    }
+    return false;
+}
+void SoapRequestParser::onText(const char* text, int len)
+{
+    if (mDepth != 4 || !mInAction) {
+        return;
+    }
+    if (mInMetaData) {
+        mDidl.feed(text, len);
+        return;
+    }
+    if (checkArgsSize(len)) {
+        mArgs.append(text, len);
+    }
+}
+void SoapRequestParser::onElementEnd(const char* name)
+{
+    if (mDepth == 4 && mInAction) {
+        if (mArgsTooLong) {
+            return;
+        }
+        // trim the whitespace around the value
+        while (mArgs.size() > mArgValStart && isSpace(mArgs.back())) {
+            mArgs.pop_back();
+        }
+        size_t start = mArgValStart;
+        while (start < mArgs.size() && isSpace(mArgs[start])) {
+            start++;
+        }
+        mArgs.erase(mArgValStart, start - mArgValStart);
+        mArgs += '\0';
+        mInMetaData = false;
+    }
+    else if (mDepth == 3) {
+        mInAction = false;
+    }
+    else if (mDepth == 2) {
+        mInBody = false;
+    }
+    else if (mDepth == 1) {
+        mInEnvelope = false;
+    }
+}
+const char* SoapRequestParser::arg(const char* name, bool logNotFound) const
+{
+    const char* pos = mArgs.c_str();
+    const char* end = pos + mArgs.size();
+    while (pos < end) {
+        auto val = pos + strlen(pos) + 1;
+        if (val >= end) {
+            break;
+        }
+        if (strcmp(pos, name) == 0) {
+            if (!*val && logNotFound) {
+                ESP_LOGW(TAG, "%s: Argument %s has no contents", mAction, name);
+            }
+            return *val ? val : nullptr;
+        }
+        pos = val + strlen(val) + 1;
+    }
+    if (logNotFound) {
+        ESP_LOGW(TAG, "%s: Argument %s not found", mAction, name);
+    }
+    return nullptr;
+}
+
+void xmlAppendEscaped(std::string& buf, const char* str)
+{
+    const char* start = str;
+    for (;; str++) {
+        const char* esc;
+        char ch = *str;
+        if (ch == '&') {
+            esc = "&amp;";
+        }
+        else if (ch == '<') {
+            esc = "&lt;";
+        }
+        else if (ch == '>') {
+            esc = "&gt;";
+        }
+        else if (ch == '"') {
+            esc = "&quot;";
+        }
+        else if (ch) {
+            continue;
+        }
+        else {
+            esc = nullptr;
+        }
+        buf.append(start, str - start);
+        if (!esc) {
+            return;
+        }
+        buf.append(esc);
+        start = str + 1;
+    }
+}
+void xmlAppendTemplate(std::string& buf, const char* tmpl, const char* const* vals, int numVals)
+{
+    for (int idx = 0;; idx++) {
+        auto pos = strchr(tmpl, '$');
+        if (!pos) {
+            buf.append(tmpl);
+            assert(idx == numVals);
+            return;
+        }
+        buf.append(tmpl, pos - tmpl);
+        assert(idx < numVals);
+        if (vals[idx]) {
+            xmlAppendEscaped(buf, vals[idx]);
+        }
+        tmpl = pos + 1;
+    }
+}
+
+const char* msToHms(uint32_t ms, char* buf)
+{
+    snprintf(buf, kHmsBufSize, "%u:%02u:%02u.%03u", (unsigned)(ms / 3600000), (unsigned)(ms / 60000 % 60),
+        (unsigned)(ms / 1000 % 60), (unsigned)(ms % 1000));
+    return buf;
 }
 
 uint32_t parseHmsTime(const char* hms)
@@ -1,47 +1,152 @@
 #ifndef DLNA_PARSE_H
 #define DLNA_PARSE_H
 #include <string>
-#include <tinyxml2.h>
-#include <esp_log.h>
+#include <stdint.h>
 
 extern const char* kZeroHmsTime;
-namespace tinyxml2 {
-class XMLElement;
-class XMLNode;
-}
-const tinyxml2::XMLElement* xmlFindPath(const tinyxml2::XMLNode* node, const char* path);
-static inline const char* xmlFindPathGetText(const tinyxml2::XMLNode* node, const char* path)
+
+/** Incremental XML tokenizer. The document is fed in chunks of any size, as it is received, and is
+ * reported via the virtual methods, without building a tree. Element and attribute names and attribute
+ * values are copied to fixed-size buffers, and truncated if longer. Text is passed on as it is fed, with
+ * the entities decoded, so there is no limit on the text size. CDATA is reported as text. Comments,
+ * processing instructions and the DOCTYPE are skipped. End tags are not checked to match the start tags.
+ */
+class XmlStreamParser
 {
-    auto elem = xmlFindPath(node, path);
-    return elem ? elem->GetText() : nullptr;
-}
-static inline const char* xmlGetChildText(const tinyxml2::XMLElement& elem, const char* childName, bool logNotFound=true)
+public:
+    enum { kMaxNameLen = 63, kMaxAttrValLen = 191 };
+    /** Returns the part of a qualified name after the namespace prefix */
+    static const char* localName(const char* name);
+protected:
+    enum State: uint8_t {
+        kStText, kStEntity, kStTagOpen, kStStartName, kStEndName, kStInTag, kStAttrName, kStAttrEq,
+        kStAttrValStart, kStAttrVal, kStEmptyTagEnd, kStMarkup, kStComment, kStCdata, kStPi, kStDoctype,
+        kStError
+    };
+    State mState = kStText;
+    State mEntityRetState = kStText; // kStText or kStAttrVal
+    char mQuote = 0;
+    bool mHadRoot = false;
+    int16_t mDepth = 0;
+    uint8_t mMatchCnt = 0; // consecutive terminator chars of a comment, CDATA or PI seen
+    uint8_t mNameLen = 0;
+    uint8_t mAttrNameLen = 0;
+    uint8_t mAttrValLen = 0;
+    uint8_t mEntityLen = 0;
+    char mName[kMaxNameLen + 1]; // of the current element
+    char mAttrName[kMaxNameLen + 1];
+    char mAttrVal[kMaxAttrValLen + 1];
+    char mEntity[12];
+    // During the calls, depth() is that of the element, the root being at 1. onText() is called with the
+    // depth of the element containing the text, and may be called several times for one text node
+    virtual void onElementStart(const char* name) {}
+    virtual void onAttribute(const char* name, const char* value) {}
+    virtual void onText(const char* text, int len) {}
+    virtual void onElementEnd(const char* name) {}
+    static void appendChar(char* buf, uint8_t& len, uint8_t maxLen, char ch);
+    void decodeEntity();
+    void elementStart();
+    void elementEnd();
+    bool syntaxError(const char* what);
+public:
+    virtual ~XmlStreamParser() {}
+    /** Prepares for a new document */
+    virtual void reset();
+    /** Returns false on a syntax error, and for all data fed after it */
+    bool feed(const char* data, int len);
+    /** Returns whether a complete document was parsed */
+    bool done() const { return mState == kStText && mHadRoot && mDepth == 0; }
+    bool hasError() const { return mState == kStError; }
+    int depth() const { return mDepth; }
+};
+
+/** Extracts the title, artist and duration of the first item of DIDL-Lite metadata */
+class DidlParser: public XmlStreamParser
 {
-    auto child = elem.FirstChildElement(childName);
-    if (!child) {
-        if (logNotFound) {
-            ESP_LOGW("DLNA", "%s: Child node %s not found", elem.Name(), childName);
-        }
-        return nullptr;
-    }
-    auto result = child->GetText();
-    if (!result && logNotFound) {
-        ESP_LOGW("DLNA", "%s: Child node %s has no contents", elem.Name(), childName);
-    }
-    return result;
-}
+protected:
+    enum Field: uint8_t { kFieldNone, kFieldTitle, kFieldArtist };
+    std::string mTitle;
+    std::string mArtist;
+    char mDuration[16];
+    Field mField = kFieldNone;
+    bool mIsDidl = false;
+    bool mInItem = false;
+    bool mItemDone = false;
+    bool mHaveTitle = false;
+    bool mHaveArtist = false;
+    bool mInRes = false;
+    virtual void onElementStart(const char* name) override;
+    virtual void onAttribute(const char* name, const char* value) override;
+    virtual void onText(const char* text, int len) override;
+    virtual void onElementEnd(const char* name) override;
+public:
+    DidlParser() { mDuration[0] = 0; }
+    virtual void reset() override;
+    bool valid() const { return done() && mItemDone; }
+    const char* title() const { return mTitle.empty() ? nullptr : mTitle.c_str(); }
+    const char* artist() const { return mArtist.empty() ? nullptr : mArtist.c_str(); }
+    const char* duration() const { return mDuration[0] ? mDuration : nullptr; }
+};
+
+/** Extracts the action and its arguments from a SOAP control request, as it is received. The argument
+ * values are kept in a buffer that is reused for the next request. The value of an argument with a name
+ * ending in "MetaData" is not kept, but passed on to the DIDL-Lite parser, so there is no limit on its size.
+ * Element names are matched without their namespace prefix, as control points use different ones.
+ */
+class SoapRequestParser: public XmlStreamParser
+{
+public:
+    enum { kMaxArgsSize = 8192 }; // of the names and values of all arguments but the metadata
+protected:
+    std::string mArgs; // name\0value\0 pairs
+    DidlParser mDidl;
+    char mAction[kMaxNameLen + 1];
+    char mServiceType[kMaxAttrValLen + 1];
+    size_t mArgValStart = 0;
+    bool mInEnvelope = false;
+    bool mInBody = false;
+    bool mInAction = false;
+    bool mInMetaData = false;
+    bool mArgsTooLong = false;
+    bool checkArgsSize(size_t addLen);
+    virtual void onElementStart(const char* name) override;
+    virtual void onAttribute(const char* name, const char* value) override;
+    virtual void onText(const char* text, int len) override;
+    virtual void onElementEnd(const char* name) override;
+public:
+    SoapRequestParser() { mAction[0] = mServiceType[0] = 0; }
+    virtual void reset() override;
+    /** Whether a complete request with an action was parsed */
+    bool valid() const { return done() && mAction[0] && !mArgsTooLong; }
+    /** The action name, without the namespace prefix */
+    const char* action() const { return mAction; }
+    /** The namespace of the action, i.e. the service type URN */
+    const char* serviceType() const { return mServiceType[0] ? mServiceType : nullptr; }
+    /** Returns the value of an argument, or null if it is not present or is empty */
+    const char* arg(const char* name, bool logNotFound = true) const;
+    const DidlParser& didl() const { return mDidl; }
+};
 
-static inline const char* xmlGetChildAttr(const tinyxml2::XMLElement& elem, const char* childName, const char* attrName)
+/** Appends text to buf, escaping the XML special characters */
+void xmlAppendEscaped(std::string& buf, const char* str);
+/** Appends a response template to buf, replacing each '$' with the next of the values, XML-escaped */
+void xmlAppendTemplate(std::string& buf, const char* tmpl, const char* const* vals, int numVals);
+template <size_t N>
+void xmlAppendTemplate(std::string& buf, const char* tmpl, const char* const (&vals)[N])
 {
-    auto child = elem.FirstChildElement(childName);
-    if (!child) {
-        return nullptr;
-    }
-    return child->Attribute(attrName);
+    xmlAppendTemplate(buf, tmpl, vals, N);
 }
+// The SOAP response envelope. The head takes the action name and the service type, the tail the action name
+extern const char kSoapRespHead[];
+extern const char kSoapRespTail[];
+// Response bodies of the actions that return values
+extern const char kSoapRespGetTransportInfo[];
+extern const char kSoapRespGetPositionInfo[];
+extern const char kSoapRespGetProtocolInfo[];
 
-std::string msToHmsString(uint32_t ms);
+enum { kHmsBufSize = 16 };
+/** Formats a time as H:MM:SS.mmm, buf must be at least kHmsBufSize bytes */
+const char* msToHms(uint32_t ms, char* buf);
 uint32_t parseHmsTime(const char* hms);
 
-
 #endif
@@ -1,5 +1,4 @@
 #include <esp_http_server.h>
-#include <esp_http_client.h>
 #include <sys/socket.h>
 #include "dlna.hpp"
 #include <httpServer.hpp>
@@ -7,11 +6,11 @@
 #include <esp_mac.h>
 #include "utils.hpp"
 #include "incfile.hpp"
-#include <tinyxml2.h>
 #include "dlna-parse.hpp"
 #include "audioPlayer.hpp"
 //#include <sstream>
 #include <functional>
+#include <algorithm>
 
 static const char* TAG = "dlna";
 static const char* TAG_NOTIFY = "dlna-notify";
@@ -42,9 +41,6 @@ static const char kServerHeader[] = "FreeRTOS/x UPnP/1.0 NetPlayer/x";
 #define kUuidPrefix "12345678-abcd-ef12-cafe-"
 
 static constexpr uint32_t kSsdpMulticastAddr = utils::ip4Addr(239,255,255,250);
-uint32_t DlnaHandler::EventSubscription::sSidCounter = 0;
-
-using namespace tinyxml2;
 
 DlnaHandler::DlnaHandler(http::Server& httpServer, const char* hostPort, AudioPlayer& player)
 : mHttpServer(httpServer), mPlayer(player)
@@ -165,7 +161,7 @@ esp_err_t DlnaHandler::httpDlnaCommandHandler(httpd_req_t* req)
         httpd_resp_send_404(req);
         return ESP_FAIL;
     }
-    bool(DlnaHandler::*handler)(httpd_req_t*, const char*, const XMLElement&, std::string&);
+    bool(DlnaHandler::*handler)(httpd_req_t*, const char*, const SoapRequestParser&, std::string&);
     url += 6;
     if (strcmp(url, "AVTransport/ctrl") == 0) {
         handler = &DlnaHandler::handleAvTransportCommand;
@@ -179,77 +175,67 @@ esp_err_t DlnaHandler::httpDlnaCommandHandler(httpd_req_t* req)
         return ESP_FAIL;
     }
 
-    int32_t contentLen = req->content_len;
-    if (!contentLen || contentLen > 3000) {
-        ESP_LOGW(TAG, "Control request has too large or missing postdata: content-length: %ld", contentLen);
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Too large or missing POSTDATA");
+    if (!req->content_len) {
+        ESP_LOGW(TAG, "Control request has no postdata");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing POSTDATA");
         return ESP_FAIL;
     }
-    unique_ptr_mfree<char> strXml((char*)utils::mallocTrySpiram(contentLen + 1));
-    int total = 0;
-    do {
-        auto recvLen = httpd_req_recv(req, strXml.get() + total, contentLen - total);
+    // Parse the request as it is received, there is no need to have all of it in memory
+    auto self = static_cast<DlnaHandler*>(req->user_ctx);
+    auto& soap = self->mSoapRequest;
+    soap.reset();
+    char buf[384];
+    for (size_t remain = req->content_len; remain;) {
+        auto recvLen = httpd_req_recv(req, buf, std::min(remain, sizeof(buf)));
         if (recvLen <= 0) {
             ESP_LOGW(TAG, "Ctrl command: error receiving postdata: %s",
                 (recvLen < 0) ? esp_err_to_name(recvLen) : "incomplete data");
             return ESP_FAIL;
         }
-        total += recvLen;
-    } while(total < contentLen);
-    strXml.get()[contentLen] = 0; // null-terminate postdata string
-    //printf("rx XML cmd: %s\n", xml.get());
-    tinyxml2::XMLDocument xml;
-    auto err = xml.Parse(strXml.get(), contentLen);
-    if (err) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Error parsing XML");
-        return ESP_FAIL;
-    }
-    strXml.reset();
-    auto node = xmlFindPath(&xml, "s:Envelope/s:Body");
-    if (!node) {
-        ESP_LOGW(TAG, "s:Body tag not found in XML command");
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing s:Body");
-        return ESP_FAIL;
-    }
-    node = node->FirstChildElement();
-    if (!node) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing u:<command> node");
-        return ESP_FAIL;
+        remain -= recvLen;
+        if (!soap.feed(buf, recvLen)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Error parsing XML");
+            return ESP_FAIL;
+        }
     }
-    const char* cmd = node->Name();
-    if (!cmd || strncasecmp(cmd, "u:", 2)) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Command XML node does not start with u:");
+    if (!soap.valid()) {
+        ESP_LOGW(TAG, "No action found in SOAP request");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing Envelope/Body/<action>");
         return ESP_FAIL;
     }
-    const char* cmdXmlns = node->Attribute("xmlns:u");
-    if (!cmdXmlns) {
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Command XML node does not have xmlns:u attr");
+    const char* cmd = soap.action();
+    const char* serviceType = soap.serviceType();
+    if (!serviceType) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Action has no service type namespace");
         return ESP_FAIL;
     }
-
     ESP_LOGI(TAG, "Received command '\e[95m%s\e[0m' (for service %s)\n", cmd, url);
 
-    auto self = static_cast<DlnaHandler*>(req->user_ctx);
-    std::string result =
-        "<?xml version=\"1.0\"?>"
-        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
-            "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
-        "<s:Body><";
-    result.append(cmd).append("Response xmlns:u=\"")
-          .append(cmdXmlns).append("\">");
-    bool ok = (self->*handler)(req, cmd+2, *node, result);
+    auto& result = self->mSoapResponse;
+    result.clear();
+    xmlAppendTemplate(result, kSoapRespHead, {cmd, serviceType});
+    bool ok = (self->*handler)(req, cmd, soap, result);
     if (!ok) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Error parsing command");
         return ESP_FAIL;
     }
-    result.append("</").append(cmd).append("Response></s:Body></s:Envelope>");
+    xmlAppendTemplate(result, kSoapRespTail, {cmd});
     httpd_resp_set_type(req, "text/xml");
     //printf("DLNA tx(%zu):\n%s\n", result.size(), result.c_str());
     httpd_resp_send(req, result.c_str(), result.size());
     return ESP_OK;
 }
-const char* kHmsZeroTime = "0:00:00.000";
-bool DlnaHandler::handleAvTransportCommand(httpd_req_t* req, const char* cmd, const XMLElement& cmdNode, std::string& result)
+TrackInfo* DlnaHandler::trackInfoFromDidl(const char* url, const DidlParser& didl)
+{
+    if (!didl.valid()) {
+        if (didl.hasError()) {
+            ESP_LOGW(TAG, "Error parsing DIDL-Lite metadata");
+        }
+        return TrackInfo::create(url, nullptr, nullptr, 0);
+    }
+    return TrackInfo::create(url, didl.title(), didl.artist(), parseHmsTime(didl.duration()));
+}
+bool DlnaHandler::handleAvTransportCommand(httpd_req_t* req, const char* cmd, const SoapRequestParser& soap, std::string& result)
 {
     MutexLocker locker(mPlayer.mutex);
     if (strcasecmp(cmd, "Stop") == 0 || (strcasecmp(cmd, "Pause") == 0)) {
@@ -257,90 +243,71 @@ bool DlnaHandler::handleAvTransportCommand(httpd_req_t* req, const char* cmd, co
         return true;
     }
     else if (strcasecmp(cmd, "GetTransportInfo") == 0) {
-        result.reserve(256);
-        result.append("<CurrentTransportState>").append(
-               (mPlayer.mode() == AudioPlayer::kModeDlna) && mPlayer.isPlaying() ? "PLAYING" : "STOPPED")
-              .append(
-                  "</CurrentTransportState><CurrentTransportStatus>OK</CurrentTransportStatus>"
-                  "<CurrentSpeed>1</CurrentSpeed>");
+        bool playing = (mPlayer.mode() == AudioPlayer::kModeDlna) && mPlayer.isPlaying();
+        xmlAppendTemplate(result, kSoapRespGetTransportInfo, {playing ? "PLAYING" : "STOPPED"});
         return true;
     }
     else if (strcasecmp(cmd, "SetAVTransportURI") == 0) {
         mQueuedTrack.reset();
-        const char* url = xmlGetChildText(cmdNode, "CurrentURI");
+        mNextTrack.reset();
+        const char* url = soap.arg("CurrentURI");
         if (!url) {
             return false;
         }
-        do {
-            auto strInfo = xmlGetChildText(cmdNode, "CurrentURIMetaData");
-            if (!strInfo) {
-                break;
-            }
-            XMLDocument info;
-            if (info.Parse(strInfo)) {
-                ESP_LOGW(TAG, "Error parsing DIDL-Lite metadata");
-                break;
-            }
-            auto item = xmlFindPath(&info, "DIDL-Lite/item");
-            if (!item) {
-                break;
-            }
-            auto trkInfo = TrackInfo::create(url, xmlGetChildText(*item, "dc:title"),
-                xmlGetChildText(*item, "upnp:artist"), parseHmsTime(xmlGetChildAttr(*item, "res", "duration")));
-            mQueuedTrack.reset(trkInfo);
-            return true;
-        } while(false);
-        mQueuedTrack.reset(TrackInfo::create(url, nullptr, nullptr, 0));
+        mQueuedTrack.reset(trackInfoFromDidl(url, soap.didl()));
+        return true;
+    }
+    else if (strcasecmp(cmd, "SetNextAVTransportURI") == 0) {
+        const char* url = soap.arg("NextURI", false);
+        // an empty url clears the next track
+        auto trkInfo = url ? trackInfoFromDidl(url, soap.didl()) : nullptr;
+        if (!mQueuedTrack && (mPlayer.mode() == AudioPlayer::kModeDlna) && mPlayer.isPlaying()) {
+            mNextTrack.reset();
+            mPlayer.playNextUrl(trkInfo);
+        }
+        else { // next of the track that is set, but not yet playing
+            mNextTrack.reset(trkInfo);
+        }
         return true;
     }
     else if (strcasecmp(cmd, "Play") == 0) {
         if (!mQueuedTrack) {
             return false;
         }
-        mPlayer.playUrl(mQueuedTrack.release(), AudioPlayer::kModeDlna); //TODO: Implement track info
+        if (mPlayer.playUrl(mQueuedTrack.release(), AudioPlayer::kModeDlna) && mNextTrack) {
+            mPlayer.playNextUrl(mNextTrack.release());
+        }
         return true;
     }
     else if (strcasecmp(cmd, "GetPositionInfo") == 0) {
-        result.append("<Track>1</Track><TrackMetaData></TrackMetaData><TrackDuration>");
         auto trkInfo = mPlayer.trackInfo();
         if (trkInfo) {
-            auto posHms = msToHmsString(mPlayer.positionTenthSec() * 100);
-            result.append(msToHmsString(trkInfo->durationMs))
-                  .append("</TrackDuration><TrackURI>").append(trkInfo->url())
-                  .append("</TrackURI><RelTime>").append(posHms)
-                  .append("</RelTime><AbsTime>").append(posHms);
+            char dur[kHmsBufSize], pos[kHmsBufSize];
+            msToHms(trkInfo->durationMs, dur);
+            msToHms(mPlayer.positionTenthSec() * 100, pos);
+            xmlAppendTemplate(result, kSoapRespGetPositionInfo, {dur, trkInfo->url(), pos, pos});
         } else {
-            result.append(kHmsZeroTime).append("</TrackDuration><TrackURI></TrackURI><RelTime>")
-                  .append(kHmsZeroTime).append("</RelTime><AbsTime>").append(kHmsZeroTime);
+            xmlAppendTemplate(result, kSoapRespGetPositionInfo, {kZeroHmsTime, "", kZeroHmsTime, kZeroHmsTime});
         }
-        result.append("</AbsTime><RelCount>0</RelCount><AbsCount>0</AbsCount>");
         return true;
     } else {
         return false;
     }
 }
-bool DlnaHandler::handleConnMgrCommand(httpd_req_t* req, const char* cmd, const XMLElement& cmdNode, std::string& result)
+bool DlnaHandler::handleConnMgrCommand(httpd_req_t* req, const char* cmd, const SoapRequestParser& soap, std::string& result)
 {
     if (strcasecmp(cmd, "GetProtocolInfo") == 0) {
-        result.reserve(512);
-        result.append("<Source></Source><Sink>"
-            "http-get:*:audio/flac:*,http-get:*:audio/x-flac:*,"
-            "http-get:*:audio/mp3:*,http-get:*:audio/mpeg:*,"
-            "http-get:*:audio/aac:*,http-get:*:audio/x-aac:*,http-get:*:audio/aacp:*,"
-            "http-get:*:audio/ogg:*,http-get:*:application/ogg:*,"
-            "http-get:*:audio/wav:*,http-get:*:audio/wave:*,http-get:*:audio/x-wav:*,"
-            "http-get:*:audio/L8:*,http-get:*:audio/L16:*,http-get:*:audio/L24:*,http-get:*:audio/L32:*"
-            "</Sink>");
+        result.append(kSoapRespGetProtocolInfo);
         return true;
     } else {
         return false;
     }
 }
-bool DlnaHandler::handleRenderCtlCommand(httpd_req_t* req, const char* cmd, const XMLElement& cmdNode, std::string& result)
+bool DlnaHandler::handleRenderCtlCommand(httpd_req_t* req, const char* cmd, const SoapRequestParser& soap, std::string& result)
 {
     MutexLocker locker(mPlayer.mutex);
     if (strcasecmp(cmd, "SetVolume") == 0) {
-        const char* strVol = xmlGetChildText(cmdNode, "DesiredVolume");
+        const char* strVol = soap.arg("DesiredVolume");
         if (!strVol) {
             return false;
         }
@@ -353,7 +320,7 @@ bool DlnaHandler::handleRenderCtlCommand(httpd_req_t* req, const char* cmd, cons
         return true;
     }
     else if (strcasecmp(cmd, "SetMute") == 0) {
-        auto strMute = xmlGetChildText(cmdNode, "DesiredMute");
+        auto strMute = soap.arg("DesiredMute");
         if (!strMute) {
             return false;
         }
@@ -391,242 +358,97 @@ bool httpGetHeader(httpd_req_t* req, const char* hdrName, const std::function<ch
 //  printf("header '%s' -> '%s'\n", hdrName, buf);
     return true;
 }
-const char* DlnaHandler::EventSubscription::strSid(char* buf, size_t bufLen) const
-{
-//    return "uuid:00000000-0000-4000-8000-000000000001";
-    vtsnprintf(buf, bufLen, kSidPrefix, fmtHex32(sid));
-    return buf;
-}
-uint32_t DlnaHandler::EventSubscription::parseSid(char* sid, int len)
-{
-    if (len < 0) {
-        len = strlen(sid);
-    } else {
-        assert(sid[len] == 0);
-    }
-
-    if (len < 8) {
-        return 0; // invalid
-    }
-    return parseInt(sid + len - 8, 0, 16);
-}
-bool DlnaHandler::EventSubscription::notifySubscribed(AudioPlayer& player)
-{
-    std::string xml;
-    {
-    MutexLocker locker(player.mutex);
-    if (service == kEventsRendCtl) {
-        xml.reserve(200);
-        xml = "&lt;PresetNameList val=&quot;FactoryDefaults&quot; channel=&quot;Master&quot;/&gt;&lt;Mute val=&quot;";
-        xml += player.isMuted() ? '1' : '0';
-        xml += "&quot; channel=&quot;Master&quot;/&gt;&lt;Volume val=&quot;";
-        appendAny(xml, player.volumeGet());
-        xml += "&quot; channel=&quot;Master&quot;/&gt;&lt;/InstanceID&gt;&lt;/Event&gt;";
-    }
-    else if (service == kEventsAVTransport) {
-        xml.reserve(300);
-        xml = "&lt;TransportPlaySpeed val=&quot;1&quot;/&gt;"
-              "&lt;CurrentPlayMode val=&quot;NORMAL&quot;/&gt;&lt;TransportState val=&quot;";
-        const TrackInfo* trkInfo;
-        if (player.isPlaying()) {
-            trkInfo = player.trackInfo();
-            xml += "PLAYING";
-        } else {
-            trkInfo = nullptr;
-            xml += "STOPPED";
-        }
-        xml += "&quot;/&gt;&lt;AVTransportURI val=&quot;";
-        xml += trkInfo ? trkInfo->url() : "";
-        xml += "&quot;/&gt;&lt;CurrentTrackDuration val=&quot;";
-        xml += trkInfo ? msToHmsString(trkInfo->durationMs) : kHmsZeroTime;
-        xml += "&quot;/&gt;&lt;CurrentTransportActions val=&quot;Play&quot;/&gt;";
-        xml += "&lt;CurrentTrack val=&quot;1&quot;/&gt;&lt;/InstanceID&gt;&lt;/Event&gt;";
-    }
-    else {
-        ESP_LOGW(TAG_NOTIFY, "notifySubscribed: Unsupported service %d", service);
-        return false;
-    }
-    }
-    auto fullXml = createEventXml(service, xml);
-    printf("NOTIFY subscribed: %s\n", fullXml.c_str());
-    return notify(fullXml);
-}
-
-bool DlnaHandler::EventSubscription::notify(const std::string& xml)
-{
-    esp_http_client_config_t cfg = {};
-    cfg.url = callbackUrl.buf();
-    cfg.timeout_ms = 1000;
-    cfg.buffer_size = 32;
-    cfg.method = HTTP_METHOD_NOTIFY;
-    auto client = esp_http_client_init(&cfg);
-    if (!client) {
-        ESP_LOGW(TAG_NOTIFY, "Could not create http client");
-        return false;
-    }
-    esp_http_client_set_header(client, "NT", "upnp:event");
-    esp_http_client_set_header(client, "NTS", "upnp:propchange");
-    char buf[64];
-    esp_http_client_set_header(client, "SID", strSid(buf, sizeof(buf)));
-    toString(buf, sizeof(buf), ++mSeqNo);
-    esp_http_client_set_header(client, "SEQ", buf);
-    esp_http_client_set_header(client, "Content-Type", "text/xml; charset=\"utf-8\"");
-
-    bool success = false;
-    do {
-        esp_err_t err;
-        if ((err = esp_http_client_open(client, xml.size())) != ESP_OK) {
-            ESP_LOGW(TAG_NOTIFY, "Error connecting to target: %s", esp_err_to_name(err));
-            break;
-        }
-        if (esp_http_client_write(client, xml.c_str(), xml.size()) < 0) {
-            ESP_LOGW(TAG_NOTIFY, "Error posting xml: %s", strerror(errno));
-            break;
-        }
-        auto responseLen = (int)esp_http_client_fetch_headers(client);
-        if (responseLen < 0) {
-            ESP_LOGW(TAG_NOTIFY, "NOTIFY request '%s': Got negative content-length %d in response, status is %d",
-                cfg.url, responseLen, esp_http_client_get_status_code(client));
-            break;
-        }
-        auto code = esp_http_client_get_status_code(client);
-        if (code != 200) {
-            ESP_LOGW(TAG_NOTIFY, "NOTIFY request '%s' failed with code %d, response len: %d",
-                cfg.url, code, responseLen);
-            break;
-        }
-        if (responseLen > 0) {
-            char buf[32];
-            int nread;
-            while((nread = esp_http_client_read(client, buf, sizeof(buf))) > 0);
-            if (nread < 0) {
-                ESP_LOGW(TAG_NOTIFY, "Error reading response body: %s", esp_err_to_name(err));
-            }
-        }
-        success = true;
-    } while(0);
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-    return success;
-}
-DlnaHandler::EventSubscription::~EventSubscription()
-{
-    ESP_LOGI(TAG_NOTIFY, "Deleting event subscription %lu", sid);
-}
-void DlnaHandler::notify(EventSrc service, std::string& xml)
-{
-    mHttpServer.queueWork([this, service, xml = std::move(xml)]() {
-        this->doNotify(service, xml);
-    });
-}
-void DlnaHandler::doNotify(EventSrc service, const std::string& innerXml)
-{
-    auto xml = createEventXml(service, innerXml);
-    //printf("NOTIFY tx: %s\n", xml.c_str());
-    uint32_t now = esp_timer_get_time() / 1000000;
-    for (auto it = mEventSubs.begin(); it != mEventSubs.end();) {
-        if (it->tsTill < now) {
-            it = mEventSubs.erase(it);
-            continue;
+uint32_t DlnaHandler::subscribeWithState(GenaNotifier::Service service, const char* callbackUrl, uint32_t timeout)
+{
+    // The initial event carries the full state of the service. It is copied, as subscribing may resolve
+    // the callback host, which must not be done with the player locked
+    if (service == GenaNotifier::kServiceRendCtl) {
+        char vol[12];
+        bool muted;
+        {
+            MutexLocker locker(mPlayer.mutex);
+            snprintf(vol, sizeof(vol), "%d", mPlayer.volumeGet());
+            muted = mPlayer.isMuted();
         }
-        if (it->service == service) {
-            it->notify(xml);
+        const GenaNotifier::Var vars[] = {
+            {"PresetNameList", "FactoryDefaults"}, {"Mute", muted ? "1" : "0"}, {"Volume", vol}
+        };
+        return mNotifier.subscribe(service, callbackUrl, timeout, vars, std::size(vars));
+    }
+    bool playing;
+    std::string url;
+    char dur[kHmsBufSize];
+    strcpy(dur, kZeroHmsTime);
+    {
+        MutexLocker locker(mPlayer.mutex);
+        playing = mPlayer.isPlaying();
+        auto trkInfo = playing ? mPlayer.trackInfo() : nullptr;
+        if (trkInfo) {
+            url = trkInfo->url();
+            msToHms(trkInfo->durationMs, dur);
         }
-        it++;
     }
+    const GenaNotifier::Var vars[] = {
+        {"TransportPlaySpeed", "1"}, {"CurrentPlayMode", "NORMAL"},
+        {"TransportState", playing ? "PLAYING" : "STOPPED"}, {"AVTransportURI", url.c_str()},
+        {"CurrentTrackDuration", dur}, {"CurrentTransportActions", playing ? "Stop" : "Play"},
+        {"CurrentTrack", "1"}
+    };
+    return mNotifier.subscribe(service, callbackUrl, timeout, vars, std::size(vars));
 }
-const char* DlnaHandler::eventXmlFromType(EventSrc service)
-{
-    if (service == kEventsRendCtl) {
-        return "RCS";
-    } else if (service == kEventsAVTransport) {
-        return "AVT";
-    } else {
-        assert(false);
-        return nullptr;
-    }
-}
-std::string DlnaHandler::createEventXml(EventSrc service, const std::string& inner)
-{
-    std::string result;
-    result.reserve(inner.size() + 260);
-    result = "<?xml version=\"1.0\"?><e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\"><e:property><LastChange>"
-             "&lt;Event xmlns=&quot;urn:schemas-upnp-org:metadata-1-0/";
-    result.append(eventXmlFromType(service)).append("/&quot;&gt;&lt;InstanceID val=&quot;0&quot;&gt;");
-    result.append(inner);
-    result.append("</LastChange></e:property></e:propertyset>");
-    return result;
-}
-
 void DlnaHandler::notifyVolumeChange(int vol)
 {
-    std::string xml;
-    xml.reserve(100);
-    xml = "&lt;Volume val=&quot;";
-    appendAny(xml, vol);
-    xml.append("&quot; channel=&quot;Master&quot;/&gt;&lt;/InstanceID&gt;&lt;/Event&gt;");
-    notify(kEventsRendCtl, xml);
+    char str[12];
+    snprintf(str, sizeof(str), "%d", vol);
+    mNotifier.changeVars(GenaNotifier::kServiceRendCtl, {{"Volume", str}});
 }
-
 void DlnaHandler::notifyMute(bool mute, int vol)
 {
-    std::string xml;
-    xml.reserve(128);
-    xml = "&lt;Mute val=&quot;";
-    xml += (mute ? '1' : '0');
-    xml.append("&quot; channel=&quot;Master&quot;/&gt;");
-    if (!mute && vol > -1) {
-        xml.append("&lt;Volume val=&quot;");
-        appendAny(xml, vol);
-        xml.append("&quot; channel=&quot;Master&quot;/&gt;&lt;/InstanceID&gt;&lt;/Event&gt;");
-    }
-    notify(kEventsRendCtl, xml);
+    if (mute || vol < 0) {
+        mNotifier.changeVars(GenaNotifier::kServiceRendCtl, {{"Mute", mute ? "1" : "0"}});
+        return;
+    }
+    char str[12];
+    snprintf(str, sizeof(str), "%d", vol);
+    mNotifier.changeVars(GenaNotifier::kServiceRendCtl, {{"Mute", "0"}, {"Volume", str}});
 }
 void DlnaHandler::notifyPlayStart()
 {
     // called from AudioPlayer
-    std::string xml;
-    xml.reserve(200);
-    std::string dur;
+    char dur[kHmsBufSize];
     auto trkInfo = mPlayer.trackInfo();
-    dur = trkInfo ? msToHmsString(trkInfo->durationMs) : kZeroHmsTime;
     const char* url = mPlayer.url();
-    xml.append("&lt;TransportState val=&quot;PLAYING&quot;/&gt;&lt;CurrentTrackURI val=&quot;")
-       .append(url ? url : "")
-       .append("&quot;/&gt;&lt;CurrentMediaDuration val=&quot;").append(dur)
-       .append("&quot;/&gt;&lt;CurrentTrackDuration val=&quot;").append(dur)
-       .append("&quot;/&gt;&lt;CurrentTransportActions val=&quot;Stop&quot;/&gt;&lt;/InstanceID&gt;&lt;/Event&gt;");
-    notify(kEventsAVTransport, xml);
+    if (trkInfo) {
+        msToHms(trkInfo->durationMs, dur);
+    }
+    else {
+        strcpy(dur, kZeroHmsTime);
+    }
+    mNotifier.changeVars(GenaNotifier::kServiceAvTransport, {
+        {"TransportState", "PLAYING"}, {"CurrentTrackURI", url ? url : ""}, {"CurrentMediaDuration", dur},
+        {"CurrentTrackDuration", dur}, {"CurrentTransportActions", "Stop"}
+    });
 }
 void DlnaHandler::notifyPlayStop()
 {
-    std::string xml = "&lt;TransportState val=&quot;STOPPED&quot;/&gt;&lt;CurrentTransportActions val=&quot;Play&quot;/&gt;&lt;/InstanceID&gt;&lt;/Event&gt;";
-    notify(kEventsAVTransport, xml);
-}
-DlnaHandler::EventSubscription* DlnaHandler::eventSubscriptionBySid(uint32_t sid)
-{
-    for (auto it = mEventSubs.begin(); it != mEventSubs.end(); it++) {
-        if (it->sid == sid) {
-            return &(*it);
-        }
-    }
-    return nullptr;
+    mNotifier.changeVars(GenaNotifier::kServiceAvTransport, {
+        {"TransportState", "STOPPED"}, {"CurrentTransportActions", "Play"}
+    });
 }
 esp_err_t DlnaHandler::httpDlnaSubscribeHandler(httpd_req_t* req)
 {
-    EventSrc eventSrc;
+    GenaNotifier::Service service;
     if (strcmp(req->uri, "/dlna/RenderingControl/event") == 0) {
-        eventSrc = kEventsRendCtl;
+        service = GenaNotifier::kServiceRendCtl;
     }
     else if (strcmp(req->uri, "/dlna/AVTransport/event") == 0) {
-        eventSrc = kEventsAVTransport;
+        service = GenaNotifier::kServiceAvTransport;
     }
     else {
         ESP_LOGW(TAG_NOTIFY, "Refusing event subscribe request for '%s'", req->uri);
         httpd_resp_send_404(req);
         return ESP_FAIL;
     }
-    printf("subscribe req: '%s'\n", req->uri);
     char bufTout[36];
     uint32_t timeout;
     if (!httpGetHeader(req, "TIMEOUT", [&bufTout](size_t) { return bufTout; }))
@@ -651,34 +473,52 @@ esp_err_t DlnaHandler::httpDlnaSubscribeHandler(httpd_req_t* req)
         timeout = 300;
     }
     auto& self = *static_cast<DlnaHandler*>(req->user_ctx);
-    if (!httpGetHeader(req, "CALLBACK", [&self, eventSrc](size_t urlLen) {
-        auto& buf = self.mEventSubs.emplace_front(eventSrc).callbackUrl;
-        auto ptr = buf.getAppendPtr(urlLen);
-        buf.expandDataSize(urlLen);
-        return ptr;
-    })) {
-        return ESP_FAIL;
+    char bufSid[64];
+    static_assert(sizeof(bufSid) >= GenaNotifier::kSidBufSize);
+    uint32_t sid;
+    auto sidLen = httpd_req_get_hdr_value_len(req, "SID");
+    bool isRenewal = sidLen > 0;
+    if (isRenewal) {
+        if (sidLen >= sizeof(bufSid)) {
+            sid = 0;
+        }
+        else if (!httpGetHeader(req, "SID", [&bufSid](size_t) { return bufSid; })) {
+            return ESP_FAIL;
+        }
+        else {
+            sid = GenaNotifier::parseSid(bufSid);
+        }
+        if (!sid || !self.mNotifier.renew(sid, timeout)) {
+            ESP_LOGW(TAG_NOTIFY, "Refusing renewal of unknown subscription");
+            httpd_resp_set_status(req, "412 Precondition Failed");
+            httpd_resp_send(req, nullptr, 0);
+            return ESP_OK;
+        }
+    }
+    else {
+        std::string callback;
+        if (!httpGetHeader(req, "CALLBACK", [&callback](size_t len) {
+            callback.resize(len);
+            return &callback[0];
+        })) {
+            return ESP_FAIL;
+        }
+        sid = self.subscribeWithState(service, callback.c_str(), timeout);
+        if (!sid) {
+            httpd_resp_set_status(req, "412 Precondition Failed");
+            httpd_resp_send(req, nullptr, 0);
+            return ESP_OK;
+        }
+        ESP_LOGI(TAG_NOTIFY, "Subscribed to %s events: CALLBACK='%s', SID=%u, timeout=%u", req->uri,
+            callback.c_str(), (unsigned)sid, (unsigned)timeout);
     }
-    auto& subscr = self.mEventSubs.front();
-    auto& url = subscr.callbackUrl;
-    // remove <> brackets
-    memmove(url.buf(), url.buf()+1, url.dataSize()-3);
-    url.setDataSize(url.dataSize()-2);
-    url.buf()[url.dataSize()-1] = 0;
-    subscr.tsTill = esp_timer_get_time() / 1000000 + timeout;
     vtsnprintf(bufTout, sizeof(bufTout), "Second-", timeout);
     httpd_resp_set_hdr(req, "TIMEOUT", bufTout);
-    char bufSid[sizeof(EventSubscription::kSidPrefix) + 10];
-    httpd_resp_set_hdr(req, "SID", subscr.strSid(bufSid, sizeof(bufSid)));
+    httpd_resp_set_hdr(req, "SID", GenaNotifier::strSid(sid, bufSid));
     httpd_resp_send(req, nullptr, 0);
-    ESP_LOGW(TAG, "Subscribed to event: CALLBACK='%s', SID='%s', timeout='%s'",
-        url.buf(), bufSid, bufTout);
-    self.mHttpServer.queueWork([&self, sid = subscr.sid]() {
-        EventSubscription* subscr = self.eventSubscriptionBySid(sid);
-        if (subscr) {
-            subscr->notifySubscribed(self.mPlayer);
-        }
-    });
+    if (!isRenewal) {
+        self.mNotifier.startEvents(sid);
+    }
     return ESP_OK;
 }
 esp_err_t DlnaHandler::httpDlnaUnsubscribeHandler(httpd_req_t* req)
@@ -690,7 +530,7 @@ esp_err_t DlnaHandler::httpDlnaUnsubscribeHandler(httpd_req_t* req)
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error getting SID header");
         return ESP_FAIL;
     }
-    uint32_t sid = EventSubscription::parseSid(strSid);
+    uint32_t sid = GenaNotifier::parseSid(strSid);
     if (!sid) {
         const char* kMsg = "Error parsing SID header";
         ESP_LOGW(TAG_NOTIFY, "%s '%s'", kMsg, strSid);
@@ -698,20 +538,12 @@ esp_err_t DlnaHandler::httpDlnaUnsubscribeHandler(httpd_req_t* req)
         return ESP_FAIL;
     }
     auto& self = *static_cast<DlnaHandler*>(req->user_ctx);
-    int numRemoved = 0;
-    self.mEventSubs.remove_if([sid, &numRemoved](EventSubscription& sub) {
-        if (sub.sid != sid) {
-            return false;
-        }
-        numRemoved++;
-        return true;
-    });
-    if (!numRemoved) {
+    if (!self.mNotifier.unsubscribe(sid)) {
         httpd_resp_send_404(req);
         return ESP_FAIL;
     }
     else {
-        ESP_LOGW(TAG_NOTIFY, "UNSUBSCRIBE: Removed %d subscriptions with sid '%s'", numRemoved, strSid);
+        ESP_LOGW(TAG_NOTIFY, "UNSUBSCRIBE: Removed subscription with sid '%s'", strSid);
         httpd_resp_send(req, nullptr, 0);
         return ESP_OK;
     }
@@ -11,6 +11,31 @@ MyEqualizerCore<IsStereo>::MyEqualizerCore(uint8_t numBands, uint32_t sampleRate
     ESP_LOGI(TAG, "Created %d-band custom %s equalizer", numBands, IsStereo ? "stereo" : "mono");
 }
 
+template<bool IsStereo>
+void MyEqualizerCore<IsStereo>::prepareCoeffs(EqCoeffSet& set, uint32_t sampleRate)
+{
+    auto nBands = mEqualizer.numBands();
+    myassert(nBands <= EqCoeffSet::kMaxBands);
+    set.sampleRate = sampleRate;
+    set.numBands = nBands;
+    memcpy(set.gains, mEqualizer.gains(), nBands);
+    memcpy(set.configs, mEqualizer.bandConfigs(), nBands * sizeof(EqBandConfig));
+    for (int i = 0; i < nBands; i++) {
+        mEqualizer.calcBandCoeffs(i, sampleRate, set.coeffs + i * Biquad::kNumCoeffs);
+    }
+}
+template<bool IsStereo>
+void MyEqualizerCore<IsStereo>::applyCoeffs(const EqCoeffSet& set, int rampFrames)
+{
+    myassert(set.numBands == mEqualizer.numBands());
+    if (set.resetState) {
+        mEqualizer.setCoeffs(set.coeffs, set.gains);
+        mEqualizer.resetState();
+    }
+    else {
+        mEqualizer.setCoeffs(set.coeffs, set.gains, rampFrames);
+    }
+}
 template<bool IsStereo>
 void MyEqualizerCore<IsStereo>::process(void* data, int dataLen)
 {
@@ -30,21 +55,48 @@ EspEqualizerCore::EspEqualizerCore(StreamFormat fmt)
 : mSampleRate(fmt.sampleRate()), mChanCount(fmt.numChannels())
 {
     mEqualizer = esp_equalizer_init(mChanCount, mSampleRate, 10, 0);
+    memset(mGains, 0, sizeof(mGains));
+    memset(mAppliedGains, 0, sizeof(mAppliedGains));
     ESP_LOGI("eq", "Created ESP equalizer core");
 }
-void EspEqualizerCore::setBandGain(uint8_t band, int8_t dbGain)
+void EspEqualizerCore::setSampleRate(uint32_t sampleRate, const float* coeffs)
+{
+    // the ESP equalizer has no API to change the sample rate, but it's cheap to re-create
+    if (mEqualizer) {
+        esp_equalizer_uninit(mEqualizer);
+    }
+    mSampleRate = sampleRate;
+    mEqualizer = esp_equalizer_init(mChanCount, mSampleRate, 10, 0);
+    applyAllGains();
+}
+void EspEqualizerCore::prepareCoeffs(EqCoeffSet& set, uint32_t sampleRate)
 {
-    myassert(mEqualizer && band < 10);
-    mGains[band] = dbGain;
-    esp_equalizer_set_band_value(mEqualizer, dbGain, band, 0);
-    esp_equalizer_set_band_value(mEqualizer, dbGain, band, 1);
+    set.sampleRate = sampleRate;
+    set.numBands = 10;
+    memcpy(set.gains, mGains, sizeof(mGains));
+}
+void EspEqualizerCore::applyCoeffs(const EqCoeffSet& set, int rampFrames)
+{
+    myassert(mEqualizer && set.numBands == 10);
+    if (set.resetState) {
+        memcpy(mAppliedGains, set.gains, sizeof(mAppliedGains));
+        applyAllGains();
+        return;
+    }
+    // the library recalculates the filter of a band when its gain is set, so set only the changed ones
+    for (uint8_t i = 0; i < 10; i++) {
+        if (set.gains[i] != mAppliedGains[i]) {
+            mAppliedGains[i] = set.gains[i];
+            esp_equalizer_set_band_value(mEqualizer, set.gains[i], i, 0);
+            esp_equalizer_set_band_value(mEqualizer, set.gains[i], i, 1);
+        }
+    }
 }
-void EspEqualizerCore::updateAllFilters()
+void EspEqualizerCore::applyAllGains()
 {
-    auto g = gains();
     for (uint8_t i = 0; i < 10; i++) {
-        esp_equalizer_set_band_value(mEqualizer, g[i], i, 0);
-        esp_equalizer_set_band_value(mEqualizer, g[i], i, 1);
+        esp_equalizer_set_band_value(mEqualizer, mAppliedGains[i], i, 0);
+        esp_equalizer_set_band_value(mEqualizer, mAppliedGains[i], i, 1);
     }
 }
 EqBandConfig EspEqualizerCore::bandConfig(uint8_t n) const
@@ -3,8 +3,31 @@
 //#define BQ_DEBUG
 #include "equalizer.hpp"
 #include "streamDefs.hpp"
+#include <assert.h>
 
 class DataPacket;
+/** The settings of all bands, with the filter coefficients for a sample rate. Prepared by a control thread
+ * from the gains and band configs of a core, and handed over to the audio thread, which applies them
+ * between packets. The band configs and coefficients are only used by the custom equalizer */
+struct EqCoeffSet
+{
+    enum { kMaxBands = 20 };
+    uint32_t sampleRate = 0;
+    uint8_t numBands = 0;
+    bool resetState = false; // clear the filter states, instead of moving to the new coefficients gradually
+    int8_t gains[kMaxBands];
+    EqBandConfig configs[kMaxBands];
+    float coeffs[kMaxBands * Biquad::kNumCoeffs];
+    /** Calculates the coefficients of a band for another sample rate */
+    void calcBandCoeffs(uint8_t band, uint32_t rate, float* out) const
+    {
+        auto& cfg = configs[band];
+        Biquad::calcCoeffs(EqBandConfig::filterType(band, numBands), cfg.freq, (float)cfg.Q / 1000, rate, gains[band], out);
+    }
+};
+/** The gains() and bandConfigs() arrays are the settings, which are changed by the control thread. They
+ * take effect when a coefficient set, prepared from them with prepareCoeffs(), is applied with applyCoeffs()
+ * by the audio thread */
 struct IEqualizerCore
 {
     enum Type { kTypeUnknown = 0, kTypeEsp = 1, kTypeCustom = 2 };
@@ -13,10 +36,15 @@ struct IEqualizerCore
     virtual uint8_t numBands() const = 0;
     virtual int8_t* gains() = 0;
     virtual EqBandConfig* bandConfigs() = 0;
-    virtual void setBandGain(uint8_t band, int8_t dbGain) = 0;
-    virtual void updateFilter(uint8_t band, bool resetState) = 0;
-    virtual void updateAllFilters() = 0;
     virtual EqBandConfig bandConfig(uint8_t n) const = 0;
+    /** Fills \c set from the current gains and band configs, with the coefficients for \c sampleRate */
+    virtual void prepareCoeffs(EqCoeffSet& set, uint32_t sampleRate) = 0;
+    /** Switches the filters to \c set, gradually during \c rampFrames frames if the core supports it */
+    virtual void applyCoeffs(const EqCoeffSet& set, int rampFrames) = 0;
+    /** Switches to another sample rate, keeping the band configs and gains. \c coeffs are the filter
+     * coefficients for the new rate, prepared with EqCoeffSet::calcBandCoeffs(), or null to calculate
+     * them here */
+    virtual void setSampleRate(uint32_t sampleRate, const float* coeffs) = 0;
     virtual ~IEqualizerCore() {}
 };
 
@@ -30,16 +58,16 @@ public:
     Type type() const override { return kTypeCustom; }
     virtual void process(void* data, int dataLen);
     virtual uint8_t numBands() const override { return mEqualizer.numBands(); }
-    virtual void setBandGain(uint8_t band, int8_t dbGain) override {
-        mEqualizer.setBandGain(band, dbGain);
-    }
     virtual int8_t* gains() override { return mEqualizer.gains(); }
     virtual EqBandConfig* bandConfigs() override { return mEqualizer.bandConfigs(); }
-    virtual void updateFilter(uint8_t band, bool resetState) { mEqualizer.updateFilter(band, resetState); }
-    virtual void updateAllFilters() override { mEqualizer.updateAllFilters(true); }
     virtual EqBandConfig bandConfig(uint8_t n) const override {
         return mEqualizer.bandConfig(n);
     }
+    virtual void prepareCoeffs(EqCoeffSet& set, uint32_t sampleRate) override;
+    virtual void applyCoeffs(const EqCoeffSet& set, int rampFrames) override;
+    virtual void setSampleRate(uint32_t sampleRate, const float* coeffs) override {
+        mEqualizer.setSampleRate(sampleRate, coeffs);
+    }
 };
 class EspEqualizerCore: public IEqualizerCore
 {
@@ -48,6 +76,8 @@ protected:
     int mSampleRate = 0; // cache these because the esp eq wants them passed for each process() call
     int8_t mChanCount = 0;
     int8_t mGains[10];
+    int8_t mAppliedGains[10]; // the gains the library is set to, used by the audio thread
+    void applyAllGains();
 public:
     Type type() const override { return kTypeEsp; }
     virtual void process(void* data, int dataLen);
@@ -55,10 +85,10 @@ public:
     virtual int8_t* gains() override { return mGains; }
     virtual EqBandConfig* bandConfigs() override { return nullptr; }
     EspEqualizerCore(StreamFormat fmt);
-    void setBandGain(uint8_t band, int8_t dbGain) override;
-    virtual void updateFilter(uint8_t band, bool resetState) { assert(false); }
-    virtual void updateAllFilters() override;
     EqBandConfig bandConfig(uint8_t n) const override;
+    virtual void prepareCoeffs(EqCoeffSet& set, uint32_t sampleRate) override;
+    virtual void applyCoeffs(const EqCoeffSet& set, int rampFrames) override;
+    virtual void setSampleRate(uint32_t sampleRate, const float* coeffs) override;
     virtual ~EspEqualizerCore();
 };
 
@@ -4,6 +4,7 @@
 #include <esp_equalizer.h>
 #include <cmath>
 #include "asyncCall.hpp"
+#include <buffer.hpp>
 
 //#define EQ_PERF 1
 //#define CONVERT_PERF 1
@@ -11,6 +12,51 @@
 static const char* TAG = "eq";
 #define LOCK_EQ() MutexLocker locker(mMutex)
 
+// Makes the audio thread wait for mMutex before processing the next packet, and waits for it to finish the
+// current one. Used with mMutex locked, to change the core or the formats, which the audio thread uses
+// without locking
+class EqualizerNode::AudioPause
+{
+    EqualizerNode& mNode;
+    bool mWasRequested;
+public:
+    AudioPause(EqualizerNode& node): mNode(node)
+    {
+        mWasRequested = mNode.mPauseRequested.exchange(true);
+        while (mNode.mAudioBusy) {
+            vTaskDelay(1);
+        }
+    }
+    ~AudioPause() { mNode.mPauseRequested = mWasRequested; }
+};
+// The processing of a packet by the audio thread. Locks mMutex only while a control thread pauses the audio
+class EqualizerNode::ProcessingScope
+{
+    EqualizerNode& mNode;
+    bool mLocked = false;
+public:
+    ProcessingScope(EqualizerNode& node): mNode(node)
+    {
+        mNode.mAudioBusy = true;
+        if (mNode.mPauseRequested) {
+            mNode.mAudioBusy = false;
+            mNode.mMutex.lock();
+            mLocked = true;
+        }
+    }
+    ~ProcessingScope()
+    {
+        if (mLocked) {
+            mNode.mMutex.unlock();
+        }
+        else {
+            mNode.mAudioBusy = false;
+        }
+    }
+};
+
+const uint32_t EqualizerNode::kPrecalcRates[kNumPrecalcRates] = { 44100, 48000, 88200, 96000 };
+
 EqualizerNode::EqualizerNode(IAudioPipeline& parent, NvsHandle& nvs)
 : AudioNode(parent, "equalizer"), mNvsHandle(nvs)
 {
@@ -23,6 +69,7 @@ EqualizerNode::EqualizerNode(IAudioPipeline& parent, NvsHandle& nvs)
     ESP_LOGI(TAG, "Setting DAC output to %d-bit format", mOut24bit ? 24 : 16);
     mDspBufUseInternalRam = mNvsHandle.readDefault("eq.useIntRam", (uint8_t)1);
     ESP_LOGI(TAG, "Using %s RAM for DSP buffer", mDspBufUseInternalRam ? "internal" : "SPI");
+    mInPlaceEnabled = mNvsHandle.readDefault("eq.inPlace", (uint8_t)1);
     eqLoadName();
     equalizerReinit(StreamFormat(44100, 16, 2));
 }
@@ -181,8 +228,16 @@ int EqualizerNode::preConvertFuncIndex() const
     }
     return idx;
 }
-uint8_t* EqualizerNode::dspBufGetWritable(uint16_t writeSize)
+// If the packet has enough headroom, the DSP processing is done in the packet's own buffer,
+// otherwise in mDspBuffer, which is allocated only when such packets arrive
+uint8_t* EqualizerNode::dspBufGetWritable(DataPacket& pkt, uint16_t writeSize)
 {
+    mDspDataSize = writeSize;
+    mDspInPlace = mInPlaceEnabled && ((pkt.flags & mInPlaceFlags) == mInPlaceFlags);
+    if (mDspInPlace) {
+        mDspData = (uint8_t*)pkt.data;
+        return mDspData;
+    }
     if (mDspBufSize < writeSize) {
         auto allocSize = std::max<int>(writeSize, 4096);
         mDspBuffer.reset((uint8_t*)heap_caps_realloc(mDspBuffer.release(), allocSize,
@@ -190,12 +245,28 @@ uint8_t* EqualizerNode::dspBufGetWritable(uint16_t writeSize)
         mDspBufSize = allocSize;
         ESP_LOGW(TAG, "Allocated %d bytes DSP buffer in %s RAM", allocSize, mDspBufUseInternalRam ? "internal": "SPI");
     }
-    mDspDataSize = writeSize;
-    return mDspBuffer.get();
+    mDspData = mDspBuffer.get();
+    return mDspData;
+}
+// Returns the packet to write the post-converted output to. When processing in-place, this is
+// the input packet itself, and it's guaranteed to have the space, as per mInPlaceFlags
+DataPacket& EqualizerNode::dspOutputPacket(PacketResult& pr, int outSize, uint8_t spaceFlags)
+{
+    auto pkt = (DataPacket*)pr.packet.get();
+    if (!mDspInPlace && !(pkt && ((pkt->flags & spaceFlags) == spaceFlags))) {
+        auto pts = pkt ? pkt->pts : 0;
+        pkt = DataPacket::create(outSize, spaceFlags);
+        pkt->pts = pts;
+        pr.packet.reset(pkt);
+    }
+    myassert(!mDspInPlace || ((pkt->flags & spaceFlags) == spaceFlags));
+    pkt->dataLen = outSize;
+    return *pkt;
 }
 void EqualizerNode::dspBufRelease()
 {
     mDspBuffer.reset();
+    mDspData = nullptr;
     mDspBufSize = mDspDataSize = 0;
 }
 void EqualizerNode::equalizerReinit(StreamFormat fmt, bool forceLoadGains)
@@ -209,16 +280,13 @@ void EqualizerNode::equalizerReinit(StreamFormat fmt, bool forceLoadGains)
         // This gives us a chance to release some internal RAM when we need it most (for 96kHz i2s DMA)
         dspBufRelease();
     }
-    if (mUseEspEq && mInFormat.sampleRate() <= 48000) {
+    if (usesEspCore(mInFormat.sampleRate())) {
         if (fmtChanged || !mCore || mCore->type() != IEqualizerCore::kTypeEsp) {
             updateDefaultEqName(true);
             mCore.reset(new EspEqualizerCore(mOutFormat));
-            mOutFormat.setBitsPerSample(16);
             forceLoadGains = true;
-            mPreConvertFunc = sPreConvertFuncs16[preConvertFuncIndex()];
-            mPostConvertFunc = (mVolLevelMeasurePoint == 1)
-               ? &EqualizerNode::postConvert16To16<true>
-               : &EqualizerNode::postConvert16To16<false>;
+            setConvertFuncs();
+            precalcReset();
         }
     }
     else { // need custom eq
@@ -226,19 +294,8 @@ void EqualizerNode::equalizerReinit(StreamFormat fmt, bool forceLoadGains)
             updateDefaultEqName(false);
             createCustomCore(mInFormat);
             forceLoadGains = true;
-            mPreConvertFunc = sPreConvertFuncsFloat[preConvertFuncIndex()];
-            if (mOut24bit) {
-                mOutFormat.setBitsPerSample(24);
-                mPostConvertFunc = (mVolLevelMeasurePoint == 1)
-                  ? &EqualizerNode::postConvertFloatTo24<true>
-                  : &EqualizerNode::postConvertFloatTo24<false>;
-            }
-            else {
-                mOutFormat.setBitsPerSample(16);
-                mPostConvertFunc = (mVolLevelMeasurePoint == 1)
-                   ? &EqualizerNode::postConvertFloatTo16<true>
-                   : &EqualizerNode::postConvertFloatTo16<false>;
-            }
+            setConvertFuncs();
+            precalcReset();
         }
     }
     // load gains
@@ -246,6 +303,106 @@ void EqualizerNode::equalizerReinit(StreamFormat fmt, bool forceLoadGains)
         loadGains();
     }
 }
+// Sets the output format and the sample conversion functions for the current core and input format
+void EqualizerNode::setConvertFuncs()
+{
+    if (mCore->type() == IEqualizerCore::kTypeEsp) {
+        mOutFormat.setBitsPerSample(16);
+        mPreConvertFunc = sPreConvertFuncs16[preConvertFuncIndex()];
+        mPostConvertFunc = (mVolLevelMeasurePoint == 1)
+           ? &EqualizerNode::postConvert16To16<true>
+           : &EqualizerNode::postConvert16To16<false>;
+        mInPlaceFlags = StreamPacket::kHasSpaceFor16Bit;
+        return;
+    }
+    mPreConvertFunc = sPreConvertFuncsFloat[preConvertFuncIndex()];
+    mInPlaceFlags = StreamPacket::kHasSpaceFor32Bit; // float samples
+    if (mOut24bit) {
+        mOutFormat.setBitsPerSample(24);
+        mPostConvertFunc = (mVolLevelMeasurePoint == 1)
+          ? &EqualizerNode::postConvertFloatTo24<true>
+          : &EqualizerNode::postConvertFloatTo24<false>;
+    }
+    else {
+        mOutFormat.setBitsPerSample(16);
+        mPostConvertFunc = (mVolLevelMeasurePoint == 1)
+           ? &EqualizerNode::postConvertFloatTo16<true>
+           : &EqualizerNode::postConvertFloatTo16<false>;
+    }
+}
+// Switches the current core to the sample rate of the new format, if nothing else has to change. Doesn't
+// access NVS, so it can run in the audio thread, without the wait for an asyncCallWait() task switch
+bool EqualizerNode::switchSampleRate(StreamFormat fmt)
+{
+    if (fmt == mInFormat) {
+        return true;
+    }
+    if (!mCore || !mInFormat.asNumCode() || fmt.numChannels() != mInFormat.numChannels()) {
+        return false;
+    }
+    int sr = fmt.sampleRate();
+    bool isEsp = mCore->type() == IEqualizerCore::kTypeEsp;
+    if (usesEspCore(sr) != isEsp) {
+        return false;
+    }
+    const float* coeffs = nullptr;
+    if (!isEsp) {
+        // a capped preset may have to be restored, or the bands may have to be capped for the new rate
+        if (mEqMaxFreqCappedTo || mCore->bandConfigs()[mCore->numBands() - 1].freq >= (sr >> 1)) {
+            return false;
+        }
+        for (int i = 0; i < kNumPrecalcRates; i++) {
+            auto& pc = mPrecalc[i];
+            if (kPrecalcRates[i] == (uint32_t)sr && pc.gen == mCoeffGen && pc.bandsDone == mCore->numBands()) {
+                coeffs = precalcCoeffs(i);
+                mReinitStats.numPrecalc++;
+                break;
+            }
+        }
+    }
+    mOutFormat = mInFormat = fmt;
+    dspBufRelease(); // see equalizerReinit()
+    mCore->setSampleRate(sr, coeffs);
+    setConvertFuncs();
+    return true;
+}
+void EqualizerNode::precalcReset()
+{
+    mCoeffGen++;
+    for (auto& pc: mPrecalc) {
+        pc.bandsDone = 0;
+    }
+    if (mCore->type() == IEqualizerCore::kTypeCustom) {
+        mPrecalcCoeffs.reset(new float[kNumPrecalcRates * mCore->numBands() * Biquad::kNumCoeffs]);
+    }
+    else {
+        mPrecalcCoeffs.reset();
+    }
+}
+// Calculates the coefficients of one band for one of the precalc rates, called after each packet. Uses the
+// settings of the coefficient set that the filters were last set to
+void EqualizerNode::precalcStep()
+{
+    int nBands = mCore->numBands();
+    int currRate = mInFormat.sampleRate();
+    for (int i = 0; i < kNumPrecalcRates; i++) {
+        int rate = kPrecalcRates[i];
+        if (rate == currRate || usesEspCore(rate)) {
+            continue;
+        }
+        auto& pc = mPrecalc[i];
+        if (pc.gen != mCoeffGen) { // gains or configs changed, start over
+            pc.gen = mCoeffGen;
+            pc.bandsDone = 0;
+        }
+        if (pc.bandsDone >= nBands) {
+            continue;
+        }
+        mCoeffSets[mActiveSet].calcBandCoeffs(pc.bandsDone, rate, precalcCoeffs(i) + pc.bandsDone * Biquad::kNumCoeffs);
+        pc.bandsDone++;
+        return;
+    }
+}
 bool EqualizerNode::loadGains()
 {
     auto nBands = mCore->numBands();
@@ -278,12 +435,55 @@ bool EqualizerNode::loadGains()
         ESP_LOGI(TAG, "Error loading or no gains for '%s', len=%d, expected=%d", presetName(), len, nBands);
         goto fail;
     }
-    mCore->updateAllFilters();
+    applySettingsNow();
     return true;
 fail:
     memset(mCore->gains(), 0, nBands);
+    applySettingsNow(); // a newly created core has no filter coefficients calculated yet
     return false;
 }
+// Prepares a coefficient set from the current settings, and hands it over to the audio thread. Called
+// with mMutex locked
+void EqualizerNode::publishCoeffs(bool resetState)
+{
+    int idx = mPendingSet.exchange(-1, std::memory_order_acq_rel);
+    bool reclaimed = idx >= 0;
+    if (!reclaimed) { // the last published set was taken, so the other one is not used anymore
+        idx = mPublishedSet ^ 1;
+    }
+    auto& set = mCoeffSets[idx];
+    mCore->prepareCoeffs(set, mInFormat.sampleRate());
+    // a reset requested by the set that was taken back still has to be done
+    set.resetState = resetState || (reclaimed && set.resetState);
+    mPublishedSet = idx;
+    mPendingSet.store(idx, std::memory_order_release);
+}
+// Called by the audio thread before processing a packet, if a coefficient set is pending. The set is for
+// the current sample rate, as onStreamChanged() takes it before changing the rate
+void EqualizerNode::takePendingCoeffs()
+{
+    int idx = mPendingSet.exchange(-1, std::memory_order_acq_rel);
+    if (idx < 0) {
+        return;
+    }
+    mActiveSet = idx;
+    auto& set = mCoeffSets[idx];
+    mCore->applyCoeffs(set, set.sampleRate * kCoeffRampMs / 1000);
+    mCoeffGen++;
+    mNumCoeffUpdates.fetch_add(1, std::memory_order_relaxed);
+}
+// Sets the filters to the current settings at once, and drops a pending coefficient set. Called when the
+// audio thread is not processing, after the core was created or its settings were loaded
+void EqualizerNode::applySettingsNow()
+{
+    mPendingSet = -1;
+    mPublishedSet = mActiveSet;
+    auto& set = mCoeffSets[mActiveSet];
+    mCore->prepareCoeffs(set, mInFormat.sampleRate());
+    set.resetState = true;
+    mCore->applyCoeffs(set, 0);
+    mCoeffGen++;
+}
 bool EqualizerNode::setDefaultNumBands(uint8_t n)
 {
     if (n < kMyEqMinBands || n > kMyEqMaxBands) {
@@ -293,6 +493,7 @@ bool EqualizerNode::setDefaultNumBands(uint8_t n)
     mDefaultNumBands = n;
     mNvsHandle.write("eq.nbands", (uint8_t)n);
     if (isDefaultPreset()) {
+        AudioPause pause(*this);
         deleteCore();
         equalizerReinit();
     }
@@ -302,10 +503,11 @@ bool EqualizerNode::setBandGain(uint8_t band, int8_t dbGain)
 {
     LOCK_EQ();
     myassert(mCore);
-    if (band > mCore->numBands()) {
+    if (band >= mCore->numBands()) {
         return false;
     }
-    mCore->setBandGain(band, dbGain);
+    mCore->gains()[band] = dbGain;
+    publishCoeffs();
     return true;
 }
 
@@ -314,7 +516,7 @@ void EqualizerNode::zeroAllGains()
     LOCK_EQ();
     auto nBands = mCore->numBands();
     memset(mCore->gains(), 0, nBands);
-    mCore->updateAllFilters();
+    publishCoeffs();
 }
 bool EqualizerNode::saveGains()
 {
@@ -352,7 +554,7 @@ bool EqualizerNode::reconfigEqBand(uint8_t band, uint16_t freq, uint16_t Q)
         cfg.Q = Q;
     }
     ESP_LOGI(TAG, "Reconfiguring band %d: freq=%d, Q=%f", band, cfg.freq, (float)cfg.Q / 1000);
-    mCore->updateFilter(band, true);
+    publishCoeffs();
     MY_ESP_ERRCHECK(mNvsHandle.writeBlob(eqConfigKey(), allCfg, nBands * sizeof(EqBandConfig)),
         TAG, "writing band config", return false);
     return true;
@@ -372,8 +574,8 @@ bool EqualizerNode::setAllPeakingQ(int Q, bool clearState)
     auto cfgs = mCore->bandConfigs();
     for (int i = 1; i < last; i++) {
         cfgs[i].Q = Q;
-        mCore->updateFilter(i, clearState);
     }
+    publishCoeffs(clearState);
     return true;
 }
 bool EqualizerNode::switchPreset(const char *name)
@@ -394,6 +596,7 @@ bool EqualizerNode::switchPreset(const char *name)
         return false;
     }
     LOCK_EQ();
+    AudioPause pause(*this);
     mEqId = " :";
     mEqId += name;
     deleteCore();
@@ -406,10 +609,11 @@ void EqualizerNode::useEspEqualizer(bool use)
     if (mUseEspEq == use) {
         return;
     }
+    mNvsHandle.write("eq.useEsp", (uint8_t)use);
+    AudioPause pause(*this);
     mUseEspEq = use;
     mCoreTypeChanged = true;
     deleteCore();
-    mNvsHandle.write("eq.useEsp", (uint8_t)mUseEspEq);
     equalizerReinit(0, true);
 }
 
@@ -467,7 +671,7 @@ void EqualizerNode::preConvert24or32ToFloatAndApplyVolume(DataPacket& pkt)
     VolumeProbe<VolProbeEnable, int32_t, Bps - 16> volProbe;
     auto rptr = (int32_t*)pkt.data;
     auto rend = (int32_t*)(pkt.data + pkt.dataLen);
-    auto wptr = (float*)dspBufGetWritable(pkt.dataLen);
+    auto wptr = (float*)dspBufGetWritable(pkt, pkt.dataLen);
     while(rptr < rend) {
         int32_t val = *rptr++;
         *(wptr++) = toFloat24<Bps>(val) * mFloatVolumeMul;
@@ -483,17 +687,18 @@ void EqualizerNode::preConvert16or8ToFloatAndApplyVolume(DataPacket& pkt)
 {
     enum { kSampleSizeMul = 4 / sizeof(S), kShift = 24 - sizeof(S) * 8 };
     myassert(mInFormat.bitsPerSample() == sizeof(S) * 8);
-    auto wptr = (float*)dspBufGetWritable(pkt.dataLen * kSampleSizeMul);
-    auto rptr = (const S*)pkt.data;
-    auto rend = (const S*)(pkt.data + pkt.dataLen);
+    auto rbegin = (const S*)pkt.data;
+    auto rptr = (const S*)(pkt.data + pkt.dataLen);
+    auto wptr = (float*)dspBufGetWritable(pkt, pkt.dataLen * kSampleSizeMul) + (rptr - rbegin);
     VolumeProbe<VolProbeEnable, S, 2 - sizeof(S)> volProbe;
-    while(rptr < rend) {
-        S val = *(rptr++);
-        *(wptr++) = ((float)(val << kShift)) * mFloatVolumeMul;
-        volProbe.leftSample(val);
-        val = *(rptr++);
-        *(wptr++) = ((float)(val << kShift)) * mFloatVolumeMul;
+    // convert backwards, because the output overlaps the input when processing in-place
+    while(rptr > rbegin) {
+        S val = *(--rptr);
+        *(--wptr) = ((float)(val << kShift)) * mFloatVolumeMul;
         volProbe.rightSample(val);
+        val = *(--rptr);
+        *(--wptr) = ((float)(val << kShift)) * mFloatVolumeMul;
+        volProbe.leftSample(val);
     }
     volProbe.getPeakLevels(mAudioLevels);
 }
@@ -517,13 +722,9 @@ static inline int32_t floatToInt(float f)
 template<bool VolProbeEnabled>
 void EqualizerNode::postConvertFloatTo24(PacketResult& pr)
 {
-    auto rptr = (const float*)mDspBuffer.get();
-    auto rend = (const float*)(mDspBuffer.get() + mDspDataSize);
-    if (!(pr.packet && (pr.packet->flags & StreamPacket::kHasSpaceFor32Bit))) {
-        pr.packet.reset(DataPacket::create(mDspDataSize, DataPacket::kHasSpaceFor32Bit));
-    }
-    auto& pkt = pr.dataPacket();
-    pkt.dataLen = mDspDataSize;
+    auto rptr = (const float*)mDspData;
+    auto rend = (const float*)(mDspData + mDspDataSize);
+    auto& pkt = dspOutputPacket(pr, mDspDataSize, StreamPacket::kHasSpaceFor32Bit);
     auto wptr = (int32_t*)pkt.data;
     VolumeProbe<VolProbeEnabled, int32_t, 16> volProbe;
     while (rptr < rend) {
@@ -537,18 +738,10 @@ void EqualizerNode::postConvertFloatTo24(PacketResult& pr)
 template<bool VolProbeEnabled>
 void EqualizerNode::postConvertFloatTo16(PacketResult& pr)
 {
-    auto rptr = (float*)mDspBuffer.get();
-    auto rend = (float*)(mDspBuffer.get() + mDspDataSize);
-    int outSize = mDspDataSize >> 1;
-    auto pkt = (DataPacket*)pr.packet.get();
-    if (!(pkt && (pkt->flags & StreamPacket::kHasSpaceFor16Bit))) {
-        pkt = DataPacket::create(outSize, StreamPacket::kHasSpaceFor16Bit);
-        pr.packet.reset(pkt);
-    }
-    else {
-        pkt->dataLen = outSize;
-    }
-    auto wptr = (int16_t*)pkt->data;
+    auto rptr = (float*)mDspData;
+    auto rend = (float*)(mDspData + mDspDataSize);
+    auto& pkt = dspOutputPacket(pr, mDspDataSize >> 1, StreamPacket::kHasSpaceFor16Bit);
+    auto wptr = (int16_t*)pkt.data;
     VolumeProbe<VolProbeEnabled, int16_t, 0> volProbe;
     while(rptr < rend) {
         int16_t ival = *wptr++ = floatToInt<24>(*(rptr++) + 128.5555f) >> 8;
@@ -567,7 +760,7 @@ void EqualizerNode::preConvert24or32To16AndApplyVolume(DataPacket& pkt)
     enum { kShift = Bps - 16 + kVolumeDivShift, kHalfDiv = 1 << (kShift-1) };
     int32_t* rptr = (int32_t*)pkt.data;
     int32_t* rend = (int32_t*)(pkt.data + pkt.dataLen);
-    auto wptr = (int16_t*)dspBufGetWritable(pkt.dataLen >> 1);
+    auto wptr = (int16_t*)dspBufGetWritable(pkt, pkt.dataLen >> 1);
     VolumeProbe<VolProbeEnabled, int32_t, 32-Bps> volProbe;
     while(rptr < rend) {
         auto val = *(rptr++);
@@ -587,62 +780,50 @@ void EqualizerNode::preConvert8or16to16AndApplyVolume(DataPacket& pkt)
     static_assert(sizeof(T) <= 2);
     enum { kShift = (sizeof(T) == 1) ? 0 : 8 };
     enum { kSizeMult = 2 / sizeof(T) };
-    auto rptr = (T*)pkt.data;
-    auto rend = (T*)(pkt.data + pkt.dataLen);
-    auto wptr = (int16_t*)dspBufGetWritable(pkt.dataLen * kSizeMult);
+    auto rbegin = (T*)pkt.data;
+    auto rptr = (T*)(pkt.data + pkt.dataLen);
+    auto wptr = (int16_t*)dspBufGetWritable(pkt, pkt.dataLen * kSizeMult) + (rptr - rbegin);
     VolumeProbe<VolProbeEnable, T, 16 - sizeof(T) * 8> volProbe;
-    while(rptr < rend) {
-        T val = *rptr++;
+    // convert backwards, because 8-bit input expands and overlaps the output when processing in-place
+    while(rptr > rbegin) {
+        T val = *(--rptr);
         int32_t unaligned = (static_cast<int32_t>(val) * mVolume + kVolumeDiv / 2);
-        *wptr++ = (kShift != 0) ? (unaligned >> kShift) : unaligned;
-        volProbe.leftSample(val);
-        val = *rptr++;
-        unaligned = (static_cast<int32_t>(val) * mVolume + kVolumeDiv / 2);
-        *wptr++ = (kShift != 0) ? (unaligned >> kShift) : unaligned;
+        *(--wptr) = (kShift != 0) ? (unaligned >> kShift) : unaligned;
         volProbe.rightSample(val);
+        val = *(--rptr);
+        unaligned = (static_cast<int32_t>(val) * mVolume + kVolumeDiv / 2);
+        *(--wptr) = (kShift != 0) ? (unaligned >> kShift) : unaligned;
+        volProbe.leftSample(val);
     }
     volProbe.getPeakLevels(mAudioLevels);
 }
 template <bool VolProbeEnabled>
 void EqualizerNode::postConvert16To24(PacketResult& pr)
 {
-    DataPacket* pkt = (DataPacket*)pr.packet.get();
-    if (!(pkt && (pkt->flags & StreamPacket::kHasSpaceFor32Bit))) {
-        pkt = DataPacket::create(mDspDataSize * 2, StreamPacket::kHasSpaceFor32Bit);
-        pr.packet.reset(pkt);
-    }
-    else {
-        pkt->dataLen = mDspDataSize * 2;
-    }
-    auto rptr = (int16_t*)mDspBuffer.get();
-    auto rend = (int16_t*)(mDspBuffer.get() + mDspDataSize);
-    auto wptr = (int32_t*)pkt->data;
+    auto& pkt = dspOutputPacket(pr, mDspDataSize * 2, StreamPacket::kHasSpaceFor32Bit);
+    auto rbegin = (int16_t*)mDspData;
+    auto rptr = (int16_t*)(mDspData + mDspDataSize);
+    auto wptr = (int32_t*)pkt.data + (rptr - rbegin);
     VolumeProbe<VolProbeEnabled, int16_t, 0> volProbe;
-    while(rptr < rend) {
-        int16_t val = *rptr++;
-        *wptr++ = val << 16; // i2s requires samples to be left-aligned
-        volProbe.leftSample(val);
-        val = *rptr++;
-        *wptr++ = val << 16;
+    // convert backwards, because the output overlaps the input when processing in-place
+    while(rptr > rbegin) {
+        int16_t val = *(--rptr);
+        *(--wptr) = val << 16; // i2s requires samples to be left-aligned
         volProbe.rightSample(val);
+        val = *(--rptr);
+        *(--wptr) = val << 16;
+        volProbe.leftSample(val);
     }
     volProbe.getPeakLevels(mAudioLevels);
 }
 template <bool VolProbeEnabled>
 void EqualizerNode::postConvert16To16(PacketResult& pr)
 {
-    auto pkt = (DataPacket*)pr.packet.get();
-    if (!(pkt && (pkt->flags & StreamPacket::kHasSpaceFor16Bit))) {
-        pkt = DataPacket::create(mDspDataSize, StreamPacket::kHasSpaceFor16Bit);
-        pr.packet.reset(pkt);
-    }
-    else {
-        pkt->dataLen = mDspDataSize;
-    }
+    auto& pkt = dspOutputPacket(pr, mDspDataSize, StreamPacket::kHasSpaceFor16Bit);
     if (VolProbeEnabled) {
-        auto rptr = (int16_t*)mDspBuffer.get();
-        auto rend = (int16_t*)(mDspBuffer.get() + mDspDataSize);
-        auto wptr = (int16_t*)pkt->data;
+        auto rptr = (int16_t*)mDspData;
+        auto rend = (int16_t*)(mDspData + mDspDataSize);
+        auto wptr = (int16_t*)pkt.data;
         VolumeProbe<VolProbeEnabled, int16_t, 0> volProbe;
         while(rptr < rend) {
             int16_t val = *rptr++;
@@ -654,45 +835,27 @@ void EqualizerNode::postConvert16To16(PacketResult& pr)
         }
         volProbe.getPeakLevels(mAudioLevels);
     }
-    else {
-        memcpy(pkt->data, mDspBuffer.get(), mDspDataSize);
+    else if (!mDspInPlace) {
+        memcpy(pkt.data, mDspData, mDspDataSize);
     }
 }
 StreamEvent EqualizerNode::pullData(PacketResult& dpr)
 {
-    auto event = mPrev->pullData(dpr);
+    auto event = mPrev->pullDataProfiled(dpr);
     if (!event) {
-        MutexLocker locker(mMutex);
+        ProcessingScope processing(*this);
         if (mCoreTypeChanged) {
             mCoreTypeChanged = false;
-            // we have a race condition if we handle mCoreTypeChanged before pullData, because we are unlocked
-            // during pullData and someone may set mCoreTypeChanged. In that case we can't return both the
-            // kEvtStreamChanged and the data packet
-            return dpr.set(new NewStreamEvent(mStreamId, mOutFormat, mSourceBps));
-        }
-#ifdef CONVERT_PERF
-        ElapsedTimer t;
-#endif
-        (this->*mPreConvertFunc)(dpr.dataPacket());
-#ifdef CONVERT_PERF
-        ESP_LOGI(TAG, "preconvert: %lld us", t.usElapsed());
-#endif
-        if (!mBypass) {
-            mCore->process(mDspBuffer.get(), mDspDataSize);
+            // we have a race condition if we handle mCoreTypeChanged before pullData, because the audio is not
+            // paused during pullData and someone may set mCoreTypeChanged. In that case we can't return both
+            // the kEvtStreamChanged and the data packet
+            return dpr.set(new NewStreamEvent(mStreamId, mOutFormat, mSourceBps, ptsToMs(mPts.extend(dpr.dataPacket().pts))));
         }
-        (this->*mPostConvertFunc)(dpr);
-        volumeNotifyLevelCallback();
+        processPacket(dpr);
         return kEvtData;
     }
     else if (event == kEvtStreamChanged) {
-        auto& pkt = dpr.newStreamEvent();
-        MutexLocker locker(mMutex);
-        auto& fmt = pkt.fmt;
-        mStreamId = pkt.streamId;
-        mSourceBps = pkt.sourceBps;
-        asyncCallWait([&]() { equalizerReinit(fmt); });
-        fmt = mOutFormat;
-        return event;
+        return onStreamChanged(dpr);
     }
     else {
         return event;
@@ -700,3 +863,100 @@ StreamEvent EqualizerNode::pullData(PacketResult& dpr)
 
     return kNoError;
 }
+StreamEvent EqualizerNode::pullBatch(PacketResult& pr, PacketBatch& batch, int maxPackets)
+{
+    StreamEvent event = kNoError;
+    if (mHeldBatch.count) {
+        int n = std::min<int>(mHeldBatch.count, maxPackets);
+        for (int i = 0; i < n; i++) {
+            batch.add(mHeldBatch.packets[i]);
+        }
+        mHeldBatch.count -= n;
+        memmove(mHeldBatch.packets, mHeldBatch.packets + n, mHeldBatch.count * sizeof(DataPacket*));
+    }
+    else {
+        event = mPrev->pullBatchProfiled(pr, batch, maxPackets);
+    }
+    if (!event) {
+        ProcessingScope processing(*this);
+        if (mCoreTypeChanged) {
+            // see pullData(). Unlike there, the packets are kept and output after the event, as a batch
+            // may hold several of them
+            mCoreTypeChanged = false;
+            auto seekTime = ptsToMs(mPts.extend(batch[0].pts));
+            for (int i = 0; i < batch.count; i++) {
+                mHeldBatch.add(batch.packets[i]);
+            }
+            batch.count = 0;
+            return pr.set(new NewStreamEvent(mStreamId, mOutFormat, mSourceBps, seekTime));
+        }
+        PacketResult dpr;
+        for (int i = 0; i < batch.count; i++) {
+            // the output packet may be a different one, if the input one doesn't have enough headroom
+            dpr.packet.reset(batch.packets[i]);
+            processPacket(dpr);
+            batch.packets[i] = static_cast<DataPacket*>(dpr.packet.release());
+        }
+        return kEvtData;
+    }
+    else if (event == kEvtStreamChanged) {
+        return onStreamChanged(pr);
+    }
+    return event;
+}
+void EqualizerNode::processPacket(PacketResult& pr)
+{
+    mPts.extend(pr.dataPacket().pts);
+    if (mPendingSet.load(std::memory_order_relaxed) >= 0) {
+        takePendingCoeffs();
+    }
+#ifdef CONVERT_PERF
+    ElapsedTimer t;
+#endif
+    (this->*mPreConvertFunc)(pr.dataPacket());
+#ifdef CONVERT_PERF
+    ESP_LOGI(TAG, "preconvert: %lld us", t.usElapsed());
+#endif
+    if (!mBypass) {
+        mCore->process(mDspData, mDspDataSize);
+    }
+    (this->*mPostConvertFunc)(pr);
+    volumeNotifyLevelCallback();
+    if (mPrecalcCoeffs) {
+        precalcStep();
+    }
+}
+StreamEvent EqualizerNode::onStreamChanged(PacketResult& dpr)
+{
+    auto& pkt = dpr.newStreamEvent();
+    MutexLocker locker(mMutex);
+    takePendingCoeffs(); // it's for the current rate
+    auto& fmt = pkt.fmt;
+    mStreamId = pkt.streamId;
+    mSourceBps = pkt.sourceBps;
+    mPts.reset(pkt.seekTime, fmt.sampleRate());
+    ElapsedTimer timer;
+    // The output waits until this returns. Only a change of the core type or of the band setup needs a full
+    // reinit, which loads settings from NVS, and has to run in a task with an internal RAM stack
+    bool fast = switchSampleRate(fmt);
+    if (!fast) {
+        asyncCallWait([&]() { equalizerReinit(fmt); });
+    }
+    auto& stats = mReinitStats;
+    stats.lastUs = timer.usElapsed();
+    stats.maxUs = std::max(stats.maxUs, stats.lastUs);
+    (fast ? stats.numFast : stats.numFull)++;
+    ESP_LOGI(TAG, "Reconfigured for %d Hz/%d bit in %lu us (%s)", fmt.sampleRate(), fmt.bitsPerSample(),
+        (unsigned long)stats.lastUs, fast ? "rate switch" : "full reinit");
+    fmt = mOutFormat;
+    return kEvtStreamChanged;
+}
+void EqualizerNode::perfExtraToJson(DynBuffer& buf)
+{
+    LOCK_EQ();
+    auto& stats = mReinitStats;
+    buf.printf(",\"reinit\":{\"fast\":%lu,\"precalc\":%lu,\"full\":%lu,\"lastUs\":%lu,\"maxUs\":%lu}",
+        (unsigned long)stats.numFast, (unsigned long)stats.numPrecalc, (unsigned long)stats.numFull,
+        (unsigned long)stats.lastUs, (unsigned long)stats.maxUs);
+    buf.printf(",\"coeffUpdates\":%lu", (unsigned long)mNumCoeffUpdates.load(std::memory_order_relaxed));
+}
@@ -3,12 +3,14 @@
 #include "eqCores.hpp"
 #include "audioNode.hpp"
 #include "volume.hpp"
+#include <atomic>
 
 class NvsHandle;
 class EqualizerNode: public AudioNode, public IAudioVolume
 {
 protected:
     enum { kMyEqMinBands = 3, kMyEqMaxBands = 20, kDefaultNumBands = 10 };
+    static_assert((int)kMyEqMaxBands <= (int)EqCoeffSet::kMaxBands, "");
     typedef void(EqualizerNode::*PreConvertFunc)(DataPacket& pkt);
     typedef void(EqualizerNode::*PostConvertFunc)(PacketResult& pr);
     static constexpr const char kDefaultPresetPrefix[] = "deflt:";
@@ -20,18 +22,61 @@ protected:
     uint16_t mDspBufSize = 0; // mp3 packets have 1152 samples, which is the maximum that should be allowed
     uint16_t mDspDataSize = 0;
     unique_ptr_mfree<uint8_t> mDspBuffer;
+    uint8_t* mDspData = nullptr; // points either to mDspBuffer, or to the packet's buffer when processing in-place
+    uint8_t mInPlaceFlags = 0; // packet space flags required to process in-place
+    bool mDspInPlace = false;
+    bool mInPlaceEnabled;
     bool mDspBufUseInternalRam;
     bool mUseEspEq;
     bool mOut24bit;
     uint8_t mDefaultNumBands;
-    bool mBypass = false;
+    std::atomic<bool> mBypass = {false};
     bool mCoreTypeChanged = false;
+    PacketBatch mHeldBatch; // pulled when the core type changed, output after the NewStreamEvent
     uint8_t mSourceBps = 0;
     StreamId mStreamId = 0;
+    PtsExtender mPts; // for the seek time of the NewStreamEvent posted on a core type change
     uint16_t mEqMaxFreqCappedTo = 0;
     std::string mEqId; // format is [e|f]:<name>[!xx] Prefix 'e' is for gains, 'f' is for config (frequnecies). !xx is for frequency-capped version
     PreConvertFunc mPreConvertFunc = nullptr;
     PostConvertFunc mPostConvertFunc = nullptr;
+    // Filter coefficients of the custom core for other common sample rates, calculated one band per
+    // packet. A change to one of these rates then doesn't calculate them while the output waits
+    enum { kNumPrecalcRates = 4 };
+    static const uint32_t kPrecalcRates[kNumPrecalcRates];
+    struct CoeffPrecalc
+    {
+        uint32_t gen = 0; // of mCoeffGen, when the calculation was started
+        uint8_t bandsDone = 0;
+    };
+    CoeffPrecalc mPrecalc[kNumPrecalcRates];
+    std::unique_ptr<float[]> mPrecalcCoeffs; // kNumPrecalcRates * bands * Biquad::kNumCoeffs
+    uint32_t mCoeffGen = 1; // incremented when the filters are set to other gains or band configs
+    // The settings are changed by the control thread, with mMutex locked, and are handed over to the audio
+    // thread, which processes without locking mMutex. A change prepares one of the two coefficient sets and
+    // publishes it in mPendingSet, and the audio thread takes it before the next packet. The other set is
+    // the one last taken by the audio thread, so it's not touched by the control thread
+    enum { kCoeffRampMs = 20 };
+    EqCoeffSet mCoeffSets[2];
+    std::atomic<int8_t> mPendingSet = {-1}; // published and not yet taken by the audio thread
+    int8_t mPublishedSet = 0; // used by the control thread
+    int8_t mActiveSet = 0; // used by the audio thread
+    std::atomic<uint32_t> mNumCoeffUpdates = {0};
+    // Changes of the core and of the formats are done with the audio thread paused, see AudioPause
+    class AudioPause;
+    class ProcessingScope;
+    std::atomic<bool> mAudioBusy = {false};
+    std::atomic<bool> mPauseRequested = {false};
+    // Reconfiguration on stream format change, during which the output waits
+    struct ReinitStats
+    {
+        uint32_t numFast = 0; // only the sample rate was switched
+        uint32_t numPrecalc = 0; // of them, with the coefficients calculated in advance
+        uint32_t numFull = 0; // core was re-created and settings reloaded from NVS
+        uint32_t lastUs = 0;
+        uint32_t maxUs = 0;
+    };
+    ReinitStats mReinitStats;
     uint8_t eqNumBands();
     bool isDefaultPreset() const { return mEqId.size() < 2 ? false : strncmp(mEqId.c_str() + 2, kDefaultPresetPrefix, sizeof(kDefaultPresetPrefix)-1) == 0; }
     const char* eqGainsKey() { mEqId[0] = 'e'; return mEqId.c_str(); }
@@ -45,6 +90,15 @@ protected:
     void equalizerReinit(StreamFormat fmt=0, bool forceLoadGains=false);
     void updateBandGain(uint8_t band);
     void createCustomCore(StreamFormat fmt);
+    bool usesEspCore(int sampleRate) const { return mUseEspEq && sampleRate <= 48000; }
+    float* precalcCoeffs(int rateIdx) { return mPrecalcCoeffs.get() + rateIdx * mCore->numBands() * Biquad::kNumCoeffs; }
+    void precalcReset();
+    void precalcStep();
+    void publishCoeffs(bool resetState = false);
+    void takePendingCoeffs();
+    void applySettingsNow();
+    bool switchSampleRate(StreamFormat fmt);
+    void setConvertFuncs();
     template <typename S, bool VolProbeEnabled>
     void preConvert16or8ToFloatAndApplyVolume(DataPacket& pr);
     template<int Bps, bool VolProbeEnabled>
@@ -62,15 +116,22 @@ protected:
     template <bool VolProbeEnabled>
     void postConvert16To16(PacketResult& pr);
     int preConvertFuncIndex() const;
+    void processPacket(PacketResult& pr); // called within a ProcessingScope
+    StreamEvent onStreamChanged(PacketResult& pr);
+    uint32_t ptsToMs(uint64_t pts) const { return mOutFormat.sampleRate() ? pts * 1000 / mOutFormat.sampleRate() : 0; }
     static const PreConvertFunc sPreConvertFuncsFloat[];
     static const PreConvertFunc sPreConvertFuncs16[];
-    uint8_t* dspBufGetWritable(uint16_t writeSize);
+    uint8_t* dspBufGetWritable(DataPacket& pkt, uint16_t writeSize);
+    DataPacket& dspOutputPacket(PacketResult& pr, int outSize, uint8_t spaceFlags);
     void dspBufRelease();
 public:
     Mutex mMutex;
     EqualizerNode(IAudioPipeline& parent, NvsHandle& nvs);
     virtual Type type() const { return kTypeEqualizer; }
     virtual StreamEvent pullData(PacketResult &dpr) override;
+    virtual StreamEvent pullBatch(PacketResult& pr, PacketBatch& batch, int maxPackets) override;
+    /** Drops the held packets, called when the pipeline is stopped */
+    virtual void reset() override { mHeldBatch.clear(); }
     int numBands() const { return mCore->numBands(); }
     bool setDefaultNumBands(uint8_t n);
     IEqualizerCore::Type eqType() const { return mCore->type(); }
@@ -86,6 +147,7 @@ public:
     bool setAllPeakingQ(int Q, bool reset);
     const EqBandConfig bandCfg(uint8_t n) const { return mCore->bandConfig(n); }
     virtual IAudioVolume* volumeInterface() override { return this; }
+    virtual void perfExtraToJson(DynBuffer& buf) override;
 };
 
 #endif // EQUALIZERNODE_HPP
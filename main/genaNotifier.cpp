@@ -0,0 +1,495 @@
+#include "genaNotifier.hpp"
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "dlna-parse.hpp"
+
+static const char* TAG = "gena";
+#define LOCK() MutexLocker locker(mMutex)
+
+const char GenaNotifier::kSidPrefix[] = "uuid:00000000-0000-4000-8000-0000";
+static const char* kEventNs[GenaNotifier::kNumServices] = { "RCS", "AVT" };
+
+void GenaNotifier::Subscription::setVar(const char* name, const char* value)
+{
+    for (auto& var: pending) {
+        if (strcmp(var.name, name) == 0) {
+            var.value = value;
+            return;
+        }
+    }
+    pending.push_back(PendingVar{name, value});
+}
+int64_t GenaNotifier::Subscription::tsDue() const
+{
+    if (!active || pending.empty()) {
+        return INT64_MAX;
+    }
+    // the initial event is sent right away
+    int64_t ts = seq ? tsFirstChange + kCoalesceMs * 1000 : tsFirstChange;
+    return std::max(ts, tsNextTry);
+}
+GenaNotifier::~GenaNotifier()
+{
+    mTerminate = true;
+    mEvents.setBits(kEvtTerminate);
+    mTask.waitToEnd();
+    for (auto& conn: mConns) {
+        close(conn.fd);
+    }
+}
+const char* GenaNotifier::strSid(uint32_t sid, char* buf)
+{
+    snprintf(buf, kSidBufSize, "%s%08x", kSidPrefix, (unsigned)sid);
+    return buf;
+}
+uint32_t GenaNotifier::parseSid(const char* sid)
+{
+    enum { kPrefixLen = sizeof(kSidPrefix) - 1 };
+    if (strlen(sid) != kPrefixLen + 8 || strncasecmp(sid, kSidPrefix, kPrefixLen)) {
+        return 0;
+    }
+    return strtoul(sid + kPrefixLen, nullptr, 16);
+}
+uint32_t GenaNotifier::subscribe(Service service, const char* callbackUrl, uint32_t timeoutSec,
+    const Var* initial, int numInitial)
+{
+    // CALLBACK may contain several urls, as <url1><url2>, we use the first one
+    if (*callbackUrl == '<') {
+        callbackUrl++;
+    }
+    if (strncasecmp(callbackUrl, "http://", 7)) {
+        ESP_LOGW(TAG, "Callback url '%s' is not http", callbackUrl);
+        return 0;
+    }
+    const char* host = callbackUrl + 7;
+    const char* hostEnd = host + strcspn(host, "/>");
+    const char* path = *hostEnd == '/' ? hostEnd : "/";
+    const char* pathEnd = path + strcspn(path, ">");
+    std::string hostPort(host, hostEnd - host);
+    std::string hostName = hostPort;
+    uint16_t port = 80;
+    auto colon = hostName.find(':');
+    if (colon != std::string::npos) {
+        port = atoi(hostName.c_str() + colon + 1);
+        hostName.resize(colon);
+    }
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addrs = nullptr;
+    if (hostName.empty() || !port || getaddrinfo(hostName.c_str(), nullptr, &hints, &addrs) || !addrs) {
+        ESP_LOGW(TAG, "Can't resolve callback host '%s'", hostPort.c_str());
+        return 0;
+    }
+    uint32_t ip = ((sockaddr_in*)addrs->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(addrs);
+
+    LOCK();
+    auto& sub = mSubs.emplace_back();
+    if (!++mSidCounter) {
+        mSidCounter++;
+    }
+    sub.sid = mSidCounter;
+    sub.service = service;
+    sub.ip = ip;
+    sub.port = port;
+    sub.hostPort = std::move(hostPort);
+    sub.path.assign(path, pathEnd - path);
+    int64_t now = esp_timer_get_time();
+    sub.tsTill = (timeoutSec == 0xffffffff) ? INT64_MAX : now + timeoutSec * 1000000LL;
+    for (int i = 0; i < numInitial; i++) {
+        sub.setVar(initial[i].name, initial[i].value);
+    }
+    sub.tsFirstChange = now;
+    if (!mTask.handle()) {
+        mTask.createTask("gena", false, kStackSize, tskNO_AFFINITY, kPrio, this, sTaskFunc);
+    }
+    return sub.sid;
+}
+void GenaNotifier::startEvents(uint32_t sid)
+{
+    {
+        LOCK();
+        auto sub = findSub(sid);
+        if (!sub) {
+            return;
+        }
+        sub->active = true;
+    }
+    mEvents.setBits(kEvtWork);
+}
+bool GenaNotifier::renew(uint32_t sid, uint32_t timeoutSec)
+{
+    LOCK();
+    auto sub = findSub(sid);
+    if (!sub) {
+        return false;
+    }
+    sub->tsTill = (timeoutSec == 0xffffffff) ? INT64_MAX : esp_timer_get_time() + timeoutSec * 1000000LL;
+    return true;
+}
+bool GenaNotifier::unsubscribe(uint32_t sid)
+{
+    LOCK();
+    for (auto it = mSubs.begin(); it != mSubs.end(); it++) {
+        if (it->sid == sid) {
+            mSubs.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+void GenaNotifier::changeVars(Service service, const Var* vars, int numVars)
+{
+    bool haveSubs = false;
+    {
+        LOCK();
+        int64_t now = esp_timer_get_time();
+        for (auto& sub: mSubs) {
+            if (sub.service != service) {
+                continue;
+            }
+            if (sub.pending.empty()) {
+                sub.tsFirstChange = now;
+            }
+            for (int i = 0; i < numVars; i++) {
+                sub.setVar(vars[i].name, vars[i].value);
+            }
+            sub.changeGen++;
+            mStats.numChanges++;
+            haveSubs = true;
+        }
+    }
+    if (haveSubs) {
+        mEvents.setBits(kEvtWork);
+    }
+}
+int GenaNotifier::numSubscriptions()
+{
+    LOCK();
+    return mSubs.size();
+}
+GenaNotifier::Stats GenaNotifier::stats()
+{
+    LOCK();
+    return mStats;
+}
+GenaNotifier::Subscription* GenaNotifier::findSub(uint32_t sid)
+{
+    for (auto& sub: mSubs) {
+        if (sub.sid == sid) {
+            return &sub;
+        }
+    }
+    return nullptr;
+}
+void GenaNotifier::removeExpired(int64_t now)
+{
+    for (auto it = mSubs.begin(); it != mSubs.end();) {
+        if (it->tsTill < now) {
+            ESP_LOGI(TAG, "Subscription %u expired", (unsigned)it->sid);
+            it = mSubs.erase(it);
+            mStats.numDropped++;
+        }
+        else {
+            it++;
+        }
+    }
+}
+GenaNotifier::Subscription* GenaNotifier::nextDue(int64_t now, int64_t& tsWake)
+{
+    Subscription* next = nullptr;
+    tsWake = INT64_MAX;
+    for (auto& sub: mSubs) {
+        auto ts = sub.tsDue();
+        if (ts < tsWake) {
+            tsWake = ts;
+            next = &sub;
+        }
+    }
+    if (tsWake <= now) {
+        return next;
+    }
+    for (auto& sub: mSubs) {
+        tsWake = std::min(tsWake, sub.tsTill);
+    }
+    return nullptr;
+}
+void GenaNotifier::buildEvent(const Subscription& sub)
+{
+    // The LastChange value is an XML document, escaped as text of the event XML
+    std::string inner;
+    inner.reserve(80 + sub.pending.size() * 64);
+    inner = "<Event xmlns=\"urn:schemas-upnp-org:metadata-1-0/";
+    inner.append(kEventNs[sub.service]).append("/\"><InstanceID val=\"0\">");
+    for (auto& var: sub.pending) {
+        inner.append("<").append(var.name).append(" val=\"");
+        xmlAppendEscaped(inner, var.value.c_str());
+        inner.append(sub.service == kServiceRendCtl ? "\" channel=\"Master\"/>" : "\"/>");
+    }
+    inner.append("</InstanceID></Event>");
+
+    std::string body;
+    body.reserve(inner.size() * 5 / 4 + 140);
+    body = "<?xml version=\"1.0\"?><e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\"><e:property><LastChange>";
+    xmlAppendEscaped(body, inner.c_str());
+    body.append("</LastChange></e:property></e:propertyset>");
+
+    char sid[kSidBufSize];
+    mTxBuf.clear();
+    mTxBuf.append("NOTIFY ").append(sub.path).append(" HTTP/1.1\r\nHOST: ").append(sub.hostPort)
+          .append("\r\nCONTENT-TYPE: text/xml; charset=\"utf-8\"\r\nCONTENT-LENGTH: ");
+    appendAny(mTxBuf, body.size());
+    mTxBuf.append("\r\nNT: upnp:event\r\nNTS: upnp:propchange\r\nSID: ").append(strSid(sub.sid, sid))
+          .append("\r\nSEQ: ");
+    appendAny(mTxBuf, sub.seq);
+    mTxBuf.append("\r\n\r\n").append(body);
+}
+void GenaNotifier::sTaskFunc(void* ctx)
+{
+    static_cast<GenaNotifier*>(ctx)->taskFunc();
+}
+void GenaNotifier::taskFunc()
+{
+    while (!mTerminate) {
+        int64_t now = esp_timer_get_time();
+        int64_t tsWake;
+        uint32_t sid = 0, ip = 0, gen = 0;
+        uint16_t port = 0;
+        {
+            LOCK();
+            removeExpired(now);
+            closeIdleConnections(now);
+            if (auto sub = nextDue(now, tsWake)) {
+                buildEvent(*sub);
+                sid = sub->sid;
+                ip = sub->ip;
+                port = sub->port;
+                gen = sub->changeGen;
+            }
+        }
+        if (!sid) {
+            // wake up once a second while connections are open, to close the idle ones
+            int msWait = (tsWake == INT64_MAX) ? -1 : (tsWake - now + 999) / 1000;
+            if (!mConns.empty() && (msWait < 0 || msWait > 1000)) {
+                msWait = 1000;
+            }
+            mEvents.waitForOneAndReset(kEvtWork | kEvtTerminate, msWait);
+            continue;
+        }
+        int status = sendEvent(ip, port);
+        now = esp_timer_get_time();
+        LOCK();
+        auto sub = findSub(sid);
+        if (!sub) { // unsubscribed meanwhile
+            continue;
+        }
+        if (status >= 200 && status < 300) {
+            mStats.numEvents++;
+            sub->seq = (sub->seq == 0xffffffff) ? 1 : sub->seq + 1;
+            sub->numFailures = 0;
+            sub->tsNextTry = 0;
+            if (sub->changeGen == gen) {
+                sub->pending.clear();
+                sub->tsFirstChange = 0;
+            }
+            else { // changed during the send, the next event comes after another window
+                sub->tsFirstChange = now;
+            }
+            continue;
+        }
+        mStats.numFailures++;
+        if (status == 412) { // the subscriber does not know the SID (anymore)
+            ESP_LOGW(TAG, "Subscriber rejected SID %u, dropping subscription", (unsigned)sid);
+        }
+        else if (++sub->numFailures >= kMaxFailures) {
+            ESP_LOGW(TAG, "Dropping subscription %u after %d failed sends", (unsigned)sid, sub->numFailures);
+        }
+        else {
+            int delayMs = std::min(kRetryBaseMs << (sub->numFailures - 1), (int)kRetryMaxMs);
+            sub->tsNextTry = now + delayMs * 1000LL;
+            ESP_LOGI(TAG, "Sending event to %s failed (%d), retry in %d ms", sub->hostPort.c_str(), status, delayMs);
+            continue;
+        }
+        mStats.numDropped++;
+        mSubs.remove_if([sid](const Subscription& s) { return s.sid == sid; });
+    }
+}
+int GenaNotifier::sendEvent(uint32_t ip, uint16_t port)
+{
+    bool isNew;
+    auto conn = getConnection(ip, port, isNew);
+    if (!conn) {
+        return -1;
+    }
+    for (;;) {
+        bool keepAlive = false;
+        int status = -1;
+        if (send(conn->fd, mTxBuf.c_str(), mTxBuf.size(), MSG_NOSIGNAL) == (ssize_t)mTxBuf.size()) {
+            status = readResponse(conn->fd, keepAlive);
+        }
+        if (status < 0 && !isNew) {
+            // the subscriber may close an idle persistent connection at any time, retry on a new one
+            closeConnection(*conn);
+            conn = getConnection(ip, port, isNew);
+            if (!conn) {
+                return -1;
+            }
+            continue;
+        }
+        conn->tsLastUse = esp_timer_get_time();
+        if (!keepAlive) {
+            closeConnection(*conn);
+        }
+        return status;
+    }
+}
+GenaNotifier::Connection* GenaNotifier::getConnection(uint32_t ip, uint16_t port, bool& isNew)
+{
+    for (auto& conn: mConns) {
+        if (conn.ip == ip && conn.port == port) {
+            isNew = false;
+            return &conn;
+        }
+    }
+    if (mConns.size() >= kMaxConnections) { // close the least recently used one
+        auto lru = std::min_element(mConns.begin(), mConns.end(), [](const Connection& a, const Connection& b) {
+            return a.tsLastUse < b.tsLastUse;
+        });
+        closeConnection(*lru);
+    }
+    int fd = connectTo(ip, port);
+    if (fd < 0) {
+        return nullptr;
+    }
+    {
+        LOCK();
+        mStats.numConnects++;
+    }
+    isNew = true;
+    mConns.push_back(Connection{ip, port, fd, esp_timer_get_time()});
+    return &mConns.back();
+}
+void GenaNotifier::closeConnection(Connection& conn)
+{
+    close(conn.fd);
+    mConns.erase(mConns.begin() + (&conn - mConns.data()));
+}
+void GenaNotifier::closeIdleConnections(int64_t now)
+{
+    for (size_t i = 0; i < mConns.size();) {
+        auto& conn = mConns[i];
+        bool used = std::any_of(mSubs.begin(), mSubs.end(), [&conn](const Subscription& sub) {
+            return sub.ip == conn.ip && sub.port == conn.port;
+        });
+        if (!used || now - conn.tsLastUse > kIdleCloseMs * 1000LL) {
+            closeConnection(conn);
+        }
+        else {
+            i++;
+        }
+    }
+}
+int GenaNotifier::connectTo(uint32_t ip, uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ESP_LOGW(TAG, "Error %s creating socket", strerror(errno));
+        return -1;
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = ip;
+    // non-blocking, for the connect timeout
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int err = 0;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        if (errno != EINPROGRESS) {
+            err = errno;
+        }
+        else {
+            fd_set wfds;
+            FD_ZERO(&wfds);
+            FD_SET(fd, &wfds);
+            timeval tv = { kConnectTimeoutMs / 1000, (kConnectTimeoutMs % 1000) * 1000 };
+            int ret = select(fd + 1, nullptr, &wfds, nullptr, &tv);
+            if (ret <= 0) {
+                err = ret ? errno : ETIMEDOUT;
+            }
+            else {
+                socklen_t len = sizeof(err);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            }
+        }
+    }
+    if (err) {
+        ESP_LOGW(TAG, "Error connecting to subscriber: %s", strerror(err));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, flags);
+    timeval tv = { kResponseTimeoutMs / 1000, (kResponseTimeoutMs % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+int GenaNotifier::readResponse(int fd, bool& keepAlive)
+{
+    char buf[512];
+    int len = 0;
+    char* hdrEnd = nullptr;
+    while (!hdrEnd) {
+        if (len >= (int)sizeof(buf) - 1) {
+            ESP_LOGW(TAG, "Response headers too long");
+            return -1;
+        }
+        auto ret = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+        if (ret <= 0) {
+            return -1;
+        }
+        len += ret;
+        buf[len] = 0;
+        hdrEnd = strstr(buf, "\r\n\r\n");
+    }
+    if (strncmp(buf, "HTTP/1.", 7) || !buf[7] || buf[8] != ' ') {
+        return -1;
+    }
+    int status = atoi(buf + 9);
+    keepAlive = buf[7] == '1';
+    int contentLen = 0;
+    *hdrEnd = 0;
+    for (char* line = strstr(buf, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLen = atoi(line + 15);
+        }
+        else if (strncasecmp(line, "Connection:", 11) == 0) {
+            const char* val = line + 11 + strspn(line + 11, " \t");
+            keepAlive = strncasecmp(val, "close", 5) != 0 && (keepAlive || strncasecmp(val, "keep-alive", 10) == 0);
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            keepAlive = false; // a chunked body is not skipped, so the connection can't be reused
+        }
+    }
+    // skip the body, the connection is reused only if it is read completely
+    int remain = contentLen - (len - (int)(hdrEnd + 4 - buf));
+    while (remain > 0) {
+        auto ret = recv(fd, buf, std::min(remain, (int)sizeof(buf)), 0);
+        if (ret <= 0) {
+            keepAlive = false;
+            break;
+        }
+        remain -= ret;
+    }
+    return status;
+}
@@ -0,0 +1,138 @@
+#ifndef GENA_NOTIFIER_HPP
+#define GENA_NOTIFIER_HPP
+#include <string>
+#include <vector>
+#include <list>
+#include <atomic>
+#include <algorithm>
+#include <stdint.h>
+#include <utils.hpp>
+#include <mutex.hpp>
+#include <task.hpp>
+#include <eventGroup.hpp>
+
+/** Sends the UPnP (GENA) events of the renderer services to the subscribed control points, from its own
+ * task, so that neither the audio player nor the http server wait for them.
+ * State changes are recorded per subscription, as the latest value of each state variable, and sent as
+ * one LastChange event once kCoalesceMs have passed since the first of them. A burst of changes, e.g.
+ * a track change or a volume knob turn, thus results in a single event with the final state, and the
+ * event rate is limited as required by the UPnP spec for LastChange.
+ * The connections to the subscribers are kept open (HTTP/1.1 persistent connections) and shared by the
+ * subscriptions with the same callback host, i.e. the two services of a control point. A send that fails
+ * is retried with exponential backoff, with the changes made in the meantime merged in. A subscription is
+ * dropped when it expires, or after kMaxFailures consecutive failed sends.
+ * The sockets are used directly rather than via esp_http_client, to control the connection reuse, and
+ * the requests are small and always the same.
+ */
+class GenaNotifier
+{
+public:
+    enum Service: uint8_t { kServiceRendCtl, kServiceAvTransport, kNumServices };
+    enum {
+        kCoalesceMs = 200,
+        kConnectTimeoutMs = 1500,
+        kResponseTimeoutMs = 2000,
+        kRetryBaseMs = 500, kRetryMaxMs = 8000,
+        kMaxFailures = 6,
+        kIdleCloseMs = 30000, // close a connection that was not used for that long
+        kMaxConnections = 4,
+        kStackSize = 3072, kPrio = 5
+    };
+    /** A state variable change. The name must be a literal, as it is stored by pointer. For
+     * RenderingControl variables, the "Master" channel is added */
+    struct Var
+    {
+        const char* name;
+        const char* value;
+    };
+    struct Stats
+    {
+        uint32_t numEvents = 0; // sent successfully
+        uint32_t numChanges = 0; // variable changes requested, i.e. notifications without coalescing
+        uint32_t numConnects = 0;
+        uint32_t numFailures = 0; // failed send attempts
+        uint32_t numDropped = 0; // subscriptions dropped due to expiry or failures
+    };
+    static const char kSidPrefix[];
+    enum { kSidBufSize = 48 };
+protected:
+    enum: EventBits_t { kEvtWork = 1, kEvtTerminate = 2 };
+    struct PendingVar
+    {
+        const char* name;
+        std::string value;
+    };
+    struct Subscription
+    {
+        uint32_t sid;
+        Service service;
+        bool active = false; // the subscribe response was sent, so events may be sent
+        uint32_t seq = 0; // of the next event, the initial one is 0
+        uint32_t ip; // network byte order
+        uint16_t port;
+        std::string hostPort; // for the HOST header
+        std::string path;
+        int64_t tsTill; // expiry, in us
+        int64_t tsFirstChange = 0; // of the oldest pending change, 0 if none is pending
+        int64_t tsNextTry = 0; // after a failed send
+        uint32_t changeGen = 0; // incremented on each change, to detect changes during a send
+        uint8_t numFailures = 0;
+        std::vector<PendingVar> pending;
+        void setVar(const char* name, const char* value);
+        int64_t tsDue() const;
+    };
+    // Used only by the task
+    struct Connection
+    {
+        uint32_t ip;
+        uint16_t port;
+        int fd;
+        int64_t tsLastUse;
+    };
+    Mutex mMutex; // protects the subscriptions and the stats
+    EventGroup mEvents;
+    Task mTask;
+    std::atomic<bool> mTerminate = {false};
+    std::list<Subscription> mSubs;
+    uint32_t mSidCounter = 0;
+    Stats mStats;
+    // used only by the task
+    std::vector<Connection> mConns;
+    std::string mTxBuf;
+    static void sTaskFunc(void* ctx);
+    void taskFunc();
+    Subscription* findSub(uint32_t sid);
+    void removeExpired(int64_t now);
+    Subscription* nextDue(int64_t now, int64_t& tsWake);
+    void buildEvent(const Subscription& sub);
+    int sendEvent(uint32_t ip, uint16_t port);
+    Connection* getConnection(uint32_t ip, uint16_t port, bool& isNew);
+    void closeConnection(Connection& conn);
+    void closeIdleConnections(int64_t now);
+    static int connectTo(uint32_t ip, uint16_t port);
+    /** Returns the status code, or -1 if no valid response was received */
+    static int readResponse(int fd, bool& keepAlive);
+public:
+    GenaNotifier() {}
+    ~GenaNotifier();
+    /** Creates an inactive subscription, for which no events are sent until startEvents() is called. The
+     * initial event, with SEQ 0, contains \c initial, the full state of the service.
+     * Returns the SID, or 0 if the callback url is invalid or can't be resolved */
+    uint32_t subscribe(Service service, const char* callbackUrl, uint32_t timeoutSec, const Var* initial, int numInitial);
+    /** To be called after the subscribe response was sent, as the initial event must not precede it */
+    void startEvents(uint32_t sid);
+    /** Extends the subscription, returns false if it does not exist (anymore) */
+    bool renew(uint32_t sid, uint32_t timeoutSec);
+    bool unsubscribe(uint32_t sid);
+    /** Records changes of state variables of a service, to be sent to its subscribers */
+    void changeVars(Service service, const Var* vars, int numVars);
+    template <size_t N>
+    void changeVars(Service service, const Var (&vars)[N]) { changeVars(service, vars, N); }
+    int numSubscriptions();
+    Stats stats();
+    static const char* strSid(uint32_t sid, char* buf);
+    /** Returns 0 if the SID is not one of ours */
+    static uint32_t parseSid(const char* sid);
+};
+
+#endif
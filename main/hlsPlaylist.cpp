@@ -0,0 +1,239 @@
+#include "hlsPlaylist.hpp"
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+
+bool HlsPlaylist::isHls(const char* data)
+{
+    while (isspace((uint8_t)*data)) {
+        data++;
+    }
+    if (strncmp(data, "#EXTM3U", 7) != 0) {
+        return false;
+    }
+    return strstr(data, "#EXT-X-TARGETDURATION:") || strstr(data, "#EXT-X-STREAM-INF:");
+}
+std::string HlsPlaylist::resolveUrl(const char* base, const char* ref)
+{
+    if (strstr(ref, "://")) {
+        return ref;
+    }
+    const char* scheme = strstr(base, "://");
+    if (!scheme) {
+        return ref;
+    }
+    if (ref[0] == '/' && ref[1] == '/') { // network-path reference
+        return std::string(base, scheme + 1) + ref;
+    }
+    const char* pathStart = strchr(scheme + 3, '/');
+    if (!pathStart) {
+        pathStart = base + strlen(base);
+    }
+    if (ref[0] == '/') {
+        return std::string(base, pathStart) + ref;
+    }
+    // relative to the directory of the base, which ends before the query, if any
+    const char* query = strchr(pathStart, '?');
+    std::string dir(base, query ? query : pathStart + strlen(pathStart));
+    auto slash = dir.rfind('/');
+    if (slash < (size_t)(pathStart - base)) {
+        dir += '/';
+    }
+    else {
+        dir.resize(slash + 1);
+    }
+    return dir + ref;
+}
+char* HlsPlaylist::readLine(char*& pos)
+{
+    while (isspace((uint8_t)*pos)) {
+        pos++;
+    }
+    if (!*pos) {
+        return nullptr;
+    }
+    char* line = pos;
+    while (*pos && *pos != '\r' && *pos != '\n') {
+        pos++;
+    }
+    char* end = pos;
+    if (*pos) {
+        pos++;
+    }
+    while (isspace((uint8_t)end[-1])) {
+        end--;
+    }
+    *end = 0;
+    return line;
+}
+bool HlsPlaylist::getAttr(const char* attrs, const char* name, std::string& value)
+{
+    auto nameLen = strlen(name);
+    for (const char* pos = attrs; *pos;) {
+        bool match = strncmp(pos, name, nameLen) == 0 && pos[nameLen] == '=';
+        const char* val = strchr(pos, '=');
+        if (!val) {
+            return false;
+        }
+        val++;
+        const char* end;
+        if (*val == '"') {
+            val++;
+            end = strchr(val, '"');
+            if (!end) {
+                end = val + strlen(val);
+            }
+        }
+        else {
+            end = strchr(val, ',');
+            if (!end) {
+                end = val + strlen(val);
+            }
+        }
+        if (match) {
+            value.assign(val, end);
+            return true;
+        }
+        pos = strchr(end, ',');
+        if (!pos) {
+            return false;
+        }
+        pos++;
+    }
+    return false;
+}
+void HlsPlaylist::parseStreamInf(const char* attrs, const char* url,
+    const std::vector<std::pair<std::string, std::string>>& audioGroups)
+{
+    Variant variant;
+    variant.url = url;
+    std::string val;
+    variant.bandwidth = getAttr(attrs, "BANDWIDTH", val) ? strtoul(val.c_str(), nullptr, 10) : 0;
+    getAttr(attrs, "CODECS", variant.codecs);
+    // audio in a separate rendition, the segments of the variant itself would be video only
+    if (getAttr(attrs, "AUDIO", val)) {
+        for (auto& group: audioGroups) {
+            if (group.first == val) {
+                variant.url = group.second;
+                break;
+            }
+        }
+    }
+    for (auto& existing: mVariants) { // variants that differ only in video share the audio rendition
+        if (existing.url == variant.url) {
+            existing.bandwidth = std::min(existing.bandwidth, variant.bandwidth);
+            return;
+        }
+    }
+    mVariants.push_back(std::move(variant));
+}
+static bool isAudioOnly(const std::string& codecs)
+{
+    if (codecs.empty()) {
+        return false;
+    }
+    for (size_t pos = 0; pos != std::string::npos;) {
+        while (codecs[pos] == ' ') {
+            pos++;
+        }
+        if (codecs.compare(pos, 4, "mp4a") != 0) {
+            return false;
+        }
+        pos = codecs.find(',', pos);
+        if (pos != std::string::npos) {
+            pos++;
+        }
+    }
+    return true;
+}
+bool HlsPlaylist::parse(char* data, const char* url)
+{
+    mVariants.clear();
+    mSegments.clear();
+    mTargetDurationMs = 0;
+    mEndList = false;
+    mUnsupported = nullptr;
+    if (!isHls(data)) {
+        return false;
+    }
+    std::vector<std::pair<std::string, std::string>> audioGroups; // group id, url of the audio rendition
+    const char* streamInf = nullptr; // attributes of the variant whose url is on the next line
+    uint32_t seq = 0;
+    int durationMs = 0;
+    bool discontinuity = false;
+    std::string val;
+    char* pos = data;
+    while (char* line = readLine(pos)) {
+        if (line[0] != '#') {
+            if (streamInf) {
+                parseStreamInf(streamInf, resolveUrl(url, line).c_str(), audioGroups);
+                streamInf = nullptr;
+            }
+            else {
+                mSegments.push_back(Segment{resolveUrl(url, line), seq++, durationMs, discontinuity});
+                durationMs = 0;
+                discontinuity = false;
+            }
+        }
+        else if (strncmp(line, "#EXTINF:", 8) == 0) {
+            durationMs = strtof(line + 8, nullptr) * 1000;
+        }
+        else if (strncmp(line, "#EXT-X-TARGETDURATION:", 22) == 0) {
+            mTargetDurationMs = atoi(line + 22) * 1000;
+        }
+        else if (strncmp(line, "#EXT-X-MEDIA-SEQUENCE:", 22) == 0) {
+            seq = strtoul(line + 22, nullptr, 10);
+        }
+        else if (strcmp(line, "#EXT-X-DISCONTINUITY") == 0) {
+            discontinuity = true;
+        }
+        else if (strcmp(line, "#EXT-X-ENDLIST") == 0) {
+            mEndList = true;
+        }
+        else if (strncmp(line, "#EXT-X-STREAM-INF:", 18) == 0) {
+            streamInf = line + 18;
+        }
+        else if (strncmp(line, "#EXT-X-MEDIA:", 13) == 0) {
+            const char* attrs = line + 13;
+            std::string group, isDefault;
+            if (!getAttr(attrs, "TYPE", val) || val != "AUDIO" || !getAttr(attrs, "GROUP-ID", group) ||
+                !getAttr(attrs, "URI", val)) {
+                continue;
+            }
+            auto it = std::find_if(audioGroups.begin(), audioGroups.end(),
+                [&group](const std::pair<std::string, std::string>& item) { return item.first == group; });
+            if (it == audioGroups.end()) {
+                audioGroups.emplace_back(group, resolveUrl(url, val.c_str()));
+            }
+            else if (getAttr(attrs, "DEFAULT", isDefault) && isDefault == "YES") {
+                it->second = resolveUrl(url, val.c_str());
+            }
+        }
+        else if (strncmp(line, "#EXT-X-MAP:", 11) == 0) {
+            mUnsupported = "fragmented MP4 segments";
+        }
+        else if (strncmp(line, "#EXT-X-KEY:", 11) == 0) {
+            if (!getAttr(line + 11, "METHOD", val) || val != "NONE") {
+                mUnsupported = "encrypted segments";
+            }
+        }
+    }
+    if (std::any_of(mVariants.begin(), mVariants.end(), [](const Variant& var) { return isAudioOnly(var.codecs); })) {
+        mVariants.erase(std::remove_if(mVariants.begin(), mVariants.end(),
+            [](const Variant& var) { return !isAudioOnly(var.codecs); }), mVariants.end());
+    }
+    std::stable_sort(mVariants.begin(), mVariants.end(),
+        [](const Variant& a, const Variant& b) { return a.bandwidth < b.bandwidth; });
+    return true;
+}
+const HlsPlaylist::Segment* HlsPlaylist::findSegment(uint32_t seq) const
+{
+    for (auto& seg: mSegments) {
+        if ((int32_t)(seg.seq - seq) >= 0) {
+            return &seg;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,55 @@
+#ifndef HLS_PLAYLIST_HPP
+#define HLS_PLAYLIST_HPP
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Parser of HTTP Live Streaming (RFC 8216) playlists: the master playlist, with the variants of a
+ * stream, and the media playlist, with its segments. Only what is needed to play an audio stream is
+ * parsed. Urls are resolved against the url of the playlist
+ */
+class HlsPlaylist
+{
+public:
+    struct Variant {
+        std::string url; // of the media playlist
+        uint32_t bandwidth; // peak bits per second
+        std::string codecs; // the CODECS attribute, e.g. "mp4a.40.2", empty if not specified
+    };
+    struct Segment {
+        std::string url;
+        uint32_t seq; // media sequence number
+        int durationMs;
+        bool discontinuity;
+    };
+protected:
+    std::vector<Variant> mVariants; // sorted by bandwidth, ascending
+    std::vector<Segment> mSegments;
+    int mTargetDurationMs = 0;
+    bool mEndList = false;
+    const char* mUnsupported = nullptr;
+    static char* readLine(char*& pos);
+    static bool getAttr(const char* attrs, const char* name, std::string& value);
+    void parseStreamInf(const char* attrs, const char* url, const std::vector<std::pair<std::string, std::string>>& audioGroups);
+public:
+    /** Whether \c data is an HLS playlist. Extended M3U radio playlists also start with #EXTM3U, but only
+     * HLS ones have the tags that are mandatory for master or media playlists */
+    static bool isHls(const char* data);
+    /** Returns the absolute url of \c ref, relative to \c base */
+    static std::string resolveUrl(const char* base, const char* ref);
+    /** Parses \c data, which is modified. Returns false if it's not an HLS playlist */
+    bool parse(char* data, const char* url);
+    bool isMaster() const { return !mVariants.empty(); }
+    /** Variants of a master playlist. If some are audio-only, as declared by their CODECS, only those */
+    const std::vector<Variant>& variants() const { return mVariants; }
+    const std::vector<Segment>& segments() const { return mSegments; }
+    int targetDurationMs() const { return mTargetDurationMs; }
+    /** No segments will be added, i.e. it's not a live stream */
+    bool endList() const { return mEndList; }
+    /** Name of a feature of the playlist that can't be played, or null */
+    const char* unsupported() const { return mUnsupported; }
+    /** The first segment with a sequence number not lower than \c seq, or null */
+    const Segment* findSegment(uint32_t seq) const;
+};
+
+#endif
@@ -0,0 +1,347 @@
+#include "hlsStream.hpp"
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+static const char* TAG = "hls";
+
+HlsStream::~HlsStream()
+{
+    if (mClient) {
+        esp_http_client_cleanup(mClient);
+    }
+}
+int8_t HlsStream::start(const char* url, char* playlist)
+{
+    mInBuf.reset((uint8_t*)malloc(kRecvSize));
+    mOutBuf.reset((uint8_t*)malloc(kRecvSize + TsDemuxer::kPacketSize));
+    esp_http_client_config_t cfg = {};
+    cfg.url = url;
+    cfg.timeout_ms = kHttpTimeoutMs;
+    cfg.buffer_size = kHttpClientBufSize;
+    cfg.method = HTTP_METHOD_GET;
+    mClient = esp_http_client_init(&cfg);
+    if (!mClient || !mInBuf || !mOutBuf) {
+        ESP_LOGE(TAG, "Out of memory");
+        return -2;
+    }
+    mSetHeaders(mClient);
+    if (!mPlaylist.parse(playlist, url)) {
+        return -2;
+    }
+    if (mPlaylist.isMaster()) {
+        // Only variants with the same codecs as the best one can be switched to without a new stream
+        auto& variants = mPlaylist.variants();
+        auto& codecs = variants.back().codecs;
+        for (auto& variant: variants) {
+            if (codecs.empty() || variant.codecs == codecs) {
+                mVariants.push_back(variant);
+            }
+        }
+        mVariant = 0; // the lowest bitrate, until the link speed is measured
+        mMediaUrl = mVariants[0].url;
+        ESP_LOGI(TAG, "Master playlist with %d usable variants, codecs '%s'", (int)mVariants.size(), codecs.c_str());
+        if (loadPlaylist() <= 0) {
+            return -1;
+        }
+    }
+    else {
+        mMediaUrl = url;
+        mTsPlaylistLoaded = esp_timer_get_time();
+        mLastSeqLoaded = mPlaylist.segments().empty() ? 0 : mPlaylist.segments().back().seq;
+    }
+    if (mPlaylist.unsupported()) {
+        ESP_LOGE(TAG, "Stream has %s, which are not supported", mPlaylist.unsupported());
+        return -2;
+    }
+    auto& segments = mPlaylist.segments();
+    if (segments.empty()) {
+        ESP_LOGW(TAG, "Media playlist has no segments");
+        return -1;
+    }
+    int first = mPlaylist.endList() ? 0 : std::max(0, (int)segments.size() - kLiveStartSegments);
+    mNextSeq = segments[first].seq;
+    ESP_LOGI(TAG, "%s playlist with %d segments, starting at segment %lu", mPlaylist.endList() ? "VOD" : "Live",
+        (int)segments.size(), mNextSeq);
+    while (!mCodec) {
+        if (mOutLen || mNetBytes > kMaxProbeSize || fillOutBuf() <= 0) {
+            ESP_LOGW(TAG, "Couldn't find a supported audio stream");
+            return -1;
+        }
+    }
+    ESP_LOGI(TAG, "Audio stream is %s", mCodec.toString());
+    return 0;
+}
+int HlsStream::request()
+{
+    for (int redirects = 0; redirects < 4; redirects++) {
+        if (esp_http_client_open(mClient, 0) != ESP_OK) {
+            return -1;
+        }
+        mContentLen = esp_http_client_fetch_headers(mClient);
+        int status = esp_http_client_get_status_code(mClient);
+        if (status != 301 && status != 302) {
+            return status;
+        }
+        esp_http_client_set_redirection(mClient);
+    }
+    return -1;
+}
+int8_t HlsStream::loadPlaylist()
+{
+    esp_http_client_set_url(mClient, mMediaUrl.c_str());
+    int status = request();
+    if (status != 200) {
+        ESP_LOGW(TAG, "Error %d loading media playlist %s", status, mMediaUrl.c_str());
+        return onError();
+    }
+    if (mContentLen > kMaxPlaylistSize) {
+        ESP_LOGE(TAG, "Media playlist is too large: %d bytes", (int)mContentLen);
+        return -1;
+    }
+    int size = mContentLen ? (int)mContentLen : (int)kMaxPlaylistSize;
+    unique_ptr_mfree<char> buf((char*)heap_caps_malloc(size + 1, utils::haveSpiRam() ? MALLOC_CAP_SPIRAM : MALLOC_CAP_DEFAULT));
+    if (!buf) {
+        ESP_LOGE(TAG, "Out of memory for media playlist");
+        return -1;
+    }
+    int len = 0;
+    while (len < size) {
+        int rlen = esp_http_client_read(mClient, buf.get() + len, size - len);
+        if (rlen <= 0) {
+            if (rlen < 0 || (mContentLen && !esp_http_client_is_complete_data_received(mClient))) {
+                ESP_LOGW(TAG, "Error receiving media playlist");
+                return onError();
+            }
+            break;
+        }
+        len += rlen;
+    }
+    buf.get()[len] = 0;
+    if (!mPlaylist.parse(buf.get(), mMediaUrl.c_str()) || mPlaylist.isMaster()) {
+        ESP_LOGE(TAG, "Invalid media playlist %s", mMediaUrl.c_str());
+        return -1;
+    }
+    mTsPlaylistLoaded = esp_timer_get_time();
+    auto& segments = mPlaylist.segments();
+    uint32_t lastSeq = segments.empty() ? 0 : segments.back().seq;
+    mPlaylistChanged = lastSeq != mLastSeqLoaded;
+    mLastSeqLoaded = lastSeq;
+    mVariantChanged = false;
+    ESP_LOGD(TAG, "Loaded media playlist, last segment: %lu", lastSeq);
+    return 1;
+}
+int8_t HlsStream::openNextSegment()
+{
+    if (mVariantChanged) {
+        auto ret = loadPlaylist();
+        if (ret <= 0) {
+            return ret;
+        }
+    }
+    auto seg = mPlaylist.findSegment(mNextSeq);
+    if (!seg) {
+        if (mPlaylist.endList()) {
+            ESP_LOGI(TAG, "End of playlist");
+            mEnded = true;
+            return 0;
+        }
+        int interval = mPlaylist.targetDurationMs();
+        if (!mPlaylistChanged) {
+            interval /= 2;
+        }
+        int msSinceLoad = (esp_timer_get_time() - mTsPlaylistLoaded) / 1000;
+        if (msSinceLoad < interval) {
+            mMsToWait = interval - msSinceLoad;
+            return 0;
+        }
+        auto ret = loadPlaylist();
+        if (ret <= 0) {
+            return ret;
+        }
+        seg = mPlaylist.findSegment(mNextSeq);
+        if (!seg) {
+            mMsToWait = mPlaylist.targetDurationMs() / 2;
+            return 0;
+        }
+    }
+    if (seg->seq != mNextSeq) {
+        ESP_LOGW(TAG, "Segments %lu to %lu are no longer in the playlist, skipping them", mNextSeq, seg->seq - 1);
+        mNextSeq = seg->seq;
+        mSegPos = 0;
+    }
+    esp_http_client_set_url(mClient, seg->url.c_str());
+    if (mSegPos) { // resume after an error
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%d-", mSegPos);
+        esp_http_client_set_header(mClient, "Range", range);
+    }
+    auto tsStart = esp_timer_get_time();
+    int status = request();
+    mNetUs = esp_timer_get_time() - tsStart;
+    mNetBytes = 0;
+    if (mSegPos) {
+        esp_http_client_delete_header(mClient, "Range");
+    }
+    if (status == 404 || status == 410) {
+        ESP_LOGW(TAG, "Segment %lu not found, skipping it", mNextSeq);
+        mNextSeq++;
+        mSegPos = 0;
+        return onError();
+    }
+    else if (status != 200 && status != 206) {
+        ESP_LOGW(TAG, "Error %d requesting segment %lu", status, mNextSeq);
+        return onError();
+    }
+    if (!mSegPos) {
+        mSegType = kSegUnknown;
+        mSegSkip = 0;
+        mTsDemuxer.reset();
+    }
+    else if (status == 200) { // range not supported, discard what we already have
+        mSegSkip += mSegPos;
+        mSegPos = 0;
+    }
+    if (seg->discontinuity) {
+        ESP_LOGI(TAG, "Discontinuity at segment %lu", mNextSeq);
+    }
+    ESP_LOGD(TAG, "Receiving segment %lu, %d bytes", mNextSeq, (int)mContentLen);
+    mSegOpen = true;
+    return 1;
+}
+int8_t HlsStream::fillOutBuf()
+{
+    if (!mSegOpen) {
+        auto ret = openNextSegment();
+        if (ret <= 0) {
+            return ret;
+        }
+    }
+    auto tsStart = esp_timer_get_time();
+    int rlen = esp_http_client_read(mClient, (char*)mInBuf.get(), kRecvSize);
+    mNetUs += esp_timer_get_time() - tsStart;
+    if (rlen > 0) {
+        mSegPos += rlen;
+        mNetBytes += rlen;
+        mNumErrors = 0;
+        processSegmentData(mInBuf.get(), rlen);
+        return 1;
+    }
+    // without a content length, the server closes the connection at the end of the segment
+    if (rlen == 0 && (esp_http_client_is_complete_data_received(mClient) || (!mContentLen && errno != EAGAIN))) {
+        onSegmentEnd();
+        return 1;
+    }
+    ESP_LOGW(TAG, "Error receiving segment %lu at offset %d", mNextSeq, mSegPos);
+    return onError();
+}
+static Codec packedAudioCodec(const uint8_t* data, int len)
+{
+    if (len < 2 || data[0] != 0xff || (data[1] & 0xe0) != 0xe0) {
+        return Codec::kCodecUnknown;
+    }
+    // the layer bits are 0 in an ADTS header
+    return (data[1] & 0x06) ? Codec::kCodecMp3 : Codec::kCodecAac;
+}
+void HlsStream::processSegmentData(const uint8_t* data, int len)
+{
+    if (mSegSkip) {
+        int skip = std::min(mSegSkip, len);
+        mSegSkip -= skip;
+        data += skip;
+        len -= skip;
+        if (!len) {
+            return;
+        }
+    }
+    if (mSegType == kSegUnknown) {
+        if (data[0] == TsDemuxer::kSyncByte) {
+            mSegType = kSegTs;
+        }
+        else if (len >= 10 && memcmp(data, "ID3", 3) == 0) {
+            // packed audio starts with an ID3 tag, with the timestamp of the segment. Its size is syncsafe
+            mSegSkip = 10 + ((data[6] & 0x7f) << 21 | (data[7] & 0x7f) << 14 | (data[8] & 0x7f) << 7 | (data[9] & 0x7f));
+            if (data[5] & 0x10) { // footer
+                mSegSkip += 10;
+            }
+            processSegmentData(data, len);
+            return;
+        }
+        else {
+            mSegType = kSegPacked;
+            auto codec = packedAudioCodec(data, len);
+            if (!mCodec) {
+                mCodec = codec;
+            }
+        }
+    }
+    if (mSegType == kSegTs) {
+        mOutLen += mTsDemuxer.demux(data, len, mOutBuf.get() + mOutLen);
+        if (!mCodec) {
+            mCodec = mTsDemuxer.codec();
+        }
+    }
+    else {
+        memcpy(mOutBuf.get() + mOutLen, data, len);
+        mOutLen += len;
+    }
+}
+void HlsStream::onSegmentEnd()
+{
+    if (mNetUs > 0) {
+        uint32_t speed = (int64_t)mNetBytes * 1000000 / mNetUs;
+        mLinkSpeed = mLinkSpeed ? (mLinkSpeed * 3 + speed) / 4 : speed;
+    }
+    ESP_LOGD(TAG, "Segment %lu complete, %d bytes in %d ms", mNextSeq, mNetBytes, (int)(mNetUs / 1000));
+    mSegOpen = false;
+    mSegPos = 0;
+    mNextSeq++;
+    if (mVariants.size() > 1) {
+        selectVariant();
+    }
+}
+void HlsStream::selectVariant()
+{
+    int best = 0;
+    for (int i = 1; i < (int)mVariants.size(); i++) {
+        if (mVariants[i].bandwidth / 8 <= (uint64_t)mLinkSpeed * kSpeedMarginPct / 100) {
+            best = i;
+        }
+    }
+    if (best == mVariant) {
+        return;
+    }
+    ESP_LOGI(TAG, "Link speed %lu kbps, switching from variant of %lu kbps to %lu kbps", mLinkSpeed * 8 / 1000,
+        mVariants[mVariant].bandwidth / 1000, mVariants[best].bandwidth / 1000);
+    mVariant = best;
+    mMediaUrl = mVariants[best].url;
+    mVariantChanged = true;
+}
+int8_t HlsStream::onError()
+{
+    esp_http_client_close(mClient);
+    mSegOpen = false;
+    if (++mNumErrors >= kMaxErrors) {
+        ESP_LOGE(TAG, "Too many errors, giving up");
+        return -1;
+    }
+    mMsToWait = (mNumErrors - 1) * 1000;
+    return 0;
+}
+int HlsStream::read(char* buf, int len)
+{
+    while (mOutPos >= mOutLen) {
+        mOutPos = mOutLen = 0;
+        auto ret = fillOutBuf();
+        if (ret <= 0) {
+            return ret;
+        }
+    }
+    len = std::min(len, mOutLen - mOutPos);
+    memcpy(buf, mOutBuf.get() + mOutPos, len);
+    mOutPos += len;
+    return len;
+}
@@ -0,0 +1,92 @@
+#ifndef HLS_STREAM_HPP
+#define HLS_STREAM_HPP
+#include <esp_http_client.h>
+#include <utils.hpp>
+#include "hlsPlaylist.hpp"
+#include "tsDemuxer.hpp"
+
+/** Receives an HTTP Live Streaming stream for HttpNode, and returns the audio elementary stream in it,
+ * i.e. ADTS AAC or MP3, as if it was received from a plain http stream.
+ * The segments are fetched one after the other over a single connection, which is kept alive if the
+ * server allows it. They are fetched as fast as they are read, so the ring buffer of HttpNode holds the
+ * upcoming segments while the current one plays. A live media playlist is reloaded when its known
+ * segments are exhausted, as RFC 8216 allows: not earlier than the target duration after the previous
+ * load, or half of it if the playlist didn't change. With a master playlist, the variant with the highest
+ * bitrate that the measured link speed can sustain is followed, switching at segment boundaries.
+ * MPEG-TS segments and packed audio segments (ADTS or MP3, with an ID3 tag) are supported. Fragmented
+ * MP4 and encrypted segments are not
+ */
+class HlsStream
+{
+public:
+    typedef void(*SetHeadersFunc)(esp_http_client_handle_t client);
+    enum {
+        kRecvSize = 2048, kHttpTimeoutMs = 10000, kHttpClientBufSize = 1024,
+        kMaxPlaylistSize = 64 * 1024,
+        kLiveStartSegments = 3, // a live stream starts this many segments before the end of the playlist
+        kMaxErrors = 6, // consecutive errors before giving up
+        kSpeedMarginPct = 80, // a variant is selected if its bandwidth is within this percentage of the link speed
+        kMaxProbeSize = 64 * 1024 // of the first segment, to find the audio stream
+    };
+protected:
+    enum SegmentType: uint8_t { kSegUnknown, kSegTs, kSegPacked };
+    SetHeadersFunc mSetHeaders;
+    esp_http_client_handle_t mClient = nullptr;
+    int64_t mContentLen = 0; // of the last response
+    std::vector<HlsPlaylist::Variant> mVariants; // that we can switch between, empty without a master playlist
+    int mVariant = 0;
+    bool mVariantChanged = false; // its media playlist has to be loaded
+    std::string mMediaUrl;
+    HlsPlaylist mPlaylist;
+    int64_t mTsPlaylistLoaded = 0;
+    uint32_t mLastSeqLoaded = 0; // of the last segment in the playlist when it was loaded
+    bool mPlaylistChanged = true;
+    uint32_t mNextSeq = 0; // sequence number of the segment being received, or the next one to request
+    bool mSegOpen = false;
+    SegmentType mSegType = kSegUnknown;
+    int mSegPos = 0; // bytes of the segment received, from where it's resumed after an error
+    int mSegSkip = 0; // bytes of the segment to discard: an ID3 tag, or a resent start
+    int mNetBytes = 0; // received since the segment was requested
+    int64_t mNetUs = 0; // time spent on requesting and receiving the segment
+    uint32_t mLinkSpeed = 0; // bytes per second, averaged over segments
+    TsDemuxer mTsDemuxer;
+    Codec mCodec;
+    unique_ptr_mfree<uint8_t> mInBuf;
+    unique_ptr_mfree<uint8_t> mOutBuf;
+    int mOutPos = 0;
+    int mOutLen = 0;
+    int mNumErrors = 0;
+    int mMsToWait = 0;
+    bool mEnded = false;
+    int request();
+    int8_t loadPlaylist();
+    int8_t openNextSegment();
+    int8_t fillOutBuf();
+    void processSegmentData(const uint8_t* data, int len);
+    void onSegmentEnd();
+    void selectVariant();
+    int8_t onError();
+public:
+    HlsStream(SetHeadersFunc setHeaders): mSetHeaders(setHeaders) {}
+    ~HlsStream();
+    /** Starts playing the stream of the master or media playlist \c playlist, received from \c url:
+     * receives its first segment until the codec is known. Returns 0 on success, -1 on a network error and
+     * -2 if the stream can't be played */
+    int8_t start(const char* url, char* playlist);
+    /** The codec of the returned data */
+    Codec codec() const { return mCodec; }
+    /** Reads up to \c len bytes of the audio stream. Returns the number of bytes, 0 if no data is available
+     * before msToWait() or if the stream ended, and -1 on a permanent error */
+    int read(char* buf, int len);
+    /** After read() returned 0: ms before there may be more data, i.e. a new segment in a live playlist,
+     * or after an error */
+    int msToWait() const { return mMsToWait; }
+    /** All segments of a playlist that is not live were read */
+    bool ended() const { return mEnded; }
+    /** Bandwidth of the variant being received, 0 if unknown */
+    uint32_t bandwidth() const { return mVariants.empty() ? 0 : mVariants[mVariant].bandwidth; }
+    /** Bytes per second, as measured on the segments received so far */
+    uint32_t linkSpeed() const { return mLinkSpeed; }
+};
+
+#endif
@@ -14,6 +14,9 @@
 #include "queue.hpp"
 #include "utils.hpp"
 #include "httpNode.hpp"
+#include <buffer.hpp>
+#include <nvsHandle.hpp>
+#include <esp_timer.h>
 
 #define LOCK() MutexLocker locker(mMutex)
 
@@ -64,10 +67,14 @@ bool HttpNode::createClient()
         ESP_LOGE(TAG, "Error creating http client, probably out of memory");
         return false;
     };
-    esp_http_client_set_header(mClient, "User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/92.0.4515.159 Safari/537.36");
-    esp_http_client_set_header(mClient, "Icy-MetaData", "1");
+    setClientHeaders(mClient);
     return true;
 }
+void HttpNode::setClientHeaders(esp_http_client_handle_t client)
+{
+    esp_http_client_set_header(client, "User-Agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/92.0.4515.159 Safari/537.36");
+    esp_http_client_set_header(client, "Icy-MetaData", "1");
+}
 
 esp_err_t HttpNode::httpHeaderHandler(esp_http_client_event_t *evt)
 {
@@ -82,17 +89,17 @@ esp_err_t HttpNode::httpHeaderHandler(esp_http_client_event_t *evt)
 void HttpNode::onHttpHeader(const char* key, const char* val)
 {
     if (strcasecmp(key, "Content-Type") == 0) {
-        mInFormat = StreamFormat::fromMimeType(val);
-        mRxChunkSize = mInFormat.rxChunkSize();
-        if (mWaitingPrefill) {
-            mWaitingPrefill = mInFormat.prefillAmount();
-        }
-        ESP_LOGI(TAG, "Parsed content-type '%s' as %s, rxChunkSize set to %d, prefill set to %d",
-            val, mInFormat.codec().toString(), mRxChunkSize, mWaitingPrefill);
+        auto fmt = StreamFormat::fromMimeType(val);
+        ESP_LOGI(TAG, "Parsed content-type '%s' as %s", val, fmt.codec().toString());
+        setInFormat(fmt);
     }
     else if ((strcasecmp(key, "accept-ranges") == 0) && (strcasecmp(val, "bytes") == 0)) {
         mAcceptsRangeRequests = true;
     }
+    else if (strcasecmp(key, "icy-br") == 0) {
+        LOCK();
+        mGovernor.setIcyBitrate(atoi(val)); // may be a list for multi-bitrate streams, take the first
+    }
     else if (strcasecmp(key, "icy-name") == 0) {
         if (val) {
             mStationNameHdr.reset(strdup(val));
@@ -102,13 +109,105 @@ void HttpNode::onHttpHeader(const char* key, const char* val)
         mIcyParser.parseHeader(key, val);
     }
 }
+void HttpNode::setInFormat(StreamFormat fmt)
+{
+    mInFormat = fmt;
+    mRxChunkSize = mInFormat.rxChunkSize();
+    int prefillAmount;
+    {
+        LOCK();
+        mGovernor.setFormat(mInFormat);
+        prefillAmount = mGovernor.prefillAmount();
+        if (mWaitingPrefill) {
+            mWaitingPrefill = prefillAmount;
+        }
+        applyBufferLimits();
+    }
+    poolReserveRxPackets(mRxChunkSize, prefillAmount);
+    ESP_LOGI(TAG, "Input format set to %s, rxChunkSize set to %d, prefill set to %d",
+        mInFormat.codec().toString(), mRxChunkSize, mWaitingPrefill);
+}
+void HttpNode::poolReserveRxPackets(int rxSize, int prefillAmount)
+{
+    // Preallocate enough rx packets to reach the prefill level without touching the heap.
+    // Beyond that, the pool grows to the peak number of buffered packets by itself
+    int count = std::min(prefillAmount / rxSize + 2, (int)kRingQueueLen);
+    LOCK();
+    if (rxSize == mPoolRsvdSize && count == mPoolRsvdCount) {
+        return;
+    }
+    PacketPool::unreserve(mPoolRsvdSize, mPoolRsvdCount);
+    PacketPool::reserve(rxSize, count);
+    mPoolRsvdSize = rxSize;
+    mPoolRsvdCount = count;
+}
 void HttpNode::clearRingBuffer()
 {
     ESP_LOGI(TAG, "Clearing ring buffer");
+    LOCK();
     mRingBuf.clear();
+    mByteRing.clear();
+    mEventPositions.clear();
+    mByteRingGen++;
     mSpeedProbe.reset();
 }
-bool HttpNode::connect(bool isReconnect)
+void HttpNode::byteRingSetupForStream()
+{
+    // Only decoders that can decode directly from a contiguous buffer benefit from the byte ring
+    auto& codec = mInFormat.codec();
+    bool use = mByteRingEnabled && (codec.transport == Codec::kTransportDefault) &&
+        (codec.type == Codec::kCodecMp3 || codec.type == Codec::kCodecAac);
+    if (use && !mByteRing.isAllocated()) {
+        // Allocated once and kept, because the consumer may still hold a pointer into it
+        use = mByteRing.allocBuf(StreamFormat(Codec::kCodecMp3).prefillAmount() * 4);
+    }
+    mInByteRing = use;
+    LOCK();
+    applyBufferLimits();
+}
+void HttpNode::applyBufferLimits()
+{
+    // The byte ring is allocated once for all streams, so the governor's limit is applied as a cap on
+    // its usable size
+    auto maxSize = mGovernor.maxBufferSize();
+    mRingBuf.setMaxDataSize(maxSize);
+    mByteRing.setMaxDataSize(maxSize);
+}
+void HttpNode::pushEvent(StreamPacket* pkt)
+{
+    // Record the position even for packet-mode streams, so that their events are not
+    // delivered before the data of a preceding byte-mode stream
+    if (mByteRing.isAllocated()) {
+        LOCK();
+        if (!mEventPositions.emplaceBack(mByteRing.writePos())) {
+            ESP_LOGW(TAG, "Too many pending events in byte stream mode, posting event immediately");
+        }
+    }
+    mRingBuf.pushBack(pkt);
+    mByteRing.notifyReader();
+}
+StreamEvent HttpNode::popEvent(PacketResult& pr)
+{
+    StreamPacket::unique_ptr pkt(mRingBuf.popFront());
+    if (!pkt) {
+        pr.streamId = mOutStreamId;
+        return kErrStreamStopped;
+    }
+    if (pkt->type != kEvtData) {
+        LOCK();
+        if (!mEventPositions.empty() && (int)(*mEventPositions.front() - mByteRing.readPos()) <= 0) {
+            mEventPositions.popFront();
+        }
+    }
+    if (pkt->type == kEvtStreamChanged) {
+        auto& pktChange = static_cast<NewStreamEvent&>(*pkt);
+        mOutStreamId = pktChange.streamId;
+        mOutByteRing = pktChange.flags & StreamPacket::kByteStream;
+        ESP_LOGI(TAG, "pullData: Returning start of new stream%s", mOutByteRing ? " (byte stream)" : "");
+    }
+    return pr.set(pkt);
+}
+bool HttpNode::connect(bool isReconnect, bool isNext)
 {
     if (state() != kStateRunning) {
         ESP_LOGW(TAG, "connect: soft assert: not in kStateRunning, but in state %s", stateToStr(state()));
@@ -119,17 +218,27 @@ bool HttpNode::connect(bool isReconnect)
         return false;
     }
     ESP_LOGI(mTag, "Connecting to '%s'...", url());
+    bool useWarm;
     {
         LOCK();
         if (!isReconnect) {
             mAcceptsRangeRequests = false;
-            clearRingBuffer(); // clear in case of hard reconnect
+            if (!isNext) { // otherwise the current stream is still being played from the ring buffer
+                clearRingBuffer(); // clear in case of hard reconnect
+                prefillStart();
+            }
             mStreamByteCtr = 0;
             mStationNameHdr.reset();
             mLastTitle.clear();
-            prefillStart();
         }
         recordingMaybeEnable();
+        if (isReconnect || isNext) {
+            mWarmSession.reset();
+        }
+        useWarm = (bool)mWarmSession;
+    }
+    if (useWarm) {
+        return connectWarm();
     }
     if (!mClient) {
         if (!createClient()) {
@@ -195,16 +304,98 @@ bool HttpNode::connect(bool isReconnect)
         }
         plSendEvent(kEventConnected, isReconnect);
         if (!isReconnect) {
-            ESP_LOGD(TAG, "Posting kStreamChange with codec %s and streamId %ld\n", mInFormat.codec().toString(), mUrlInfo->streamId);
-            mRingBuf.pushBack(new NewStreamEvent(mUrlInfo->streamId, mInFormat));
-            if (mWaitingPrefill) {
-                mRingBuf.pushBack(new PrefillEvent(mUrlInfo->streamId));
-            }
+            postStreamStart();
         }
         return true;
     }
     return false;
 }
+void HttpNode::postStreamStart()
+{
+    ESP_LOGD(TAG, "Posting kStreamChange with codec %s and streamId %ld\n", mInFormat.codec().toString(), mUrlInfo->streamId);
+    byteRingSetupForStream();
+    auto pkt = new NewStreamEvent(mUrlInfo->streamId, mInFormat);
+    if (mInByteRing) {
+        pkt->flags |= StreamPacket::kByteStream;
+    }
+    pushEvent(pkt);
+    if (mWaitingPrefill) {
+        pushEvent(new PrefillEvent(mUrlInfo->streamId));
+    }
+}
+bool HttpNode::connectWarm()
+{
+    StationPrewarmer::SessionPtr warm;
+    {
+        LOCK();
+        warm = std::move(mWarmSession);
+    }
+    destroyClient();
+    mClient = warm->releaseClient();
+    esp_http_client_set_timeout_ms(mClient, kHttpRecvTimeoutMs);
+    if (warm->streamUrl()) { // reconnects should go to the stream, not to the playlist
+        updateUrl(warm->streamUrl());
+    }
+    mInFormat = warm->format();
+    mRxChunkSize = mInFormat.rxChunkSize();
+    mContentLen = warm->contentLen();
+    mAcceptsRangeRequests = warm->acceptsRanges();
+    mIcyParser.takeStreamState(warm->icyParser());
+    int prefillAmount;
+    {
+        LOCK();
+        if (warm->stationName()) {
+            mStationNameHdr.reset(strdup(warm->stationName()));
+        }
+        if (warm->icyBitrate()) {
+            mGovernor.setIcyBitrate(warm->icyBitrate());
+        }
+        mGovernor.setFormat(mInFormat);
+        mGovernor.onData(warm->dataSize(), esp_timer_get_time());
+        prefillAmount = mGovernor.prefillAmount();
+        if (mWaitingPrefill) {
+            mWaitingPrefill = prefillAmount;
+        }
+        applyBufferLimits();
+    }
+    poolReserveRxPackets(mRxChunkSize, prefillAmount);
+    ESP_LOGI(TAG, "Took over pre-connected session to '%s', codec %s, %d bytes buffered", url(),
+        mInFormat.codec().toString(), warm->dataSize());
+    plSendEvent(kEventConnected, false);
+    postStreamStart();
+    warm->takeData([this](const uint8_t* data, int len) { pushWarmData(data, len); });
+    return true;
+}
+void HttpNode::pushWarmData(const uint8_t* data, int len)
+{
+    while (len > 0) {
+        int chunk;
+        if (mInByteRing) {
+            auto buf = mByteRing.writePtr(chunk);
+            if (!buf) {
+                return; // stop signal
+            }
+            chunk = std::min(chunk, len);
+            memcpy(buf, data, chunk);
+            mByteRing.commitWrite(chunk);
+        }
+        else {
+            chunk = std::min(len, (int)mRxChunkSize);
+            auto pkt = DataPacket::createWithoutFlags(chunk);
+            memcpy(pkt->data, data, chunk);
+            mRingBuf.pushBack(pkt);
+        }
+        {
+            LOCK();
+            mStreamByteCtr += chunk;
+        }
+        data += chunk;
+        len -= chunk;
+        if (mWaitingPrefill && (int)bufferedDataSize() >= mWaitingPrefill) {
+            prefillComplete();
+        }
+    }
+}
 int8_t HttpNode::handleResponseAsPlaylist(int32_t contentLen)
 {
     if (!isPlaylist()) {
@@ -225,6 +416,9 @@ int8_t HttpNode::handleResponseAsPlaylist(int32_t contentLen)
         return -1;
     }
     buf.get()[rlen] = 0;
+    if (HlsPlaylist::isHls(buf.get())) {
+        return startHls(buf.get());
+    }
     mPlaylist.load(buf.get());
     auto url = mPlaylist.getNextTrack();
     if (!url) {
@@ -235,8 +429,27 @@ int8_t HttpNode::handleResponseAsPlaylist(int32_t contentLen)
     return 1;
 }
 
+int8_t HttpNode::startHls(char* playlist)
+{
+    // The url is kept, so that a reconnect starts over from the playlist
+    ESP_LOGI(TAG, "Playlist is an HLS stream");
+    mHls.reset(new HlsStream(setClientHeaders));
+    auto ret = mHls->start(url(), playlist);
+    if (ret < 0) {
+        mHls.reset();
+        if (ret <= -2) {
+            plSendError(kErrNoCodec, 0);
+        }
+        return ret;
+    }
+    esp_http_client_close(mClient); // the segments are received by mHls, on its own connection
+    mContentLen = 0;
+    setInFormat(mHls->codec());
+    return 0;
+}
 void HttpNode::destroyClient()
 {
+    mHls.reset();
     if (!mClient) {
         return;
     }
@@ -255,19 +468,41 @@ bool HttpNode::isConnected() const
 int8_t HttpNode::recv()
 {
     for (int retries = 0; retries < 26; retries++) { // retry net errors
-        auto rxSize = mRxChunkSize; // we are unlocked, this may change at any time, so we need a locally cached value
-        DataPacket::unique_ptr dataPacket(DataPacket::createWithoutFlags(rxSize));
-        int rlen = esp_http_client_read(mClient, dataPacket->data, rxSize);
+        int rxSize = mRxChunkSize; // we are unlocked, this may change at any time, so we need a locally cached value
+        DataPacket::unique_ptr dataPacket;
+        char* buf;
+        if (mInByteRing) { // receive directly into the byte ring
+            int len;
+            buf = (char*)mByteRing.writePtr(len);
+            if (!buf) {
+                return 0; // stop signal, main loop will process the command
+            }
+            rxSize = std::min(rxSize, len);
+        }
+        else {
+            dataPacket.reset(DataPacket::createWithoutFlags(rxSize));
+            buf = dataPacket->data;
+        }
+        int rlen = mHls ? mHls->read(buf, rxSize) : esp_http_client_read(mClient, buf, rxSize);
         if (rlen <= 0) {
+            if (mHls && rlen == 0 && !mHls->ended()) {
+                // the live playlist has no new segment yet, or a segment is about to be retried
+                mCmdQueue.waitForMessage(mHls->msToWait());
+                return 0;
+            }
             if (mWaitingPrefill) {
                 prefillComplete();
             }
             if (rlen == 0) {
-                if (mContentLen && esp_http_client_is_complete_data_received(mClient)) {
+                if (mHls || (mContentLen && esp_http_client_is_complete_data_received(mClient))) {
                     // transfer complete, post end of stream
                     ESP_LOGI(TAG, "Transfer complete, posting kStreamEnd event (streamId=%ld)", mUrlInfo->streamId);
                     mStreamByteCtr = 0;
-                    mRingBuf.pushBack(new GenericEvent(kEvtStreamEnd, mUrlInfo->streamId, 0));
+                    mStreamComplete = true;
+                    pushEvent(new GenericEvent(kEvtStreamEnd, mUrlInfo->streamId, 0));
+                    if (mNextUrlInfo) {
+                        return connectNext() ? 0 : 1;
+                    }
                     return 1; // don't stop the node, just wait for new commands
                 }
                 else if (errno == EAGAIN) {
@@ -285,15 +520,20 @@ int8_t HttpNode::recv()
                 return 1; // main loop will process the command, but we won't reconnect
             }
             destroyClient(); // just in case
+            {
+                LOCK();
+                mGovernor.onDiscontinuity(true);
+            }
             connect(canResume());
             continue;
         }
         {
             LOCK();
             mSpeedProbe.onTraffic(rlen);
+            mGovernor.onData(rlen, esp_timer_get_time());
             if (mIcyParser.icyInterval()) {
                 bool isFirst = !mIcyParser.trackName();
-                bool gotTitle = mIcyParser.processRecvData(dataPacket->data, rlen);
+                bool gotTitle = mIcyParser.processRecvData(buf, rlen);
                 if (gotTitle) {
                     const char* newTitle = mIcyParser.trackName();
                     if (!newTitle) {
@@ -306,7 +546,7 @@ int8_t HttpNode::recv()
                             mIcyParser.trackName() ? strdup(mIcyParser.trackName()) : nullptr, nullptr));
                         {
                             MutexUnlocker unlocker(mMutex);
-                            mRingBuf.pushBack(pkt.release());
+                            pushEvent(pkt.release());
                         }
                         // offset of title within packet: (rlen - mIcyParser.bytesSinceLastMeta())
                         if (mRecorder && !isFirst) { // start recording only on second icy track event - first track may be incomplete
@@ -316,15 +556,20 @@ int8_t HttpNode::recv()
                     }
                 }
             }
-            dataPacket->dataLen = rlen;
             mStreamByteCtr += rlen;
             if (mRecorder) {
-                mRecorder->onData(dataPacket->data, dataPacket->dataLen);
+                mRecorder->onData(buf, rlen);
             }
         }
-        mRingBuf.pushBack(dataPacket.release());
-        ESP_LOGD(TAG, "Received %d bytes, wrote to ringbuf (%d)", rlen, mRingBuf.dataSize());
-        if (mWaitingPrefill && mRingBuf.dataSize() >= mWaitingPrefill) {
+        if (dataPacket) {
+            dataPacket->dataLen = rlen;
+            mRingBuf.pushBack(dataPacket.release());
+        }
+        else {
+            mByteRing.commitWrite(rlen);
+        }
+        ESP_LOGD(TAG, "Received %d bytes, wrote to ringbuf (%lu)", rlen, bufferedDataSize());
+        if (mWaitingPrefill && (int)bufferedDataSize() >= mWaitingPrefill) {
             prefillComplete();
         }
         return 0;
@@ -339,8 +584,12 @@ uint32_t HttpNode::pollSpeed()
 //  return mSpeedProbe.average();
 }
 
-void HttpNode::setUrlAndStart(UrlInfo* urlInfo)
+void HttpNode::setUrlAndStart(UrlInfo* urlInfo, StationPrewarmer::SessionPtr warm)
 {
+    {
+        LOCK();
+        mWarmSession = std::move(warm);
+    }
     if (mState == AudioNodeWithTask::kStateTerminated) {
         run();
     }
@@ -348,9 +597,64 @@ void HttpNode::setUrlAndStart(UrlInfo* urlInfo)
     mCmdQueue.post(kCommandSetUrl, (uintptr_t)urlInfo);
 }
 
+void HttpNode::setNextUrl(UrlInfo* urlInfo)
+{
+    ESP_LOGI(mTag, "Posting setNextUrl command");
+    mCmdQueue.post(kCommandSetNextUrl, (uintptr_t)urlInfo);
+}
+bool HttpNode::connectNext()
+{
+    myassert(mNextUrlInfo && mStreamComplete);
+    auto streamId = mNextUrlInfo->streamId;
+    ESP_LOGI(mTag, "Connecting to next url, %lu bytes of the current stream still buffered", bufferedDataSize());
+    destroyClient();
+    doSetUrl(mNextUrlInfo.release());
+    governorStartSession();
+    mStreamComplete = false;
+    if (connect(false, true)) {
+        return true;
+    }
+    // let the buffered data of the current stream play out, then end the next one, so that the player stops
+    mStreamComplete = true;
+    pushEvent(new GenericEvent(kEvtStreamEnd, streamId, 0));
+    return false;
+}
+bool HttpNode::seekStream(uint32_t pos)
+{
+    LOCK();
+    // the consumer must be reading the stream that we are receiving, i.e. not one before a gapless transition
+    if (!mUrlInfo || mUrlInfo->streamId != mOutStreamId || !canResume()) {
+        ESP_LOGW(mTag, "Stream seek requested, but not supported by server or stream is no longer current");
+        return false;
+    }
+    mCmdQueue.post(kCommandSeek, pos);
+    return true;
+}
+void HttpNode::doSeek(uint32_t pos)
+{
+    if (!mUrlInfo || mUrlInfo->streamId != mOutStreamId) {
+        ESP_LOGW(mTag, "Ignoring seek request for a stream that is no longer current");
+        return;
+    }
+    ESP_LOGI(mTag, "Seeking to byte offset %lu", pos);
+    destroyClient();
+    clearRingBuffer();
+    mStreamComplete = false;
+    mStreamByteCtr = pos;
+    pushEvent(new GenericEvent(kEvtSeek, mUrlInfo->streamId, 0));
+    {
+        LOCK();
+        mGovernor.onDiscontinuity(false);
+    }
+    if (!connect(true)) { // resume from mStreamByteCtr
+        mStreamComplete = true;
+        pushEvent(new GenericEvent(kEvtStreamEnd, mUrlInfo->streamId, 0));
+    }
+}
 void HttpNode::onStopRequest()
 {
     mRingBuf.setStopSignal();
+    mByteRing.setStopSignal();
 }
 
 bool HttpNode::dispatchCommand(Command &cmd)
@@ -362,15 +666,32 @@ bool HttpNode::dispatchCommand(Command &cmd)
     case kCommandSetUrl: {
         destroyClient();
         doSetUrl((UrlInfo*)cmd.arg);
+        governorStartSession();
+        {
+            LOCK();
+            if (mWarmSession && strcmp(mWarmSession->url(), url()) != 0) { // superseded by a later setUrl
+                mWarmSession.reset();
+            }
+        }
+        mNextUrlInfo.reset();
+        mStreamComplete = false;
         // must be cleared before going into kStateRunning because player will start the output node
         // which will start reading from us. Before we had a prefill set here, which guaranteed some delay
         // to clear the ringbuf in connect(). Now we don't have to wait prefill for the first audio packet
         clearRingBuffer();
         mRingBuf.clearStopSignal();
+        mByteRing.clearStopSignal();
         cmd.arg = 0;
         setState(kStateRunning);
         break;
     }
+    case kCommandSetNextUrl:
+        mNextUrlInfo.reset((UrlInfo*)cmd.arg);
+        cmd.arg = 0;
+        break;
+    case kCommandSeek:
+        doSeek(cmd.arg);
+        break;
     default:
         return false;
     }
@@ -381,13 +702,20 @@ void HttpNode::nodeThreadFunc()
 {
     ESP_LOGI(TAG, "Task started");
     mRingBuf.clearStopSignal();
+    mByteRing.clearStopSignal();
     for (;;) {
         processMessages();
         if (mTerminate) {
             return;
         }
         myassert(mState == kStateRunning);
-        if (!isConnected()) {
+        if (mStreamComplete) {
+            // idle until a new url is set, unless the next url has been set meanwhile
+            if (!mNextUrlInfo || !connectNext()) {
+                continue;
+            }
+        }
+        else if (!isConnected()) {
             if (!connect()) {
                 stop(false);
                 continue;
@@ -411,12 +739,40 @@ HttpNode::~HttpNode()
 {
     terminate(true);
     destroyClient();
+    governorEndSession();
+    PacketPool::unreserve(mPoolRsvdSize, mPoolRsvdCount);
 }
 
 HttpNode::HttpNode(IAudioPipeline& parent)
     : AudioNodeWithTask(parent, "node-http", true, kStackSize, 15, kCpuCore), mIcyParser(mMutex)
 {
 }
+void HttpNode::setBufferGovernorStore(NvsHandle& nvs)
+{
+    uint8_t data[BufferGovernor::kMaxStatsSize];
+    int len = sizeof(data);
+    LOCK();
+    mGovernorNvs = &nvs;
+    if (nvs.readBlob("bufGov", data, len) == ESP_OK && !mGovernor.loadStats(data, len)) {
+        ESP_LOGW(TAG, "Invalid stored buffer stats, ignoring");
+    }
+}
+void HttpNode::governorEndSession()
+{
+    LOCK();
+    if (!mGovernor.endSession() || !mGovernorNvs) {
+        return;
+    }
+    int len;
+    auto data = mGovernor.statsData(len);
+    MY_ESP_ERRCHECK(mGovernorNvs->writeBlob("bufGov", data, len), TAG, "saving buffer stats", return);
+}
+void HttpNode::governorStartSession()
+{
+    governorEndSession();
+    LOCK();
+    mGovernor.startSession(BufferGovernor::keyFromUrl(url()));
+}
 void HttpNode::prefillStart()
 {
     mWaitingPrefill = 1;
@@ -429,23 +785,82 @@ void HttpNode::prefillComplete()
 }
 StreamEvent HttpNode::pullData(PacketResult& pr)
 {
+    mQueueTrace.sample(mRingBuf.size(), bufferedDataSize());
+    if (mOutByteRing) {
+        // The consumer doesn't use the byte stream API, i.e. discarding data before a new stream
+        const uint8_t* data;
+        int len;
+        auto evt = peekBytes(1, data, len, pr);
+        if (evt) {
+            return evt;
+        }
+        len = std::min(len, (int)mRxChunkSize);
+        auto pkt = DataPacket::createWithoutFlags(len);
+        memcpy(pkt->data, data, len);
+        consumeBytes(len);
+        return pr.set(pkt);
+    }
     if (!mRingBuf.dataSize() && !mWaitingPrefill && mStreamByteCtr) {
         LOCK();
-        mWaitingPrefill = mInFormat.prefillAmount();
+        mWaitingPrefill = mGovernor.onUnderrun();
+        applyBufferLimits();
         ESP_LOGW(TAG, "Underrun: prefilling with %d bytes", mWaitingPrefill);
         return pr.set(new PrefillEvent(mOutStreamId));
     }
-    StreamPacket::unique_ptr pkt(mRingBuf.popFront());
-    if (!pkt) {
-        pr.streamId = mOutStreamId;
-        return kErrStreamStopped;
+    return popEvent(pr);
+}
+StreamEvent HttpNode::peekBytes(int minLen, const uint8_t*& data, int& len, PacketResult& pr)
+{
+    static_assert((int)kMaxPeekBytes <= (int)ByteRing::kMirrorSize, "Max peek size exceeds byte ring mirror size");
+    myassert(minLen > 0 && minLen <= kMaxPeekBytes);
+    mQueueTrace.sample(mRingBuf.size(), bufferedDataSize());
+    for (;;) {
+        auto seq = mByteRing.writeSeq();
+        {
+            LOCK();
+            // number of bytes before the next event, -1 if no event is pending in the byte stream
+            int boundary = mEventPositions.empty() ? -1 : (int)(*mEventPositions.front() - mByteRing.readPos());
+            if (boundary <= 0 && !mRingBuf.empty()) {
+                return popEvent(pr);
+            }
+            int avail = mByteRing.dataSize();
+            if (boundary >= 0 && boundary < avail) {
+                avail = boundary;
+            }
+            if (avail >= minLen || (avail > 0 && avail == boundary)) {
+                len = std::min(avail, (int)kMaxPeekBytes);
+                data = mByteRing.peek(len);
+                mPeekGen = mByteRingGen;
+                return kEvtData;
+            }
+            if (!avail && boundary < 0 && !mWaitingPrefill && mStreamByteCtr) {
+                mWaitingPrefill = mGovernor.onUnderrun();
+                applyBufferLimits();
+                ESP_LOGW(TAG, "Underrun: prefilling with %d bytes", mWaitingPrefill);
+                return pr.set(new PrefillEvent(mOutStreamId));
+            }
+        }
+        if (mByteRing.waitForWrite(seq) < 0) {
+            pr.streamId = mOutStreamId;
+            return kErrStreamStopped;
+        }
     }
-    if (pkt->type == kEvtStreamChanged) {
-        auto& pktChange = static_cast<NewStreamEvent&>(*pkt);
-        mOutStreamId = pktChange.streamId;
-        ESP_LOGI(TAG, "pullData: Returning start of new stream");
+}
+void HttpNode::consumeBytes(int len)
+{
+    LOCK();
+    if (mPeekGen == mByteRingGen) { // otherwise the ring was cleared after the peek
+        mByteRing.consume(len);
+    }
+}
+void HttpNode::perfExtraToJson(DynBuffer& buf)
+{
+    buf.printf(",\"queue\":");
+    mQueueTrace.toJson(buf);
+    LOCK();
+    if (mRecorder) {
+        buf.printf(",\"recBacklog\":%d,\"recDropped\":%u", mRecorder->backlog(), (unsigned)mRecorder->droppedBytes());
     }
-    return pr.set(pkt);
 }
 DataPacket* HttpNode::peekData(bool& preceded)
 {
@@ -458,7 +873,13 @@ StreamPacket* HttpNode::peek()
 void HttpNode::notifyFormatDetails(StreamFormat fmt)
 {
     auto rxSize = fmt.rxChunkSize();
-    auto prefillAmount = fmt.prefillAmount();
+    int prefillAmount;
+    {
+        LOCK();
+        mGovernor.setFormat(fmt);
+        prefillAmount = mGovernor.prefillAmount();
+    }
+    poolReserveRxPackets(rxSize, prefillAmount);
     LOCK();
     mInFormat = fmt;
     if (mRxChunkSize != rxSize) {
@@ -469,7 +890,7 @@ void HttpNode::notifyFormatDetails(StreamFormat fmt)
         ESP_LOGI(TAG, "Updated prefill size from %d to %d", mWaitingPrefill, prefillAmount);
         mWaitingPrefill = prefillAmount;
     }
-    mRingBuf.setMaxDataSize(prefillAmount * 4);
+    applyBufferLimits();
 }
 bool HttpNode::recordingMaybeEnable() {
     auto staName = recStaName();
@@ -478,13 +899,17 @@ bool HttpNode::recordingMaybeEnable() {
     }
     ESP_LOGW(TAG, "Preparing recorder for station %s", staName);
     if (!mRecorder) {
-        mRecorder.reset(new TrackRecorder("/sdcard/rec"));
+        mRecorder.reset(new TrackRecorder("/sdcard/rec", onRecorderStopped, this));
     }
     mRecorder->setStation(staName);
     plSendEvent(kEventRecording, true);
     return true;
 }
 
+void HttpNode::onRecorderStopped(void* arg, bool recording)
+{
+    static_cast<HttpNode*>(arg)->plSendEvent(kEventRecording, recording);
+}
 void HttpNode::recordingCancelCurrent() {
     LOCK();
     if (!mRecorder) {
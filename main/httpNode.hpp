@@ -20,8 +20,14 @@
 #include "speedProbe.hpp"
 #include "recorder.hpp"
 #include "streamRingQueue.hpp"
+#include "byteRing.hpp"
+#include "bufferGovernor.hpp"
+#include "stationPrewarmer.hpp"
+#include "hlsStream.hpp"
 #include <cStringTuple.hpp>
 
+class NvsHandle;
+
 class HttpNode: public AudioNodeWithTask, public IInputAudioNode
 {
 public:
@@ -41,18 +47,35 @@ public:
 protected:
     enum {
         kHttpRecvTimeoutMs = 10000, kHttpClientBufSize = 1024, kRingQueueLen = 256, kStackSize = 5120,
-        kCpuCore = 1
+        kCpuCore = 1, kMaxRingEvents = 32
     };
-    enum: uint8_t { kCommandSetUrl = AudioNodeWithTask::kCommandLast + 1 };
+    enum: uint8_t { kCommandSetUrl = AudioNodeWithTask::kCommandLast + 1, kCommandSetNextUrl, kCommandSeek };
     // Read mode dictates how the pullData() caller behaves. Since it may
     // need to wait for the read mode to change to a specific value, the enum values
     // are flags
     UrlInfo::unique_ptr mUrlInfo;
+    // Gapless playback: when the transfer of the current url completes, the next url is connected
+    // right away, and its stream is queued after the current one, without clearing the ring buffer
+    UrlInfo::unique_ptr mNextUrlInfo;
+    bool mStreamComplete = false; // the transfer of the current url is complete, nothing more to receive
     esp_http_client_handle_t mClient = nullptr;
     StreamFormat mInFormat; // is not Codec, because PCM needs sample format info as well
     StreamId mOutStreamId = 0;
     Playlist mPlaylist; /* media playlist */
+    // Set when the url is an HLS playlist: the stream data is read from it, instead of from mClient
+    std::unique_ptr<HlsStream> mHls;
     StreamRingQueue<kRingQueueLen> mRingBuf;
+    // Byte stream mode: stream data goes to mByteRing and only events go to mRingBuf. The ring position
+    // of each event is queued in mEventPositions. Events without a queued position are delivered
+    // immediately (i.e. posted in packet mode)
+    ByteRing mByteRing;
+    RingQueue<uint32_t, kMaxRingEvents> mEventPositions;
+    QueueDepthTrace mQueueTrace;
+    uint32_t mByteRingGen = 0; // incremented when the byte ring is cleared, to invalidate a pending peek
+    uint32_t mPeekGen = 0;
+    bool mByteRingEnabled = true;
+    bool mInByteRing = false; // current input stream uses the byte ring
+    bool mOutByteRing = false; // current output stream uses the byte ring
     int64_t mStreamByteCtr = 0;
     int mContentLen = 0;
     unique_ptr_mfree<const char> mStationNameHdr;
@@ -60,21 +83,41 @@ protected:
     IcyParser mIcyParser;
     std::unique_ptr<TrackRecorder> mRecorder;
     int16_t mRxChunkSize = 0;
+    int16_t mPoolRsvdSize = 0; // rx packet pool reservation currently held by us
+    int16_t mPoolRsvdCount = 0;
     bool mAcceptsRangeRequests = false;
     volatile int mWaitingPrefill = 0;
+    // Sizes the prefill and the max buffer per station, from the link behavior seen in previous sessions
+    BufferGovernor mGovernor;
+    NvsHandle* mGovernorNvs = nullptr;
+    StationPrewarmer::SessionPtr mWarmSession; // pre-connected session of the url being set, if any
     static esp_err_t httpHeaderHandler(esp_http_client_event_t *evt);
     void onHttpHeader(const char* key, const char* val);
+    void setInFormat(StreamFormat fmt);
     bool canResume() const { return (mContentLen != 0) && mAcceptsRangeRequests; }
     bool isPlaylist();
     bool createClient();
     bool parseContentType();
     int8_t handleResponseAsPlaylist(int32_t contentLen);
+    int8_t startHls(char* playlist);
     void doSetUrl(UrlInfo* urlInfo);
     void updateUrl(const char* url);
     void clearRingBuffer();
+    void byteRingSetupForStream();
+    void applyBufferLimits(); // sets the max data size of the buffers from mGovernor, with mMutex locked
+    void pushEvent(StreamPacket* pkt);
+    StreamEvent popEvent(PacketResult& pr);
+    void poolReserveRxPackets(int rxSize, int prefillAmount);
     void prefillStart();
     void prefillComplete();
-    bool connect(bool isReconnect=false);
+    void governorStartSession();
+    void governorEndSession();
+    bool connect(bool isReconnect=false, bool isNext=false);
+    bool connectWarm();
+    void pushWarmData(const uint8_t* data, int len);
+    void postStreamStart();
+    bool connectNext();
+    void doSeek(uint32_t pos);
     void disconnect();
     void destroyClient();
     int8_t recv();
@@ -86,6 +129,7 @@ protected:
     bool recordingMaybeEnable();
     void recordingStop();
     void recordingCancelCurrent();
+    static void onRecorderStopped(void* arg, bool recording);
 public:
     IcyInfo& icyInfo() { return mIcyParser; }
     HttpNode(IAudioPipeline& parent);
@@ -93,18 +137,30 @@ public:
     virtual Type type() const { return kTypeHttpIn; }
     virtual StreamEvent pullData(PacketResult& pr);
     virtual void onStopped() override { recordingCancelCurrent(); }
+    virtual void perfExtraToJson(DynBuffer& buf) override;
     virtual DataPacket* peekData(bool& preceded) override;
     virtual StreamPacket* peek() override;
     virtual void notifyFormatDetails(StreamFormat fmt) override;
     virtual IInputAudioNode* inputNodeIntf() override { return static_cast<IInputAudioNode*>(this); }
-    void setUrlAndStart(UrlInfo* urlInfo);
+    /** If \c warm is set, its connection and buffered data are used, instead of connecting to the url */
+    void setUrlAndStart(UrlInfo* urlInfo, StationPrewarmer::SessionPtr warm = nullptr);
+    /** Sets the url to be played after the current one, with no gap. Null clears it */
+    void setNextUrl(UrlInfo* urlInfo);
     bool isConnected() const;
     const char* trackName() const;
     bool recordingIsActive() const;
     bool recordingIsEnabled() const;
     virtual uint32_t pollSpeed() override;
-    virtual uint32_t bufferedDataSize() const override { return mRingBuf.dataSize(); }
+    virtual uint32_t bufferedDataSize() const override { return mRingBuf.dataSize() + mByteRing.dataSize(); }
+    virtual bool byteStreamActive() const override { return mOutByteRing; }
+    virtual StreamEvent peekBytes(int minLen, const uint8_t*& data, int& len, PacketResult& pr) override;
+    virtual void consumeBytes(int len) override;
+    virtual bool seekStream(uint32_t pos) override;
+    void enableByteStream(bool enable) { mByteRingEnabled = enable; } // takes effect from the next stream
+    /** Loads the learned per-station buffer stats from NVS, and saves them there after each session */
+    void setBufferGovernorStore(NvsHandle& nvs);
     void logStartOfRingBuf(const char* msg);
+    static void setClientHeaders(esp_http_client_handle_t client);
 protected:
     mutable LinkSpeedProbe mSpeedProbe;
 public:
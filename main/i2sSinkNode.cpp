@@ -10,7 +10,7 @@
 #include "i2sSinkNode.hpp"
 #include <magic_enum.hpp>
 #include <limits>
-#define DEBUG_TIMING 1
+#include <buffer.hpp>
 
 void I2sOutputNode::setDacMutePin(uint8_t level)
 {
@@ -103,6 +103,7 @@ bool I2sOutputNode::dispatchCommand(Command &cmd)
 }
 void I2sOutputNode::onStopped()
 {
+    mStreamEnded = false;
     muteDac();
 }
 void I2sOutputNode::nodeThreadFunc()
@@ -121,20 +122,12 @@ void I2sOutputNode::nodeThreadFunc()
         myassert(mState == kStateRunning);
         while (!mTerminate && (mCmdQueue.numMessages() == 0)) {
             PacketResult dpr;
-#ifdef DEBUG_TIMING
-            ElapsedTimer t;
-#endif
-            auto evt = mPrev->pullData(dpr);
-#ifdef DEBUG_TIMING
-            auto elapsed = t.usElapsed();
-#if DEBUG_TIMING < 2
-            if (elapsed >= 12000) {
-#endif
-                ESP_LOGI(mTag, "pullData took %d ms", (int)((elapsed + 500) / 1000));
-#if DEBUG_TIMING < 2
+            PacketBatch batch;
+            auto evt = mPrev->pullBatchProfiled(dpr, batch, kPullBatchSize);
+            auto elapsed = mPrev->pullStats().lastUs();
+            if (elapsed >= kSlowPullLogUs) {
+                ESP_LOGI(mTag, "pullBatch took %d ms", (int)((elapsed + 500) / 1000));
             }
-#endif
-#endif
             if (evt) {
                 if (evt < 0) {
                     ESP_LOGI(mTag, "Got stream error %s", magic_enum::enum_name(evt).data());
@@ -160,14 +153,17 @@ void I2sOutputNode::nodeThreadFunc()
                                 break;
                             }
                         }
-                        else {
+                        else if (!mStreamEnded) {
                             setFade(true);
-                        }
-                        mSampleCtr = 0;
+                        } // else gapless continuation of the previous stream, the output is not interrupted
+                        mStreamEnded = false;
+                        mPts.reset(pkt.seekTime, pkt.fmt.sampleRate());
+                        mWrittenPts = mPts.pts;
                         mStreamId = pkt.streamId;
                         plSendEvent(kEventNewStream, 0, (uintptr_t)dpr.packet.get());
                     }
                     else if (evt == kEvtStreamEnd) {
+                        mStreamEnded = true;
                         plSendEvent(kEventStreamEnd, dpr.genericEvent().streamId);
                     }
                     else if (evt == kEvtPrefill) {
@@ -190,43 +186,78 @@ void I2sOutputNode::nodeThreadFunc()
                 continue;
             }
             // we have data
-            auto& pkt = dpr.dataPacket();
-            myassert(pkt.dataLen);
-            {
-                MutexLocker locker(mutex);
-                mSampleCtr += pkt.dataLen >> mBytesPerSampleShiftDiv;
-            }
-            if (mFadeFunc) {
-                (this->*mFadeFunc)(pkt);
-            }
-            size_t written = 0;
-            if (!mChanStarted) {
-                MY_ESP_ERRCHECK(i2s_channel_preload_data(mI2sChan, pkt.data, pkt.dataLen, &written), mTag, "pre-loading DMA", continue);
-                if (written == pkt.dataLen) {
-                    continue;
-                }
-                i2s_channel_enable(mI2sChan);
-                mChanStarted = true;
-                plSendEvent(kEventPlaying);
-                vTaskDelay(kTicksBeforeDacUnmute);
-                unMuteDac();
-                MY_ESP_ERRCHECK(i2s_channel_write(mI2sChan, pkt.data + written, pkt.dataLen - written,
-                    &written, 0xffffffff), mTag, "calling i2s_channel_write()", continue);
-            }
-            else {
-                MY_ESP_ERRCHECK(i2s_channel_write(mI2sChan, pkt.data, pkt.dataLen, &written, 0xffffffff), mTag,
-                    "calling i2s_channel_write()", continue);
-                if (written != pkt.dataLen) {
-                    ESP_LOGW(mTag, "is2_channel_write() wrote less than requested, with infinite timeout");
-                }
-                if (mDacMuted) {
-                    vTaskDelay(kTicksBeforeDacUnmute);
-                    unMuteDac();
-                }
+            for (int i = 0; i < batch.count; i++) {
+                writePacket(batch[i]);
             }
         }
     }
 }
+void I2sOutputNode::writePacket(DataPacket& pkt)
+{
+    myassert(pkt.dataLen);
+    if (mFadeFunc) {
+        (this->*mFadeFunc)(pkt);
+    }
+    size_t written = 0;
+    if (!mChanStarted) {
+        MY_ESP_ERRCHECK(i2s_channel_preload_data(mI2sChan, pkt.data, pkt.dataLen, &written), mTag, "pre-loading DMA", return);
+        if (written == pkt.dataLen) {
+            onDmaWritten(pkt, pkt.dataLen);
+            return;
+        }
+        auto preloaded = written;
+        i2s_channel_enable(mI2sChan);
+        mChanStarted = true;
+        plSendEvent(kEventPlaying);
+        vTaskDelay(kTicksBeforeDacUnmute);
+        unMuteDac();
+        MY_ESP_ERRCHECK(i2s_channel_write(mI2sChan, pkt.data + written, pkt.dataLen - written,
+            &written, 0xffffffff), mTag, "calling i2s_channel_write()", return);
+        onDmaWritten(pkt, preloaded + written);
+    }
+    else {
+        MY_ESP_ERRCHECK(i2s_channel_write(mI2sChan, pkt.data, pkt.dataLen, &written, 0xffffffff), mTag,
+            "calling i2s_channel_write()", return);
+        if (written != pkt.dataLen) {
+            ESP_LOGW(mTag, "is2_channel_write() wrote less than requested, with infinite timeout");
+        }
+        onDmaWritten(pkt, written);
+        if (mDacMuted) {
+            vTaskDelay(kTicksBeforeDacUnmute);
+            unMuteDac();
+        }
+    }
+}
+void I2sOutputNode::onDmaWritten(DataPacket& pkt, size_t written)
+{
+    int32_t frames = written / mFrameSize;
+    mDmaQueuedFrames.fetch_add(frames, std::memory_order_relaxed);
+    mWrittenPts.store(mPts.extend(pkt.pts) + frames, std::memory_order_relaxed);
+}
+bool IRAM_ATTR I2sOutputNode::onDmaSent(i2s_chan_handle_t chan, i2s_event_data_t* event, void* userCtx)
+{
+    auto& self = *static_cast<I2sOutputNode*>(userCtx);
+    int32_t frames = event->size / self.mFrameSize;
+    auto queued = self.mDmaQueuedFrames.load(std::memory_order_relaxed);
+    // On underrun, the DMA sends silence (auto_clear), which was never accounted as queued
+    while (queued > 0 && !self.mDmaQueuedFrames.compare_exchange_weak(queued, std::max(queued - frames, (int32_t)0),
+        std::memory_order_relaxed));
+    return false;
+}
+uint64_t I2sOutputNode::audiblePts() const
+{
+    int64_t pts = (int64_t)mWrittenPts.load(std::memory_order_relaxed) - mDmaQueuedFrames.load(std::memory_order_relaxed);
+    return (pts > 0) ? pts : 0;
+}
+uint32_t I2sOutputNode::dmaLatencyMs() const
+{
+    auto sr = mFormat.sampleRate();
+    return sr ? (uint64_t)mDmaQueuedFrames.load(std::memory_order_relaxed) * 1000 / sr : 0;
+}
+void I2sOutputNode::perfExtraToJson(DynBuffer& buf)
+{
+    buf.printf(",\"pts\":%llu,\"dmaMs\":%lu", (unsigned long long)audiblePts(), (unsigned long)dmaLatencyMs());
+}
 
 bool I2sOutputNode::setFormat(StreamFormat fmt)
 {
@@ -256,8 +287,8 @@ bool I2sOutputNode::reconfigChannel()
     );
     MY_ESP_ERRCHECK(i2s_channel_reconfig_std_slot(mI2sChan, &slotCfg), mTag, "setting sample format", return false);
 
-    uint bytesPerSample = mFormat.numChannels() * (bps / 8);
-    for (mBytesPerSampleShiftDiv = 0; bytesPerSample; bytesPerSample >>= 1, mBytesPerSampleShiftDiv++);
+    mFrameSize = (bps <= 16 ? 2 : 4) * mFormat.numChannels();
+    mDmaQueuedFrames = 0;
     MY_ESP_ERRCHECK(i2s_channel_enable(mI2sChan), mTag, "enabling channel",);
     return true;
 }
@@ -279,7 +310,8 @@ bool I2sOutputNode::createChannel()
     auto sr = mFormat.sampleRate();
     auto nChans = mFormat.numChannels();
     int millis = mConfig.dmaBufSizeMs;
-    int sampleSize = (bps <= 16 ? 2 : 4) * nChans;
+    int sampleSize = mFrameSize = (bps <= 16 ? 2 : 4) * nChans;
+    mDmaQueuedFrames = 0;
     int dmaSize = (sampleSize * sr * millis + 999) / 1000;
     if (dmaSize > mConfig.dmaBufSizeMax) {
         dmaSize = mConfig.dmaBufSizeMax;
@@ -326,6 +358,10 @@ bool I2sOutputNode::createChannel()
         mI2sChan = nullptr;
         return false;
     );
+    i2s_event_callbacks_t callbacks = {};
+    callbacks.on_sent = onDmaSent;
+    MY_ESP_ERRCHECK(i2s_channel_register_event_callback(mI2sChan, &callbacks, this), mTag,
+        "registering DMA callback", );
     return true;
 }
 
@@ -354,5 +390,5 @@ uint32_t I2sOutputNode::positionTenthSec() const
     if (divider == 0) {
         return 0;
     }
-    return (mSampleCtr + (divider >> 1)) / divider;
+    return (audiblePts() + (divider >> 1)) / divider;
 }
@@ -2,6 +2,7 @@
 #define I2S_SINK_NODE_HPP
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
 #include "audioNode.hpp"
 #include <driver/i2s_std.h>
 #include "volume.hpp"
@@ -22,23 +23,28 @@ public:
 protected:
     enum {
         kTaskPriority = 22, kDefaultBps = 16, kDefaultSamplerate = 44100,
-        kFadeInMs = 400, kFadeOutMs = 50, kTicksBeforeDacUnmute = 10
+        kFadeInMs = 400, kFadeOutMs = 50, kTicksBeforeDacUnmute = 10,
+        kSlowPullLogUs = 12000, // log pullBatch() calls that take longer
+        kPullBatchSize = 4 // max packets per pullBatch(), stop and other commands are handled between batches
     };
     enum: uint8_t { kCommandPrefillComplete = AudioNodeWithTask::kCommandLast + 1 };
     typedef bool(I2sOutputNode::*FadeFunc)(DataPacket& pkt);
     Config mConfig;
     i2s_chan_handle_t mI2sChan = nullptr;
     StreamFormat mFormat;
-    uint64_t mSampleCtr;
+    PtsExtender mPts; // of the packets written to DMA, accessed only by the node's task
+    std::atomic<uint64_t> mWrittenPts = {0}; // timestamp of the sample following the last one written to DMA
+    std::atomic<int32_t> mDmaQueuedFrames = {0}; // written to DMA but not yet sent out, decremented by the DMA ISR
     FadeFunc mFadeFunc = nullptr;
     float mFadeStep = 0.0f;
     float mCurrFadeLevel = 0.0f;
     uint16_t mFadeInMs = kFadeInMs;
     uint16_t mFadeOutMs = kFadeOutMs;
-    uint8_t mBytesPerSampleShiftDiv;
+    uint8_t mFrameSize = 4; // bytes per sample frame in the DMA buffer
     uint8_t mDmaBufMillisec;
     bool mChanStarted = false;
     bool mDacMuted = false;
+    bool mStreamEnded = false; // the last stream ended normally, and no other stream has started since
     PrefillEvent::IdType mLastPrefillId = 0;
     bool mWaitingPrefill = false;
     const gpio_num_t kDacMutePin = GPIO_NUM_32;
@@ -55,6 +61,9 @@ protected:
     void muteDac();
     void unMuteDac();
     bool sendSilence();
+    void writePacket(DataPacket& pkt);
+    void onDmaWritten(DataPacket& pkt, size_t written);
+    static bool onDmaSent(i2s_chan_handle_t chan, i2s_event_data_t* event, void* userCtx);
     template <typename T, bool fadeIn>
     bool fade(DataPacket& pkt);
 public:
@@ -63,7 +72,12 @@ public:
     virtual Type type() const { return kTypeI2sOut; }
     virtual StreamEvent pullData(PacketResult& dpr) { return kErrStreamStopped; }
     void notifyPrefillComplete(PrefillEvent::IdType id) { mCmdQueue.post(kCommandPrefillComplete, id); }
+    /** Timestamp of the sample that is currently being output, derived from the timestamp of the last
+     * written packet, extended to 64 bits, and the amount of data in the DMA buffers that hasn't been sent yet */
+    uint64_t audiblePts() const;
+    uint32_t dmaLatencyMs() const;
     uint32_t positionTenthSec() const;
+    virtual void perfExtraToJson(DynBuffer& buf) override;
     void mute() { muteDac(); }
     void unmute() { unMuteDac(); }
 };
@@ -130,6 +130,23 @@ void IcyParser::reset()
     clearIcyInfo();
 }
 
+void IcyParser::takeStreamState(IcyParser& other)
+{
+    mIcyInterval = other.mIcyInterval;
+    mIcyCtr = other.mIcyCtr;
+    mIcyRemaining = other.mIcyRemaining;
+    mIcyMetaBuf.clear();
+    if (other.mIcyMetaBuf.dataSize()) { // metadata that continues in the next data
+        mIcyMetaBuf.appendStr(other.mIcyMetaBuf.buf(), true);
+    }
+    MutexLocker locker(mInfoMutex);
+    MutexLocker otherLocker(other.mInfoMutex);
+    mTrackName = std::move(other.mTrackName);
+    mStaName = std::move(other.mStaName);
+    mStaDesc = std::move(other.mStaDesc);
+    mStaGenre = std::move(other.mStaGenre);
+    mStaUrl = std::move(other.mStaUrl);
+}
 void IcyInfo::clearIcyInfo()
 {
     MutexLocker locker(mInfoMutex);
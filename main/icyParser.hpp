@@ -1,3 +1,4 @@
+#include <memory>
 #include <buffer.hpp>
 #include <mutex.hpp>
 class IcyInfo
@@ -41,4 +42,7 @@ public:
     void reset();
     bool parseHeader(const char* key, const char* value);
     bool processRecvData(char* buf, int& rlen);
+    /** Continues parsing the stream where \c other is, i.e. when taking over its connection. Takes the
+     * station and track info as well */
+    void takeStreamState(IcyParser& other);
 };
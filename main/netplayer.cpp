@@ -33,6 +33,7 @@
 #include "a2dpInputNode.hpp"
 #include "btRemote.hpp"
 #include "asyncCall.hpp"
+#include "packetPool.hpp"
 
 #define DEV_MODE 1
 
@@ -293,7 +294,9 @@ static esp_err_t indexUrlHandler(httpd_req_t *req)
     );
     httpd_resp_send_chunk(req, buf.buf(), buf.dataSize());
     buf.clear();
-    buf.printf("ESP-IDF version: %d.%d.%d\n\nTasks:\n", ESP_IDF_VERSION_MAJOR, ESP_IDF_VERSION_MINOR, ESP_IDF_VERSION_PATCH);
+    buf.printf("ESP-IDF version: %d.%d.%d\n\nPacket pool:\n", ESP_IDF_VERSION_MAJOR, ESP_IDF_VERSION_MINOR, ESP_IDF_VERSION_PATCH);
+    PacketPool::printStats(buf);
+    buf.printf("\nTasks:\n");
     httpd_resp_send_chunk(req, buf.buf(), buf.dataSize());
 
     std::string stats;
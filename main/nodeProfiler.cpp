@@ -0,0 +1,78 @@
+#include "nodeProfiler.hpp"
+#include <buffer.hpp>
+#include <string.h>
+#include <algorithm>
+
+void LatencyStats::reset()
+{
+    mCount = mMaxUs = mLastUs = 0;
+    mMinUs = UINT32_MAX;
+    mSumUs = mBytes = mSamples = 0;
+    memset(mBuckets, 0, sizeof(mBuckets));
+}
+void LatencyStats::add(uint32_t us, uint32_t bytes, uint32_t samples)
+{
+    if (mResetRequested.load(std::memory_order_relaxed) && mResetRequested.exchange(false)) {
+        reset();
+    }
+    mCount++;
+    mLastUs = us;
+    mSumUs += us;
+    mBytes += bytes;
+    mSamples += samples;
+    if (us < mMinUs) {
+        mMinUs = us;
+    }
+    if (us > mMaxUs) {
+        mMaxUs = us;
+    }
+    int bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= kNumBuckets) {
+        bucket = kNumBuckets - 1;
+    }
+    mBuckets[bucket]++;
+}
+uint32_t LatencyStats::percentileUs(int pct) const
+{
+    uint32_t count = mCount;
+    if (!count) {
+        return 0;
+    }
+    uint64_t target = ((uint64_t)count * pct + 99) / 100;
+    uint64_t sum = 0;
+    for (int i = 0; i < kNumBuckets; i++) {
+        sum += mBuckets[i];
+        if (sum >= target) {
+            return i ? std::min<uint32_t>((1u << i) - 1, mMaxUs) : 0;
+        }
+    }
+    return mMaxUs;
+}
+void LatencyStats::toJson(DynBuffer& buf) const
+{
+    uint32_t count = mCount;
+    buf.printf("{\"n\":%lu,\"bytes\":%llu,\"smpl\":%llu,\"min\":%lu,\"avg\":%lu,\"p99\":%lu,\"max\":%lu,\"hist\":[",
+        (unsigned long)count, (unsigned long long)mBytes, (unsigned long long)mSamples,
+        (unsigned long)(count ? mMinUs : 0), (unsigned long)(count ? mSumUs / count : 0),
+        (unsigned long)percentileUs(99), (unsigned long)mMaxUs);
+    // omit trailing empty buckets
+    int last = kNumBuckets - 1;
+    while (last >= 0 && !mBuckets[last]) {
+        last--;
+    }
+    for (int i = 0; i <= last; i++) {
+        buf.printf(i ? ",%lu" : "%lu", (unsigned long)mBuckets[i]);
+    }
+    buf.printf("]}");
+}
+void QueueDepthTrace::toJson(DynBuffer& buf) const
+{
+    int num = mNumSamples;
+    int idx = (num < kNumSamples) ? 0 : mWritePos;
+    buf.printf("[");
+    for (int i = 0; i < num; i++) {
+        buf.printf(i ? ",[%u,%lu]" : "[%u,%lu]", mCounts[idx], (unsigned long)mBytes[idx]);
+        idx = (idx + 1) % kNumSamples;
+    }
+    buf.printf("]");
+}
@@ -0,0 +1,81 @@
+#ifndef NODE_PROFILER_HPP
+#define NODE_PROFILER_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <esp_timer.h>
+
+class DynBuffer;
+/** Call statistics with a log2 latency histogram, for profiling pipeline calls.
+ * Updated by a single thread (the caller of the profiled function), read by the /perf
+ * HTTP handler. Readers may see slightly inconsistent values, which is acceptable.
+ * Reset is requested by the reader and performed by the writer on its next update
+ */
+class LatencyStats
+{
+public:
+    enum { kNumBuckets = 24 }; // bucket n holds latencies in [2^(n-1), 2^n) us, bucket 0 is for 0 us
+protected:
+    uint32_t mCount = 0;
+    uint32_t mMinUs = UINT32_MAX;
+    uint32_t mMaxUs = 0;
+    uint32_t mLastUs = 0;
+    uint64_t mSumUs = 0;
+    uint64_t mBytes = 0;
+    uint64_t mSamples = 0;
+    uint32_t mBuckets[kNumBuckets] = {0};
+    std::atomic<bool> mResetRequested = {false};
+    void reset();
+public:
+    void add(uint32_t us, uint32_t bytes, uint32_t samples = 0);
+    void requestReset() { mResetRequested = true; }
+    uint32_t count() const { return mCount; }
+    uint32_t lastUs() const { return mLastUs; }
+    uint64_t sumUs() const { return mSumUs; }
+    uint64_t bytes() const { return mBytes; }
+    uint64_t samples() const { return mSamples; }
+    /** Returns the upper bound of the histogram bucket that contains the specified percentile */
+    uint32_t percentileUs(int pct) const;
+    void toJson(DynBuffer& buf) const;
+    /** Measures the lifetime of the object and adds it to the stats */
+    struct Timer
+    {
+        LatencyStats& stats;
+        int64_t tsStart;
+        uint32_t bytes = 0;
+        uint32_t samples = 0;
+        Timer(LatencyStats& aStats): stats(aStats), tsStart(esp_timer_get_time()) {}
+        ~Timer() { stats.add(esp_timer_get_time() - tsStart, bytes, samples); }
+    };
+};
+/** Keeps a history of the fill level of a packet queue, sampled at most every kIntervalMs */
+class QueueDepthTrace
+{
+public:
+    enum { kNumSamples = 64, kIntervalMs = 500 };
+protected:
+    int64_t mLastSampleTs = 0;
+    uint8_t mWritePos = 0;
+    uint8_t mNumSamples = 0;
+    uint16_t mCounts[kNumSamples];
+    uint32_t mBytes[kNumSamples];
+public:
+    void sample(int count, int bytes)
+    {
+        auto now = esp_timer_get_time();
+        if (now - mLastSampleTs < kIntervalMs * 1000) {
+            return;
+        }
+        mLastSampleTs = now;
+        mCounts[mWritePos] = count;
+        mBytes[mWritePos] = bytes;
+        mWritePos = (mWritePos + 1) % kNumSamples;
+        if (mNumSamples < kNumSamples) {
+            mNumSamples++;
+        }
+    }
+    /** Outputs the samples as [[count,bytes],...], oldest first */
+    void toJson(DynBuffer& buf) const;
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include "oggSeeker.hpp"
+#include <string.h>
+#include <algorithm>
+#include <esp_log.h>
+
+static const char* TAG = "oggseek";
+// Used for the estimates when the track duration or the file size is not known, the highest Spotify bitrate
+static constexpr uint32_t kAssumedBytesPerSec = 320000 / 8;
+
+// CRC-32 with the polynomial of Ogg, without bit reflection, in flash
+struct OggCrcTable
+{
+    uint32_t entries[256];
+    constexpr OggCrcTable(): entries{}
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i << 24;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+            }
+            entries[i] = crc;
+        }
+    }
+};
+static constexpr OggCrcTable kCrcTable;
+
+static inline uint32_t readLe32(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+int64_t OggSeeker::pageGranule(const uint8_t* page)
+{
+    return (int64_t)(readLe32(page + 6) | ((uint64_t)readLe32(page + 10) << 32));
+}
+uint32_t OggSeeker::pageSerial(const uint8_t* page)
+{
+    return readLe32(page + 14);
+}
+int OggSeeker::pageSize(const uint8_t* data, int len)
+{
+    enum { kHeaderSize = 27 };
+    if (len < 5) {
+        return (memcmp(data, "OggS", len) == 0) ? 0 : -1;
+    }
+    if (memcmp(data, "OggS", 4) || data[4] != 0) {
+        return -1;
+    }
+    if (len < kHeaderSize) {
+        return 0;
+    }
+    int numSegs = data[26];
+    if (len < kHeaderSize + numSegs) {
+        return 0;
+    }
+    int size = kHeaderSize + numSegs;
+    for (int i = 0; i < numSegs; i++) {
+        size += data[kHeaderSize + i];
+    }
+    if (len < size) {
+        return 0;
+    }
+    // the CRC field counts as zero
+    uint32_t crc = 0;
+    for (int i = 0; i < size; i++) {
+        uint8_t byte = (i >= 22 && i < 26) ? 0 : data[i];
+        crc = (crc << 8) ^ kCrcTable.entries[(crc >> 24) ^ byte];
+    }
+    return (crc == readLe32(data + 22)) ? size : -1;
+}
+bool OggSeeker::captureHeaders(uint32_t offset, const uint8_t* data, int len)
+{
+    if (haveHeaders() || mHeadersFailed) {
+        return true;
+    }
+    if (offset != mCapture.size()) {
+        ESP_LOGW(TAG, "Header capture: data not in sequence");
+        mHeadersFailed = true;
+        mCapture = std::string();
+        return true;
+    }
+    mCapture.append((const char*)data, len);
+    auto ret = parseHeaders((const uint8_t*)mCapture.data(), mCapture.size());
+    if (ret) {
+        mHeadersFailed = ret < 0;
+        mCapture = std::string();
+    }
+    return ret != 0;
+}
+int8_t OggSeeker::parseHeaders(const uint8_t* data, int len)
+{
+    int pos = mDataStart;
+    while (pos < len) {
+        auto page = data + pos;
+        int size = pageSize(page, len - pos);
+        if (size < 0) {
+            ESP_LOGW(TAG, "Invalid Ogg page at %d while looking for the headers", pos);
+            return -1;
+        }
+        if (size == 0) {
+            break;
+        }
+        if (pos == (int)mDataStart) {
+            // identification header: packet type 1, "vorbis", version, channels, sample rate
+            auto body = page + 27 + page[26];
+            if (!(page[5] & 2) || size - (body - page) < 16 || body[0] != 1 || memcmp(body + 1, "vorbis", 6)) {
+                ESP_LOGW(TAG, "Stream does not start with a Vorbis identification header");
+                return -1;
+            }
+            mSerial = pageSerial(page);
+            mSampleRate = readLe32(body + 12);
+            if (!mSampleRate) {
+                return -1;
+            }
+        }
+        else if (pageSerial(page) == mSerial && pageGranule(page) > 0) { // the first audio page
+            mAudioStart = pos;
+            mPageSize = std::max(mPageSize, size);
+            mHeaders.assign((const char*)data + mDataStart, pos - mDataStart);
+            return 1;
+        }
+        pos += size;
+    }
+    if (len >= kMaxHeaderSize) {
+        ESP_LOGW(TAG, "No audio page within %d bytes", len);
+        return -1;
+    }
+    return 0;
+}
+bool OggSeeker::readHeaders(IReader& reader, Result& result)
+{
+    result.numProbes++;
+    auto size = reader.open(0);
+    if (size < 0) {
+        return false;
+    }
+    mFileSize = size;
+    std::string buf;
+    for (;;) {
+        auto len = buf.size();
+        buf.resize(len + kReadChunk);
+        auto nread = reader.read((uint8_t*)&buf[len], kReadChunk);
+        if (nread < 0) {
+            return false;
+        }
+        buf.resize(len + nread);
+        auto ret = parseHeaders((const uint8_t*)buf.data(), buf.size());
+        if (ret) {
+            return ret > 0;
+        }
+        if (nread < kReadChunk) {
+            ESP_LOGW(TAG, "File ended before the Vorbis headers");
+            return false;
+        }
+    }
+}
+uint32_t OggSeeker::estimateOffset(const Bound& lo, const Bound& hi, uint64_t target) const
+{
+    if (hi.offset <= lo.offset) { // the file size is not known
+        return lo.offset + (target - lo.granule) * kAssumedBytesPerSec / mSampleRate;
+    }
+    if (hi.granule <= lo.granule) { // the duration is not known
+        return lo.offset + (hi.offset - lo.offset) / 2;
+    }
+    return lo.offset + (target - lo.granule) * (hi.offset - lo.offset) / (hi.granule - lo.granule);
+}
+bool OggSeeker::seek(IReader& reader, uint32_t timeMs, Result& result)
+{
+    result.numProbes = 0;
+    result.data.clear();
+    if (!haveHeaders() && !readHeaders(reader, result)) {
+        return false;
+    }
+    if (mDurationMs > 1000 && timeMs > mDurationMs - 1000) {
+        timeMs = mDurationMs - 1000; // the last granule may be a bit below the duration
+    }
+    uint64_t target = (uint64_t)timeMs * mSampleRate / 1000;
+    Bound lo = { mAudioStart, 0 };
+    Bound hi = { mFileSize, (int64_t)mDurationMs * mSampleRate / 1000 };
+    // open that much before the estimate, to land before the start of the page preceding the target one,
+    // whose granule is where the target page starts. The estimate itself may fall anywhere in the target page
+    uint32_t backoff = mPageSize * 3;
+    for (int i = 0; i < kMaxProbes; i++) {
+        uint32_t offset = estimateOffset(lo, hi, target);
+        if (hi.offset > lo.offset) {
+            offset = std::min(offset, hi.offset - 1);
+        }
+        offset = (offset > lo.offset + backoff) ? offset - backoff : lo.offset;
+        offset &= ~(kAlign - 1);
+        auto prevLo = lo.offset;
+        auto prevHi = hi.offset;
+        auto ret = probe(reader, target, offset, lo, hi, result);
+        if (ret) {
+            return ret > 0;
+        }
+        if (lo.offset == prevLo && hi.offset == prevHi) {
+            // the first page found was the upper bound again, i.e. the target page starts further back
+            backoff *= 2;
+        }
+    }
+    ESP_LOGW(TAG, "Target page not found after %d probes", kMaxProbes);
+    return false;
+}
+int8_t OggSeeker::probe(IReader& reader, uint64_t target, uint32_t offset, Bound& lo, Bound& hi, Result& result)
+{
+    result.numProbes++;
+    auto remain = reader.open(offset);
+    if (remain < 0) {
+        return -1;
+    }
+    mFileSize = offset + remain;
+    if (!hi.offset || hi.offset > mFileSize) {
+        hi.offset = mFileSize;
+    }
+    auto& buf = result.data; // starts at the page being parsed, or at the data to sync to a page
+    buf.clear();
+    uint32_t bufOffset = offset;
+    uint32_t readPos = offset;
+    bool eof = false;
+    int64_t pageStart = -1; // the granule of the start of the next page, if known
+    for (;;) {
+        int size;
+        size_t pos = 0;
+        for (;;) {
+            size = (pos < buf.size()) ? pageSize((const uint8_t*)buf.data() + pos, buf.size() - pos) : 0;
+            if (size > 0 && pageSerial((const uint8_t*)buf.data() + pos) != mSerial) {
+                size = -1;
+            }
+            if (size < 0) {
+                pos++;
+                continue;
+            }
+            if (size > 0) {
+                break;
+            }
+            if (eof) {
+                ESP_LOGW(TAG, "Target is after the last page");
+                return -1;
+            }
+            auto len = buf.size();
+            buf.resize(len + kReadChunk);
+            auto nread = reader.read((uint8_t*)&buf[len], kReadChunk);
+            if (nread < 0) {
+                return -1;
+            }
+            buf.resize(len + nread);
+            readPos += nread;
+            eof = nread < kReadChunk;
+        }
+        if (pos) { // skipped data before a page, the start of the page is not known
+            buf.erase(0, pos);
+            bufOffset += pos;
+            pageStart = -1;
+        }
+        auto granule = pageGranule((const uint8_t*)buf.data());
+        if (bufOffset == lo.offset) {
+            pageStart = lo.granule;
+        }
+        if (granule >= 0 && (uint64_t)granule > target) {
+            if (pageStart >= 0) {
+                result.pageOffset = bufOffset;
+                result.granule = pageStart;
+                result.readPos = readPos;
+                return 1;
+            }
+            // the target page starts at or before this one. The granule of a page is the position at its
+            // end, i.e. at the start of the next page
+            mPageSize = std::max(mPageSize, size);
+            hi = { bufOffset + size, granule };
+            return 0;
+        }
+        mPageSize = std::max(mPageSize, size);
+        buf.erase(0, size);
+        bufOffset += size;
+        if (granule >= 0) {
+            pageStart = granule;
+        }
+        if (pageStart < 0) {
+            continue;
+        }
+        lo = { bufOffset, pageStart };
+        // read on if the target is near, otherwise open near it
+        uint64_t bytesAhead = (hi.granule > lo.granule)
+            ? (target - lo.granule) * (hi.offset - lo.offset) / (hi.granule - lo.granule)
+            : (target - lo.granule) * kAssumedBytesPerSec / mSampleRate;
+        if (bytesAhead > kMaxReadAhead) {
+            return 0;
+        }
+    }
+}
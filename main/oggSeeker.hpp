@@ -0,0 +1,87 @@
+#ifndef OGG_SEEKER_HPP
+#define OGG_SEEKER_HPP
+#include <string>
+#include <stdint.h>
+
+/** Seeking in an Ogg Vorbis file that is fetched in byte ranges, as the Spotify tracks are. Finds the page
+ * that contains the sample at the target time, by interpolating between the byte offsets and the granule
+ * positions of pages found in previous probes. A probe opens the file at the estimated offset and reads
+ * on, page by page, for as long as the target is estimated to be near, so that the request of the last
+ * probe continues as the playback stream. With the track duration known, one probe is usually enough.
+ * The Vorbis header pages are needed to decode from the seek position. They are collected from the stream
+ * while the track plays from its start, or read by seek() otherwise.
+ * The file may start with data before the Ogg stream (Spotify's own header), which is skipped. Reads are
+ * in multiples of kAlign, from offsets aligned to it, as needed to decrypt AES-CTR at any offset.
+ */
+class OggSeeker
+{
+public:
+    /** Sequential reader of the file */
+    class IReader
+    {
+    public:
+        /** Starts reading at offset, which is a multiple of kAlign, until the end of the file. Returns the
+         * number of bytes from the offset to the end of the file, or -1 on error */
+        virtual int32_t open(uint32_t offset) = 0;
+        /** Reads len bytes, len being a multiple of kAlign. Returns less only at the end of the file, and
+         * -1 on error */
+        virtual int32_t read(uint8_t* buf, int32_t len) = 0;
+        virtual ~IReader() {}
+    };
+    enum {
+        kAlign = 16, // the AES block size
+        kReadChunk = 4096,
+        kMaxHeaderSize = 65536,
+        kMaxReadAhead = 128 * 1024, // read on, rather than opening at a new offset, if the target is that near
+        kMaxProbes = 8
+    };
+    struct Result
+    {
+        uint32_t pageOffset; // of the page that contains the target sample
+        uint64_t granule; // sample position of the start of the page
+        uint32_t readPos; // where the reader is positioned, a multiple of kAlign
+        std::string data; // read from pageOffset to readPos
+        int numProbes; // number of open() calls, including for reading the headers
+    };
+protected:
+    struct Bound
+    {
+        uint32_t offset; // of a page start, or of the end of the file
+        int64_t granule; // sample position at that offset, i.e. the granule of the preceding page
+    };
+    uint32_t mDataStart; // offset of the Ogg stream in the file
+    uint32_t mDurationMs; // estimate, 0 if unknown
+    uint32_t mFileSize = 0; // 0 if unknown
+    uint32_t mAudioStart = 0; // offset of the first audio page, 0 if the headers are not known yet
+    uint32_t mSerial = 0;
+    uint32_t mSampleRate = 0;
+    int mPageSize = kReadChunk; // largest audio page seen, how far before the estimate of the target to open
+    bool mHeadersFailed = false;
+    std::string mHeaders; // the Vorbis header pages, from mDataStart to mAudioStart
+    std::string mCapture; // stream data from the file start, while looking for the end of the headers
+    int8_t parseHeaders(const uint8_t* data, int len);
+    bool readHeaders(IReader& reader, Result& result);
+    int8_t probe(IReader& reader, uint64_t target, uint32_t offset, Bound& lo, Bound& hi, Result& result);
+    uint32_t estimateOffset(const Bound& lo, const Bound& hi, uint64_t target) const;
+public:
+    OggSeeker(uint32_t dataStart, uint32_t durationMs): mDataStart(dataStart), mDurationMs(durationMs) {}
+    /** To be called with the data of a stream that starts at the beginning of the file, in sequence, until
+     * it returns true, i.e. the headers are collected or can't be found */
+    bool captureHeaders(uint32_t offset, const uint8_t* data, int len);
+    bool haveHeaders() const { return mAudioStart != 0; }
+    /** The header pages, to be decoded before the data from the seek position */
+    const std::string& headers() const { return mHeaders; }
+    uint32_t sampleRate() const { return mSampleRate; }
+    uint32_t fileSize() const { return mFileSize; }
+    /** The size of the file, if known from an earlier request, saves a probe */
+    void setFileSize(uint32_t size) { mFileSize = size; }
+    /** Finds the page that contains the sample at timeMs, reading via \c reader, which is left positioned
+     * at result.readPos. Returns false if the page is not found, the reader is then in an undefined state */
+    bool seek(IReader& reader, uint32_t timeMs, Result& result);
+    /** Checks for a valid page at data. Returns its size, 0 if len is too short to tell, -1 if not a page */
+    static int pageSize(const uint8_t* data, int len);
+    static int64_t pageGranule(const uint8_t* page);
+    static uint32_t pageSerial(const uint8_t* page);
+};
+
+#endif
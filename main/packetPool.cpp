@@ -0,0 +1,151 @@
+#include "packetPool.hpp"
+#include <stdlib.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <buffer.hpp>
+#include "utils.hpp"
+
+static const char* TAG = "pktpool";
+
+// Buffer sizes of the classes, in ascending order. They cover the network rx chunk sizes
+// (see StreamFormat::rxChunkSize()) and the decoder output packets: FLAC/Vorbis/AAC max 8192 bytes,
+// MP3 1152 stereo samples in 32-bit words = 9216 bytes
+const uint16_t PacketPool::sBufSizes[kNumClasses] = { 1024, 2048, 4096, 8192, 9216, 16384 };
+PacketPool::SizeClass PacketPool::sClasses[kNumClasses];
+Mutex PacketPool::sMutex;
+uint32_t PacketPool::sNumOversize = 0;
+
+uint8_t PacketPool::classForBufSize(int bufSize)
+{
+    for (uint8_t i = 0; i < kNumClasses; i++) {
+        if (bufSize <= sBufSizes[i]) {
+            return i;
+        }
+    }
+    return kNoClass;
+}
+void* PacketPool::heapAlloc(size_t size)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+}
+void* PacketPool::alloc(int bufSize, uint8_t& cls)
+{
+    cls = classForBufSize(bufSize);
+    if (cls == kNoClass) {
+        MutexLocker locker(sMutex);
+        sNumOversize++;
+        return heapAlloc(kHeaderSize + bufSize);
+    }
+    auto& sc = sClasses[cls];
+    {
+        MutexLocker locker(sMutex);
+        sc.numAllocs++;
+        if (++sc.inUse > sc.highWater) {
+            sc.highWater = sc.inUse;
+        }
+        auto block = sc.freeList;
+        if (block) {
+            sc.freeList = block->next;
+            sc.numFree--;
+            return block;
+        }
+        sc.misses++;
+    }
+    auto block = heapAlloc(kHeaderSize + sBufSizes[cls]);
+    if (!block) {
+        MutexLocker locker(sMutex);
+        sc.inUse--;
+    }
+    return block;
+}
+void PacketPool::release(void* ptr, uint8_t cls)
+{
+    myassert(cls < kNumClasses);
+    auto& sc = sClasses[cls];
+    {
+        MutexLocker locker(sMutex);
+        sc.inUse--;
+        if (sc.inUse + sc.numFree < sc.limit()) {
+            auto block = static_cast<Block*>(ptr);
+            block->next = sc.freeList;
+            sc.freeList = block;
+            sc.numFree++;
+            return;
+        }
+    }
+    free(ptr);
+}
+void PacketPool::reserve(int bufSize, int count)
+{
+    auto cls = classForBufSize(bufSize);
+    if (cls == kNoClass || count <= 0) {
+        return;
+    }
+    auto& sc = sClasses[cls];
+    int needed;
+    {
+        MutexLocker locker(sMutex);
+        sc.reserved += count;
+        needed = sc.reserved - sc.inUse - sc.numFree;
+    }
+    int numAlloc = 0;
+    for (; numAlloc < needed; numAlloc++) {
+        auto block = static_cast<Block*>(heapAlloc(kHeaderSize + sBufSizes[cls]));
+        if (!block) {
+            ESP_LOGW(TAG, "Out of memory preallocating %d-byte blocks", sBufSizes[cls]);
+            break;
+        }
+        MutexLocker locker(sMutex);
+        block->next = sc.freeList;
+        sc.freeList = block;
+        sc.numFree++;
+    }
+    if (numAlloc) {
+        ESP_LOGI(TAG, "Preallocated %d blocks of %d bytes", numAlloc, sBufSizes[cls]);
+    }
+}
+void PacketPool::unreserve(int bufSize, int count)
+{
+    auto cls = classForBufSize(bufSize);
+    if (cls == kNoClass || count <= 0) {
+        return;
+    }
+    MutexLocker locker(sMutex);
+    auto& sc = sClasses[cls];
+    sc.reserved = (sc.reserved > count) ? sc.reserved - count : 0;
+}
+void PacketPool::freeExcess(SizeClass& sc, uint16_t keep)
+{
+    // sMutex must be locked
+    while (sc.freeList && (sc.inUse + sc.numFree > keep)) {
+        auto block = sc.freeList;
+        sc.freeList = block->next;
+        sc.numFree--;
+        free(block);
+    }
+}
+void PacketPool::trim()
+{
+    MutexLocker locker(sMutex);
+    for (auto& sc: sClasses) {
+        sc.highWater = sc.inUse;
+        freeExcess(sc, sc.limit());
+    }
+}
+PacketPool::Stats PacketPool::stats(uint8_t cls)
+{
+    myassert(cls < kNumClasses);
+    MutexLocker locker(sMutex);
+    auto& sc = sClasses[cls];
+    return Stats { sBufSizes[cls], sc.reserved, sc.numFree, sc.inUse, sc.highWater, sc.numAllocs, sc.misses };
+}
+void PacketPool::printStats(DynBuffer& buf)
+{
+    buf.printf("size   rsvd   free  inuse  hiwat     allocs   misses\n");
+    for (uint8_t i = 0; i < kNumClasses; i++) {
+        auto st = stats(i);
+        buf.printf("%5u %6u %6u %6u %6u %10lu %8lu\n", st.bufSize, st.reserved, st.numFree, st.inUse,
+            st.highWater, (unsigned long)st.numAllocs, (unsigned long)st.misses);
+    }
+    buf.printf("oversize (heap) allocs: %lu\n", (unsigned long)sNumOversize);
+}
@@ -0,0 +1,68 @@
+#ifndef PACKETPOOL_HPP
+#define PACKETPOOL_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex.hpp>
+
+class DynBuffer;
+/** Size-class pool for packets allocated via StreamPacket::allocWithBufSize().
+ * Freed packets are kept on per-class free lists instead of being returned to the heap,
+ * which takes malloc/free off the real-time path and prevents PSRAM fragmentation during
+ * long sessions. Each class retains at most max(reserved, high-water in-use) blocks, so it
+ * self-sizes to the peak usage of the current stream. Reservations preallocate blocks
+ * before they are needed. Sizes that don't fit in any class fall back to the heap.
+ */
+class PacketPool {
+public:
+    enum: uint8_t { kNumClasses = 6, kNoClass = 0xff };
+    enum { kHeaderSize = 8 }; // max packet header size that precedes the buffer
+    struct Stats {
+        uint16_t bufSize;
+        uint16_t reserved;
+        uint16_t numFree;
+        uint16_t inUse;
+        uint16_t highWater;
+        uint32_t numAllocs;
+        uint32_t misses; // allocations that had to go to the heap
+    };
+protected:
+    struct Block { Block* next; };
+    struct SizeClass {
+        Block* freeList = nullptr;
+        uint16_t reserved = 0;
+        uint16_t numFree = 0;
+        uint16_t inUse = 0;
+        uint16_t highWater = 0;
+        uint32_t numAllocs = 0;
+        uint32_t misses = 0;
+        uint16_t limit() const { return reserved > highWater ? reserved : highWater; }
+    };
+    static const uint16_t sBufSizes[kNumClasses];
+    static SizeClass sClasses[kNumClasses];
+    static Mutex sMutex;
+    static uint32_t sNumOversize;
+    static void* heapAlloc(size_t size);
+    static void freeExcess(SizeClass& cls, uint16_t keep);
+public:
+    static uint8_t classForBufSize(int bufSize);
+    static uint16_t classBufSize(uint8_t cls) { return sBufSizes[cls]; }
+    /** Allocates a block for a packet with the specified buffer size. On return, cls contains
+     * the size class, which has to be passed to release(), or kNoClass if the block was
+     * allocated on the heap and has to be freed with free()
+     */
+    static void* alloc(int bufSize, uint8_t& cls);
+    static void release(void* ptr, uint8_t cls);
+    /** Ensures at least \c count blocks able to hold \c bufSize bytes are kept in the pool,
+     * preallocating them if needed. Reservations from different owners add up
+     */
+    static void reserve(int bufSize, int count);
+    static void unreserve(int bufSize, int count);
+    /** Frees blocks beyond the reservation and the current usage, and resets high-water marks.
+     * Should be called when the pipeline is stopped */
+    static void trim();
+    static Stats stats(uint8_t cls);
+    static void printStats(DynBuffer& buf);
+};
+
+#endif // PACKETPOOL_HPP
@@ -7,14 +7,37 @@
 #include "utils.hpp"
 
 static const char* TAG = "Rec";
+#define LOCK() MutexLocker locker(mMutex)
 
-TrackRecorder::TrackRecorder(const char *rootPath)
+TrackRecorder::TrackRecorder(const char *rootPath, StateCb stateCb, void* stateCbArg)
+: mStateCb(stateCb), mStateCbArg(stateCbArg)
 {
     if (createDirIfNotExist(rootPath)) {
         mRootPath = rootPath;
     }
+    bool psram = utils::haveSpiRam();
+    mRingSize = psram ? kRingSizePsram : kRingSizeNoPsram;
+    mWriteChunkSize = std::min((uint32_t)kWriteChunkSize, mRingSize / 4);
+    // plus a mirror area for writes that cross the ring end
+    mRing.reset((uint8_t*)heap_caps_malloc(mRingSize + mWriteChunkSize, psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_DEFAULT));
+    if (!mRing) {
+        ESP_LOGE(TAG, "Out of memory allocating %u bytes for the write queue", (unsigned)mRingSize);
+        return;
+    }
+    // internal RAM stack, as the card driver may do DMA from it
+    mTask.createTask("recorder", false, kStackSize, 0, kPrio, this, sWriterFunc);
+}
+TrackRecorder::~TrackRecorder()
+{
+    stopWriter();
+}
+void TrackRecorder::stopWriter()
+{
+    mTerminate = true;
+    mEvents.setBits(kEvtTerminate);
+    mTask.waitToEnd();
+    closeSink(false);
 }
-
 void TrackRecorder::setStation(const char* name)
 {
     if (mRootPath.empty()) {
@@ -52,82 +75,251 @@ bool TrackRecorder::createDirIfNotExist(const char* dirname) const
 
 std::string TrackRecorder::trackNameToPath(const std::string& trackName) const
 {
-    return mRootPath + "/" + mStationName + "/" + trackName;
+    return mRootPath + "/" + trackName;
 }
-
-void TrackRecorder::commit()
+void TrackRecorder::pushCmd(CmdType type, std::string&& name)
 {
-    if (!mSinkFile) {
-        return;
+    auto& cmd = mCmds[mNumCmds++];
+    cmd.type = type;
+    cmd.streamPos = mWritePos.load(std::memory_order_relaxed);
+    cmd.name = std::move(name);
+    mEvents.setBits(kEvtCmd);
+}
+bool TrackRecorder::onNewTrack(const char* trackName, Codec codec)
+{
+    if (mStationName.empty() || !mRing) {
+        return false;
     }
-    assert(!mCurrTrackName.empty());
-    int ret = fclose(mSinkFile);
-    mSinkFile = nullptr;
-    if (ret) {
-        ESP_LOGE(TAG, "commit: Error closing stream sink file, will not save track");
+    LOCK();
+    if (mNumCmds >= kMaxPendingCmds) {
+        ESP_LOGW(TAG, "onNewTrack: Writer is too far behind, will not record track '%s'", trackName);
+        return false;
+    }
+    std::string name = mStationName + "/" + trackName;
+    name += '.';
+    name += codec.fileExt();
+    pushCmd(kCmdStartTrack, std::move(name));
+    mRecording = true;
+    return true;
+}
+void TrackRecorder::onData(const void* data, int dataLen)
+{
+    if (!mRecording.load(std::memory_order_relaxed)) {
         return;
     }
-    auto name = trackNameToPath(mCurrTrackName);
-    ret = rename(sinkFileName().c_str(), name.c_str());
-    if (ret) {
-        ESP_LOGE(TAG, "commit: Error renaming sink file to '%s': %s\nTrack will not be saved",
-            name.c_str(), strerror(errno));
+    LOCK(); // not held by the writer during I/O
+    auto wpos = mWritePos.load(std::memory_order_relaxed);
+    int backlog = wpos - mReadPos.load(std::memory_order_acquire);
+    // once dropping, resume only when half of the ring is free, for fewer and larger gaps
+    int freeSpace = mRingSize - backlog;
+    if (dataLen > freeSpace || (mDropping && freeSpace < (int)mRingSize / 2)) {
+        if (!mDropping) {
+            mDropping = true;
+            ESP_LOGW(TAG, "Card can't keep up, dropping data");
+        }
+        mDroppedBytes.fetch_add(dataLen, std::memory_order_relaxed);
         return;
     }
-    ESP_LOGI(TAG, "Recorded track '%s' on station '%s'", mCurrTrackName.c_str(), mStationName.c_str());
+    if (mDropping) {
+        mDropping = false;
+        ESP_LOGW(TAG, "Writer caught up, %u bytes dropped so far", (unsigned)droppedBytes());
+    }
+    uint32_t idx = wpos % mRingSize;
+    int len1 = std::min(dataLen, (int)(mRingSize - idx));
+    memcpy(mRing.get() + idx, data, len1);
+    if (dataLen > len1) {
+        memcpy(mRing.get(), (const uint8_t*)data + len1, dataLen - len1);
+    }
+    mWritePos.store(wpos + dataLen, std::memory_order_release);
+    if (backlog + dataLen >= (int)mWriteChunkSize) {
+        mEvents.setBits(kEvtData);
+    }
 }
-
-bool TrackRecorder::onNewTrack(const char* trackName, Codec codec)
+void TrackRecorder::abortTrack()
 {
-    if (mStationName.empty()) {
-        return false;
+    LOCK();
+    // the pending track starts are superseded, and the data before the abort is discarded by the writer
+    mNumCmds = 0;
+    pushCmd(kCmdAbort, std::string());
+    mRecording = false;
+}
+void TrackRecorder::sWriterFunc(void* ctx)
+{
+    static_cast<TrackRecorder*>(ctx)->writerFunc();
+}
+void TrackRecorder::writerFunc()
+{
+    while (!mTerminate) {
+        mEvents.waitForOneAndReset(kEvtData | kEvtCmd | kEvtTerminate, -1);
+        processQueue();
     }
-    if (mSinkFile) {
-        commit();
+}
+void TrackRecorder::processQueue()
+{
+    while (!mTerminate) {
+        Cmd cmd;
+        bool haveCmd = false;
+        bool discard = false;
+        bool flush = false; // write all the data before the next command
+        auto rpos = mReadPos.load(std::memory_order_relaxed);
+        uint32_t end = rpos;
+        {
+            LOCK();
+            if (mNumCmds && mCmds[0].streamPos == rpos) { // all data before the command is written
+                cmd = std::move(mCmds[0]);
+                std::move(mCmds + 1, mCmds + mNumCmds, mCmds);
+                mNumCmds--;
+                haveCmd = true;
+            }
+            else if (mNumCmds) {
+                end = mCmds[0].streamPos;
+                discard = mCmds[0].type == kCmdAbort;
+                flush = true;
+            }
+            else {
+                end = mWritePos.load(std::memory_order_acquire);
+            }
+        }
+        if (haveCmd) {
+            if (cmd.type == kCmdStartTrack) {
+                startTrack(cmd.name);
+            }
+            else {
+                closeSink(false);
+            }
+            continue;
+        }
+        int len = end - rpos;
+        if (discard || !mSinkFile) {
+            if (!len) {
+                return;
+            }
+            mReadPos.store(end, std::memory_order_release);
+            continue;
+        }
+        if (!flush) {
+            // write only up to the next chunk boundary of the file, the rest waits for more data
+            int toBoundary = mWriteChunkSize - mFileSize % mWriteChunkSize;
+            if (len < toBoundary) {
+                return;
+            }
+            len = toBoundary;
+        }
+        if (!len) {
+            return;
+        }
+        if (!writeData(len)) {
+            closeSink(false);
+            writerStopped("write error");
+        }
     }
-    assert(!mSinkFile);
-    mCurrTrackName.clear();
-
-    std::string name = trackName;
-    name += '.';
-    name += codec.fileExt();
-
+}
+void TrackRecorder::startTrack(const std::string& name)
+{
+    closeSink(true);
+    auto path = trackNameToPath(name);
     struct stat info;
-    if (stat(trackNameToPath(name).c_str(), &info) == 0) {
-        ESP_LOGI(TAG, "onNewTrack: Track '%s' already exists, will not record it", trackName);
-        return false;
+    if (stat(path.c_str(), &info) == 0) {
+        ESP_LOGI(TAG, "Track '%s' already exists, will not record it", name.c_str());
+        writerStopped(nullptr);
+        return;
     }
-
     mSinkFile = fopen(sinkFileName().c_str(), "w+");
     if (!mSinkFile) {
         ESP_LOGE(TAG, "Error opening stream sink file '%s' for writing: %s", sinkFileName().c_str(), strerror(errno));
-        return false;
+        writerStopped("can't open sink file");
+        return;
     }
+    // the writes are already in large chunks, stdio buffering would only add a copy
+    setvbuf(mSinkFile, nullptr, _IONBF, 0);
+    mFileSize = mFileAlloc = 0;
     mCurrTrackName = name;
-    ESP_LOGI(TAG, "Starting to record track '%s' on station %s", mCurrTrackName.c_str(), mStationName.c_str());
+    ESP_LOGI(TAG, "Starting to record track '%s'", mCurrTrackName.c_str());
+}
+void TrackRecorder::writerStopped(const char* reason)
+{
+    {
+        LOCK();
+        if (mNumCmds) { // a newer track is queued, it decides the state
+            return;
+        }
+        mRecording = false;
+    }
+    if (reason) {
+        ESP_LOGE(TAG, "Recording stopped: %s", reason);
+    }
+    if (mStateCb) {
+        mStateCb(mStateCbArg, false);
+    }
+}
+bool TrackRecorder::preallocate(uint32_t size)
+{
+    // Seeking past the end and writing a byte makes FatFs allocate the cluster chain at once. The
+    // contents in between are not written, and the file is truncated to the actual size when closed
+    if (fseek(mSinkFile, size - 1, SEEK_SET) || fputc(0, mSinkFile) == EOF || fseek(mSinkFile, mFileSize, SEEK_SET)) {
+        ESP_LOGW(TAG, "Error preallocating sink file: %s", strerror(errno));
+        return false;
+    }
+    mFileAlloc = size;
     return true;
 }
-void TrackRecorder::onData(const void* data, int dataLen)
+bool TrackRecorder::writeData(int len)
+{
+    auto rpos = mReadPos.load(std::memory_order_relaxed);
+    while (len > 0) {
+        // up to the next chunk boundary of the file, so that all writes but the last are aligned
+        int wlen = std::min(len, (int)(mWriteChunkSize - mFileSize % mWriteChunkSize));
+        uint32_t idx = rpos % mRingSize;
+        int wrapped = idx + wlen - mRingSize;
+        if (wrapped > 0) { // make it contiguous in the mirror area past the ring end
+            memcpy(mRing.get() + mRingSize, mRing.get(), wrapped);
+        }
+        if (mFileSize + wlen > mFileAlloc) {
+            preallocate(mFileAlloc + kPreallocStep);
+        }
+        ElapsedTimer timer;
+        if (fileWrite(mRing.get() + idx, wlen) != wlen) {
+            ESP_LOGE(TAG, "Error writing to stream sink file: %s", strerror(errno));
+            return false;
+        }
+        auto msElapsed = timer.msElapsed();
+        if (msElapsed > 500) {
+            ESP_LOGW(TAG, "SDCard write took %d ms", msElapsed);
+        }
+        mFileSize += wlen;
+        rpos += wlen;
+        len -= wlen;
+        mReadPos.store(rpos, std::memory_order_release);
+    }
+    return true;
+}
+int TrackRecorder::fileWrite(const void* data, int len)
+{
+    return fwrite(data, 1, len, mSinkFile);
+}
+void TrackRecorder::closeSink(bool save)
 {
     if (!mSinkFile) {
         return;
     }
-    ElapsedTimer timer;
-    int ret = fwrite(data, 1, dataLen, mSinkFile);
-    if (ret != dataLen) {
-        abortTrack();
-        ESP_LOGE(TAG, "Error writing to stream sink file: %s", strerror(errno));
+    bool ok = fflush(mSinkFile) == 0 && ftruncate(fileno(mSinkFile), mFileSize) == 0;
+    ok = (fclose(mSinkFile) == 0) && ok;
+    mSinkFile = nullptr;
+    auto trackName = std::move(mCurrTrackName);
+    if (!save) {
+        remove(sinkFileName().c_str());
+        return;
     }
-    auto msElapsed = timer.msElapsed();
-    if (msElapsed > 80) {
-        ESP_LOGW(TAG, "SDCard write took %d ms", msElapsed);
+    if (!ok) {
+        ESP_LOGE(TAG, "commit: Error closing stream sink file, will not save track");
+        return;
     }
-}
-void TrackRecorder::abortTrack()
-{
-    if (mSinkFile) {
-        fclose(mSinkFile);
-        mSinkFile = nullptr;
+    auto name = trackNameToPath(trackName);
+    int ret = rename(sinkFileName().c_str(), name.c_str());
+    if (ret) {
+        ESP_LOGE(TAG, "commit: Error renaming sink file to '%s': %s\nTrack will not be saved",
+            name.c_str(), strerror(errno));
+        return;
     }
-    mCurrTrackName.clear();
+    ESP_LOGI(TAG, "Recorded track '%s', %u bytes", trackName.c_str(), (unsigned)mFileSize);
 }
@@ -2,28 +2,103 @@
 #define TRACK_RECORDER_HPP
 #include <string>
 #include <stdio.h>
-#include "audioNode.hpp"
+#include <atomic>
+#include <utils.hpp>
+#include <mutex.hpp>
+#include <task.hpp>
+#include <eventGroup.hpp>
+#include "streamDefs.hpp"
 
+/** Records the tracks of a radio station to the SD card, without the stream receive path ever waiting
+ * for the card. onData() only copies the data to a ring buffer, and a low-priority task writes it out.
+ * The writes are in large chunks, aligned to the file start, and the sink file is preallocated in large
+ * steps, so that the FAT is not updated on every write. If the card falls behind and the ring is full,
+ * the data is dropped and counted.
+ * Track starts and aborts are queued with their stream position, and executed by the task once the data
+ * before them has been written. The file system checks of a new track are done by the task as well, if
+ * it turns out that the track can't be recorded, this is reported via the state callback.
+ * onData(), onNewTrack() and abortTrack() are to be called by the stream receive task.
+ */
 class TrackRecorder
 {
+public:
+    /** Called by the writer task when it stops recording on its own, i.e. on an error or when the track
+     * already exists */
+    typedef void(*StateCb)(void* arg, bool recording);
+    enum {
+        kRingSizePsram = 128 * 1024,
+        kRingSizeNoPsram = 16 * 1024,
+        kWriteChunkSize = 16 * 1024, // a multiple of the sector and of the usual cluster size
+        kPreallocStep = 2 * 1024 * 1024,
+        kMaxPendingCmds = 4,
+        kStackSize = 3072, kPrio = 2
+    };
 protected:
+    enum CmdType: uint8_t { kCmdStartTrack, kCmdAbort };
+    struct Cmd
+    {
+        CmdType type;
+        uint32_t streamPos; // ring write position at the time of the command
+        std::string name; // of the track file, relative to the root path
+    };
+    enum: EventBits_t { kEvtData = 1, kEvtCmd = 2, kEvtTerminate = 4 };
     std::string mRootPath;
     std::string mStationName;
-    std::string mCurrTrackName;
+    StateCb mStateCb;
+    void* mStateCbArg;
+    Mutex mMutex; // protects the command queue
+    EventGroup mEvents;
+    Task mTask;
+    unique_ptr_mfree<uint8_t> mRing;
+    uint32_t mRingSize = 0;
+    uint32_t mWriteChunkSize = kWriteChunkSize;
+    // free-running byte counters
+    std::atomic<uint32_t> mWritePos = {0};
+    std::atomic<uint32_t> mReadPos = {0};
+    std::atomic<uint32_t> mDroppedBytes = {0};
+    std::atomic<bool> mRecording = {false};
+    std::atomic<bool> mTerminate = {false};
+    bool mDropping = false;
+    Cmd mCmds[kMaxPendingCmds];
+    int mNumCmds = 0;
+    // used only by the writer task
     FILE* mSinkFile = nullptr;
-    bool mLastNotifiedRec = false;
-    void commit();
+    std::string mCurrTrackName;
+    uint32_t mFileSize = 0;
+    uint32_t mFileAlloc = 0;
     std::string sinkFileName() const { return mRootPath + "/stream.dat"; }
     std::string trackNameToPath(const std::string& trackName) const;
     bool createDirIfNotExist(const char* dirname) const;
+    void pushCmd(CmdType type, std::string&& name);
+    static void sWriterFunc(void* ctx);
+    void writerFunc();
+    void processQueue();
+    void startTrack(const std::string& name);
+    void closeSink(bool save);
+    bool preallocate(uint32_t size);
+    bool writeData(int len);
+    void writerStopped(const char* reason);
+    /** Stops the writer task. Called by the destructor, and must be called by the destructor of a subclass
+     * that overrides fileWrite() */
+    void stopWriter();
+    /** Writes to the sink file. Overridden by the host test to simulate a slow card */
+    virtual int fileWrite(const void* data, int len);
 public:
-    TrackRecorder(const char* rootPath);
-    ~TrackRecorder() { abortTrack(); }
+    TrackRecorder(const char* rootPath, StateCb stateCb = nullptr, void* stateCbArg = nullptr);
+    virtual ~TrackRecorder();
     void setStation(const char* name);
+    /** Queues the start of a new track, the current one is saved. Returns false if the recorder can't
+     * accept it */
     bool onNewTrack(const char* trackName, Codec codec);
+    /** Copies the data to the write queue, or drops it if the queue is full. Doesn't block on the card */
     void onData(const void* data, int dataLen);
+    /** Discards the current track, including its data still in the write queue */
     void abortTrack();
-    bool isRecording() const { return mSinkFile != nullptr; }
+    bool isRecording() const { return mRecording.load(std::memory_order_relaxed); }
+    /** Bytes waiting to be written to the card */
+    int backlog() const { return mWritePos.load(std::memory_order_acquire) - mReadPos.load(std::memory_order_acquire); }
+    /** Total bytes dropped because the card couldn't keep up */
+    uint32_t droppedBytes() const { return mDroppedBytes.load(std::memory_order_relaxed); }
 };
 
 #endif
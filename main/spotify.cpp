@@ -1,17 +1,17 @@
 #include "spotify.hpp"
 #include <httpServer.hpp>
+#include <buffer.hpp>
 #include <LoginBlob.h>
 #include "audioPlayer.hpp"
 #include <utils.hpp>
 #include <mdns.hpp>
 #include <SpircHandler.h>
-#include <Utils.h> // for bigNumAdd
 #include <BellLogger.h>
 
 static const char* TAG = "spotify";
 std::unique_ptr<cspot::LoginBlob> SpotifyNode::sLoginBlob;
 AudioPlayer* SpotifyNode::sAudioPlayer = nullptr;
-const std::vector<uint8_t> SpotifyNode::sAudioAesIV = {
+const uint8_t SpotifyNode::sAudioAesIV[AesCtrStream::kBlockSize] = {
     0x72, 0xe0, 0x67, 0xfb, 0xdd, 0xcb, 0xcf, 0x77, 0xeb, 0xe8, 0xbc, 0x64, 0x3f, 0x63, 0x0d, 0x93
 };
 #define LOCK_PLAYER() MutexLocker locker(sAudioPlayer->mutex)
@@ -107,7 +107,12 @@ bool SpotifyNode::dispatchCommand(Command &cmd)
     }
     switch(cmd.opcode) {
         case kCmdPlay:
-            startCurrentTrack(true, cmd.arg);
+            if (startCurrentTrack(true) && cmd.arg) {
+                seekTo(cmd.arg); // if it fails, the track plays from the start
+            }
+            break;
+        case kCmdSeek:
+            seekTo(cmd.arg);
             break;
         case kCmdNextTrack:
             startNextTrack(true, (bool)cmd.arg);
@@ -118,6 +123,8 @@ bool SpotifyNode::dispatchCommand(Command &cmd)
         case kCmdStop:
         case kCmdStopPlayback:
             mCurrentTrack.reset();
+            mSeeker.reset();
+            mPrefetcher.cancel();
             mHttp.close();
             mFileSize = 0;
             mRecvPos = 0;
@@ -127,24 +134,65 @@ bool SpotifyNode::dispatchCommand(Command &cmd)
     }
     return true;
 }
-bool SpotifyNode::startCurrentTrack(bool flush, uint32_t tsSeek)
+bool SpotifyNode::startCurrentTrack(bool flush)
 {
     mHttp.close();
     mCurrentTrack.reset();
+    mSeeker.reset();
     mFileSize = 0;
     mRecvPos = 0;
-    mTsSeek = tsSeek;
+    mTsSeek = 0;
+    mPrefetchRequested = false;
     mCurrentTrack = mSpirc.mTrackQueue.currentTrack();
     if (!mCurrentTrack) {
         return false;
     }
+    auto& key = mCurrentTrack->audioKey;
+    if (!mDecryptor.setKey(key.data(), key.size(), sAudioAesIV)) {
+        mCurrentTrack.reset();
+        return false;
+    }
+    mSeeker.reset(new OggSeeker(kSpotifyHeaderSize, mCurrentTrack->duration));
     if (flush) {
         clearRingQueue();
         prefillStart();
     }
     mInStreamId = mPipeline.getNewStreamId();
+    pushPrefetched(); // if not, the node thread connects and downloads from the start
+    return true;
+}
+bool SpotifyNode::pushPrefetched()
+{
+    unique_ptr_mfree<uint8_t> data;
+    int32_t fileSize = 0;
+    // after a flush, only the prefill is waited for, otherwise the queue still has data to play
+    int minLen = mWaitingPrefill ? mWaitingPrefill + kSpotifyHeaderSize : SpotifyPrefetcher::kPrefetchSize;
+    int len = mPrefetcher.take(mCurrentTrack->cdnUrl.c_str(), data, fileSize, minLen);
+    if (len <= kSpotifyHeaderSize || !fileSize) {
+        return false;
+    }
+    auto buf = data.get();
+    if (!mDecryptor.xcrypt(buf, len)) {
+        throw std::runtime_error("Error decrypting audio data");
+    }
+    mSeeker->captureHeaders(0, buf, len);
+    mFileSize = fileSize;
+    mRecvPos = len;
+    pushStreamStart();
+    pushData(buf + kSpotifyHeaderSize, len - kSpotifyHeaderSize);
+    ESP_LOGI(TAG, "Started track with %d prefetched bytes of %ld", len, mFileSize);
     return true;
 }
+void SpotifyNode::prefetchNextTrack()
+{
+    auto next = mSpirc.mTrackQueue.peekNextTrack();
+    if (!next || next->cdnUrl.empty()) {
+        return; // not loaded yet, retried with the next packet
+    }
+    mPrefetchRequested = true;
+    ESP_LOGI(TAG, "Prefetching start of next track '%s'", next->name.c_str());
+    mPrefetcher.prefetch(next->cdnUrl.c_str());
+}
 void SpotifyNode::clearRingQueue()
 {
     ESP_LOGI(mTag, "Clearing ring buffer");
@@ -241,7 +289,8 @@ void SpotifyNode::nodeThreadFunc()
             myassert(mCurrentTrack);
             myassert(mState == kStateRunning);
             mRingBuf.clearStopSignal();
-            if (!mHttp.connected()) {
+            // the prefetched data may already be the whole track
+            if (!mHttp.connected() && (!mFileSize || mRecvPos < mFileSize)) {
                 ESP_LOGI(TAG, "Connecting...");
                 connect();
                 ESP_LOGI(TAG, "Starting download...");
@@ -269,7 +318,8 @@ void SpotifyNode::connect()
     for (int i = 0; i < 10; i++) {
         auto ret = mHttp.request(mCurrentTrack->cdnUrl.c_str(), HTTP_METHOD_GET, hdrs.get());
         if (ret >= 0) {
-            mFileSize = mHttp.contentLen();
+            mFileSize = mRecvPos + mHttp.contentLen(); // with a range, the length is of the rest of the file
+            mDecryptor.seek(mRecvPos);
             return;
         }
         int msDelay = std::min(i * 500, 6000);
@@ -281,7 +331,9 @@ void SpotifyNode::connect()
 }
 bool SpotifyNode::recv()
 {
-    bool isStart = (mRecvPos == 0);
+    if (mRecvPos == 0 && !recvSpotifyHeader()) {
+        return true;
+    }
     auto toRecv = std::min(mFileSize - mRecvPos, (int32_t)kRecvSize);
     if (toRecv <= 0) {
         if (toRecv < 0) {
@@ -294,10 +346,6 @@ bool SpotifyNode::recv()
         mCurrentTrack.reset();
         return false;
     }
-    if (mRecvPos & 0x0f) {
-        throw std::runtime_error("Receive offset not aligned to 16 bytes - a non-final recv got less "
-                                 "than the chunk amount");
-    }
     DataPacket::unique_ptr pkt(DataPacket::createWithoutFlags<true>(toRecv));
     auto nRecv = mHttp.recv(pkt->data, pkt->dataLen);
     if (nRecv <= 0) { // premature file end
@@ -310,31 +358,143 @@ bool SpotifyNode::recv()
         MutexLocker locker(mMutex);
         mSpeedProbe.onTraffic(nRecv);
     }
-    auto calculatedIV = bigNumAdd(sAudioAesIV, mRecvPos >> 4);
+    if (!mDecryptor.xcrypt((uint8_t*)pkt->data, nRecv)) {
+        throw std::runtime_error("Error decrypting audio data");
+    }
+    // no-op once the headers are known
+    mSeeker->captureHeaders(mRecvPos, (uint8_t*)pkt->data, nRecv);
     mRecvPos += nRecv;
-    mCrypto.aesCTRXcrypt(mCurrentTrack->audioKey, calculatedIV, (uint8_t*)pkt->data, pkt->dataLen);
-    if (isStart) {
-        memmove(pkt->data, pkt->data + 167, pkt->dataLen - 167);
-        pkt->dataLen -= 167;
-        mRingBuf.pushBack(
-            new NewStreamEvent(mInStreamId, Codec(Codec::kCodecVorbis, Codec::kTransportOgg), mTsSeek)
-        );
-        mRingBuf.pushBack(new TitleChangeEvent(strdup(mCurrentTrack->name.c_str()),
-            strdup(mCurrentTrack->artist.c_str())));
-        if (mWaitingPrefill) {
-            mRingBuf.pushBack(new PrefillEvent(mInStreamId));
+    pushPacket(pkt.release());
+    // only when the download is ahead of playback, otherwise the prefetch would take bandwidth from it
+    if (!mPrefetchRequested && mRingBuf.size() * 2 >= mRingBuf.capacity()) {
+        auto duration = mCurrentTrack->duration;
+        int64_t leadBytes = duration
+            ? (int64_t)mFileSize * kPrefetchLeadMs / duration
+            : SpotifyPrefetcher::kPrefetchSize * 2;
+        if (mFileSize - mRecvPos <= leadBytes) {
+            prefetchNextTrack();
         }
     }
-    mRingBuf.pushBack(pkt.release());
+    return true;
+}
+bool SpotifyNode::recvSpotifyHeader()
+{
+    // received on its own, so that the Ogg stream starts at the start of a DataPacket, without moving data
+    uint8_t hdr[kSpotifyHeaderSize];
+    if (mHttp.recv((char*)hdr, sizeof(hdr)) != (int)sizeof(hdr)) {
+        ESP_LOGW(TAG, "Connection dropped in the Spotify header, will restart...");
+        mHttp.close();
+        return false;
+    }
+    if (!mDecryptor.xcrypt(hdr, sizeof(hdr))) {
+        throw std::runtime_error("Error decrypting audio data");
+    }
+    mSeeker->captureHeaders(0, hdr, sizeof(hdr));
+    mRecvPos = sizeof(hdr);
+    pushStreamStart();
+    return true;
+}
+void SpotifyNode::pushStreamStart()
+{
+    mRingBuf.pushBack(
+        new NewStreamEvent(mInStreamId, Codec(Codec::kCodecVorbis, Codec::kTransportOgg), 0, mTsSeek)
+    );
+    mRingBuf.pushBack(new TitleChangeEvent(strdup(mCurrentTrack->name.c_str()),
+        strdup(mCurrentTrack->artist.c_str())));
+    if (mWaitingPrefill) {
+        mRingBuf.pushBack(new PrefillEvent(mInStreamId));
+    }
+}
+void SpotifyNode::pushData(const uint8_t* data, size_t len)
+{
+    for (size_t pos = 0; pos < len; pos += kRecvSize) {
+        auto pktLen = std::min(len - pos, (size_t)kRecvSize);
+        DataPacket::unique_ptr pkt(DataPacket::createWithoutFlags<true>(pktLen));
+        memcpy(pkt->data, data + pos, pktLen);
+        pushPacket(pkt.release());
+    }
+}
+void SpotifyNode::pushPacket(DataPacket* pkt)
+{
+    mRingBuf.pushBack(pkt);
     if (mWaitingPrefill && mRingBuf.dataSize() >= mWaitingPrefill) {
         mWaitingPrefill = 0;
         ESP_LOGI(TAG, "Prefill complete, sending event");
         plSendEvent(kEventPrefillComplete, PrefillEvent::lastPrefillId());
     }
+}
+bool SpotifyNode::seekTo(uint32_t ms)
+{
+    if (!mCurrentTrack || !mSeeker) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Seeking to %lu ms", ms);
+    ElapsedTimer timer;
+    if (mFileSize) {
+        mSeeker->setFileSize(mFileSize);
+    }
+    SeekReader reader(*this);
+    OggSeeker::Result res;
+    if (!mSeeker->seek(reader, ms, res)) {
+        // the connection is not at mRecvPos anymore, the node thread will reconnect there
+        ESP_LOGW(TAG, "Seek failed after %d requests, continuing from the current position", res.numProbes);
+        mHttp.close();
+        return false;
+    }
+    clearRingQueue();
+    prefillStart();
+    mInStreamId = mPipeline.getNewStreamId();
+    mRecvPos = res.readPos;
+    mFileSize = mSeeker->fileSize();
+    // the start of the page, the decoder outputs the samples before the target too
+    mTsSeek = res.granule * 1000 / mSeeker->sampleRate();
+    pushStreamStart();
+    // the decoder needs the header pages before the audio pages
+    auto& headers = mSeeker->headers();
+    pushData((const uint8_t*)headers.data(), headers.size());
+    pushData((const uint8_t*)res.data.data(), res.data.size());
+    ESP_LOGI(TAG, "Seek to %lu ms: page at %ld ms, offset %lu, %d requests, took %d ms", ms, mTsSeek,
+        res.pageOffset, res.numProbes, timer.msElapsed());
     return true;
 }
+int32_t SpotifyNode::SeekReader::open(uint32_t offset)
+{
+    auto& http = mNode.mHttp;
+    http.close();
+    HttpClient::Headers hdrs({{"Range", (std::string("bytes=") + std::to_string(offset) + '-').c_str()}});
+    if (http.request(mNode.mCurrentTrack->cdnUrl.c_str(), HTTP_METHOD_GET, &hdrs) < 0) {
+        return -1;
+    }
+    mNode.mDecryptor.seek(offset);
+    return http.contentLen();
+}
+int32_t SpotifyNode::SeekReader::read(uint8_t* buf, int32_t len)
+{
+    int32_t total = 0;
+    while (total < len) {
+        auto nRecv = mNode.mHttp.recv((char*)buf + total, len - total);
+        if (nRecv < 0) {
+            return -1;
+        }
+        if (nRecv == 0) {
+            break;
+        }
+        total += nRecv;
+    }
+    {
+        MutexLocker locker(mNode.mMutex);
+        mNode.mSpeedProbe.onTraffic(total);
+    }
+    return mNode.mDecryptor.xcrypt(buf, total) ? total : -1;
+}
+void SpotifyNode::perfExtraToJson(DynBuffer& buf)
+{
+    buf.printf(",\"queue\":");
+    mQueueTrace.toJson(buf);
+}
 StreamEvent SpotifyNode::pullData(PacketResult &pr)
 {
+    mQueueTrace.sample(mRingBuf.size(), mRingBuf.dataSize());
     StreamPacket::unique_ptr pkt;
     pkt.reset(mRingBuf.popFront());
     if (!pkt) {
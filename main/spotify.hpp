@@ -7,8 +7,10 @@
 #include <httpClient.hpp>
 #include "streamRingQueue.hpp"
 #include "speedProbe.hpp"
+#include "oggSeeker.hpp"
 #include <SpircHandler.h>
-#include <Crypto.h>
+#include "aesCtrStream.hpp"
+#include "spotifyPrefetcher.hpp"
 
 namespace cspot {
     class LoginBlob;
@@ -19,7 +21,11 @@ class AudioPlayer;
 
 class SpotifyNode: public AudioNodeWithTask, public cspot::ITrackPlayer, public IInputAudioNode {
 protected:
-    enum { kRecvSize = 4096 };
+    enum { kRecvSize = 4096, kSpotifyHeaderSize = 167 };
+    // The start of the next track is prefetched when the download of the current one is this close to its end.
+    // The download runs ahead of playback by the ring queue, so there is more time than that before the end
+    // of the track is played
+    enum { kPrefetchLeadMs = 10000 };
     enum: uint8_t {
         kCmdPlay = AudioNodeWithTask::kCommandLast + 1, /* int pos */
         kCmdStopPlayback,
@@ -32,12 +38,26 @@ protected:
     static std::unique_ptr<cspot::LoginBlob> sLoginBlob;
     static AudioPlayer* sAudioPlayer;
     // AES IV for decrypting the audio stream
-    static const std::vector<uint8_t> sAudioAesIV;
+    static const uint8_t sAudioAesIV[AesCtrStream::kBlockSize];
+    // Reads the current track for the seeker, via mHttp, decrypting as recv() does
+    class SeekReader: public OggSeeker::IReader
+    {
+    protected:
+        SpotifyNode& mNode;
+    public:
+        SeekReader(SpotifyNode& node): mNode(node) {}
+        virtual int32_t open(uint32_t offset) override;
+        virtual int32_t read(uint8_t* buf, int32_t len) override;
+    };
     cspot::SpircHandler mSpirc;
     StreamRingQueue<100> mRingBuf;
+    QueueDepthTrace mQueueTrace;
     HttpClient mHttp;
     cspot::TrackInfo::SharedPtr mCurrentTrack;
-    Crypto mCrypto;
+    AesCtrStream mDecryptor; // of the current track, positioned at mRecvPos
+    std::unique_ptr<OggSeeker> mSeeker; // for the current track
+    SpotifyPrefetcher mPrefetcher;
+    bool mPrefetchRequested = false; // for the track after the current one
     int32_t mFileSize = 0;
     int32_t mRecvPos = 0;
     int32_t mTsSeek = 0;
@@ -50,10 +70,17 @@ protected:
     virtual bool dispatchCommand(Command &cmd) override;
     void connect();
     bool recv();
+    bool recvSpotifyHeader();
+    void pushStreamStart();
+    void pushPacket(DataPacket* pkt);
+    void pushData(const uint8_t* data, size_t len);
+    void prefetchNextTrack();
+    bool pushPrefetched();
+    bool seekTo(uint32_t ms);
     void prefillStart();
     void prefillComplete();
     void clearRingQueue();
-    bool startCurrentTrack(bool flush, uint32_t tsSeek = 0);
+    bool startCurrentTrack(bool flush);
     bool startNextTrack(bool flush, bool nextPrev = true);
     // cspot::TrackPlayer interface
     virtual void play(uint32_t pos) override;
@@ -72,5 +99,6 @@ public:
     SpotifyNode(IAudioPipeline& parent);
     virtual Type type() const override { return kTypeSpotify; }
     virtual StreamEvent pullData(PacketResult &pr) override;
+    virtual void perfExtraToJson(DynBuffer& buf) override;
 };
 #endif
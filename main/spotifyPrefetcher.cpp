@@ -0,0 +1,197 @@
+#include "spotifyPrefetcher.hpp"
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+
+static const char* TAG = "sp-prefetch";
+#define LOCK() MutexLocker locker(mMutex)
+
+SpotifyPrefetcher::~SpotifyPrefetcher()
+{
+    mTerminate = true;
+    mEvents.setBits(kEvtTerminate);
+    mTask.waitToEnd();
+}
+void SpotifyPrefetcher::prefetch(const char* url)
+{
+    LOCK();
+    if (mUrl && strcmp(mUrl.get(), url) == 0) {
+        return;
+    }
+    if (!mBuf) {
+        mBuf.reset((uint8_t*)heap_caps_malloc(kPrefetchSize, utils::haveSpiRam() ? MALLOC_CAP_SPIRAM : MALLOC_CAP_DEFAULT));
+        if (!mBuf) {
+            ESP_LOGW(TAG, "Out of memory allocating prefetch buffer");
+            return;
+        }
+    }
+    mUrl.reset(strdup(url));
+    mGeneration++;
+    mDownloading = true; // pending counts as in progress, for take()
+    mDataLen = 0;
+    mFileSize = 0;
+    if (!mTask.handle()) {
+        mTask.createTask("sp-prefetch", true, kStackSize, 0, kPrio, this, sTaskFunc);
+    }
+    mEvents.setBits(kEvtRequest);
+}
+int SpotifyPrefetcher::take(const char* url, unique_ptr_mfree<uint8_t>& data, int32_t& fileSize, int minLen)
+{
+    for (;;) {
+        {
+            LOCK();
+            if (!mDownloading || mDataLen >= minLen || !mUrl || strcmp(mUrl.get(), url) != 0) {
+                break;
+            }
+        }
+        if (!mEvents.waitForOneAndReset(kEvtProgress, kConnectTimeoutMs)) {
+            ESP_LOGW(TAG, "Prefetch stalled, not waiting for it anymore");
+            break;
+        }
+    }
+    LOCK();
+    bool match = mUrl && strcmp(mUrl.get(), url) == 0;
+    int len = mDataLen;
+    mUrl.reset();
+    mGeneration++;
+    mDownloading = false;
+    mDataLen = 0;
+    if (!match || !len) {
+        return 0;
+    }
+    data = std::move(mBuf); // a new one is allocated by the next request
+    fileSize = mFileSize;
+    ESP_LOGI(TAG, "Handing over %d prefetched bytes of %ld", len, mFileSize);
+    return len;
+}
+void SpotifyPrefetcher::cancel()
+{
+    LOCK();
+    mUrl.reset();
+    mGeneration++;
+    mDownloading = false;
+    mDataLen = 0;
+}
+bool SpotifyPrefetcher::isCurrent(uint32_t gen)
+{
+    LOCK();
+    return gen == mGeneration && !mTerminate;
+}
+void SpotifyPrefetcher::sTaskFunc(void* ctx)
+{
+    static_cast<SpotifyPrefetcher*>(ctx)->taskFunc();
+}
+void SpotifyPrefetcher::taskFunc()
+{
+    while (!(mEvents.waitForOneAndReset(kEvtRequest | kEvtTerminate, -1) & kEvtTerminate)) {
+        unique_ptr_mfree<char> url;
+        uint32_t gen;
+        {
+            LOCK();
+            if (!mUrl) {
+                continue;
+            }
+            url.reset(strdup(mUrl.get()));
+            gen = mGeneration;
+        }
+        download(url.get(), gen);
+        {
+            LOCK();
+            if (gen == mGeneration) {
+                mDownloading = false;
+            }
+        }
+        mEvents.setBits(kEvtProgress);
+    }
+}
+esp_err_t SpotifyPrefetcher::httpEventHandler(esp_http_client_event_t* evt)
+{
+    if (evt->event_id != HTTP_EVENT_ON_HEADER || strcasecmp(evt->header_key, "Content-Range") != 0) {
+        return ESP_OK;
+    }
+    // bytes <first>-<last>/<total>, the total can be '*'
+    const char* slash = strrchr(evt->header_value, '/');
+    if (slash) {
+        *static_cast<int32_t*>(evt->user_data) = atoi(slash + 1);
+    }
+    return ESP_OK;
+}
+void SpotifyPrefetcher::download(const char* url, uint32_t gen)
+{
+    ElapsedTimer timer;
+    int32_t fileSize = 0;
+    esp_http_client_config_t cfg = {};
+    cfg.url = url;
+    cfg.event_handler = httpEventHandler;
+    cfg.user_data = &fileSize;
+    cfg.timeout_ms = kConnectTimeoutMs;
+    cfg.buffer_size = 1024;
+    cfg.method = HTTP_METHOD_GET;
+    auto client = esp_http_client_init(&cfg);
+    unique_ptr_mfree<char> chunk((char*)malloc(kRecvChunkSize));
+    if (!client || !chunk) {
+        ESP_LOGE(TAG, "Out of memory creating http client");
+        if (client) {
+            esp_http_client_cleanup(client);
+        }
+        return;
+    }
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=0-%d", kPrefetchSize - 1);
+    esp_http_client_set_header(client, "Range", range);
+    int total = 0;
+    if (esp_http_client_open(client, 0) != ESP_OK) {
+        ESP_LOGW(TAG, "Error connecting to CDN");
+        goto done;
+    }
+    {
+        int64_t contentLen = esp_http_client_fetch_headers(client);
+        int status = esp_http_client_get_status_code(client);
+        if (status == 200) { // range not supported, the whole file is sent
+            fileSize = contentLen;
+        }
+        else if (status != 206) {
+            ESP_LOGW(TAG, "Http code %d from CDN", status);
+            goto done;
+        }
+    }
+    {
+        LOCK();
+        if (gen != mGeneration) {
+            goto done;
+        }
+        mFileSize = fileSize;
+    }
+    esp_http_client_set_timeout_ms(client, kReadTimeoutMs);
+    for (int msLastData = 0; total < kPrefetchSize;) {
+        int rlen = esp_http_client_read(client, chunk.get(), std::min((int)kRecvChunkSize, kPrefetchSize - total));
+        if (rlen == 0 && !esp_http_client_is_complete_data_received(client)) { // read timeout
+            if (!isCurrent(gen)) {
+                goto done;
+            }
+            if (timer.msElapsed() - msLastData > kConnectTimeoutMs) {
+                ESP_LOGW(TAG, "Download stalled");
+                goto done;
+            }
+            continue;
+        }
+        if (rlen <= 0) { // complete (the file is shorter than the prefetch size), or error
+            break;
+        }
+        msLastData = timer.msElapsed();
+        LOCK();
+        if (gen != mGeneration) {
+            goto done;
+        }
+        memcpy(mBuf.get() + mDataLen, chunk.get(), rlen);
+        mDataLen += rlen;
+        total = mDataLen;
+        mEvents.setBits(kEvtProgress);
+    }
+    ESP_LOGI(TAG, "Prefetched %d bytes of %ld in %d ms", total, fileSize, timer.msElapsed());
+done:
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+}
@@ -0,0 +1,58 @@
+#ifndef SPOTIFY_PREFETCHER_HPP
+#define SPOTIFY_PREFETCHER_HPP
+#include <esp_http_client.h>
+#include <atomic>
+#include <utils.hpp>
+#include <mutex.hpp>
+#include <task.hpp>
+#include <eventGroup.hpp>
+
+/** Downloads the start of the next Spotify track in the background, while the current one is still
+ * downloading, so that SpotifyNode can push it as soon as the current download ends, instead of first
+ * waiting for the (TLS) connection to the CDN and the first data. The data is kept as received, i.e.
+ * encrypted, the node decrypts it with the key of the track when it takes it. The audio key and the CDN
+ * url are resolved beforehand by cspot's TrackQueue.
+ * A single download is done at a time, by a task that is created on the first request
+ */
+class SpotifyPrefetcher
+{
+public:
+    enum {
+        kPrefetchSize = 100 * 1024,
+        kConnectTimeoutMs = 5000,
+        kReadTimeoutMs = 200, // how fast a cancelled download notices it
+        kRecvChunkSize = 4096,
+        kStackSize = 4096, kPrio = 10
+    };
+protected:
+    enum: EventBits_t { kEvtRequest = 1, kEvtTerminate = 2, kEvtProgress = 4 };
+    Mutex mMutex;
+    Task mTask;
+    EventGroup mEvents;
+    unique_ptr_mfree<char> mUrl; // of the requested download, null if none
+    unique_ptr_mfree<uint8_t> mBuf;
+    int mDataLen = 0;
+    int32_t mFileSize = 0; // from the Content-Range of the response, 0 if not (yet) known
+    uint32_t mGeneration = 0; // incremented by each request and cancel, the task discards stale data
+    bool mDownloading = false; // the current generation is requested or being downloaded
+    std::atomic<bool> mTerminate = false;
+    static void sTaskFunc(void* ctx);
+    void taskFunc();
+    void download(const char* url, uint32_t gen);
+    static esp_err_t httpEventHandler(esp_http_client_event_t* evt);
+    bool isCurrent(uint32_t gen);
+public:
+    ~SpotifyPrefetcher();
+    /** Starts downloading the first kPrefetchSize bytes of \c url, unless it is the one already requested.
+     * A download of another url is abandoned */
+    void prefetch(const char* url);
+    /** If the prefetched url is \c url, hands over its data and the total size of the file in \c fileSize.
+     * If the download is still in progress, it is waited for until it has \c minLen bytes, as long as it
+     * advances: a new connection would take at least as long. Returns the data length, 0 if there is no data
+     * for that url. The download is stopped in any case */
+    int take(const char* url, unique_ptr_mfree<uint8_t>& data, int32_t& fileSize, int minLen = kPrefetchSize);
+    /** Stops the download and discards its data */
+    void cancel();
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef SPSCSTREAMQUEUE_HPP
+#define SPSCSTREAMQUEUE_HPP
+
+#include <atomic>
+#include <limits>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <waitable.hpp>
+#include "streamPackets.hpp"
+
+/** Lock-free single-producer/single-consumer variant of StreamRingQueue.
+ * Exactly one task may call pushBack() and exactly one task may call popFront().
+ * The head index is written only by the consumer and the tail index only by the producer,
+ * so neither side needs a mutex. The event group is touched only when the other side
+ * is actually blocked, and only after a watermark is crossed:
+ * - A blocked consumer is woken when the number of queued packets reaches the read wake level,
+ *   or when a non-data (event) packet is queued
+ * - A blocked producer is woken when the number of free slots reaches the write wake level
+ *   and dataSize() is below the maximum
+ * With a read wake level above 1, the producer must not stall indefinitely with less than
+ * that many packets queued, as the consumer would not be woken until the next event packet
+ */
+template<int N>
+class SpscStreamQueue: public Waitable {
+protected:
+    enum { kNumSlots = N + 1 }; // one slot is always kept empty to distinguish full from empty
+    StreamPacket* mItems[kNumSlots];
+    std::atomic<uint32_t> mHead = {0}; // written only by consumer
+    std::atomic<uint32_t> mTail = {0}; // written only by producer
+    std::atomic<int> mDataSize = {0};
+    int mMaxDataSize;
+    uint16_t mReadWakeLevel = 1;
+    uint16_t mWriteWakeLevel = 1;
+    std::atomic<bool> mReaderWaiting = {false};
+    std::atomic<bool> mWriterWaiting = {false};
+    std::atomic<bool> mReaderBusy = {false}; // guards popFront() against a concurrent clear()
+    static uint32_t nextIdx(uint32_t idx) { return (idx + 1 == kNumSlots) ? 0 : idx + 1; }
+    static int count(uint32_t head, uint32_t tail) {
+        int n = (int)tail - (int)head;
+        return (n < 0) ? n + kNumSlots : n;
+    }
+    bool isFull(uint32_t head, uint32_t tail) const {
+        return (nextIdx(tail) == head) || (mDataSize.load(std::memory_order_relaxed) >= mMaxDataSize);
+    }
+    void lockReader() {
+        while (mReaderBusy.exchange(true, std::memory_order_acquire)) {
+            vTaskDelay(1);
+        }
+    }
+    void unlockReader() { mReaderBusy.store(false, std::memory_order_release); }
+    void wakeReaderIf(bool cond) {
+        if (cond && mReaderWaiting.load() && mReaderWaiting.exchange(false)) {
+            mEvents.setBits(kFlagHasItems);
+        }
+    }
+    void wakeWriterIf(bool cond) {
+        if (cond && mWriterWaiting.load() && mWriterWaiting.exchange(false)) {
+            mEvents.setBits(kFlagHasSpace);
+        }
+    }
+public:
+    SpscStreamQueue(int maxDataSize = std::numeric_limits<int>::max())
+        : mMaxDataSize(maxDataSize) {}
+    ~SpscStreamQueue() { clear(); }
+    static constexpr int capacity() { return N; }
+    int size() const { return count(mHead.load(std::memory_order_acquire), mTail.load(std::memory_order_acquire)); }
+    bool empty() const { return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire); }
+    bool full() const { return isFull(mHead.load(std::memory_order_acquire), mTail.load(std::memory_order_relaxed)); }
+    int dataSize() const { return mDataSize.load(std::memory_order_relaxed); }
+    int maxDataSize() const { return mMaxDataSize; }
+    void setMaxDataSize(int val) { mMaxDataSize = val; }
+    /** @param readLevel Number of queued packets at which a blocked consumer is woken
+     *  @param writeLevel Number of free slots at which a blocked producer is woken
+     */
+    void setWakeLevels(uint16_t readLevel, uint16_t writeLevel)
+    {
+        mReadWakeLevel = readLevel ? std::min<uint16_t>(readLevel, N) : 1;
+        mWriteWakeLevel = writeLevel ? std::min<uint16_t>(writeLevel, N) : 1;
+    }
+    /** Called only by the producer. Blocks while the queue is full or dataSize() is at or above the maximum.
+     * As with StreamRingQueue, only the data size before the addition is checked against the maximum.
+     * On stop signal, the packet is destroyed and false is returned
+     */
+    bool pushBack(StreamPacket* item)
+    {
+        auto tail = mTail.load(std::memory_order_relaxed);
+        while (isFull(mHead.load(std::memory_order_acquire), tail)) {
+            // announce that we are about to sleep, then re-check, so that a concurrent pop can't be missed
+            mEvents.clearBits(kFlagHasSpace);
+            mWriterWaiting.store(true);
+            if (!isFull(mHead.load(), tail)) {
+                mWriterWaiting.store(false);
+                break;
+            }
+            if (waitFor(kFlagHasSpace, -1) <= 0) {
+                mWriterWaiting.store(false);
+                item->destroy();
+                return false;
+            }
+        }
+        bool isData = item->type == kEvtData;
+        if (isData) {
+            mDataSize.fetch_add(static_cast<DataPacket*>(item)->dataLen, std::memory_order_relaxed);
+        }
+        mItems[tail] = item;
+        tail = nextIdx(tail);
+        mTail.store(tail);
+        wakeReaderIf(!isData || count(mHead.load(std::memory_order_relaxed), tail) >= mReadWakeLevel);
+        return true;
+    }
+    /** Called only by the consumer. Blocks while the queue is empty. Returns null on stop signal */
+    StreamPacket* popFront()
+    {
+        lockReader();
+        auto head = mHead.load(std::memory_order_relaxed);
+        while (head == mTail.load(std::memory_order_acquire)) {
+            unlockReader();
+            mEvents.clearBits(kFlagHasItems);
+            mReaderWaiting.store(true);
+            if (head != mTail.load()) {
+                mReaderWaiting.store(false);
+            }
+            else if (waitFor(kFlagHasItems, -1) <= 0) {
+                mReaderWaiting.store(false);
+                return nullptr;
+            }
+            lockReader();
+            head = mHead.load(std::memory_order_relaxed); // may have been reset by clear()
+        }
+        auto item = mItems[head];
+        int data = mDataSize.load(std::memory_order_relaxed);
+        if (item->type == kEvtData) {
+            auto len = static_cast<DataPacket*>(item)->dataLen;
+            data = mDataSize.fetch_sub(len, std::memory_order_relaxed) - len;
+        }
+        head = nextIdx(head);
+        mHead.store(head);
+        unlockReader();
+        wakeWriterIf((kNumSlots - 1 - count(head, mTail.load(std::memory_order_relaxed)) >= mWriteWakeLevel)
+            && (data < mMaxDataSize));
+        return item;
+    }
+    /** Called only by the consumer. Blocks while the queue is empty, then pops up to \c maxItems
+     * consecutive data packets that are already queued, stopping before the first non-data packet.
+     * If the first packet is not a data packet, it is the only one popped.
+     * The data size and the producer wakeup are updated once for the whole batch.
+     * Returns the number of packets popped, 0 on stop signal
+     */
+    int popBatch(StreamPacket** items, int maxItems)
+    {
+        auto first = popFront();
+        if (!first) {
+            return 0;
+        }
+        items[0] = first;
+        if (first->type != kEvtData) {
+            return 1;
+        }
+        lockReader();
+        auto head = mHead.load(std::memory_order_relaxed);
+        auto tail = mTail.load(std::memory_order_acquire);
+        int n = 1;
+        int len = 0;
+        for (; n < maxItems && head != tail && mItems[head]->type == kEvtData; n++) {
+            items[n] = mItems[head];
+            len += static_cast<DataPacket*>(items[n])->dataLen;
+            head = nextIdx(head);
+        }
+        int data = mDataSize.fetch_sub(len, std::memory_order_relaxed) - len;
+        mHead.store(head);
+        unlockReader();
+        if (n > 1) {
+            wakeWriterIf((kNumSlots - 1 - count(head, mTail.load(std::memory_order_relaxed)) >= mWriteWakeLevel)
+                && (data < mMaxDataSize));
+        }
+        return n;
+    }
+    /** Destroys all queued packets. Must be called either from the producer task or while the producer
+     * is not pushing. A consumer that is blocked or inside popFront() is handled safely
+     */
+    void clear()
+    {
+        lockReader();
+        auto tail = mTail.load(std::memory_order_acquire);
+        for (auto head = mHead.load(std::memory_order_relaxed); head != tail; head = nextIdx(head)) {
+            mItems[head]->destroy();
+        }
+        mHead.store(tail);
+        mDataSize.store(0);
+        unlockReader();
+        wakeWriterIf(true);
+    }
+};
+#endif // SPSCSTREAMQUEUE_HPP
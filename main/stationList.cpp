@@ -116,6 +116,42 @@ bool StationList::next()
     }
     return ok;
 }
+bool StationList::getPrev(const char* before, Station& station)
+{
+    // The NVS iterator only goes forward, so we remember the last key before the one we look for.
+    // If it's the first one, or not found, we take the last key in the list
+    char prevKey[NVS_KEY_NAME_MAX_SIZE] = {0};
+    char lastKey[NVS_KEY_NAME_MAX_SIZE] = {0};
+    bool found = false;
+    for (nvs_iterator_t it = nvsEntryFind("nvs", mNsName, NVS_TYPE_BLOB); it; it = nvsEntryNext(it)) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        char ch = info.key[0];
+        if (ch == '_' || ch == ':') {
+            continue;
+        }
+        if (before && !found && strcmp(info.key, before) == 0) {
+            if (prevKey[0]) {
+                nvs_release_iterator(it);
+                return station.load(prevKey);
+            }
+            found = true;
+        }
+        else if (!found) {
+            strcpy(prevKey, info.key);
+        }
+        strcpy(lastKey, info.key);
+    }
+    return lastKey[0] && station.load(lastKey);
+}
+bool StationList::prev()
+{
+    bool ok = getPrev(currStation.isValid() ? currStation.id() : nullptr, currStation);
+    if (ok) {
+        saveCurrent();
+    }
+    return ok;
+}
 
 bool StationList::stationExists(const char* id)
 {
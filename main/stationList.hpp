@@ -61,6 +61,7 @@ protected:
     bool loadCurrent();
     bool stationExists(const char* id);
     bool getNext(const char* after, Station& station);
+    bool getPrev(const char* before, Station& station);
     char* getString(const char* key);
     static esp_err_t httpHandler(httpd_req_t* req);
     static esp_err_t httpImportHandler(httpd_req_t* req);
@@ -77,6 +78,11 @@ public:
     bool setCurrent(const char* id, bool noSave=false);
     bool saveCurrent();
     bool next();
+    bool prev();
+    /** Loads the station after \c id into \c station, wrapping around at the end of the list */
+    bool nextOf(const char* id, Station& station) { return getNext(id, station) || getNext(nullptr, station); }
+    /** Loads the station before \c id into \c station, wrapping around at the start of the list */
+    bool prevOf(const char* id, Station& station) { return getPrev(id, station); }
     bool remove(const char* id);
     template<class CB>
     void enumerate(CB&& callback);
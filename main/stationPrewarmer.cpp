@@ -0,0 +1,322 @@
+#include "stationPrewarmer.hpp"
+#include "hlsPlaylist.hpp"
+#include <string.h>
+#include <strings.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+static const char* TAG = "prewarm";
+#define LOCK() MutexLocker locker(mMutex)
+
+StationPrewarmer::Session::Session(const char* url, int bufSize)
+: mUrl(strdup(url)), mIcyParser(mIcyMutex), mBufSize(bufSize)
+{
+    mBuf.reset((uint8_t*)heap_caps_malloc(bufSize, utils::haveSpiRam() ? MALLOC_CAP_SPIRAM : MALLOC_CAP_DEFAULT));
+}
+StationPrewarmer::Session::~Session()
+{
+    disconnect();
+}
+esp_err_t StationPrewarmer::Session::httpEventHandler(esp_http_client_event_t* evt)
+{
+    // user_data is cleared when the client is handed over
+    if (evt->event_id != HTTP_EVENT_ON_HEADER || !evt->user_data) {
+        return ESP_OK;
+    }
+    static_cast<Session*>(evt->user_data)->onHttpHeader(evt->header_key, evt->header_value);
+    return ESP_OK;
+}
+void StationPrewarmer::Session::onHttpHeader(const char* key, const char* val)
+{
+    if (strcasecmp(key, "Content-Type") == 0) {
+        mFormat = StreamFormat::fromMimeType(val);
+    }
+    else if ((strcasecmp(key, "accept-ranges") == 0) && (strcasecmp(val, "bytes") == 0)) {
+        mAcceptsRanges = true;
+    }
+    else if (strcasecmp(key, "icy-br") == 0) {
+        mIcyBitrate = atoi(val);
+    }
+    else if (strcasecmp(key, "icy-name") == 0) {
+        mStationName.reset(strdup(val));
+    }
+    else {
+        mIcyParser.parseHeader(key, val);
+    }
+}
+bool StationPrewarmer::Session::isPlaylist() const
+{
+    auto type = mFormat.codec().type;
+    if (type == Codec::kPlaylistM3u8 || type == Codec::kPlaylistPls) {
+        return true;
+    }
+    const char* dot = strrchr(currentUrl(), '.');
+    return (dot && ((strcasecmp(dot, ".m3u") == 0 || strcasecmp(dot, ".m3u8") == 0)));
+}
+int8_t StationPrewarmer::Session::handleResponseAsPlaylist()
+{
+    if (!isPlaylist()) {
+        return 0;
+    }
+    int len = mContentLen ? mContentLen : 2048;
+    std::unique_ptr<char[]> buf(new char[len + 1]);
+    int rlen = esp_http_client_read(mClient, buf.get(), len);
+    if (rlen < 0) {
+        return -1;
+    }
+    buf[rlen] = 0;
+    if (HlsPlaylist::isHls(buf.get())) { // its segments are fetched by HttpNode itself
+        ESP_LOGI(TAG, "%s is an HLS stream, not keeping it warm", mUrl.get());
+        return -1;
+    }
+    mPlaylist.load(buf.get());
+    auto url = mPlaylist.getNextTrack();
+    if (!url) {
+        ESP_LOGW(TAG, "Couldn't obtain an url from playlist of %s", mUrl.get());
+        return -1;
+    }
+    mStreamUrl.reset(strdup(url));
+    esp_http_client_set_url(mClient, url);
+    return 1;
+}
+bool StationPrewarmer::Session::connect(SetHeadersFunc setHeaders)
+{
+    myassert(!mClient);
+    if (!mBuf) {
+        return false;
+    }
+    esp_http_client_config_t cfg = {};
+    cfg.url = currentUrl();
+    cfg.event_handler = httpEventHandler;
+    cfg.user_data = this;
+    cfg.timeout_ms = kConnectTimeoutMs;
+    cfg.buffer_size = 1024;
+    cfg.method = HTTP_METHOD_GET;
+    mClient = esp_http_client_init(&cfg);
+    if (!mClient) {
+        ESP_LOGE(TAG, "Error creating http client, probably out of memory");
+        return false;
+    }
+    setHeaders(mClient);
+    for (int tries = 0; tries < 4; tries++) { // redirects and playlists
+        mIcyParser.reset();
+        mFormat = StreamFormat();
+        mStationName.reset();
+        mIcyBitrate = 0;
+        mAcceptsRanges = false;
+        if (esp_http_client_open(mClient, 0) != ESP_OK) {
+            break;
+        }
+        mContentLen = esp_http_client_fetch_headers(mClient);
+        int status = esp_http_client_get_status_code(mClient);
+        if (status == 301 || status == 302) {
+            esp_http_client_set_redirection(mClient);
+            continue;
+        }
+        else if (status != 200) {
+            ESP_LOGW(TAG, "Http code %d from %s", status, currentUrl());
+            break;
+        }
+        auto ret = handleResponseAsPlaylist();
+        if (ret < 0) {
+            break;
+        }
+        else if (ret > 0) {
+            continue;
+        }
+        auto& codec = mFormat.codec();
+        mKeepsLatest = (codec.transport == Codec::kTransportDefault) &&
+            (codec.type == Codec::kCodecMp3 || codec.type == Codec::kCodecAac);
+        esp_http_client_set_timeout_ms(mClient, kReadTimeoutMs);
+        mDataStart = mDataLen = 0;
+        mTsConnected = mTsLastData = esp_timer_get_time();
+        mState = kStateStreaming;
+        ESP_LOGI(TAG, "Connected to %s, codec %s", currentUrl(), codec.toString());
+        return true;
+    }
+    disconnect();
+    return false;
+}
+void StationPrewarmer::Session::recv()
+{
+    int64_t now = esp_timer_get_time();
+    int freeSpace = mBufSize - mDataLen;
+    if (freeSpace < kRecvChunkSize) {
+        if (!mKeepsLatest) {
+            if (!freeSpace) {
+                mState = kStatePaused;
+                return;
+            }
+        }
+        else { // drop the oldest data
+            int drop = kRecvChunkSize - freeSpace;
+            mDataStart = (mDataStart + drop) % mBufSize;
+            mDataLen -= drop;
+            freeSpace = kRecvChunkSize;
+        }
+    }
+    int writePos = (mDataStart + mDataLen) % mBufSize;
+    int len = std::min(std::min((int)kRecvChunkSize, freeSpace), mBufSize - writePos);
+    char* buf = (char*)mBuf.get() + writePos;
+    int rlen = esp_http_client_read(mClient, buf, len);
+    if (rlen == 0 && !(mContentLen && esp_http_client_is_complete_data_received(mClient))) {
+        // read timeout. A closed connection looks the same, so it is detected by the data not arriving
+        if (now - mTsLastData > kStallTimeoutMs * 1000LL) {
+            ESP_LOGW(TAG, "No data from %s for too long, reconnecting", currentUrl());
+            disconnect();
+        }
+        return;
+    }
+    else if (rlen <= 0) {
+        ESP_LOGW(TAG, "Connection to %s ended", currentUrl());
+        disconnect();
+        mTsRetry = now + kRetryDelayMs * 1000LL;
+        return;
+    }
+    mTsLastData = now;
+    if (mIcyParser.icyInterval()) {
+        mIcyParser.processRecvData(buf, rlen);
+    }
+    mDataLen += rlen;
+}
+void StationPrewarmer::Session::disconnect()
+{
+    mState = kStateIdle;
+    mDataStart = mDataLen = 0;
+    if (!mClient) {
+        return;
+    }
+    esp_http_client_close(mClient);
+    esp_http_client_cleanup(mClient);
+    mClient = nullptr;
+}
+esp_http_client_handle_t StationPrewarmer::Session::releaseClient()
+{
+    auto client = mClient;
+    if (client) {
+        esp_http_client_set_user_data(client, nullptr);
+    }
+    mClient = nullptr;
+    mState = kStateIdle;
+    return client;
+}
+StationPrewarmer::StationPrewarmer(int maxSessions, int memBudget, SetHeadersFunc setHeaders)
+: mMaxSessions(std::min(maxSessions, (int)kMaxSessions)), mSetHeaders(setHeaders)
+{
+    mBufSize = mMaxSessions ? memBudget / mMaxSessions : 0;
+    mTask.createTask("prewarm", true, kStackSize, 0, kPrio, this, sTaskFunc);
+}
+StationPrewarmer::~StationPrewarmer()
+{
+    mTerminate = true;
+    mTask.waitToEnd();
+}
+void StationPrewarmer::sTaskFunc(void* ctx)
+{
+    static_cast<StationPrewarmer*>(ctx)->taskFunc();
+}
+void StationPrewarmer::taskFunc()
+{
+    int slot = 0;
+    int numIdle = 0; // consecutive sessions that had nothing to do
+    while (!mTerminate) {
+        Session* session = nullptr;
+        {
+            LOCK();
+            for (int i = 0; i < mMaxSessions && !session; i++) {
+                slot = (slot + 1) % mMaxSessions;
+                session = mSessions[slot].get();
+            }
+            mBusy = session;
+        }
+        bool didWork = false;
+        if (session) {
+            int64_t now = esp_timer_get_time();
+            switch (session->mState) {
+            case Session::kStateIdle:
+                if (now >= session->mTsRetry) {
+                    if (!session->connect(mSetHeaders)) {
+                        session->mTsRetry = now + kRetryDelayMs * 1000LL;
+                    }
+                    didWork = true;
+                }
+                break;
+            case Session::kStateStreaming:
+                session->recv();
+                didWork = true;
+                break;
+            case Session::kStatePaused:
+                if (now - session->mTsConnected > kMaxPausedMs * 1000LL) {
+                    session->disconnect();
+                    didWork = true;
+                }
+                break;
+            }
+            LOCK();
+            mBusy = nullptr;
+            mOrphan.reset(); // if the session was removed while we were servicing it
+        }
+        numIdle = didWork ? 0 : numIdle + 1;
+        if (numIdle >= std::max(mMaxSessions, 1)) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+            numIdle = 0;
+        }
+    }
+}
+void StationPrewarmer::setStations(const char* const* urls, int count)
+{
+    LOCK();
+    SessionPtr sessions[kMaxSessions];
+    int num = 0;
+    for (int i = 0; i < count && num < mMaxSessions; i++) {
+        auto url = urls[i];
+        if (!url || std::any_of(sessions, sessions + num, [url](SessionPtr& s) { return strcmp(s->url(), url) == 0; })) {
+            continue;
+        }
+        auto existing = std::find_if(mSessions, mSessions + mMaxSessions,
+            [url](SessionPtr& s) { return s && strcmp(s->url(), url) == 0; });
+        if (existing != mSessions + mMaxSessions) {
+            sessions[num++] = std::move(*existing);
+            continue;
+        }
+        SessionPtr session(new Session(url, mBufSize));
+        if (!session->mBuf) {
+            ESP_LOGW(TAG, "Out of memory allocating buffer for %s", url);
+            continue;
+        }
+        ESP_LOGI(TAG, "Keeping station %s warm", url);
+        sessions[num++] = std::move(session);
+    }
+    for (int i = 0; i < kMaxSessions; i++) {
+        auto& old = mSessions[i];
+        if (old && old.get() == mBusy) {
+            mOrphan = std::move(old); // deleted by the task when done with it
+        }
+        mSessions[i] = std::move(sessions[i]);
+    }
+}
+StationPrewarmer::SessionPtr StationPrewarmer::take(const char* url)
+{
+    // if the session is being serviced, wait for the read to complete, but not for a connect
+    for (int tries = 0; tries < 4; tries++) {
+        {
+            LOCK();
+            auto it = std::find_if(mSessions, mSessions + mMaxSessions,
+                [url](SessionPtr& s) { return s && strcmp(s->url(), url) == 0; });
+            if (it == mSessions + mMaxSessions) {
+                return nullptr;
+            }
+            if (it->get() != mBusy) {
+                if (!(*it)->isConnected() || !(*it)->dataSize()) {
+                    return nullptr;
+                }
+                ESP_LOGI(TAG, "Handing over connection to %s with %d bytes buffered", url, (*it)->dataSize());
+                return std::move(*it);
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(kReadTimeoutMs));
+    }
+    return nullptr;
+}
@@ -0,0 +1,128 @@
+#ifndef STATION_PREWARMER_HPP
+#define STATION_PREWARMER_HPP
+#include <esp_http_client.h>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <utils.hpp>
+#include <mutex.hpp>
+#include <task.hpp>
+#include "streamDefs.hpp"
+#include "icyParser.hpp"
+#include "playlist.hpp"
+
+/** Keeps connections to the stations that are likely to be played next, i.e. the neighbours of the
+ * current one in the station list, each with a small buffer of stream data. Switching to one of them then
+ * doesn't have to wait for connecting, following redirects and playlists, and receiving the whole prefill.
+ * All connections are serviced in turn by a single task.
+ * ICY metadata is stripped as the data is received, and the parser state is handed over with the
+ * connection. For codecs where decoding can start at any byte position (MP3 and AAC ADTS), the buffer
+ * keeps the most recent data. For the others, e.g. Ogg, the start of the stream is needed, so reception
+ * pauses when the buffer is full, and the connection is renewed after a while to not go stale
+ */
+class StationPrewarmer
+{
+public:
+    enum {
+        kMaxSessions = 4,
+        kConnectTimeoutMs = 5000,
+        kReadTimeoutMs = 50, // per read of a session, so that the others are not delayed
+        kRecvChunkSize = 2048,
+        kStallTimeoutMs = 8000, // reconnect if no data for that long
+        kMaxPausedMs = 20000, // renew a paused connection after that time
+        kRetryDelayMs = 5000,
+        kStackSize = 4096, kPrio = 10
+    };
+    typedef void(*SetHeadersFunc)(esp_http_client_handle_t client);
+    class Session
+    {
+    protected:
+        friend class StationPrewarmer;
+        enum State: uint8_t { kStateIdle, kStateStreaming, kStatePaused };
+        unique_ptr_mfree<char> mUrl; // as requested, to match against
+        unique_ptr_mfree<char> mStreamUrl; // after following playlists, null if the same as mUrl
+        esp_http_client_handle_t mClient = nullptr;
+        Mutex mIcyMutex;
+        IcyParser mIcyParser;
+        Playlist mPlaylist;
+        StreamFormat mFormat;
+        unique_ptr_mfree<char> mStationName;
+        int mIcyBitrate = 0;
+        int mContentLen = 0;
+        bool mAcceptsRanges = false;
+        bool mKeepsLatest = false;
+        State mState = kStateIdle;
+        unique_ptr_mfree<uint8_t> mBuf;
+        int mBufSize;
+        int mDataStart = 0;
+        int mDataLen = 0;
+        int64_t mTsConnected = 0;
+        int64_t mTsLastData = 0;
+        int64_t mTsRetry = 0;
+        static esp_err_t httpEventHandler(esp_http_client_event_t* evt);
+        void onHttpHeader(const char* key, const char* val);
+        const char* currentUrl() const { return mStreamUrl ? mStreamUrl.get() : mUrl.get(); }
+        bool isPlaylist() const;
+        bool connect(SetHeadersFunc setHeaders);
+        int8_t handleResponseAsPlaylist();
+        void recv();
+        void disconnect();
+    public:
+        Session(const char* url, int bufSize);
+        ~Session();
+        const char* url() const { return mUrl.get(); }
+        /** Url of the actual stream, if a playlist was followed, otherwise null */
+        const char* streamUrl() const { return mStreamUrl.get(); }
+        bool isConnected() const { return mState != kStateIdle; }
+        /** The connection, detached from the session. Its event handler no longer has a target, so it must
+         * not be opened again */
+        esp_http_client_handle_t releaseClient();
+        const StreamFormat& format() const { return mFormat; }
+        IcyParser& icyParser() { return mIcyParser; }
+        const char* stationName() const { return mStationName.get(); }
+        int icyBitrate() const { return mIcyBitrate; }
+        int contentLen() const { return mContentLen; }
+        bool acceptsRanges() const { return mAcceptsRanges; }
+        int dataSize() const { return mDataLen; }
+        /** Calls \c cb(const uint8_t* data, int len) for each contiguous region of the buffered data, in
+         * stream order, and empties the buffer */
+        template <class CB>
+        void takeData(CB&& cb)
+        {
+            int len1 = std::min(mDataLen, mBufSize - mDataStart);
+            if (len1) {
+                cb(mBuf.get() + mDataStart, len1);
+            }
+            if (mDataLen > len1) {
+                cb(mBuf.get(), mDataLen - len1);
+            }
+            mDataStart = mDataLen = 0;
+        }
+    };
+    typedef std::unique_ptr<Session> SessionPtr;
+protected:
+    Mutex mMutex;
+    Task mTask;
+    SessionPtr mSessions[kMaxSessions];
+    int mMaxSessions;
+    int mBufSize; // per session
+    SetHeadersFunc mSetHeaders;
+    Session* mBusy = nullptr; // being serviced by the task, without the lock held
+    SessionPtr mOrphan; // busy session that was removed, deleted by the task when done with it
+    std::atomic<bool> mTerminate = false;
+    static void sTaskFunc(void* ctx);
+    void taskFunc();
+public:
+    /** \c maxSessions is the number of stations kept warm, \c memBudget is the total size of their buffers.
+     * \c setHeaders sets the request headers, so that the server sees the same request as from the stream node */
+    StationPrewarmer(int maxSessions, int memBudget, SetHeadersFunc setHeaders);
+    ~StationPrewarmer();
+    int maxSessions() const { return mMaxSessions; }
+    /** Sets the urls of the stations to keep warm, in order of priority. Sessions of other urls are closed,
+     * and those of urls beyond maxSessions() are not opened. Null entries are skipped */
+    void setStations(const char* const* urls, int count);
+    /** Removes and returns the session of the url if it is connected, null otherwise */
+    SessionPtr take(const char* url);
+};
+
+#endif
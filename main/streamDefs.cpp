@@ -8,30 +8,33 @@
 
 int StreamFormat::prefillAmount() const
 {
-    enum { kHalfSecs = 3 };
     switch (codec().type) {
         case Codec::kCodecMp3:
             // kbits/sec * (1024 / 8) * (halfSec / 2)
-            return (256 * 1024 * kHalfSecs) >> 4;
+            return (256 * 1024 * kPrefillHalfSecs) >> 4;
         case Codec::kCodecVorbis:
-            return (160 * 1024 * kHalfSecs) >> 4;
-        case Codec::kCodecAac:
-            return (100 * 1024 * kHalfSecs) >> 4;
+            return (160 * 1024 * kPrefillHalfSecs) >> 4;
+        case Codec::kCodecOpus:
+            return (128 * 1024 * kPrefillHalfSecs) >> 4;
+        case Codec::kCodecAac: // MP4 files are typically encoded at a higher bitrate than radio streams
+            return (((codec().transport == Codec::kTransportMpeg) ? 256 : 100) * 1024 * kPrefillHalfSecs) >> 4;
+        case Codec::kCodecAlac:
+            return (((sampleRate() <= 48000 && bitsPerSample() <= 16) ? 1000 : 3000) * 1024 * kPrefillHalfSecs) >> 4;
         case Codec::kCodecFlac: {
             int kbps = (sampleRate() <= 48000)
                 ? (bitsPerSample() <= 16 ? 1000 : 1500)
                 : (bitsPerSample() <= 16 ? 1700 : 3000);
-            return (kbps * 1024 * kHalfSecs) >> 4;
+            return (kbps * 1024 * kPrefillHalfSecs) >> 4;
         }
         case Codec::kCodecWav:
         case Codec::kCodecPcm: {
-            auto val = (bytesPerSample() * sampleRate() * numChannels() * kHalfSecs) >> 1;
-            return val ? val : (2 * 44100 * 2 * kHalfSecs) >> 1;
+            auto val = (bytesPerSample() * sampleRate() * numChannels() * kPrefillHalfSecs) >> 1;
+            return val ? val : (2 * 44100 * 2 * kPrefillHalfSecs) >> 1;
         }
         case Codec::KCodecSbc:
             return 8192; // Bluetooth sink should do minimum buffering
         default:
-            return (256 * 1024 * kHalfSecs) >> 4; // 256 kbit/s
+            return (256 * 1024 * kPrefillHalfSecs) >> 4; // 256 kbit/s
     }
 }
 int16_t StreamFormat::rxChunkSize() const
@@ -41,6 +44,7 @@ int16_t StreamFormat::rxChunkSize() const
             // need to limit this because it affects packet size and DSP buffer size
             return sampleRate() ? 1024 * bytesPerSample() * numChannels() : 4096;
         case Codec::kCodecFlac:
+        case Codec::kCodecAlac:
             return 4096;
         default:
             return (codec().transport == Codec::kTransportOgg) ? 4096 : 2048;
@@ -63,6 +67,7 @@ const char* Codec::toString() const
         case kCodecWav: return "wav";
         case kCodecPcm: return "pcm";
         case KCodecSbc: return "sbc";
+        case kCodecAlac: return "alac"; // transport is always mpeg
         case kCodecUnknown:
         default:
             if (transport == kTransportOgg) {
@@ -81,6 +86,7 @@ const char* Codec::fileExt() const {
         case kCodecFlac: return "flac";
         case kCodecOpus: return "opus";
         case kCodecVorbis: return "ogg";
+        case kCodecAlac: return "m4a";
         case kCodecWav: return "wav";
         default: return "unk";
     }
@@ -110,10 +116,15 @@ StreamFormat StreamFormat::fromMimeType(const char* content_type)
     }
     else if (strcasecmp(content_type, "audio/aac") == 0 ||
         strcasecmp(content_type, "audio/x-aac") == 0 ||
-//      strcasecmp(content_type, "audio/mp4") == 0 ||
         strcasecmp(content_type, "audio/aacp") == 0) {
         return Codec::kCodecAac;
     }
+    else if (strcasecmp(content_type, "audio/mp4") == 0 ||
+        strcasecmp(content_type, "audio/x-m4a") == 0 ||
+        strcasecmp(content_type, "audio/m4a") == 0) {
+        // may turn out to be ALAC, the demuxer determines the actual codec
+        return Codec(Codec::kCodecAac, Codec::kTransportMpeg);
+    }
     else if (strcasecmp(content_type, "audio/flac") == 0 ||
              strcasecmp(content_type, "audio/x-flac") == 0) {
         return Codec::kCodecFlac;
@@ -133,7 +144,7 @@ StreamFormat StreamFormat::fromMimeType(const char* content_type)
         return parseLpcmContentType(content_type, 24);
     }
     else if (strcasecmp(content_type, "audio/opus") == 0) {
-        return Codec::kCodecOpus;
+        return Codec(Codec::kCodecOpus, Codec::kTransportOgg);
     }
     else if (strcasecmp(content_type, "audio/x-mpegurl") == 0 ||
         strcasecmp(content_type, "application/vnd.apple.mpegurl") == 0 ||
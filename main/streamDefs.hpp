@@ -13,6 +13,7 @@ struct Codec {
         kCodecWav,
         kCodecPcm,
         KCodecSbc,
+        kCodecAlac,
         // ====
         kPlaylistM3u8,
         kPlaylistPls
@@ -126,7 +127,10 @@ public:
     void setIsLeftAligned(bool val) { members.isLeftAligned = val; }
     void setNumChannels(uint8_t ch) { members.numChannels = ch - 1; }
     void setSourceIsMono(bool val) { members.sourceIsMono = val; }
+    // prefillAmount() is this many half-seconds of audio, at a typical bitrate for the codec
+    enum { kPrefillHalfSecs = 3 };
     int prefillAmount() const;
+    int typicalByteRate() const { return prefillAmount() * 2 / kPrefillHalfSecs; }
     int16_t rxChunkSize() const;
 };
 
@@ -6,6 +6,7 @@
 #include <atomic>
 #include "utils.hpp"
 #include <utils-parse.hpp>
+#include "packetPool.hpp"
 
 constexpr uint32_t myLog2(uint32_t n) noexcept
 {
@@ -30,12 +31,18 @@ public:
     enum: uint8_t {
         kHasSpaceFor16Bit = 1,
         kHasSpaceFor32Bit = 2 | kHasSpaceFor16Bit,
-        kCustomAlloc = 4
+        kCustomAlloc = 4,
+        kByteStream = 8, // NewStreamEvent: the stream data is delivered via the source node's byte stream API
+        kPoolClassShift = 4, // bits 4-7: PacketPool size class + 1, 0 if not pool-allocated
+        kPoolClassMask = 0xf0
     };
     StreamEvent type;
     uint8_t flags;
     void destroy() { // may use custom allocation
-        if (flags & kCustomAlloc) {
+        if (flags & kPoolClassMask) {
+            PacketPool::release(this, (flags >> kPoolClassShift) - 1);
+        }
+        else if (flags & kCustomAlloc) {
             free(this);
         }
         else {
@@ -44,12 +51,27 @@ public:
     }
     template<class T>
     static T* allocWithBufSize(StreamEvent type, size_t aBufSize) {
-        auto inst = (T*)heap_caps_malloc(sizeof(T) + aBufSize, MALLOC_CAP_SPIRAM);
+        static_assert(sizeof(T) <= PacketPool::kHeaderSize, "Packet header does not fit in PacketPool::kHeaderSize");
+        uint8_t cls;
+        auto inst = (T*)PacketPool::alloc(aBufSize, cls);
         inst->type = type;
-        inst->flags = kCustomAlloc;
+        inst->flags = (cls == PacketPool::kNoClass) ? kCustomAlloc : (kCustomAlloc | ((cls + 1) << kPoolClassShift));
         return inst;
     }
 };
+/** Extends the wrapping 32-bit DataPacket::pts of a stream to 64 bits. It must be updated with the pts of
+ * every packet, or at least once per 2^31 frames */
+struct PtsExtender
+{
+    uint64_t pts = 0;
+    /** Sets the position at the start of a stream, from the seek time of its NewStreamEvent */
+    void reset(uint32_t seekTimeMs, uint32_t sampleRate) { pts = (uint64_t)seekTimeMs * sampleRate / 1000; }
+    uint64_t extend(uint32_t pktPts)
+    {
+        pts += (int32_t)(pktPts - (uint32_t)pts);
+        return pts;
+    }
+};
 struct TitleChangeEvent: public StreamPacket {
     typedef std::unique_ptr<TitleChangeEvent, Deleter> unique_ptr;
     unique_ptr_mfree<const char> title;
@@ -61,6 +83,11 @@ struct TitleChangeEvent: public StreamPacket {
 struct DataPacket: public StreamPacket {
     typedef std::unique_ptr<DataPacket, Deleter> unique_ptr;
     int16_t dataLen;
+    // PCM packets: presentation timestamp, as the index of the first sample (frame) in the stream,
+    // including the seek offset. Assigned by the decoder or the PCM input node, 0 for encoded data.
+    // It wraps around, after about 27 hours at 44.1kHz, and 6.2 hours at 192kHz. Consumers that need
+    // the absolute position extend it with PtsExtender
+    uint32_t pts;
     alignas(uint32_t) char data[];
     template <bool Empty=false>
     static DataPacket* create(int aBufSize, uint8_t flags) {
@@ -72,6 +99,7 @@ struct DataPacket: public StreamPacket {
     static DataPacket* createWithoutFlags(int aBufSize) {
         auto inst = allocWithBufSize<DataPacket>(kEvtData, aBufSize);
         inst->dataLen = Empty ? 0 : aBufSize;
+        inst->pts = 0;
         return inst;
     }
     void logData(int16_t maxLen, const char* msg, int lineLen=20)
@@ -0,0 +1,220 @@
+// Host trace replay of the adaptive buffer governor. A trace of network arrivals is played through a
+// simulated buffer that is drained at the stream byte rate, once with the static per-codec prefill, and
+// with the BufferGovernor - first with no history of the station, then after it has learned from a
+// previous session on the same link. Reports, as one JSON object per line: startup delay, number of
+// underruns and total stall time of each run. Fails if the learned run has more underruns than the
+// static one, or if an adaptive run stalls for longer than the static one.
+// Without trace files, synthetic traces of a LAN, a flaky WiFi and a cellular link are generated, and
+// the learning session is played on a trace with a different random seed than the measured one.
+// A trace file has one "<microseconds> <bytes>" line per arrival, and optionally a "# kbps <N>" line
+// with the stream bitrate. To record one from a real stream (128 kbps in this example):
+// (echo "# kbps 128"; curl -sN <url> | perl -MTime::HiRes=time -e 'binmode STDIN; $t0=time;
+//   while (($n = sysread(STDIN, $b, 4096)) > 0) { printf("%d %d\n", (time-$t0)*1e6, $n) }') > trace.txt
+// With a file, the learning session is played on the same trace.
+// g++ -std=gnu++17 -O2 -o bufferGovernorTest bufferGovernorTest.cpp ../bufferGovernor.cpp ../streamDefs.cpp -I ./host -I ..
+// Usage: bufferGovernorTest [trace files...]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "bufferGovernor.hpp"
+
+struct Arrival
+{
+    int64_t us;
+    int bytes;
+};
+struct Trace
+{
+    std::string name;
+    int kbps = 0;
+    std::vector<Arrival> arrivals;
+};
+struct Result
+{
+    int startupMs = -1; // -1 if playback never started
+    int underruns = 0;
+    int stallMs = 0;
+};
+enum { kSessionSec = 180, kChunkMs = 50 };
+
+static uint32_t sSeed;
+static int rnd(int range) // 0..range-1
+{
+    sSeed = sSeed * 1664525 + 1013904223;
+    return (sSeed >> 8) % range;
+}
+enum LinkType { kLinkLan, kLinkWifi, kLinkCell };
+static const char* linkName(LinkType type)
+{
+    static const char* names[] = { "lan", "wifi", "cell" };
+    return names[type];
+}
+// The server sends at the stream rate, in chunks delayed by the link jitter. On a stall, nothing arrives,
+// and afterwards the data that was held up arrives at once
+static Trace makeTrace(LinkType type, uint32_t seed)
+{
+    Trace trace;
+    trace.name = std::string(linkName(type)) + "-" + std::to_string(seed);
+    trace.kbps = 128;
+    sSeed = seed;
+    int rate = trace.kbps * 125;
+    int jitterMs = (type == kLinkLan) ? 2 : (type == kLinkWifi) ? 30 : 80;
+    int64_t nextStallMs = (type == kLinkLan) ? INT64_MAX : 5000 + rnd(15000);
+    int64_t stalledUntilMs = 0;
+    int pending = 0;
+    int64_t lastUs = 0;
+    if (type == kLinkWifi) { // a server with an initial burst
+        trace.arrivals.push_back({20000, 32768});
+        lastUs = 20000;
+    }
+    for (int64_t ms = 0; ms < kSessionSec * 1000; ms += kChunkMs) {
+        pending += rate * kChunkMs / 1000;
+        if (ms >= nextStallMs) {
+            int len = (type == kLinkWifi) ? 200 + rnd(700) : 1000 + rnd(2500);
+            stalledUntilMs = ms + len;
+            nextStallMs = ms + ((type == kLinkWifi) ? 10000 + rnd(10000) : 20000 + rnd(20000));
+        }
+        if (ms < stalledUntilMs) {
+            continue;
+        }
+        int64_t us = std::max(lastUs + 1000, (ms + 20 + rnd(jitterMs)) * 1000);
+        trace.arrivals.push_back({us, pending});
+        lastUs = us;
+        pending = 0;
+    }
+    return trace;
+}
+static bool loadTrace(const char* fname, Trace& trace)
+{
+    FILE* f = fopen(fname, "r");
+    if (!f) {
+        fprintf(stderr, "Can't open %s\n", fname);
+        return false;
+    }
+    trace.name = fname;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        long long us;
+        int val;
+        if (sscanf(line, "# kbps %d", &val) == 1) {
+            trace.kbps = val;
+        }
+        else if (sscanf(line, "%lld %d", &us, &val) == 2) {
+            trace.arrivals.push_back({us, val});
+        }
+    }
+    fclose(f);
+    if (trace.arrivals.empty() || !trace.kbps) {
+        fprintf(stderr, "%s: no arrivals or no '# kbps' line\n", fname);
+        return false;
+    }
+    return true;
+}
+// Plays the trace into a buffer that is drained at the stream rate once the prefill level is reached.
+// If gov is null, the static prefill is used for the start and after underruns
+static Result simulate(const Trace& trace, BufferGovernor* gov)
+{
+    StreamFormat fmt(Codec::kCodecMp3);
+    int rate = trace.kbps * 125;
+    int prefill = fmt.prefillAmount();
+    if (gov) {
+        gov->startSession(0x1234);
+        gov->setFormat(fmt);
+        gov->setIcyBitrate(trace.kbps);
+        prefill = gov->prefillAmount();
+    }
+    Result res;
+    int64_t buffered = 0;
+    bool playing = false;
+    int64_t stallStartUs = 0;
+    int64_t prevUs = 0;
+    for (auto& arr: trace.arrivals) {
+        if (playing) {
+            int64_t drain = rate * (arr.us - prevUs) / 1000000;
+            if (drain >= buffered) {
+                stallStartUs = prevUs + buffered * 1000000 / rate;
+                buffered = 0;
+                playing = false;
+                res.underruns++;
+                prefill = gov ? gov->onUnderrun() : fmt.prefillAmount();
+            }
+            else {
+                buffered -= drain;
+            }
+        }
+        prevUs = arr.us;
+        if (gov) {
+            gov->onData(arr.bytes, arr.us);
+        }
+        buffered += arr.bytes;
+        if (!playing && buffered >= prefill) {
+            playing = true;
+            if (res.startupMs < 0) {
+                res.startupMs = arr.us / 1000;
+            }
+            else {
+                res.stallMs += (arr.us - stallStartUs) / 1000;
+            }
+        }
+    }
+    return res;
+}
+static void printResult(const Trace& trace, const char* mode, const Result& res, int prefill)
+{
+    printf("{\"trace\":\"%s\",\"mode\":\"%s\",\"prefill\":%d,\"startupMs\":%d,\"underruns\":%d,\"stallMs\":%d}\n",
+        trace.name.c_str(), mode, prefill, res.startupMs, res.underruns, res.stallMs);
+}
+static bool runTrace(const Trace& learnTrace, const Trace& trace)
+{
+    auto fixed = simulate(trace, nullptr);
+    printResult(trace, "static", fixed, StreamFormat(Codec::kCodecMp3).prefillAmount());
+    BufferGovernor gov;
+    auto first = simulate(trace, &gov);
+    printResult(trace, "adaptiveFirst", first, StreamFormat(Codec::kCodecMp3).prefillAmount());
+    gov.endSession();
+    simulate(learnTrace, &gov);
+    gov.endSession();
+    gov.startSession(0x1234);
+    gov.setIcyBitrate(trace.kbps);
+    int learnedPrefill = gov.prefillAmount();
+    auto learned = simulate(trace, &gov);
+    printResult(trace, "adaptiveLearned", learned, learnedPrefill);
+    bool ok = true;
+    if (learned.underruns > fixed.underruns) {
+        printf("FAIL: %s: learned run has %d underruns vs %d with the static prefill\n",
+            trace.name.c_str(), learned.underruns, fixed.underruns);
+        ok = false;
+    }
+    for (auto run: { std::make_pair("first", &first), std::make_pair("learned", &learned) }) {
+        if (run.second->stallMs > fixed.stallMs) {
+            printf("FAIL: %s: %s run stalls for %d ms vs %d ms with the static prefill\n",
+                trace.name.c_str(), run.first, run.second->stallMs, fixed.stallMs);
+            ok = false;
+        }
+    }
+    return ok;
+}
+int main(int argc, char* argv[])
+{
+    int numFailed = 0;
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            Trace trace;
+            if (!loadTrace(argv[i], trace)) {
+                return 2;
+            }
+            numFailed += !runTrace(trace, trace);
+        }
+    }
+    else {
+        for (auto type: { kLinkLan, kLinkWifi, kLinkCell }) {
+            for (uint32_t seed = 1; seed <= 3; seed++) {
+                numFailed += !runTrace(makeTrace(type, seed + 100), makeTrace(type, seed));
+            }
+        }
+    }
+    return numFailed ? 1 : 0;
+}
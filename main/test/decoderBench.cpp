@@ -0,0 +1,280 @@
+// Host benchmark of the decoders: runs test vectors through FileInputNode -> DecoderNode, with the
+// same Decoder implementations as the firmware, and reports per vector, as one JSON object per line:
+// decode speed as a multiple of realtime (time spent in Decoder::decode(), excluding output queue waits),
+// output packets per second of decode time, peak heap usage of the decoder (including its output queue),
+// and a checksum of the PCM output.
+// The absolute speed is of the host, not of the ESP32, but changes in the ratios between runs and codecs,
+// and checksum mismatches, show regressions in the integration of libmad, helix-aac, tremor, libFLAC and libopus,
+// and in the MP4 demuxer and ALAC decoder.
+// With -p, native FLAC vectors are also decoded single-threaded and with the frame-parallel decoder forced on,
+// and an extra line reports the speedup and whether both outputs are identical.
+// Build: same as hostPlayer, with decoderBench.cpp instead of hostPlayer.cpp, hostSinkNode.cpp and the EQ sources
+// Test vectors (ffmpeg with libmp3lame, libvorbis and libopus), as used for decoderBench-baseline.jsonl:
+// SRC="-f lavfi -i anoisesrc=d=30:c=pink:a=0.25:r=192000:seed=1 -f lavfi -i sine=f=440:d=30:r=192000 -filter_complex amix=inputs=2,aformat=channel_layouts=stereo"
+// ffmpeg $SRC -ar 44100 -c:a libmp3lame -b:a 320k mp3-320k.mp3
+// ffmpeg $SRC -ar 44100 -c:a aac -b:a 128k aac-lc-128k.aac
+// ffmpeg -i aac-lc-128k.aac -c copy aac-lc-128k.m4a (index after the media data, exercises AudioNode::seekStream())
+// ffmpeg -i aac-lc-128k.aac -c copy -movflags +faststart aac-lc-128k-faststart.m4a
+// ffmpeg -i wav-16-44k.wav -c:a alac alac-16-44k.m4a
+// ffmpeg -i flac-24-192k.flac -c:a alac -sample_fmt s32p alac-24-192k.m4a
+// ffmpeg $SRC -ar 44100 -sample_fmt s16 flac-16-44k.flac
+// ffmpeg $SRC -ar 44100 -sample_fmt s16 flac-16-44k.oga
+// ffmpeg $SRC -ar 192000 -sample_fmt s32 -bits_per_raw_sample 24 flac-24-192k.flac
+// ffmpeg $SRC -ar 44100 -c:a libvorbis -q:a 10 vorbis-q10.ogg
+// ffmpeg $SRC -ar 48000 -c:a libopus -b:a 128k -metadata title=Pink -metadata artist=Noise opus-128k.opus
+// ffmpeg $SRC -ac 1 -ar 48000 -c:a libopus -b:a 64k opus-mono-64k.opus
+// The Opus output is not bit-exact between libopus versions and fixed/float builds, so the baseline has no Opus checksums
+// ffmpeg $SRC -ar 44100 -c:a pcm_s16le wav-16-44k.wav
+// HE-AAC requires an encoder with SBR support, i.e. ffmpeg -c:a libfdk_aac -profile:a aac_he -b:a 64k he-aac-64k.aac
+// Usage: decoderBench [-n runs] [-b baseline.jsonl] [-t tolerance%] [-p] <file>... > results.jsonl
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <string>
+#include <map>
+#include <eventGroup.hpp>
+#include "fileInputNode.hpp"
+#include "decoderNode.hpp"
+
+static const char* TAG = "decbench";
+
+class BenchPipeline: public IAudioPipeline
+{
+public:
+    uint8_t mCodec = 0;
+    virtual bool onNodeEvent(AudioNode& node, uint32_t type, size_t numArg, uintptr_t arg) override
+    {
+        if (type == DecoderNode::kEventCodecChange) {
+            mCodec = numArg;
+        }
+        return true;
+    }
+    virtual void onNodeError(AudioNode& node, int error, uintptr_t arg) override {}
+    virtual void onNeedLargeMemory(int32_t amountHint) override {}
+};
+class BenchDecoderNode: public DecoderNode
+{
+public:
+    using DecoderNode::DecoderNode;
+    const LatencyStats& decodeStats() const { return mDecodeStats; }
+    int32_t heapPeak() const { return mHeapPeak; }
+};
+struct BenchResult
+{
+    std::string file;
+    const char* codec = "";
+    StreamFormat fmt;
+    double audioSec = 0;
+    double decodeSec = 0;
+    double rtf = 0;
+    double pktPerSec = 0;
+    int32_t heap = 0;
+    uint32_t crc = 0;
+    bool ok = false;
+    void toJson(FILE* out) const
+    {
+        fprintf(out, "{\"file\":\"%s\",\"codec\":\"%s\",\"sr\":%lu,\"bits\":%d,\"ch\":%d,\"audioSec\":%.3f,"
+            "\"decodeSec\":%.4f,\"rtf\":%.1f,\"pktPerSec\":%.0f,\"heap\":%ld,\"crc\":\"%08lx\",\"ok\":%s}\n",
+            file.c_str(), codec, (unsigned long)fmt.sampleRate(), fmt.bitsPerSample(), fmt.numChannels(),
+            audioSec, decodeSec, rtf, pktPerSec, (long)heap, (unsigned long)crc, ok ? "true" : "false");
+    }
+};
+// FNV-1a
+static uint32_t checksumUpdate(uint32_t crc, const uint8_t* data, int len)
+{
+    for (const uint8_t* end = data + len; data < end; data++) {
+        crc = (crc ^ *data) * 16777619u;
+    }
+    return crc;
+}
+static bool runOne(const char* path, BenchResult& res, uint8_t flacMode = DecoderNode::kFlacParallelHiRes)
+{
+    BenchPipeline pipeline;
+    FileInputNode input(pipeline);
+    BenchDecoderNode decoder(pipeline);
+    decoder.linkToPrev(&input);
+    decoder.setFlacParallel(flacMode);
+    input.setFile(path);
+    res.file = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    res.crc = 2166136261u;
+    uint32_t numPackets = 0;
+    uint64_t numSamples = 0;
+    int frameSize = 0;
+    input.run();
+    // so that the input buffer allocations don't count in the decoder heap usage
+    while (!input.prefilled()) {
+        usleep(1000);
+    }
+    decoder.run();
+    for (;;) {
+        AudioNode::PacketResult pr;
+        AudioNode::PacketBatch batch;
+        auto evt = decoder.pullBatch(pr, batch, AudioNode::PacketBatch::kMaxPackets);
+        if (evt == kEvtStreamEnd) {
+            res.ok = true;
+            break;
+        }
+        else if (evt == kEvtStreamChanged) {
+            res.fmt = pr.newStreamEvent().fmt;
+            frameSize = res.fmt.numChannels() * (res.fmt.bitsPerSample() > 16 ? 4 : 2);
+        }
+        else if (evt == kEvtData) {
+            for (int i = 0; i < batch.count; i++) {
+                auto& pkt = batch[i];
+                res.crc = checksumUpdate(res.crc, (uint8_t*)pkt.data, pkt.dataLen);
+                numPackets++;
+                if (frameSize) {
+                    numSamples += pkt.dataLen / frameSize;
+                }
+            }
+        }
+        else if (evt < 0) {
+            ESP_LOGE(TAG, "Decode error %d for '%s'", evt, path);
+            break;
+        }
+    }
+    input.terminate(true);
+    decoder.terminate(true); // the stats of the last decode() call are updated by the decoder thread
+    auto& stats = decoder.decodeStats();
+    res.codec = Codec::numCodeToStr(pipeline.mCodec);
+    res.heap = decoder.heapPeak();
+    res.decodeSec = stats.sumUs() / 1000000.0;
+    res.audioSec = res.fmt.sampleRate() ? (double)numSamples / res.fmt.sampleRate() : 0;
+    if (res.decodeSec > 0) {
+        res.rtf = res.audioSec / res.decodeSec;
+        res.pktPerSec = numPackets / res.decodeSec;
+    }
+    return res.ok;
+}
+// Fastest of numRuns runs, fails if the output differs between runs
+static BenchResult runBest(const char* path, int numRuns, uint8_t flacMode = DecoderNode::kFlacParallelHiRes)
+{
+    BenchResult best;
+    for (int run = 0; run < numRuns; run++) {
+        BenchResult res;
+        if (!runOne(path, res, flacMode)) {
+            return res;
+        }
+        if (run && res.crc != best.crc) {
+            ESP_LOGE(TAG, "'%s': output differs between runs", path);
+            res.ok = false;
+            return res;
+        }
+        if (res.rtf > best.rtf) {
+            best = res;
+        }
+    }
+    return best;
+}
+// Compares the single-threaded and the frame-parallel FLAC decoder
+static bool benchFlacParallel(const char* path, int numRuns, const BenchResult& ref)
+{
+    auto single = runBest(path, numRuns, DecoderNode::kFlacParallelOff);
+    auto parallel = runBest(path, numRuns, DecoderNode::kFlacParallelAlways);
+    bool ok = single.ok && parallel.ok && single.crc == ref.crc && parallel.crc == ref.crc;
+    if (single.ok && parallel.ok && !ok) {
+        ESP_LOGE(TAG, "'%s': single-threaded output %08lx, parallel %08lx, expected %08lx", ref.file.c_str(),
+            (unsigned long)single.crc, (unsigned long)parallel.crc, (unsigned long)ref.crc);
+    }
+    printf("{\"file\":\"%s\",\"flacMt\":true,\"rtfSingle\":%.1f,\"rtfParallel\":%.1f,\"speedup\":%.2f,"
+        "\"heapSingle\":%ld,\"heapParallel\":%ld,\"ok\":%s}\n", ref.file.c_str(), single.rtf, parallel.rtf,
+        single.rtf > 0 ? parallel.rtf / single.rtf : 0, (long)single.heap, (long)parallel.heap, ok ? "true" : "false");
+    return ok;
+}
+// Baseline file is the output of a previous run, one JSON object per line
+static std::map<std::string, BenchResult> loadBaseline(const char* path)
+{
+    std::map<std::string, BenchResult> result;
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        ESP_LOGE(TAG, "Can't open baseline file '%s'", path);
+        return result;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        const char* name = strstr(line, "\"file\":\"");
+        const char* rtf = strstr(line, "\"rtf\":");
+        const char* crc = strstr(line, "\"crc\":\"");
+        if (!name || !rtf || !crc) { // also skips the -p lines
+            continue;
+        }
+        name += 8;
+        auto nameEnd = strchr(name, '"');
+        if (!nameEnd) {
+            continue;
+        }
+        BenchResult res;
+        res.file.assign(name, nameEnd - name);
+        res.rtf = strtod(rtf + 6, nullptr);
+        res.crc = strtoul(crc + 7, nullptr, 16);
+        result[res.file] = res;
+    }
+    fclose(file);
+    return result;
+}
+static void usage()
+{
+    fprintf(stderr, "Usage: decoderBench [-n runs] [-b baseline.jsonl] [-t tolerance%%] [-p] <file>...\n"
+        "  -n  number of runs per file, the fastest is reported (default 3)\n"
+        "  -b  compare against a baseline, exits with an error on checksum mismatch or slowdown\n"
+        "  -t  allowed slowdown vs the baseline, in percent (default 10)\n"
+        "  -p  also compare single-threaded and frame-parallel decoding of native FLAC files\n");
+}
+int main(int argc, char* argv[])
+{
+    int numRuns = 3;
+    int tolerance = 10;
+    const char* baselinePath = nullptr;
+    bool flacParallel = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:b:t:p")) != -1) {
+        switch (opt) {
+            case 'n': numRuns = atoi(optarg); break;
+            case 'b': baselinePath = optarg; break;
+            case 't': tolerance = atoi(optarg); break;
+            case 'p': flacParallel = true; break;
+            default: usage(); return 1;
+        }
+    }
+    if (optind >= argc || numRuns < 1) {
+        usage();
+        return 1;
+    }
+    // account the allocations of the decoder thread in the heap stats, see xPortGetFreeHeapSize()
+    mallopt(M_ARENA_MAX, 1);
+    std::map<std::string, BenchResult> baseline;
+    if (baselinePath) {
+        baseline = loadBaseline(baselinePath);
+    }
+    int numFailed = 0;
+    for (int i = optind; i < argc; i++) {
+        auto best = runBest(argv[i], numRuns);
+        if (baselinePath && best.ok) {
+            auto it = baseline.find(best.file);
+            if (it == baseline.end()) {
+                ESP_LOGW(TAG, "'%s' is not in the baseline", best.file.c_str());
+            }
+            else if (it->second.crc != best.crc) {
+                ESP_LOGE(TAG, "'%s': checksum %08lx differs from baseline %08lx", best.file.c_str(),
+                    (unsigned long)best.crc, (unsigned long)it->second.crc);
+                best.ok = false;
+            }
+            else if (best.rtf < it->second.rtf * (100 - tolerance) / 100) {
+                ESP_LOGE(TAG, "'%s': %.1fx realtime is slower than baseline %.1fx", best.file.c_str(),
+                    best.rtf, it->second.rtf);
+                best.ok = false;
+            }
+        }
+        if (!best.ok) {
+            numFailed++;
+        }
+        best.toJson(stdout);
+        if (flacParallel && best.ok && strcmp(best.codec, "flac") == 0 && !benchFlacParallel(argv[i], numRuns, best)) {
+            numFailed++;
+        }
+        fflush(stdout);
+    }
+    return numFailed ? 1 : 0;
+}
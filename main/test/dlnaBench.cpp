@@ -0,0 +1,536 @@
+// Host benchmark of the DLNA control request path of DlnaHandler: parsing the SOAP request and its
+// DIDL-Lite metadata, and building the response. The requests are modelled on those sent by BubbleUPnP,
+// foobar2000, Windows Media Player (which uses other namespace prefixes) and Kodi, plus ones with the
+// metadata in CDATA and with 8 KB of metadata, as sent by servers with long descriptions and many
+// resources. Each request is processed the way the handler did it before - the whole body in one buffer,
+// tinyxml2 documents for it and the metadata, and the response appended to a std::string - and by
+// SoapRequestParser, fed in chunks as read from the socket, with the response filled from the templates
+// into a reused buffer.
+// Checks that both ways extract the same action, arguments and metadata where the old one could handle
+// the request, that feeding the parser byte by byte gives the same, that the new responses are valid XML
+// with the values in place, and that the new way doesn't allocate once its buffers have grown.
+// Reports, as one JSON object per line: the request, its size, and of both ways, whether it was handled,
+// the heap allocations and the time per request.
+// g++ -std=gnu++17 -O2 -o dlnaBench dlnaBench.cpp ../dlna-parse.cpp ../../components/tinyxml/tinyxml2.cpp \
+//   -I ./host -I .. -I ../../components/tinyxml
+// Usage: dlnaBench [iterations, default 2000]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <new>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <utils.hpp>
+#include <tinyxml2.h>
+#include "dlna-parse.hpp"
+
+using namespace tinyxml2;
+
+enum { kRecvChunkSize = 384 }; // as in DlnaHandler::httpDlnaCommandHandler()
+static const char kTrackUrl[] = "http://192.168.1.20:9790/minimserver/*/Music/x.flac?fmt=flac&br=1411";
+static const uint32_t kTrackDurationMs = 562000;
+static const uint32_t kTrackPositionMs = 83400;
+
+static uint32_t sNumAllocs = 0;
+void* operator new(size_t size)
+{
+    sNumAllocs++;
+    if (void* ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+static int64_t nsNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#define SOAP_HEAD "<?xml version=\"1.0\" encoding=\"utf-8\"?><s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" " \
+    "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>"
+#define SOAP_TAIL "</s:Body></s:Envelope>"
+#define DIDL_HEAD "&lt;DIDL-Lite xmlns=&quot;urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/&quot; " \
+    "xmlns:dc=&quot;http://purl.org/dc/elements/1.1/&quot; xmlns:upnp=&quot;urn:schemas-upnp-org:metadata-1-0/upnp/&quot; " \
+    "xmlns:dlna=&quot;urn:schemas-dlna-org:metadata-1-0/&quot;&gt;"
+
+static const char kBubbleSetUri[] = SOAP_HEAD
+    "<u:SetAVTransportURI xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\"><InstanceID>0</InstanceID>"
+    "<CurrentURI>http://192.168.1.20:9790/minimserver/*/Music/Miles*20Davis/Kind*20of*20Blue/01*20So*20What.flac</CurrentURI>"
+    "<CurrentURIMetaData>" DIDL_HEAD "&lt;item id=&quot;0$=Artist$12$albums$*a3$*i1&quot; parentID=&quot;0$=Artist$12$albums$*a3&quot; "
+    "restricted=&quot;1&quot;&gt;&lt;dc:title&gt;So What&lt;/dc:title&gt;&lt;upnp:class&gt;object.item.audioItem.musicTrack"
+    "&lt;/upnp:class&gt;&lt;dc:creator&gt;Miles Davis&lt;/dc:creator&gt;&lt;upnp:artist&gt;Miles Davis&lt;/upnp:artist&gt;"
+    "&lt;upnp:album&gt;Kind of Blue&lt;/upnp:album&gt;&lt;upnp:originalTrackNumber&gt;1&lt;/upnp:originalTrackNumber&gt;"
+    "&lt;dc:date&gt;1959-08-17&lt;/dc:date&gt;&lt;upnp:albumArtURI dlna:profileID=&quot;JPEG_TN&quot;&gt;"
+    "http://192.168.1.20:9790/minimserver/*/Music/Miles*20Davis/Kind*20of*20Blue/folder.jpg&lt;/upnp:albumArtURI&gt;"
+    "&lt;res duration=&quot;0:09:22.000&quot; size=&quot;61523810&quot; bitrate=&quot;109375&quot; sampleFrequency=&quot;44100&quot; "
+    "nrAudioChannels=&quot;2&quot; protocolInfo=&quot;http-get:*:audio/x-flac:DLNA.ORG_OP=01;DLNA.ORG_FLAGS=01700000000000000000000000000000&quot;&gt;"
+    "http://192.168.1.20:9790/minimserver/*/Music/Miles*20Davis/Kind*20of*20Blue/01*20So*20What.flac&lt;/res&gt;"
+    "&lt;/item&gt;&lt;/DIDL-Lite&gt;</CurrentURIMetaData></u:SetAVTransportURI>" SOAP_TAIL;
+
+static const char kBubbleGetPosition[] = SOAP_HEAD
+    "<u:GetPositionInfo xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\"><InstanceID>0</InstanceID>"
+    "</u:GetPositionInfo>" SOAP_TAIL;
+
+static const char kBubbleSetVolume[] = SOAP_HEAD
+    "<u:SetVolume xmlns:u=\"urn:schemas-upnp-org:service:RenderingControl:1\"><InstanceID>0</InstanceID>"
+    "<Channel>Master</Channel><DesiredVolume>35</DesiredVolume></u:SetVolume>" SOAP_TAIL;
+
+static const char kFoobarSetNextUri[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
+    "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">\r\n"
+    "  <s:Body>\r\n"
+    "    <u:SetNextAVTransportURI xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\">\r\n"
+    "      <InstanceID>0</InstanceID>\r\n"
+    "      <NextURI>http://192.168.1.12:56923/content/c2/b16/f44100/d7432-co2154.flac?a=1&amp;b=2</NextURI>\r\n"
+    "      <NextURIMetaData>" DIDL_HEAD "&lt;item id=&quot;2154&quot; parentID=&quot;2153&quot; restricted=&quot;1&quot;&gt;"
+    "&lt;dc:title&gt;The Boxer&lt;/dc:title&gt;&lt;upnp:artist role=&quot;Performer&quot;&gt;Simon &amp;amp; Garfunkel&lt;/upnp:artist&gt;"
+    "&lt;upnp:artist role=&quot;Composer&quot;&gt;Paul Simon&lt;/upnp:artist&gt;"
+    "&lt;upnp:album&gt;Bridge over Troubled Water&lt;/upnp:album&gt;&lt;upnp:class&gt;object.item.audioItem.musicTrack&lt;/upnp:class&gt;"
+    "&lt;res protocolInfo=&quot;http-get:*:audio/flac:*&quot; duration=&quot;0:05:08.293&quot; bitsPerSample=&quot;16&quot;&gt;"
+    "http://192.168.1.12:56923/content/c2/b16/f44100/d7432-co2154.flac?a=1&amp;amp;b=2&lt;/res&gt;&lt;/item&gt;&lt;/DIDL-Lite&gt;"
+    "</NextURIMetaData>\r\n"
+    "    </u:SetNextAVTransportURI>\r\n"
+    "  </s:Body>\r\n"
+    "</s:Envelope>\r\n";
+
+static const char kWmpSetUri[] =
+    "<?xml version=\"1.0\"?><SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+    "SOAP-ENV:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><SOAP-ENV:Body>"
+    "<m:SetAVTransportURI xmlns:m=\"urn:schemas-upnp-org:service:AVTransport:1\">"
+    "<InstanceID xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"ui4\">0</InstanceID>"
+    "<CurrentURI xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"string\">"
+    "http://192.168.1.35:10243/WMPNSSv4/2914585213/0_e0YxQTg5QzZCLUQ2MjQtNDQ3Ri1BNkI3LUNFM0ZBNDdDNjM2M30uMC40.mp3</CurrentURI>"
+    "<CurrentURIMetaData xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"string\">"
+    "&lt;DIDL-Lite xmlns:dc=&quot;http://purl.org/dc/elements/1.1/&quot; xmlns:upnp=&quot;urn:schemas-upnp-org:metadata-1-0/upnp/&quot; "
+    "xmlns=&quot;urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/&quot; xmlns:microsoft=&quot;urn:schemas-microsoft-com:WMPNSS-1-0/&quot;&gt;"
+    "&lt;item id=&quot;{F1A89C6B-D624-447F-A6B7-CE3FA47C6363}.0.4&quot; restricted=&quot;0&quot; parentID=&quot;4&quot;&gt;"
+    "&lt;dc:title&gt;Caf&#233; del Mar&lt;/dc:title&gt;&lt;dc:creator&gt;Energy 52&lt;/dc:creator&gt;"
+    "&lt;upnp:artist role=&quot;AlbumArtist&quot;&gt;Energy 52&lt;/upnp:artist&gt;&lt;upnp:genre&gt;Trance&lt;/upnp:genre&gt;"
+    "&lt;microsoft:userEffectiveRatingInStars&gt;3&lt;/microsoft:userEffectiveRatingInStars&gt;"
+    "&lt;res size=&quot;9482385&quot; duration=&quot;0:03:57.000&quot; bitrate=&quot;40000&quot; "
+    "protocolInfo=&quot;http-get:*:audio/mpeg:DLNA.ORG_PN=MP3;DLNA.ORG_OP=01;DLNA.ORG_FLAGS=01500000000000000000000000000000&quot; "
+    "sampleFrequency=&quot;44100&quot; bitsPerSample=&quot;16&quot; nrAudioChannels=&quot;2&quot;&gt;"
+    "http://192.168.1.35:10243/WMPNSSv4/2914585213/0_e0YxQTg5QzZCLUQ2MjQtNDQ3Ri1BNkI3LUNFM0ZBNDdDNjM2M30uMC40.mp3&lt;/res&gt;"
+    "&lt;upnp:class&gt;object.item.audioItem.musicTrack&lt;/upnp:class&gt;&lt;/item&gt;&lt;/DIDL-Lite&gt;</CurrentURIMetaData>"
+    "</m:SetAVTransportURI></SOAP-ENV:Body></SOAP-ENV:Envelope>";
+
+static const char kKodiGetTransportInfo[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+    "<s:Body><u:GetTransportInfo xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\"><InstanceID>0</InstanceID>"
+    "</u:GetTransportInfo></s:Body></s:Envelope>\n";
+
+static const char kCdataSetUri[] = SOAP_HEAD
+    "<u:SetAVTransportURI xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\"><InstanceID>0</InstanceID>"
+    "<CurrentURI>http://192.168.1.40:8200/MediaItems/1234.mp3</CurrentURI><CurrentURIMetaData><![CDATA["
+    "<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\" "
+    "xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\"><item id=\"64$1$3$0\" parentID=\"64$1$3\" restricted=\"1\">"
+    "<dc:title>Wish You Were Here [Remastered]</dc:title><upnp:artist>Pink Floyd</upnp:artist>"
+    "<upnp:class>object.item.audioItem.musicTrack</upnp:class>"
+    "<res duration=\"0:05:34.000\" protocolInfo=\"http-get:*:audio/mpeg:*\">http://192.168.1.40:8200/MediaItems/1234.mp3</res>"
+    "</item></DIDL-Lite>]]></CurrentURIMetaData></u:SetAVTransportURI>" SOAP_TAIL;
+
+// SetAVTransportURI with a long description and many resources, larger than the old 3000 byte limit
+static std::string largeDidlRequest()
+{
+    std::string req = SOAP_HEAD
+        "<u:SetAVTransportURI xmlns:u=\"urn:schemas-upnp-org:service:AVTransport:1\"><InstanceID>0</InstanceID>"
+        "<CurrentURI>http://192.168.1.50:32469/object/8f3c1e0b2a/file.flac</CurrentURI><CurrentURIMetaData>" DIDL_HEAD
+        "&lt;item id=&quot;8f3c1e0b2a&quot; parentID=&quot;77a1&quot; restricted=&quot;1&quot;&gt;"
+        "&lt;dc:title&gt;Symphony No. 9 in D minor, Op. 125 &quot;Choral&quot;: IV. Presto &#x2013; Allegro assai&lt;/dc:title&gt;"
+        "&lt;upnp:artist&gt;Berliner Philharmoniker&lt;/upnp:artist&gt;&lt;upnp:longDescription&gt;";
+    for (int i = 0; i < 60; i++) {
+        req += "The finale sets Schiller&amp;apos;s &amp;quot;Ode to Joy&amp;quot; for soloists, chorus and orchestra. ";
+    }
+    req += "&lt;/upnp:longDescription&gt;";
+    for (int i = 0; i < 6; i++) {
+        char res[512];
+        snprintf(res, sizeof(res), "&lt;res duration=&quot;0:24:%02d.500&quot; bitrate=&quot;%d&quot; protocolInfo=&quot;"
+            "http-get:*:audio/%s:DLNA.ORG_OP=01;DLNA.ORG_CI=%d;DLNA.ORG_FLAGS=01700000000000000000000000000000&quot;&gt;"
+            "http://192.168.1.50:32469/object/8f3c1e0b2a/file.%d&lt;/res&gt;",
+            i ? 10 : 13, 100000 + i * 1000, i ? "mpeg" : "x-flac", i ? 1 : 0, i);
+        req += res;
+    }
+    req += "&lt;/item&gt;&lt;/DIDL-Lite&gt;</CurrentURIMetaData></u:SetAVTransportURI>" SOAP_TAIL;
+    return req;
+}
+
+struct Request
+{
+    const char* name;
+    std::string body;
+    bool legacyHandles;
+};
+
+// What the handler takes from the request
+struct Extracted
+{
+    std::string action;
+    std::string serviceType;
+    std::string url;
+    std::string volume;
+    bool hasDidl = false;
+    std::string title;
+    std::string artist;
+    uint32_t durationMs = 0;
+    bool operator==(const Extracted& other) const
+    {
+        return action == other.action && serviceType == other.serviceType && url == other.url &&
+            volume == other.volume && hasDidl == other.hasDidl && title == other.title &&
+            artist == other.artist && durationMs == other.durationMs;
+    }
+};
+static void setStr(std::string* str, const char* val)
+{
+    if (str) {
+        *str = val ? val : "";
+    }
+}
+
+// The code of DlnaHandler before the streaming parser
+namespace legacy {
+const XMLElement* xmlFindPath(const XMLNode* node, const char* path)
+{
+    if (!path || !node) {
+        return nullptr;
+    }
+    char buf[32];
+    for(;;) {
+        while (*path == '/') {
+            path++;
+        }
+        const char* end = strchr(path, '/');
+        int len = end ? (end - path) : strlen(path);
+        if (!len) {
+            return node->ToElement();
+        }
+        if (len > (int)sizeof(buf)-1) {
+            return nullptr;
+        }
+        memcpy(buf, path, len);
+        buf[len] = 0;
+        node = node->FirstChildElement(buf);
+        if (!node) {
+            return nullptr;
+        }
+        if (!end) {
+            return node->ToElement();
+        }
+        path = end + 1;
+    }
+}
+static const char* xmlGetChildText(const XMLElement& elem, const char* childName)
+{
+    auto child = elem.FirstChildElement(childName);
+    return child ? child->GetText() : nullptr;
+}
+static const char* xmlGetChildAttr(const XMLElement& elem, const char* childName, const char* attrName)
+{
+    auto child = elem.FirstChildElement(childName);
+    return child ? child->Attribute(attrName) : nullptr;
+}
+std::string msToHmsString(uint32_t ms)
+{
+    std::ostringstream oss;
+    oss << ms / 3600000 << ':';
+    ms %= 3600000;
+    oss << ms / 60000 << ':';
+    ms %= 60000;
+    oss << ms / 1000 << '.';
+    oss << (ms % 1000);
+    return oss.str();
+}
+static void trackInfoFromDidl(const char* didl, Extracted* out)
+{
+    if (!didl) {
+        return;
+    }
+    XMLDocument info;
+    if (info.Parse(didl)) {
+        return;
+    }
+    auto item = xmlFindPath(&info, "DIDL-Lite/item");
+    if (!item) {
+        return;
+    }
+    auto title = xmlGetChildText(*item, "dc:title");
+    auto artist = xmlGetChildText(*item, "upnp:artist");
+    auto duration = parseHmsTime(xmlGetChildAttr(*item, "res", "duration"));
+    if (out) {
+        out->hasDidl = true;
+        setStr(&out->title, title);
+        setStr(&out->artist, artist);
+        out->durationMs = duration;
+    }
+}
+static bool process(const std::string& body, std::string& result, Extracted* out)
+{
+    int32_t contentLen = body.size();
+    if (!contentLen || contentLen > 3000) {
+        return false;
+    }
+    unique_ptr_mfree<char> strXml((char*)malloc(contentLen + 1));
+    sNumAllocs++;
+    memcpy(strXml.get(), body.c_str(), contentLen); // as received
+    strXml.get()[contentLen] = 0;
+    XMLDocument xml;
+    if (xml.Parse(strXml.get(), contentLen)) {
+        return false;
+    }
+    strXml.reset();
+    auto node = xmlFindPath(&xml, "s:Envelope/s:Body");
+    if (!node || !(node = node->FirstChildElement())) {
+        return false;
+    }
+    const char* cmd = node->Name();
+    if (!cmd || strncasecmp(cmd, "u:", 2)) {
+        return false;
+    }
+    const char* cmdXmlns = node->Attribute("xmlns:u");
+    if (!cmdXmlns) {
+        return false;
+    }
+    result =
+        "<?xml version=\"1.0\"?>"
+        "<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+            "s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">"
+        "<s:Body><";
+    result.append(cmd).append("Response xmlns:u=\"").append(cmdXmlns).append("\">");
+    if (out) {
+        setStr(&out->action, cmd + 2);
+        setStr(&out->serviceType, cmdXmlns);
+    }
+    const char* action = cmd + 2;
+    if (strcmp(action, "SetAVTransportURI") == 0) {
+        auto url = xmlGetChildText(*node, "CurrentURI");
+        if (!url) {
+            return false;
+        }
+        if (out) {
+            setStr(&out->url, url);
+        }
+        trackInfoFromDidl(xmlGetChildText(*node, "CurrentURIMetaData"), out);
+    }
+    else if (strcmp(action, "SetNextAVTransportURI") == 0) {
+        auto url = xmlGetChildText(*node, "NextURI");
+        if (url && *url) {
+            if (out) {
+                setStr(&out->url, url);
+            }
+            trackInfoFromDidl(xmlGetChildText(*node, "NextURIMetaData"), out);
+        }
+    }
+    else if (strcmp(action, "SetVolume") == 0) {
+        auto vol = xmlGetChildText(*node, "DesiredVolume");
+        if (!vol) {
+            return false;
+        }
+        if (out) {
+            setStr(&out->volume, vol);
+        }
+    }
+    else if (strcmp(action, "GetTransportInfo") == 0) {
+        result.reserve(256);
+        result.append("<CurrentTransportState>").append("PLAYING").append(
+            "</CurrentTransportState><CurrentTransportStatus>OK</CurrentTransportStatus><CurrentSpeed>1</CurrentSpeed>");
+    }
+    else if (strcmp(action, "GetPositionInfo") == 0) {
+        result.append("<Track>1</Track><TrackMetaData></TrackMetaData><TrackDuration>");
+        auto posHms = msToHmsString(kTrackPositionMs);
+        result.append(msToHmsString(kTrackDurationMs))
+              .append("</TrackDuration><TrackURI>").append(kTrackUrl)
+              .append("</TrackURI><RelTime>").append(posHms)
+              .append("</RelTime><AbsTime>").append(posHms);
+        result.append("</AbsTime><RelCount>0</RelCount><AbsCount>0</AbsCount>");
+    }
+    result.append("</").append(cmd).append("Response></s:Body></s:Envelope>");
+    return true;
+}
+}
+
+// The current code of DlnaHandler
+static bool streamProcess(SoapRequestParser& soap, std::string& result, const std::string& body, int chunkSize, Extracted* out)
+{
+    soap.reset();
+    for (size_t pos = 0; pos < body.size(); pos += chunkSize) {
+        if (!soap.feed(body.c_str() + pos, std::min((size_t)chunkSize, body.size() - pos))) {
+            return false;
+        }
+    }
+    if (!soap.valid() || !soap.serviceType()) {
+        return false;
+    }
+    const char* cmd = soap.action();
+    if (out) {
+        setStr(&out->action, cmd);
+        setStr(&out->serviceType, soap.serviceType());
+    }
+    result.clear();
+    xmlAppendTemplate(result, kSoapRespHead, {cmd, soap.serviceType()});
+    auto getDidl = [&soap, out]() {
+        auto& didl = soap.didl();
+        if (out && didl.valid()) {
+            out->hasDidl = true;
+            setStr(&out->title, didl.title());
+            setStr(&out->artist, didl.artist());
+            out->durationMs = parseHmsTime(didl.duration());
+        }
+    };
+    if (strcmp(cmd, "SetAVTransportURI") == 0) {
+        auto url = soap.arg("CurrentURI");
+        if (!url) {
+            return false;
+        }
+        setStr(out ? &out->url : nullptr, url);
+        getDidl();
+    }
+    else if (strcmp(cmd, "SetNextAVTransportURI") == 0) {
+        auto url = soap.arg("NextURI", false);
+        if (url) {
+            setStr(out ? &out->url : nullptr, url);
+            getDidl();
+        }
+    }
+    else if (strcmp(cmd, "SetVolume") == 0) {
+        auto vol = soap.arg("DesiredVolume");
+        if (!vol) {
+            return false;
+        }
+        setStr(out ? &out->volume : nullptr, vol);
+    }
+    else if (strcmp(cmd, "GetTransportInfo") == 0) {
+        xmlAppendTemplate(result, kSoapRespGetTransportInfo, {"PLAYING"});
+    }
+    else if (strcmp(cmd, "GetPositionInfo") == 0) {
+        char dur[kHmsBufSize], pos[kHmsBufSize];
+        msToHms(kTrackDurationMs, dur);
+        msToHms(kTrackPositionMs, pos);
+        xmlAppendTemplate(result, kSoapRespGetPositionInfo, {dur, kTrackUrl, pos, pos});
+    }
+    xmlAppendTemplate(result, kSoapRespTail, {cmd});
+    return true;
+}
+
+// Checks that a response is valid XML, and for GetPositionInfo, that it has the values
+static bool checkResponse(const char* xml, const char* action)
+{
+    XMLDocument doc;
+    if (doc.Parse(xml)) {
+        return false;
+    }
+    auto body = legacy::xmlFindPath(&doc, "s:Envelope/s:Body");
+    auto resp = body ? body->FirstChildElement() : nullptr;
+    if (!resp || strcmp(resp->Name(), (std::string("u:") + action + "Response").c_str())) {
+        return false;
+    }
+    if (strcmp(action, "GetPositionInfo") == 0) {
+        auto text = [resp](const char* name) {
+            auto val = legacy::xmlGetChildText(*resp, name);
+            return std::string(val ? val : "");
+        };
+        return text("TrackURI") == kTrackUrl && text("TrackDuration") == "0:09:22.000" &&
+            text("RelTime") == "0:01:23.400" && text("AbsTime") == "0:01:23.400";
+    }
+    return true;
+}
+static std::string jsonStr(const std::string& str)
+{
+    std::string result = "\"";
+    for (char ch: str) {
+        if (ch == '"' || ch == '\\') {
+            result += '\\';
+        }
+        result += ch;
+    }
+    return result + '"';
+}
+static std::string toJson(const Extracted& ex)
+{
+    char dur[16];
+    snprintf(dur, sizeof(dur), "%u", ex.durationMs);
+    return "{\"action\":" + jsonStr(ex.action) + ",\"url\":" + jsonStr(ex.url) + ",\"title\":" + jsonStr(ex.title) +
+        ",\"artist\":" + jsonStr(ex.artist) + ",\"durationMs\":" + dur + "}";
+}
+int main(int argc, char* argv[])
+{
+    int iters = (argc > 1) ? atoi(argv[1]) : 2000;
+    if (iters <= 0) {
+        fprintf(stderr, "Usage: dlnaBench [iterations]\n");
+        return 1;
+    }
+    const Request requests[] = {
+        { "bubbleupnp-SetAVTransportURI", kBubbleSetUri, true },
+        { "bubbleupnp-GetPositionInfo", kBubbleGetPosition, true },
+        { "bubbleupnp-SetVolume", kBubbleSetVolume, true },
+        { "foobar2000-SetNextAVTransportURI", kFoobarSetNextUri, true },
+        { "wmp-SetAVTransportURI", kWmpSetUri, false }, // SOAP-ENV: and m: prefixes
+        { "kodi-GetTransportInfo", kKodiGetTransportInfo, true },
+        { "cdata-SetAVTransportURI", kCdataSetUri, true },
+        { "largeDidl-SetAVTransportURI", largeDidlRequest(), false } // over 3000 bytes
+    };
+    SoapRequestParser soap;
+    std::string response;
+    int numFailed = 0;
+    for (auto& req: requests) {
+        // correctness
+        Extracted legacyEx, streamEx, byteEx;
+        std::string legacyResp;
+        bool legacyOk = legacy::process(req.body, legacyResp, &legacyEx);
+        bool legacyRespValid = legacyOk && checkResponse(legacyResp.c_str(), legacyEx.action.c_str());
+        bool ok = streamProcess(soap, response, req.body, 1, &byteEx);
+        ok = streamProcess(soap, response, req.body, kRecvChunkSize, &streamEx) && ok;
+        bool respValid = ok && checkResponse(response.c_str(), streamEx.action.c_str());
+        bool match = ok && streamEx == byteEx && (!legacyOk || legacyEx == streamEx);
+        // performance, the new way is warmed up by the above
+        std::string legacyBuf;
+        auto allocsBefore = sNumAllocs;
+        auto tsStart = nsNow();
+        for (int i = 0; i < iters; i++) {
+            legacy::process(req.body, legacyBuf, nullptr);
+        }
+        double legacyUs = (nsNow() - tsStart) / 1000.0 / iters;
+        double legacyAllocs = (double)(sNumAllocs - allocsBefore) / iters;
+        allocsBefore = sNumAllocs;
+        tsStart = nsNow();
+        for (int i = 0; i < iters; i++) {
+            streamProcess(soap, response, req.body, kRecvChunkSize, nullptr);
+        }
+        double streamUs = (nsNow() - tsStart) / 1000.0 / iters;
+        double streamAllocs = (double)(sNumAllocs - allocsBefore) / iters;
+        printf("{\"request\":\"%s\",\"bytes\":%zu,\"legacyHandled\":%s,\"legacyRespValid\":%s,\"legacyAllocs\":%.1f,"
+            "\"legacyUs\":%.2f,\"streamHandled\":%s,\"streamRespValid\":%s,\"streamAllocs\":%.1f,\"streamUs\":%.2f,"
+            "\"match\":%s,\"extracted\":%s}\n", req.name, req.body.size(), legacyOk ? "true" : "false",
+            legacyRespValid ? "true" : "false", legacyAllocs, legacyUs, ok ? "true" : "false",
+            respValid ? "true" : "false", streamAllocs, streamUs, match ? "true" : "false", toJson(streamEx).c_str());
+        fflush(stdout);
+        if (!ok || !respValid) {
+            printf("FAIL: %s: not handled, or invalid response\n", req.name);
+            numFailed++;
+        }
+        if (!match) {
+            printf("FAIL: %s: extracted values differ\n", req.name);
+            numFailed++;
+        }
+        if (legacyOk != req.legacyHandles) {
+            printf("FAIL: %s: expected the old code to %s it\n", req.name, req.legacyHandles ? "handle" : "reject");
+            numFailed++;
+        }
+        if (streamAllocs > 0) {
+            printf("FAIL: %s: the streaming parser allocates in the steady state\n", req.name);
+            numFailed++;
+        }
+    }
+    return numFailed ? 1 : 0;
+}
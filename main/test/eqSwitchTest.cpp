@@ -0,0 +1,171 @@
+// Host test of EqualizerNode reconfiguration on stream format changes. A stub source sends a sequence of
+// streams with different sample rates, each a kEvtStreamChanged followed by PCM packets, through one
+// EqualizerNode, as on gapless playback of a playlist. Each stream is also sent through a new node with the
+// same settings, and the outputs must be identical, i.e. switching the rate, with coefficients calculated in
+// advance, must give the same result as setting up the equalizer from scratch.
+// Runs with the custom equalizer for all rates, and with the ESP equalizer for rates up to 48 kHz (which
+// is a pass-through on the host), where switching to and from higher rates changes the core type.
+// Reports, as one JSON object per line: the rate change, the reconfiguration path, the time the output
+// waited for it, the time of a full reinit, as was done on every format change before, and whether the
+// output matches.
+// g++ -std=gnu++17 -O2 -pthread -o eqSwitchTest eqSwitchTest.cpp ../streamDefs.cpp ../packetPool.cpp ../nodeProfiler.cpp \
+//   ../audioNode.cpp ../eqCores.cpp ../equalizerNode.cpp ../../components/myeq/equalizer.cpp -I ./host -I .. -I ../../components/myeq
+// Usage: eqSwitchTest
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include <nvsHandle.hpp>
+#include "equalizerNode.hpp"
+
+enum { kFramesPerPacket = 1152, kPacketsPerStream = 60 };
+static const int8_t kGains[] = { 3, -2, 5, 0, 0, 1, -4, 2, 0, 6 };
+static const uint32_t kRates[] = { 44100, 48000, 44100, 96000, 88200, 48000, 192000, 44100, 22050, 44100 };
+
+class StubPipeline: public IAudioPipeline
+{
+public:
+    virtual bool onNodeEvent(AudioNode& node, uint32_t type, size_t numArg, uintptr_t arg) override { return true; }
+    virtual void onNodeError(AudioNode& node, int error, uintptr_t arg) override {}
+    virtual void onNeedLargeMemory(int32_t amountHint) override {}
+};
+class StubSource: public AudioNode
+{
+public:
+    std::deque<StreamPacket*> mPackets;
+    StubSource(IAudioPipeline& pipeline): AudioNode(pipeline, "source") {}
+    ~StubSource()
+    {
+        for (auto pkt: mPackets) {
+            pkt->destroy();
+        }
+    }
+    virtual Type type() const override { return kTypeUnknown; }
+    virtual StreamEvent pullData(PacketResult& pr) override
+    {
+        if (mPackets.empty()) {
+            return kEvtStreamEnd;
+        }
+        auto pkt = mPackets.front();
+        mPackets.pop_front();
+        return pr.set(pkt);
+    }
+    // A stream of noise, the same for a given rate
+    void addStream(uint32_t rate)
+    {
+        mPackets.push_back(new NewStreamEvent(rate, StreamFormat(rate, 16, 2)));
+        uint32_t seed = rate;
+        for (int i = 0; i < kPacketsPerStream; i++) {
+            // with room for the float samples, as the decoders do
+            auto pkt = DataPacket::create(kFramesPerPacket * 8, StreamPacket::kHasSpaceFor32Bit);
+            pkt->dataLen = kFramesPerPacket * 4;
+            auto samples = (int16_t*)pkt->data;
+            for (int j = 0; j < kFramesPerPacket * 2; j++) {
+                seed = seed * 1664525 + 1013904223;
+                samples[j] = (int32_t)seed >> 18;
+            }
+            pkt->pts = i * kFramesPerPacket;
+            mPackets.push_back(pkt);
+        }
+    }
+};
+class TestEqNode: public EqualizerNode
+{
+public:
+    TestEqNode(IAudioPipeline& pipeline, NvsHandle& nvs): EqualizerNode(pipeline, nvs) {}
+    const ReinitStats& reinitStats() const { return mReinitStats; }
+    /** The reconfiguration that was done on every format change */
+    uint32_t timeFullReinit(StreamFormat fmt)
+    {
+        ElapsedTimer timer;
+        equalizerReinit(fmt);
+        return timer.usElapsed();
+    }
+};
+static void noopLevelCb(void*) {}
+static void setupNode(EqualizerNode& eq, AudioNode& source)
+{
+    eq.linkToPrev(&source);
+    eq.setVolume(100);
+    eq.volEnableLevel(noopLevelCb, nullptr, 0xff);
+}
+// Pulls a stream, returns the output data
+static bool pullStream(EqualizerNode& eq, std::vector<uint8_t>& out)
+{
+    AudioNode::PacketResult pr;
+    if (eq.pullData(pr) != kEvtStreamChanged) {
+        return false;
+    }
+    for (int i = 0; i < kPacketsPerStream; i++) {
+        if (eq.pullData(pr) != kEvtData) {
+            return false;
+        }
+        auto& pkt = pr.dataPacket();
+        out.insert(out.end(), pkt.data, pkt.data + pkt.dataLen);
+    }
+    return true;
+}
+static int runSequence(bool useEspEq)
+{
+    NvsHandle nvs;
+    nvs.write("eq.useEsp", (uint8_t)useEspEq);
+    StubPipeline pipeline;
+    {
+        // as set in the web UI, so that the node loads them, rather than changing to them gradually
+        EqualizerNode setupEq(pipeline, nvs);
+        for (int i = 0; i < (int)sizeof(kGains); i++) {
+            setupEq.setBandGain(i, kGains[i]);
+        }
+        setupEq.saveGains();
+    }
+    StubSource source(pipeline);
+    TestEqNode eq(pipeline, nvs);
+    setupNode(eq, source);
+    int numFailed = 0;
+    uint32_t prevRate = 44100; // the node is created for 44.1 kHz
+    for (auto rate: kRates) {
+        source.addStream(rate);
+        auto statsBefore = eq.reinitStats();
+        std::vector<uint8_t> out;
+        bool ok = pullStream(eq, out);
+        auto& stats = eq.reinitStats();
+        bool fast = stats.numFast > statsBefore.numFast;
+        bool precalc = stats.numPrecalc > statsBefore.numPrecalc;
+        // reference: a new node that only plays this stream
+        StubSource refSource(pipeline);
+        TestEqNode refEq(pipeline, nvs);
+        setupNode(refEq, refSource);
+        refSource.addStream(rate);
+        std::vector<uint8_t> refOut;
+        ok = ok && pullStream(refEq, refOut);
+        bool exact = ok && out == refOut;
+        TestEqNode fullEq(pipeline, nvs);
+        fullEq.timeFullReinit(StreamFormat(prevRate, 16, 2));
+        uint32_t fullUs = fullEq.timeFullReinit(StreamFormat(rate, 16, 2));
+        // a full reinit is needed when the core type changes between the ESP and the custom eq, and when
+        // the bands of the custom eq are capped to the Nyquist frequency, i.e. below 32 kHz
+        bool expectFast = useEspEq
+            ? (prevRate <= 48000) == (rate <= 48000)
+            : (rate >= 32000 && prevRate >= 32000);
+        printf("{\"eq\":\"%s\",\"from\":%u,\"to\":%u,\"path\":\"%s\",\"precalc\":%s,\"gapUs\":%lu,\"fullReinitUs\":%lu,\"exact\":%s}\n",
+            useEspEq ? "esp" : "custom", prevRate, rate, fast ? "fast" : "full", precalc ? "true" : "false",
+            (unsigned long)stats.lastUs, (unsigned long)fullUs, exact ? "true" : "false");
+        fflush(stdout);
+        if (!exact) {
+            printf("FAIL: output differs from that of a new equalizer\n");
+            numFailed++;
+        }
+        if (fast != expectFast) {
+            printf("FAIL: expected a %s reconfiguration\n", expectFast ? "fast" : "full");
+            numFailed++;
+        }
+        prevRate = rate;
+    }
+    return numFailed;
+}
+int main(int argc, char* argv[])
+{
+    int numFailed = runSequence(false) + runSequence(true);
+    return numFailed ? 1 : 0;
+}
@@ -0,0 +1,271 @@
+// Host test of equalizer settings changes during playback, as done by dragging a slider in the web UI.
+// Part "ramp": a sine at the frequency of a band goes through an Equalizer, and the gain of the band is
+// stepped up and down between packets, once switching the coefficients at once, and once moving them
+// gradually, as the audio thread of EqualizerNode does. The size of a click is the largest second
+// difference of the output, relative to that of the steady sine at the higher gain.
+// Part "drag": a control thread changes band gains every millisecond, band configs and the preset less
+// often, while the main thread pulls packets from an EqualizerNode. Checks that the output stays within
+// the range that the gains allow, and that, once the changes stop, it converges to the output of a new
+// node with the final settings. A difference at the level of the float rounding remains, as that depends
+// on the signal history, i.e. about -105 dBFS with the shelf filters of the default bands.
+// Reports, as one JSON object per line: the click size of each ramp mode, and for the drag, the number of
+// settings changes, of coefficient sets taken by the audio thread, and the max packet time with and
+// without the changes.
+// g++ -std=gnu++17 -O2 -pthread -o eqUpdateTest eqUpdateTest.cpp ../streamDefs.cpp ../packetPool.cpp ../nodeProfiler.cpp \
+//   ../audioNode.cpp ../eqCores.cpp ../equalizerNode.cpp ../../components/myeq/equalizer.cpp -I ./host -I .. -I ../../components/myeq
+// Usage: eqUpdateTest [drag seconds, default 2]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <nvsHandle.hpp>
+#include <buffer.hpp>
+#include "equalizerNode.hpp"
+
+enum {
+    kSampleRate = 44100, kFramesPerPacket = 1152, kRampMs = 20,
+    kMaxFinalDiff = 256 // in 24-bit LSBs, -90 dBFS
+};
+static const int8_t kFinalGains[] = { 4, -3, 0, 6, -6, 2, 0, -2, 5, 3 };
+
+static int64_t usNow()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+static double sineAt(int64_t frame, double freq, double amplitude)
+{
+    return amplitude * sin(2 * M_PI * freq * (double)(frame % kSampleRate) / kSampleRate);
+}
+// Returns the largest second difference of the left channel after the gain changes, relative to that
+// of the steady output at the higher gain
+static double rampClickSize(int rampFrames)
+{
+    enum { kBand = 4, kPackets = 16 };
+    const double freq = EqBandConfig::kPreset10Band[kBand].freq;
+    const double amplitude = 0.1 * (1 << 23);
+    Equalizer<true> eq(10, kSampleRate);
+    memcpy(eq.bandConfigs(), EqBandConfig::kPreset10Band, sizeof(EqBandConfig::kPreset10Band));
+    eq.updateAllFilters(true);
+    std::vector<float> buf(kFramesPerPacket * 2);
+    std::vector<float> coeffs(10 * Biquad::kNumCoeffs);
+    int8_t gains[10] = {};
+    double prev1 = 0, prev2 = 0;
+    double maxDiff2 = 0;
+    for (int pkt = 0; pkt < kPackets; pkt++) {
+        if (pkt % 4 == 2) { // +12 dB, then back to 0 dB
+            gains[kBand] = gains[kBand] ? 0 : 12;
+            memcpy(eq.gains(), gains, sizeof(gains));
+            for (int i = 0; i < 10; i++) {
+                eq.calcBandCoeffs(i, kSampleRate, coeffs.data() + i * Biquad::kNumCoeffs);
+            }
+            eq.setCoeffs(coeffs.data(), gains, rampFrames);
+        }
+        int64_t start = (int64_t)pkt * kFramesPerPacket;
+        for (int i = 0; i < kFramesPerPacket; i++) {
+            buf[i * 2] = buf[i * 2 + 1] = sineAt(start + i, freq, amplitude);
+        }
+        eq.process(buf.data(), kFramesPerPacket);
+        for (int i = 0; i < kFramesPerPacket; i++) {
+            double val = buf[i * 2];
+            if (pkt > 1) { // after the initial transient
+                maxDiff2 = std::max(maxDiff2, fabs(val - 2 * prev1 + prev2));
+            }
+            prev2 = prev1;
+            prev1 = val;
+        }
+    }
+    double steady = amplitude * pow(10, 12.0 / 20) * pow(2 * sin(M_PI * freq / kSampleRate), 2);
+    return maxDiff2 / steady;
+}
+
+class StubPipeline: public IAudioPipeline
+{
+public:
+    virtual bool onNodeEvent(AudioNode& node, uint32_t type, size_t numArg, uintptr_t arg) override { return true; }
+    virtual void onNodeError(AudioNode& node, int error, uintptr_t arg) override {}
+    virtual void onNeedLargeMemory(int32_t amountHint) override {}
+};
+// An endless 16-bit stereo stream of two sines, starting at a given frame
+class SineSource: public AudioNode
+{
+public:
+    int64_t mFrame;
+    bool mStarted = false;
+    SineSource(IAudioPipeline& pipeline, int64_t startFrame): AudioNode(pipeline, "source"), mFrame(startFrame) {}
+    virtual Type type() const override { return kTypeUnknown; }
+    virtual StreamEvent pullData(PacketResult& pr) override
+    {
+        if (!mStarted) {
+            mStarted = true;
+            return pr.set(new NewStreamEvent(1, StreamFormat(kSampleRate, 16, 2)));
+        }
+        auto pkt = DataPacket::create(kFramesPerPacket * 8, StreamPacket::kHasSpaceFor32Bit);
+        pkt->dataLen = kFramesPerPacket * 4;
+        auto samples = (int16_t*)pkt->data;
+        for (int i = 0; i < kFramesPerPacket; i++) {
+            auto frame = mFrame + i;
+            samples[i * 2] = lround(sineAt(frame, 440, 2000) + sineAt(frame, 3000, 2000));
+            samples[i * 2 + 1] = lround(sineAt(frame, 150, 2000) + sineAt(frame, 8000, 2000));
+        }
+        pkt->pts = mFrame;
+        mFrame += kFramesPerPacket;
+        return pr.set(pkt);
+    }
+};
+static void noopLevelCb(void*) {}
+static void setupNode(EqualizerNode& eq, AudioNode& source)
+{
+    eq.linkToPrev(&source);
+    eq.setVolume(100);
+    eq.volEnableLevel(noopLevelCb, nullptr, 0xff);
+}
+// Pulls a data packet, skipping format change events. Returns the 24-bit samples
+static bool pullPacket(EqualizerNode& eq, std::vector<int32_t>& out, int64_t& usTaken)
+{
+    AudioNode::PacketResult pr;
+    for (int i = 0; i < 3; i++) {
+        auto ts = usNow();
+        auto evt = eq.pullData(pr);
+        usTaken = usNow() - ts;
+        if (evt == kEvtStreamChanged) {
+            continue;
+        }
+        if (evt != kEvtData) {
+            return false;
+        }
+        auto& pkt = pr.dataPacket();
+        auto samples = (const int32_t*)pkt.data;
+        out.assign(samples, samples + pkt.dataLen / 4);
+        for (auto& s: out) {
+            s >>= 8;
+        }
+        return true;
+    }
+    return false;
+}
+static uint32_t coeffUpdates(EqualizerNode& eq)
+{
+    DynBuffer buf(256);
+    eq.perfExtraToJson(buf);
+    auto pos = strstr(buf.buf(), "\"coeffUpdates\":");
+    return pos ? atoi(pos + 15) : 0;
+}
+static bool runDrag(int dragSec)
+{
+    NvsHandle nvs;
+    nvs.write("eq.useEsp", (uint8_t)0);
+    StubPipeline pipeline;
+    SineSource source(pipeline, 0);
+    EqualizerNode eq(pipeline, nvs);
+    setupNode(eq, source);
+    eq.switchPreset("a");
+    std::vector<int32_t> out;
+    int64_t usTaken, maxQuietUs = 0, maxDragUs = 0;
+    bool ok = true;
+    for (int i = 0; i < 50; i++) {
+        ok = ok && pullPacket(eq, out, usTaken);
+        maxQuietUs = std::max(maxQuietUs, usTaken);
+    }
+    std::atomic<bool> stop(false);
+    std::atomic<int> numChanges(0);
+    std::thread control([&]() {
+        unsigned seed = 1;
+        for (int n = 1; !stop; n++) {
+            seed = seed * 1103515245 + 12345;
+            uint8_t band = (seed >> 16) % 10;
+            eq.setBandGain(band, (int)((seed >> 8) % 25) - 12);
+            if (n % 97 == 0) {
+                eq.reconfigEqBand(band, 0, 500 + (seed >> 4) % 1000);
+            }
+            if (n % 499 == 0) {
+                eq.switchPreset((n / 499) % 2 ? "b" : "a");
+            }
+            numChanges++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    // The +-12 dB of ten bands can't take the two sines of 2000 above 24 dB and some overlap
+    const int32_t maxOut = 4000 * 16 * 16 << 8;
+    int numOutOfRange = 0;
+    auto tsEnd = usNow() + dragSec * 1000000LL;
+    while (ok && usNow() < tsEnd) {
+        ok = pullPacket(eq, out, usTaken);
+        maxDragUs = std::max(maxDragUs, usTaken);
+        for (auto s: out) {
+            if (s > maxOut || s < -maxOut) {
+                numOutOfRange++;
+            }
+        }
+        // roughly realtime
+        std::this_thread::sleep_for(std::chrono::microseconds(kFramesPerPacket * 1000000LL / kSampleRate / 4));
+    }
+    stop = true;
+    control.join();
+    eq.switchPreset("a");
+    for (int i = 0; i < 10; i++) {
+        eq.setBandGain(i, kFinalGains[i]);
+    }
+    eq.saveGains();
+    // the filters with a low frequency take a while to forget the drag
+    for (int i = 0; ok && i < 40; i++) {
+        ok = pullPacket(eq, out, usTaken);
+    }
+    int64_t nextFrame = source.mFrame;
+    std::vector<int32_t> last;
+    ok = ok && pullPacket(eq, last, usTaken);
+    // reference: a new node with the final settings, warmed up on the same signal
+    SineSource refSource(pipeline, nextFrame - 40 * kFramesPerPacket);
+    EqualizerNode refEq(pipeline, nvs);
+    setupNode(refEq, refSource);
+    refEq.switchPreset("a");
+    std::vector<int32_t> refOut;
+    for (int i = 0; ok && i < 41; i++) {
+        ok = pullPacket(refEq, refOut, usTaken);
+    }
+    int maxDiff = 0;
+    for (size_t i = 0; ok && i < last.size(); i++) {
+        maxDiff = std::max(maxDiff, abs(last[i] - refOut[i]));
+    }
+    printf("{\"part\":\"drag\",\"changes\":%d,\"coeffUpdates\":%u,\"maxPacketUsQuiet\":%d,\"maxPacketUsDrag\":%d,"
+        "\"outOfRange\":%d,\"finalMaxDiff\":%d}\n", numChanges.load(), coeffUpdates(eq), (int)maxQuietUs,
+        (int)maxDragUs, numOutOfRange, maxDiff);
+    fflush(stdout);
+    if (!ok) {
+        printf("FAIL: drag: pulling data failed\n");
+        return false;
+    }
+    if (numOutOfRange) {
+        printf("FAIL: drag: output out of range\n");
+        ok = false;
+    }
+    if (maxDiff > kMaxFinalDiff) {
+        printf("FAIL: drag: output doesn't converge to that of the final settings\n");
+        ok = false;
+    }
+    return ok;
+}
+int main(int argc, char* argv[])
+{
+    int dragSec = (argc > 1) ? atoi(argv[1]) : 2;
+    if (dragSec <= 0) {
+        fprintf(stderr, "Usage: eqUpdateTest [drag seconds]\n");
+        return 1;
+    }
+    int numFailed = 0;
+    double abrupt = rampClickSize(0);
+    double ramped = rampClickSize(kSampleRate * kRampMs / 1000);
+    printf("{\"part\":\"ramp\",\"rampMs\":0,\"clickSize\":%.2f}\n", abrupt);
+    printf("{\"part\":\"ramp\",\"rampMs\":%d,\"clickSize\":%.2f}\n", kRampMs, ramped);
+    fflush(stdout);
+    if (ramped > 1.5 || ramped * 10 > abrupt) {
+        printf("FAIL: ramp: the gradual change causes a click\n");
+        numFailed++;
+    }
+    numFailed += !runDrag(dragSec);
+    return numFailed ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+#include "fileInputNode.hpp"
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+static const char* TAG = "node-file";
+
+FileInputNode::FileInputNode(IAudioPipeline& parent)
+    : AudioNodeWithTask(parent, TAG, false, kStackSize)
+{
+    mRingBuf.setMaxDataSize(kDefaultBufSize);
+}
+const char* FileInputNode::contentTypeFromPath(const char* path)
+{
+    const char* ext = strrchr(path, '.');
+    if (!ext) {
+        return nullptr;
+    }
+    ext++;
+    if (strcasecmp(ext, "mp3") == 0) {
+        return "audio/mpeg";
+    }
+    else if (strcasecmp(ext, "aac") == 0) {
+        return "audio/aac";
+    }
+    else if (strcasecmp(ext, "flac") == 0) {
+        return "audio/flac";
+    }
+    else if (strcasecmp(ext, "ogg") == 0 || strcasecmp(ext, "oga") == 0 || strcasecmp(ext, "opus") == 0) {
+        return "audio/ogg";
+    }
+    else if (strcasecmp(ext, "m4a") == 0 || strcasecmp(ext, "mp4") == 0) {
+        return "audio/mp4";
+    }
+    else if (strcasecmp(ext, "wav") == 0) {
+        return "audio/wav";
+    }
+    return nullptr;
+}
+void FileInputNode::setFile(const char* path, const char* contentType)
+{
+    LOCK();
+    mPath = path;
+    if (!contentType) {
+        contentType = contentTypeFromPath(path);
+    }
+    mContentType = contentType ? contentType : "";
+    mEof = false;
+    closeFile();
+    mRingBuf.clear();
+}
+bool FileInputNode::openFile(bool isSeek)
+{
+    closeFile();
+    if (mContentType.empty()) {
+        ESP_LOGE(TAG, "Can't determine content type of '%s'", mPath.c_str());
+        return false;
+    }
+    mInFormat = StreamFormat::fromMimeType(mContentType.c_str());
+    if (mInFormat.codec().type == Codec::kCodecUnknown && mInFormat.codec().transport == Codec::kTransportDefault) {
+        ESP_LOGE(TAG, "Unsupported content type '%s'", mContentType.c_str());
+        return false;
+    }
+    mFile = (mPath == "-") ? stdin : fopen(mPath.c_str(), "rb");
+    if (!mFile) {
+        ESP_LOGE(TAG, "Error opening '%s': %s", mPath.c_str(), strerror(errno));
+        return false;
+    }
+    if (isSeek) {
+        return true;
+    }
+    mStreamId = mPipeline.getNewStreamId();
+    ESP_LOGI(TAG, "Opened '%s', codec: %s, streamId: %ld", mPath.c_str(), mInFormat.codec().toString(), mStreamId);
+    mRingBuf.pushBack(new NewStreamEvent(mStreamId, mInFormat));
+    return true;
+}
+void FileInputNode::closeFile()
+{
+    if (mFile && mFile != stdin) {
+        fclose(mFile);
+    }
+    mFile = nullptr;
+}
+int8_t FileInputNode::recv()
+{
+    if (mEof) {
+        return 1;
+    }
+    if (!mFile && !openFile()) {
+        return -1;
+    }
+    int rxSize = mInFormat.rxChunkSize();
+    DataPacket::unique_ptr pkt(DataPacket::createWithoutFlags(rxSize));
+    auto rlen = fread(pkt->data, 1, rxSize, mFile);
+    if (rlen == 0) {
+        if (ferror(mFile)) {
+            ESP_LOGE(TAG, "Error reading '%s': %s", mPath.c_str(), strerror(errno));
+            closeFile();
+            return -1;
+        }
+        ESP_LOGI(TAG, "End of file, posting kStreamEnd event (streamId=%ld)", mStreamId);
+        closeFile();
+        mEof = true;
+        mRingBuf.pushBack(new GenericEvent(kEvtStreamEnd, mStreamId, 0));
+        return 1;
+    }
+    pkt->dataLen = rlen;
+    mRingBuf.pushBack(pkt.release());
+    return 0;
+}
+void FileInputNode::nodeThreadFunc()
+{
+    ESP_LOGI(TAG, "Task started");
+    mRingBuf.clearStopSignal();
+    for (;;) {
+        processMessages();
+        if (mTerminate) {
+            return;
+        }
+        mRingBuf.clearStopSignal();
+        while (!mTerminate && (mCmdQueue.numMessages() == 0)) {
+            auto ret = recv();
+            if (ret) {
+                if (ret < 0) {
+                    stop(false);
+                }
+                break;
+            }
+        }
+    }
+}
+bool FileInputNode::seekStream(uint32_t pos)
+{
+    if (mPath == "-") {
+        return false;
+    }
+    mCmdQueue.post(kCommandSeek, pos);
+    return true;
+}
+bool FileInputNode::dispatchCommand(Command& cmd)
+{
+    if (AudioNodeWithTask::dispatchCommand(cmd)) {
+        return true;
+    }
+    if (cmd.opcode != kCommandSeek) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Seeking to byte offset %lu", (unsigned long)cmd.arg);
+    mRingBuf.clear(); // also removes a kStreamEnd that the consumer hasn't seen yet
+    mRingBuf.pushBack(new GenericEvent(kEvtSeek, mStreamId, 0));
+    if ((!mFile && !openFile(true)) || fseek(mFile, cmd.arg, SEEK_SET)) {
+        ESP_LOGE(TAG, "Error seeking '%s'", mPath.c_str());
+        closeFile();
+        mRingBuf.pushBack(new GenericEvent(kEvtStreamEnd, mStreamId, 0));
+        mEof = true;
+        return true;
+    }
+    mEof = false;
+    return true;
+}
+StreamEvent FileInputNode::pullData(PacketResult& pr)
+{
+    StreamPacket::unique_ptr pkt(mRingBuf.popFront());
+    if (!pkt) {
+        pr.streamId = mStreamId;
+        return kErrStreamStopped;
+    }
+    return pr.set(pkt);
+}
+DataPacket* FileInputNode::peekData(bool& preceded)
+{
+    return mRingBuf.peekFirstDataWait((StreamEvent)(kEvtStreamChanged | kEvtStreamEnd), &preceded);
+}
@@ -0,0 +1,50 @@
+#ifndef FILE_INPUT_NODE_HPP
+#define FILE_INPUT_NODE_HPP
+#include "audioNode.hpp"
+#include "streamRingQueue.hpp"
+#include <stdio.h>
+#include <string>
+#include <atomic>
+
+/** Host stand-in for HttpNode. Reads a file (or stdin) in its own thread and posts the same
+ * packet sequence as HttpNode does for an HTTP stream: a kEvtStreamChanged with the format
+ * derived from the content type, data packets of StreamFormat::rxChunkSize() bytes, and kEvtStreamEnd
+ */
+class FileInputNode: public AudioNodeWithTask, public IInputAudioNode
+{
+protected:
+    enum { kRingQueueLen = 256, kStackSize = 8192, kDefaultBufSize = 256 * 1024 };
+    enum: uint8_t { kCommandSeek = AudioNodeWithTask::kCommandLast + 1 };
+    StreamRingQueue<kRingQueueLen> mRingBuf;
+    std::string mPath;
+    std::string mContentType;
+    FILE* mFile = nullptr;
+    StreamFormat mInFormat;
+    StreamId mStreamId = 0;
+    std::atomic<bool> mEof = {false};
+    virtual void nodeThreadFunc() override;
+    virtual bool dispatchCommand(Command& cmd) override;
+    virtual void onStopRequest() override { mRingBuf.setStopSignal(); }
+    bool openFile(bool isSeek=false);
+    void closeFile();
+    int8_t recv();
+public:
+    /** Content type as it would be sent by an HTTP server, derived from the file extension */
+    static const char* contentTypeFromPath(const char* path);
+    FileInputNode(IAudioPipeline& parent);
+    virtual ~FileInputNode() { terminate(true); closeFile(); }
+    virtual Type type() const override { return kTypeHttpIn; }
+    virtual IInputAudioNode* inputNodeIntf() override { return this; }
+    virtual StreamEvent pullData(PacketResult& pr) override;
+    virtual DataPacket* peekData(bool& preceded) override;
+    virtual StreamPacket* peek() override { return mRingBuf.peekFirstWait(); }
+    virtual uint32_t bufferedDataSize() const override { return mRingBuf.dataSize(); }
+    virtual bool seekStream(uint32_t pos) override;
+    /** Whether the buffer is full or the whole file is buffered */
+    bool prefilled() const { return mEof || mRingBuf.dataSize() >= mRingBuf.maxDataSize(); }
+    /** Sets the file to play, "-" is stdin. If contentType is null, it's derived from the file extension.
+     * Like HttpNode, the buffer is cleared here and not on stop, so the consumer can still see the stop signal */
+    void setFile(const char* path, const char* contentType = nullptr);
+};
+
+#endif
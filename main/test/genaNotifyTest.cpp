@@ -0,0 +1,408 @@
+// Host test of the GENA event notifier, against a local stand-in for a control point, i.e. an HTTP server
+// that records the NOTIFY requests it receives, and counts the connections it accepts. A RenderingControl
+// and an AVTransport subscription have callbacks on the same server, as with real control points.
+// Parts:
+// - burst: a volume knob turn and a track change, i.e. many changes within a few ms. Each service must
+//   get a single event with the final state, over the one connection opened for the initial events.
+// - steady: changes further apart than the coalescing window, each must result in an event, still over
+//   the same connection. Measures the latency from the change to the receipt of the event.
+// - idleClose: the server closes the idle connection, the next event must be delivered on a new one.
+// - outage: the server responds with errors for a while, the changes made meanwhile must arrive as one
+//   event once it recovers.
+// - expiry: a subscription with a short timeout must get no events after it expired, and be dropped.
+// Checks that the SEQ of each subscription counts up from 0 without gaps, and that the LastChange values,
+// decoded as a control point does, give back the values that were set.
+// Reports, as one JSON object per line: the number of changes, i.e. of NOTIFY requests and connections
+// without the notifier, the events and connections seen by the server, failures and latencies.
+// g++ -std=gnu++17 -O2 -pthread -o genaNotifyTest genaNotifyTest.cpp ../genaNotifier.cpp ../dlna-parse.cpp -I ./host -I ..
+// Usage: genaNotifyTest
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <string>
+#include <esp_timer.h>
+#include <loopbackServer.hpp>
+#include "genaNotifier.hpp"
+#include "dlna-parse.hpp"
+
+typedef GenaNotifier::Var Var;
+static const char kTrickyUrl[] = "http://192.168.1.2:8200/a?b=1&c=\"<x>\"";
+
+struct Event
+{
+    std::string path;
+    uint32_t sid;
+    uint32_t seq;
+    std::string body;
+    int64_t tsRecv;
+};
+// Extracts the state variables from a LastChange event body: the text of LastChange is an XML document
+class LastChangeParser: public XmlStreamParser
+{
+protected:
+    bool mInLastChange = false;
+    std::string mLastChange;
+    virtual void onElementStart(const char* name) override { mInLastChange = strcmp(name, "LastChange") == 0; }
+    virtual void onText(const char* text, int len) override
+    {
+        if (mInLastChange) {
+            mLastChange.append(text, len);
+        }
+    }
+    virtual void onElementEnd(const char* name) override { mInLastChange = false; }
+    class VarParser: public XmlStreamParser
+    {
+    public:
+        std::map<std::string, std::string> vars;
+        std::string curr;
+        virtual void onElementStart(const char* name) override { curr = name; }
+        virtual void onAttribute(const char* name, const char* value) override
+        {
+            if (strcmp(name, "val") == 0 && depth() == 3) {
+                vars[curr] = value;
+            }
+        }
+    };
+public:
+    std::map<std::string, std::string> vars;
+    bool parse(const std::string& body)
+    {
+        reset();
+        mLastChange.clear();
+        if (!feed(body.c_str(), body.size()) || !done()) {
+            return false;
+        }
+        VarParser parser;
+        if (!parser.feed(mLastChange.c_str(), mLastChange.size()) || !parser.done()) {
+            return false;
+        }
+        vars = std::move(parser.vars);
+        return true;
+    }
+};
+std::map<std::string, std::string> eventVars(const Event& evt)
+{
+    LastChangeParser parser;
+    if (!parser.parse(evt.body)) {
+        printf("FAIL: can't parse event body: %s\n", evt.body.c_str());
+        return {};
+    }
+    return parser.vars;
+}
+
+// The stand-in control point
+class Subscriber
+{
+public:
+    enum Mode { kModeOk, kModeError };
+protected:
+    struct Conn
+    {
+        int fd;
+        std::string rx;
+    };
+    uint16_t mPort = 0;
+    std::mutex mMutex;
+    std::vector<Event> mEvents;
+    Mode mMode = kModeOk;
+    LoopbackServer mServer;
+    void serve(int fd)
+    {
+        Conn conn{fd, {}};
+        char buf[2048];
+        for (;;) {
+            auto len = recv(fd, buf, sizeof(buf), 0);
+            if (len <= 0) {
+                return;
+            }
+            conn.rx.append(buf, len);
+            if (!handleRequests(conn)) {
+                return;
+            }
+        }
+    }
+    static std::string header(const std::string& hdrs, const char* name)
+    {
+        auto pos = hdrs.find(std::string("\r\n") + name + ": ");
+        if (pos == std::string::npos) {
+            return std::string();
+        }
+        pos += strlen(name) + 4;
+        return hdrs.substr(pos, hdrs.find("\r\n", pos) - pos);
+    }
+    // Returns false if the connection is to be closed
+    bool handleRequests(Conn& conn)
+    {
+        for (;;) {
+            auto hdrEnd = conn.rx.find("\r\n\r\n");
+            if (hdrEnd == std::string::npos) {
+                return true;
+            }
+            auto hdrs = conn.rx.substr(0, hdrEnd + 2);
+            size_t bodyLen = atoi(header(hdrs, "CONTENT-LENGTH").c_str());
+            if (conn.rx.size() < hdrEnd + 4 + bodyLen) {
+                return true;
+            }
+            Event evt;
+            evt.tsRecv = esp_timer_get_time();
+            evt.path = hdrs.substr(7, hdrs.find(' ', 7) - 7);
+            evt.sid = GenaNotifier::parseSid(header(hdrs, "SID").c_str());
+            evt.seq = atoi(header(hdrs, "SEQ").c_str());
+            evt.body = conn.rx.substr(hdrEnd + 4, bodyLen);
+            conn.rx.erase(0, hdrEnd + 4 + bodyLen);
+            bool ok = strncmp(hdrs.c_str(), "NOTIFY ", 7) == 0 && header(hdrs, "NT") == "upnp:event"
+                && header(hdrs, "NTS") == "upnp:propchange";
+            Mode mode;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mode = mMode;
+                if (ok && mode == kModeOk) {
+                    mEvents.push_back(std::move(evt));
+                }
+            }
+            const char* resp = !ok ? "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n"
+                : (mode == kModeOk) ? "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n"
+                : "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 5\r\n\r\nbusy!";
+            send(conn.fd, resp, strlen(resp), MSG_NOSIGNAL);
+        }
+    }
+public:
+    Subscriber(): mServer([this](int fd) { serve(fd); }) {}
+    bool start()
+    {
+        mPort = mServer.start();
+        return mPort != 0;
+    }
+    std::string url(const char* path) const
+    {
+        return "<http://127.0.0.1:" + std::to_string(mPort) + path + ">";
+    }
+    void setMode(Mode mode) { std::lock_guard<std::mutex> lock(mMutex); mMode = mode; }
+    void dropConnections() { mServer.dropConnections(); }
+    int numAccepted() { return mServer.numAccepted(); }
+    std::vector<Event> events() { std::lock_guard<std::mutex> lock(mMutex); return mEvents; }
+    std::vector<Event> eventsSince(size_t idx, const char* path)
+    {
+        std::vector<Event> result;
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (size_t i = idx; i < mEvents.size(); i++) {
+            if (mEvents[i].path == path) {
+                result.push_back(mEvents[i]);
+            }
+        }
+        return result;
+    }
+    size_t numEvents() { std::lock_guard<std::mutex> lock(mMutex); return mEvents.size(); }
+};
+
+static void sleepMs(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+static int numFailed = 0;
+static void check(bool cond, const char* part, const char* what)
+{
+    if (!cond) {
+        printf("FAIL: %s: %s\n", part, what);
+        numFailed++;
+    }
+}
+static void setVolume(GenaNotifier& notifier, int vol)
+{
+    auto str = std::to_string(vol);
+    notifier.changeVars(GenaNotifier::kServiceRendCtl, {{"Volume", str.c_str()}});
+}
+static void setPlaying(GenaNotifier& notifier, bool playing, const char* url)
+{
+    if (playing) {
+        notifier.changeVars(GenaNotifier::kServiceAvTransport, {{"TransportState", "PLAYING"},
+            {"CurrentTrackURI", url}, {"CurrentTrackDuration", "0:03:12.000"}, {"CurrentTransportActions", "Stop"}});
+    }
+    else {
+        notifier.changeVars(GenaNotifier::kServiceAvTransport, {{"TransportState", "STOPPED"},
+            {"CurrentTransportActions", "Play"}});
+    }
+}
+static void printPart(const char* part, GenaNotifier& notifier, Subscriber& server, const GenaNotifier::Stats& before,
+    size_t evtsBefore, int acceptedBefore, const char* extra = "")
+{
+    auto stats = notifier.stats();
+    printf("{\"part\":\"%s\",\"changes\":%u,\"events\":%d,\"connections\":%d,\"failures\":%u%s}\n", part,
+        stats.numChanges - before.numChanges, (int)(server.numEvents() - evtsBefore),
+        server.numAccepted() - acceptedBefore, stats.numFailures - before.numFailures, extra);
+    fflush(stdout);
+}
+int main()
+{
+    Subscriber server;
+    if (!server.start()) {
+        printf("FAIL: can't start the stand-in subscriber\n");
+        return 1;
+    }
+    GenaNotifier notifier;
+    const Var rcsState[] = {{"PresetNameList", "FactoryDefaults"}, {"Mute", "0"}, {"Volume", "20"}};
+    const Var avtState[] = {{"TransportState", "STOPPED"}, {"AVTransportURI", ""}, {"CurrentTransportActions", "Play"}};
+    auto rcsSid = notifier.subscribe(GenaNotifier::kServiceRendCtl, server.url("/rcs").c_str(), 300, rcsState, 3);
+    auto avtSid = notifier.subscribe(GenaNotifier::kServiceAvTransport, server.url("/avt").c_str(), 300, avtState, 3);
+    check(rcsSid && avtSid && rcsSid != avtSid, "subscribe", "no or duplicate SIDs");
+    sleepMs(100);
+    check(server.numEvents() == 0, "subscribe", "event sent before startEvents()");
+    notifier.startEvents(rcsSid);
+    notifier.startEvents(avtSid);
+    sleepMs(100);
+    {
+        auto evts = server.events();
+        check(evts.size() == 2, "initial", "expected one initial event per subscription");
+        for (auto& evt: evts) {
+            check(evt.seq == 0, "initial", "initial SEQ is not 0");
+            auto vars = eventVars(evt);
+            check(vars.size() == 3, "initial", "initial event doesn't have the full state");
+        }
+    }
+    // burst
+    {
+        auto before = notifier.stats();
+        auto evtIdx = server.numEvents();
+        int accepted = server.numAccepted();
+        for (int vol = 21; vol <= 50; vol++) {
+            setVolume(notifier, vol);
+            sleepMs(1);
+        }
+        setPlaying(notifier, false, nullptr);
+        setPlaying(notifier, true, "http://192.168.1.2:8200/first.mp3");
+        setPlaying(notifier, false, nullptr);
+        setPlaying(notifier, true, kTrickyUrl);
+        sleepMs(GenaNotifier::kCoalesceMs * 3);
+        printPart("burst", notifier, server, before, evtIdx, accepted);
+        auto rcs = server.eventsSince(evtIdx, "/rcs");
+        auto avt = server.eventsSince(evtIdx, "/avt");
+        check(rcs.size() == 1 && avt.size() == 1, "burst", "expected one event per service");
+        check(server.numAccepted() == 1, "burst", "expected a single connection since the start");
+        if (rcs.size() == 1 && avt.size() == 1) {
+            check(eventVars(rcs[0])["Volume"] == "50", "burst", "wrong final volume");
+            auto vars = eventVars(avt[0]);
+            check(vars["TransportState"] == "PLAYING", "burst", "wrong final transport state");
+            check(vars["CurrentTrackURI"] == kTrickyUrl, "burst", "url not escaped properly");
+        }
+    }
+    // steady
+    {
+        enum { kNumChanges = 10 };
+        auto before = notifier.stats();
+        auto evtIdx = server.numEvents();
+        int accepted = server.numAccepted();
+        int64_t tsChange[kNumChanges];
+        for (int i = 0; i < kNumChanges; i++) {
+            tsChange[i] = esp_timer_get_time();
+            setVolume(notifier, 60 + i);
+            sleepMs(GenaNotifier::kCoalesceMs + 100);
+        }
+        sleepMs(GenaNotifier::kCoalesceMs);
+        auto rcs = server.eventsSince(evtIdx, "/rcs");
+        int64_t sumUs = 0, maxUs = 0;
+        for (size_t i = 0; i < rcs.size() && i < kNumChanges; i++) {
+            auto us = rcs[i].tsRecv - tsChange[i];
+            sumUs += us;
+            maxUs = std::max(maxUs, us);
+            check(eventVars(rcs[i])["Volume"] == std::to_string(60 + i), "steady", "wrong volume");
+        }
+        char extra[96];
+        snprintf(extra, sizeof(extra), ",\"avgLatencyMs\":%.1f,\"maxLatencyMs\":%.1f",
+            rcs.empty() ? 0.0 : sumUs / 1000.0 / rcs.size(), maxUs / 1000.0);
+        printPart("steady", notifier, server, before, evtIdx, accepted, extra);
+        check(rcs.size() == kNumChanges, "steady", "expected an event per change");
+        check(server.numAccepted() == accepted, "steady", "connection not reused");
+        check(maxUs < (GenaNotifier::kCoalesceMs + 100) * 1000, "steady", "latency above the coalescing window");
+    }
+    // idleClose
+    {
+        auto before = notifier.stats();
+        auto evtIdx = server.numEvents();
+        int accepted = server.numAccepted();
+        server.dropConnections();
+        sleepMs(50);
+        setVolume(notifier, 33);
+        sleepMs(GenaNotifier::kCoalesceMs * 2);
+        printPart("idleClose", notifier, server, before, evtIdx, accepted);
+        auto rcs = server.eventsSince(evtIdx, "/rcs");
+        check(rcs.size() == 1, "idleClose", "event not delivered after the connection was closed");
+        check(server.numAccepted() == accepted + 1, "idleClose", "expected one new connection");
+        check(notifier.stats().numFailures == before.numFailures, "idleClose", "reconnect counted as failure");
+    }
+    // outage
+    {
+        auto before = notifier.stats();
+        auto evtIdx = server.numEvents();
+        int accepted = server.numAccepted();
+        server.setMode(Subscriber::kModeError);
+        auto tsStart = esp_timer_get_time();
+        setVolume(notifier, 10);
+        setPlaying(notifier, false, nullptr);
+        sleepMs(700);
+        setVolume(notifier, 11);
+        sleepMs(900);
+        server.setMode(Subscriber::kModeOk);
+        auto tsUp = esp_timer_get_time();
+        sleepMs(GenaNotifier::kRetryBaseMs * 4);
+        auto rcs = server.eventsSince(evtIdx, "/rcs");
+        auto avt = server.eventsSince(evtIdx, "/avt");
+        char extra[96];
+        snprintf(extra, sizeof(extra), ",\"outageMs\":%d,\"recoveryMs\":%.1f", (int)((tsUp - tsStart) / 1000),
+            rcs.empty() ? -1.0 : (rcs[0].tsRecv - tsUp) / 1000.0);
+        printPart("outage", notifier, server, before, evtIdx, accepted, extra);
+        auto failures = notifier.stats().numFailures - before.numFailures;
+        check(failures >= 4 && failures <= 8, "outage", "unexpected number of retries");
+        check(rcs.size() == 1 && avt.size() == 1, "outage", "expected one event per service after recovery");
+        if (rcs.size() == 1) {
+            check(eventVars(rcs[0])["Volume"] == "11", "outage", "wrong volume after recovery");
+        }
+        check(notifier.numSubscriptions() == 2, "outage", "subscription dropped");
+    }
+    // expiry
+    {
+        auto before = notifier.stats();
+        auto evtIdx = server.numEvents();
+        int accepted = server.numAccepted();
+        auto sid = notifier.subscribe(GenaNotifier::kServiceRendCtl, server.url("/short").c_str(), 1, rcsState, 3);
+        notifier.startEvents(sid);
+        sleepMs(1300);
+        setVolume(notifier, 44);
+        sleepMs(GenaNotifier::kCoalesceMs * 2);
+        printPart("expiry", notifier, server, before, evtIdx, accepted);
+        auto shortEvts = server.eventsSince(evtIdx, "/short");
+        check(shortEvts.size() == 1, "expiry", "expected only the initial event");
+        check(server.eventsSince(evtIdx, "/rcs").size() == 1, "expiry", "other subscription not notified");
+        check(notifier.numSubscriptions() == 2, "expiry", "expired subscription not dropped");
+        check(notifier.stats().numDropped == before.numDropped + 1, "expiry", "drop not counted");
+        check(!notifier.renew(sid, 300), "expiry", "expired subscription renewed");
+    }
+    // unsubscribe
+    {
+        auto evtIdx = server.numEvents();
+        check(notifier.unsubscribe(avtSid), "unsubscribe", "failed");
+        setPlaying(notifier, true, "http://192.168.1.2:8200/next.mp3");
+        sleepMs(GenaNotifier::kCoalesceMs * 2);
+        check(server.eventsSince(evtIdx, "/avt").empty(), "unsubscribe", "event after unsubscribe");
+    }
+    // SEQ of each subscription must be 0, 1, 2...
+    std::map<uint32_t, uint32_t> nextSeq;
+    for (auto& evt: server.events()) {
+        auto& seq = nextSeq[evt.sid];
+        if (evt.seq != seq) {
+            printf("FAIL: seq: SID %u got SEQ %u, expected %u\n", evt.sid, evt.seq, seq);
+            numFailed++;
+        }
+        seq = evt.seq + 1;
+    }
+    auto stats = notifier.stats();
+    printf("{\"part\":\"total\",\"changes\":%u,\"events\":%u,\"connections\":%u,\"serverConnections\":%d,\"failures\":%u,\"dropped\":%u}\n",
+        stats.numChanges, stats.numEvents, stats.numConnects, server.numAccepted(), stats.numFailures, stats.numDropped);
+    return numFailed ? 1 : 0;
+}
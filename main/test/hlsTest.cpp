@@ -0,0 +1,464 @@
+// Host test of HlsStream, against a local HLS server that serves recorded playlists and segments from a
+// directory. It runs in-process on the loopback interface, keeps connections alive, supports byte ranges,
+// and counts connections and requests. Media playlists are served as recorded (VOD), or under /live/ as a
+// live stream: a sliding window of kLiveWindow segments of the recording, which advances by one segment
+// per second, the segment duration. Optionally, all data goes through a link of limited rate, and one
+// connection is dropped in the middle of a segment.
+// Checks, reported as one JSON object per line:
+// - vod-ts: the stream demuxed from a VOD playlist of MPEG-TS segments is byte-exact with the recorded
+//   ADTS stream, even though a connection is dropped in the middle of a segment, and all requests but the
+//   one after the drop go over one connection
+// - vod-packed: the same with packed audio segments, ADTS with an ID3 tag
+// - live: the stream starts kLiveStartSegments before the live edge, every segment from there is received
+//   once, in order, and the playlist is not reloaded more often than RFC 8216 allows
+// - abr: with a master playlist of the 48, 96 and 192 kbps variants, over links of different rates: the
+//   variant followed at the end is the highest one within kSpeedMarginPct of the rate, and the stream has
+//   every ADTS frame exactly once, each from one of the variants
+// Recording the test content into /tmp/hls, the default directory:
+//   for br in 48 96 192; do
+//     ffmpeg -f lavfi -i "sine=frequency=440:beep_factor=4:duration=16:sample_rate=44100" -ac 2 -c:a aac -b:a ${br}k -f adts a$br.aac
+//     ffmpeg -i a$br.aac -c copy -f hls -hls_time 1 -hls_playlist_type vod -hls_segment_filename "ts${br}_%02d.ts" ts$br.m3u8
+//   done
+//   ffmpeg -i a96.aac -c copy -f segment -segment_time 1 -segment_format adts -segment_format_options write_id3v2=1 -segment_list pk96.m3u8 -segment_list_type m3u8 "pk96_%02d.aac"
+// The master playlist is generated by the server, with the peak bitrate of the segments of each variant.
+// g++ -std=gnu++17 -O2 -pthread -o hlsTest hlsTest.cpp ../hlsStream.cpp ../hlsPlaylist.cpp ../tsDemuxer.cpp ../streamDefs.cpp -I ./host -I ..
+// Usage: hlsTest [content dir]
+// Takes about a minute
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <loopbackServer.hpp>
+#include "hlsStream.hpp"
+
+enum { kLiveWindow = 6, kLiveStartSegment = 10, kRecvSize = 4096, kSendChunk = 1024 };
+static const int kBitrates[] = { 48, 96, 192 };
+typedef std::chrono::steady_clock Clock;
+static int64_t msNow()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
+}
+static bool readFile(const std::string& path, std::string& data)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    char buf[8192];
+    data.clear();
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.append(buf, len);
+    }
+    fclose(file);
+    return true;
+}
+// A link of limited rate, shared by all connections. A rate of 0 is unlimited
+class Link
+{
+    std::mutex mMutex;
+    Clock::time_point mTsFree = Clock::now();
+public:
+    std::atomic<int> rate = {0}; // bytes/sec
+    bool send(int fd, const char* data, size_t len)
+    {
+        while (len) {
+            size_t chunk = std::min(len, (size_t)kSendChunk);
+            if (rate) {
+                Clock::time_point ts;
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mTsFree = std::max(mTsFree, Clock::now()) + std::chrono::microseconds(chunk * 1000000 / rate);
+                    ts = mTsFree;
+                }
+                std::this_thread::sleep_until(ts);
+            }
+            if (::send(fd, data, chunk, MSG_NOSIGNAL) != (ssize_t)chunk) {
+                return false;
+            }
+            data += chunk;
+            len -= chunk;
+        }
+        return true;
+    }
+};
+struct Segment
+{
+    std::string extinf;
+    std::string file;
+};
+class HlsServer
+{
+protected:
+    std::string mDir;
+    std::mutex mMutex;
+    std::vector<std::string> mRequests;
+    int64_t mTsLiveStart = 0;
+    static bool parseRecorded(const std::string& text, std::string& header, std::vector<Segment>& segments)
+    {
+        header.clear();
+        segments.clear();
+        size_t pos = 0;
+        std::string extinf;
+        while (pos < text.size()) {
+            auto end = text.find('\n', pos);
+            std::string line = text.substr(pos, end - pos);
+            pos = (end == std::string::npos) ? text.size() : end + 1;
+            if (line.empty() || line == "#EXT-X-ENDLIST" || line.compare(0, 21, "#EXT-X-PLAYLIST-TYPE:") == 0 ||
+                line.compare(0, 22, "#EXT-X-MEDIA-SEQUENCE:") == 0) {
+                continue;
+            }
+            if (line.compare(0, 8, "#EXTINF:") == 0) {
+                extinf = line;
+            }
+            else if (line[0] != '#') {
+                segments.push_back(Segment{extinf, line});
+            }
+            else {
+                header += line + "\n";
+            }
+        }
+        return !segments.empty();
+    }
+    // The window of the recording that is live now
+    std::string livePlaylist(const std::string& recorded)
+    {
+        std::string header;
+        std::vector<Segment> segments;
+        if (!parseRecorded(recorded, header, segments)) {
+            return "";
+        }
+        int end = std::min<int>(segments.size(), kLiveStartSegment + (msNow() - mTsLiveStart) / 1000);
+        int start = std::max(0, end - kLiveWindow);
+        std::string text = header + "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(start) + "\n";
+        for (int i = start; i < end; i++) {
+            text += segments[i].extinf + "\n" + segments[i].file + "\n";
+        }
+        if (end == (int)segments.size()) {
+            text += "#EXT-X-ENDLIST\n";
+        }
+        return text;
+    }
+    std::string masterPlaylist()
+    {
+        std::string text = "#EXTM3U\n#EXT-X-VERSION:3\n";
+        for (int br: kBitrates) {
+            text += "#EXT-X-STREAM-INF:BANDWIDTH=" + std::to_string(bandwidth(br)) +
+                ",CODECS=\"mp4a.40.2\"\nts" + std::to_string(br) + ".m3u8\n";
+        }
+        return text;
+    }
+    bool respond(int fd, const std::string& path, const std::string& req)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mRequests.push_back(path);
+        }
+        std::string body;
+        bool found;
+        const char* type = "video/MP2T";
+        if (path == "/master.m3u8") {
+            body = masterPlaylist();
+            found = true;
+        }
+        else {
+            bool live = path.compare(0, 6, "/live/") == 0;
+            found = readFile(mDir + path.substr(live ? 5 : 0), body);
+            if (path.size() > 5 && path.compare(path.size() - 5, 5, ".m3u8") == 0) {
+                type = "application/vnd.apple.mpegurl";
+                if (live && found) {
+                    body = livePlaylist(body);
+                }
+            }
+            else if (path.size() > 4 && path.compare(path.size() - 4, 4, ".aac") == 0) {
+                type = "audio/aac";
+            }
+        }
+        if (!found) {
+            std::string resp = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: keep-alive\r\n\r\n";
+            return link.send(fd, resp.data(), resp.size());
+        }
+        size_t start = 0;
+        auto range = req.find("Range: bytes=");
+        if (range != std::string::npos) {
+            start = std::min(body.size(), (size_t)strtoul(req.c_str() + range + 13, nullptr, 10));
+        }
+        std::string resp = std::string(range != std::string::npos ? "HTTP/1.1 206 Partial Content" : "HTTP/1.1 200 OK") +
+            "\r\nContent-Type: " + type + "\r\nContent-Length: " + std::to_string(body.size() - start) +
+            "\r\nConnection: keep-alive\r\n\r\n";
+        if (!link.send(fd, resp.data(), resp.size())) {
+            return false;
+        }
+        size_t len = body.size() - start;
+        if (!dropPath.empty() && path.find(dropPath) != std::string::npos) {
+            dropPath.clear();
+            link.send(fd, body.data() + start, len / 2);
+            return false;
+        }
+        return link.send(fd, body.data() + start, len);
+    }
+    void serve(int fd)
+    {
+        int one = 1; // the headers and the body are separate sends on a kept-alive connection
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        std::string buf;
+        char chunk[1024];
+        for (;;) {
+            size_t end;
+            while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+                auto len = recv(fd, chunk, sizeof(chunk), 0);
+                if (len <= 0) {
+                    return;
+                }
+                buf.append(chunk, len);
+            }
+            std::string req = buf.substr(0, end + 4);
+            buf.erase(0, end + 4);
+            auto pathStart = req.find(' ') + 1;
+            if (!respond(fd, req.substr(pathStart, req.find(' ', pathStart) - pathStart), req)) {
+                return;
+            }
+        }
+    }
+public:
+    Link link;
+    std::string dropPath; // the first request of a path that contains it gets half of the response
+    HlsServer(const char* dir): mDir(dir), mServer([this](int fd) { serve(fd); }) {}
+    uint16_t start() { return mServer.start(); }
+    int numConnections() { return mServer.numAccepted(); }
+    void startLive() { mTsLiveStart = msNow(); }
+    /** Peak bits per second of the segments of a variant */
+    uint32_t bandwidth(int bitrate)
+    {
+        std::string text, header, data;
+        std::vector<Segment> segments;
+        readFile(mDir + "/ts" + std::to_string(bitrate) + ".m3u8", text);
+        parseRecorded(text, header, segments);
+        uint32_t peak = 0;
+        for (auto& seg: segments) {
+            double duration = atof(seg.extinf.c_str() + 8);
+            if (duration < 0.5) { // the last one, with a few frames and the overhead of the PAT and PMT
+                continue;
+            }
+            readFile(mDir + "/" + seg.file, data);
+            peak = std::max(peak, (uint32_t)(data.size() * 8 / duration));
+        }
+        return peak;
+    }
+    std::vector<std::string> takeRequests()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto ret = std::move(mRequests);
+        mRequests.clear();
+        return ret;
+    }
+protected:
+    LoopbackServer mServer;
+};
+static HlsServer* sServer;
+static std::string sBaseUrl;
+
+static void setHeaders(esp_http_client_handle_t client)
+{
+    esp_http_client_set_header(client, "User-Agent", "hlsTest");
+}
+/** As HttpNode::connect() and recv(): receives the playlist, then the stream from HlsStream, as fast as it
+ * comes. Returns false on error */
+static bool receive(const std::string& url, std::string& out, std::unique_ptr<HlsStream>& hls)
+{
+    out.clear();
+    esp_http_client_config_t cfg = {};
+    cfg.url = url.c_str();
+    cfg.timeout_ms = 5000;
+    auto client = esp_http_client_init(&cfg);
+    std::string playlist;
+    if (esp_http_client_open(client, 0) == ESP_OK && esp_http_client_fetch_headers(client) > 0) {
+        playlist.resize(esp_http_client_get_content_length(client));
+        playlist.resize(std::max(0, esp_http_client_read(client, &playlist[0], playlist.size())));
+    }
+    esp_http_client_cleanup(client);
+    if (!HlsPlaylist::isHls(playlist.c_str())) {
+        printf("FAIL: %s is not an HLS playlist\n", url.c_str());
+        return false;
+    }
+    hls.reset(new HlsStream(setHeaders));
+    if (hls->start(url.c_str(), &playlist[0]) < 0) {
+        printf("FAIL: Couldn't start HLS stream %s\n", url.c_str());
+        return false;
+    }
+    if (hls->codec().type != Codec::kCodecAac) {
+        printf("FAIL: Codec is %s instead of AAC\n", hls->codec().toString());
+        return false;
+    }
+    char buf[kRecvSize];
+    for (;;) {
+        int rlen = hls->read(buf, sizeof(buf));
+        if (rlen > 0) {
+            out.append(buf, rlen);
+        }
+        else if (rlen < 0) {
+            printf("FAIL: Error receiving %s\n", url.c_str());
+            return false;
+        }
+        else if (hls->ended()) {
+            return true;
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(hls->msToWait()));
+        }
+    }
+}
+static int numFailed = 0;
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        numFailed++;
+    }
+}
+static std::string readContent(const char* name)
+{
+    std::string data;
+    if (!readFile(name, data)) {
+        printf("FAIL: Can't read %s\n", name);
+        exit(1);
+    }
+    return data;
+}
+/** Splits an ADTS stream into frames. Returns false if it's not a valid one */
+static bool adtsFrames(const std::string& data, std::vector<std::string>& frames)
+{
+    frames.clear();
+    for (size_t pos = 0; pos < data.size();) {
+        auto hdr = (const uint8_t*)data.data() + pos;
+        if (data.size() - pos < 7 || hdr[0] != 0xff || (hdr[1] & 0xf6) != 0xf0) {
+            return false;
+        }
+        size_t len = ((hdr[3] & 0x03) << 11) | (hdr[4] << 3) | (hdr[5] >> 5);
+        if (len < 7 || pos + len > data.size()) {
+            return false;
+        }
+        frames.push_back(data.substr(pos, len));
+        pos += len;
+    }
+    return true;
+}
+static int countIf(const std::vector<std::string>& reqs, const char* str)
+{
+    return std::count_if(reqs.begin(), reqs.end(), [str](const std::string& req) { return req.find(str) != std::string::npos; });
+}
+static void testVod(const char* dir, const char* playlist, const char* what)
+{
+    auto expected = readContent((std::string(dir) + "/a96.aac").c_str());
+    int conns = sServer->numConnections();
+    sServer->dropPath = "_05.";
+    std::unique_ptr<HlsStream> hls;
+    std::string out;
+    auto start = msNow();
+    bool ok = receive(sBaseUrl + playlist, out, hls);
+    auto reqs = sServer->takeRequests();
+    // the playlist over its own connection, as HttpNode fetches it, and a new one after the drop
+    int segConns = sServer->numConnections() - conns - 1;
+    printf("{\"test\":\"%s\",\"bytes\":%zu,\"expected\":%zu,\"requests\":%zu,\"connections\":%d,\"ms\":%lld}\n",
+        what, out.size(), expected.size(), reqs.size(), segConns, (long long)(msNow() - start));
+    check(ok && out == expected, what);
+    check(segConns == 2, "keep-alive");
+    check(countIf(reqs, "_05.") == 2, "resume of the dropped segment");
+}
+static void testLive(const char* dir)
+{
+    auto expected = readContent((std::string(dir) + "/a96.aac").c_str());
+    sServer->startLive();
+    std::unique_ptr<HlsStream> hls;
+    std::string out;
+    auto start = msNow();
+    bool ok = receive(sBaseUrl + "/live/ts96.m3u8", out, hls);
+    int elapsedMs = msNow() - start;
+    auto reqs = sServer->takeRequests();
+    int firstSeg = kLiveStartSegment - HlsStream::kLiveStartSegments;
+    // each segment from the first one once, in order
+    std::vector<std::string> segReqs;
+    std::copy_if(reqs.begin(), reqs.end(), std::back_inserter(segReqs),
+        [](const std::string& req) { return req.find(".ts") != std::string::npos; });
+    bool inOrder = !segReqs.empty();
+    for (size_t i = 0; i < segReqs.size(); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "ts96_%02d.ts", firstSeg + (int)i);
+        inOrder &= segReqs[i].find(name) != std::string::npos;
+    }
+    int reloads = countIf(reqs, ".m3u8") - 1;
+    // the window advances once per second: reloaded after the target duration, or half of it if unchanged
+    int maxReloads = elapsedMs / 500 + 1;
+    printf("{\"test\":\"live\",\"bytes\":%zu,\"firstSegment\":%d,\"segments\":%zu,\"reloads\":%d,\"maxReloads\":%d,\"ms\":%d}\n",
+        out.size(), firstSeg, segReqs.size(), reloads, maxReloads, elapsedMs);
+    check(ok && out.size() <= expected.size() && out.size() > 0 &&
+        expected.compare(expected.size() - out.size(), out.size(), out) == 0, "live: stream is the end of the recording");
+    check(inOrder, "live: each segment once, in order");
+    check(reloads >= 1 && reloads <= maxReloads, "live: playlist reloads");
+}
+static void testAbr(const char* dir)
+{
+    std::vector<std::string> frames[3];
+    uint32_t bandwidths[3];
+    for (int i = 0; i < 3; i++) {
+        auto data = readContent((std::string(dir) + "/a" + std::to_string(kBitrates[i]) + ".aac").c_str());
+        check(adtsFrames(data, frames[i]), "recorded stream is ADTS");
+        bandwidths[i] = sServer->bandwidth(kBitrates[i]);
+    }
+    check(frames[0].size() == frames[1].size() && frames[1].size() == frames[2].size(), "same number of frames in all variants");
+    // just below and above what each variant needs, and unlimited
+    auto needs = [&bandwidths](int idx, int pct) {
+        return (uint32_t)((uint64_t)bandwidths[idx] * 100 / HlsStream::kSpeedMarginPct / 8 * pct / 100);
+    };
+    for (uint32_t rate: { needs(1, 80), needs(1, 110), needs(2, 90), needs(2, 120), 0u }) {
+        int expected = 0;
+        for (int i = 0; i < 3; i++) {
+            if (!rate || bandwidths[i] / 8 <= rate * HlsStream::kSpeedMarginPct / 100) {
+                expected = i;
+            }
+        }
+        sServer->link.rate = rate;
+        std::unique_ptr<HlsStream> hls;
+        std::string out;
+        auto start = msNow();
+        bool ok = receive(sBaseUrl + "/master.m3u8", out, hls);
+        sServer->takeRequests();
+        std::vector<std::string> outFrames;
+        bool valid = ok && adtsFrames(out, outFrames) && outFrames.size() == frames[0].size();
+        for (size_t i = 0; valid && i < outFrames.size(); i++) {
+            valid = outFrames[i] == frames[0][i] || outFrames[i] == frames[1][i] || outFrames[i] == frames[2][i];
+        }
+        printf("{\"test\":\"abr\",\"linkKbps\":%u,\"measuredKbps\":%u,\"variantKbps\":%u,\"expectedKbps\":%u,\"frames\":%zu,\"ms\":%lld}\n",
+            rate * 8 / 1000, hls ? hls->linkSpeed() * 8 / 1000 : 0, hls ? hls->bandwidth() / 1000 : 0,
+            bandwidths[expected] / 1000, outFrames.size(), (long long)(msNow() - start));
+        check(valid, "abr: every frame once, from one of the variants");
+        check(hls && hls->bandwidth() == bandwidths[expected], "abr: variant for the link rate");
+    }
+    sServer->link.rate = 0;
+}
+int main(int argc, char** argv)
+{
+    const char* dir = (argc > 1) ? argv[1] : "/tmp/hls";
+    HlsServer server(dir);
+    sServer = &server;
+    auto port = server.start();
+    if (!port) {
+        printf("FAIL: Can't start server\n");
+        return 1;
+    }
+    sBaseUrl = "http://127.0.0.1:" + std::to_string(port);
+    testVod(dir, "/ts96.m3u8", "vod-ts");
+    testVod(dir, "/pk96.m3u8", "vod-packed");
+    testLive(dir);
+    testAbr(dir);
+    return numFailed ? 1 : 0;
+}
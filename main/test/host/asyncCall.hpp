@@ -0,0 +1,8 @@
+// Host stand-in for esp32-mylibs asyncCall.hpp. On target, the call runs in a task with an
+// internal RAM stack, here it just runs in the caller's thread
+#ifndef HOST_ASYNCCALL_HPP
+#define HOST_ASYNCCALL_HPP
+
+template <class F>
+void asyncCallWait(F&& func) { func(); }
+#endif
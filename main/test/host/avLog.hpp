@@ -0,0 +1,9 @@
+// Host stand-in for esp32-mylibs avLog.hpp, which logs via ESP_LOGx
+#ifndef HOST_AVLOG_HPP
+#define HOST_AVLOG_HPP
+#include "esp_log.h"
+#define AV_LOGE ESP_LOGE
+#define AV_LOGW ESP_LOGW
+#define AV_LOGI ESP_LOGI
+#define AV_LOGD ESP_LOGD
+#endif
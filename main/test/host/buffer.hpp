@@ -0,0 +1,41 @@
+// Host stand-in for the subset of esp32-mylibs DynBuffer used by the stats printers and the ICY parser
+#ifndef HOST_BUFFER_HPP
+#define HOST_BUFFER_HPP
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+
+class DynBuffer {
+    std::string mData; // always null-terminated; dataSize() includes the terminating null, as on target
+public:
+    DynBuffer(size_t reserveSize = 0) { mData.reserve(reserveSize); }
+    char* buf() { return &mData[0]; }
+    const char* buf() const { return mData.c_str(); }
+    size_t dataSize() const { return mData.empty() ? 0 : mData.size() + 1; }
+    void clear() { mData.clear(); }
+    void reserve(size_t size) { mData.reserve(size); }
+    void appendStr(const char* str, bool = false) { mData.append(str); }
+    void appendStr(const char* str, int len, bool = false) { mData.append(str, len); }
+    void ensureFreeSpace(size_t size) { mData.reserve(mData.size() + size); }
+    char& operator[](size_t idx) { return mData[idx]; }
+    void setDataSize(size_t size) { mData.resize(size ? size - 1 : 0); }
+    /** Returns the data as a malloc-ed string, and clears the buffer */
+    char* release() { char* str = strdup(mData.c_str()); mData.clear(); return str; }
+    int printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, fmt);
+        va_list args2;
+        va_copy(args2, args);
+        int len = vsnprintf(nullptr, 0, fmt, args);
+        va_end(args);
+        auto oldSize = mData.size();
+        mData.resize(oldSize + len + 1);
+        vsnprintf(&mData[oldSize], len + 1, fmt, args2);
+        va_end(args2);
+        mData.resize(oldSize + len);
+        return len;
+    }
+};
+#endif
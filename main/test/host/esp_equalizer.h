@@ -0,0 +1,16 @@
+// Host stand-in for the prebuilt ESP-ADF equalizer library, which is not available for the host.
+// It passes audio through unmodified - use the custom equalizer (eq.useEsp = 0) on the host
+#ifndef HOST_ESP_EQUALIZER_H
+#define HOST_ESP_EQUALIZER_H
+#include <stdio.h>
+
+inline void* esp_equalizer_init(int nch, int sample_rate, int band_num, int use_xmms_original_freqs)
+{
+    fprintf(stderr, "W (esp_equalizer) ESP equalizer is not available on the host, passing audio through\n");
+    static int dummy;
+    return &dummy;
+}
+inline void esp_equalizer_uninit(void* handle) {}
+inline int esp_equalizer_process(void* handle, unsigned char* data, int len, int sample_rate, int nch) { return len; }
+inline void esp_equalizer_set_band_value(void* handle, float value, int index, int nch) {}
+#endif
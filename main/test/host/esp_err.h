@@ -0,0 +1,11 @@
+#ifndef HOST_ESP_ERR_H
+#define HOST_ESP_ERR_H
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+inline const char* esp_err_to_name(esp_err_t err) { return err ? "error" : "ESP_OK"; }
+#endif
@@ -0,0 +1,14 @@
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+inline void* heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+inline void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps) { return realloc(ptr, size); }
+inline void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) { return calloc(n, size); }
+inline size_t heap_caps_get_free_size(uint32_t caps) { return 0; }
+#endif
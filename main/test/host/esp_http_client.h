@@ -0,0 +1,275 @@
+// Host stand-in for the subset of the ESP-IDF http client used by the stream code. Plain HTTP/1.0 over
+// POSIX sockets, no chunked encoding or TLS. The connection is reused for the next request if the server
+// kept it alive, the host is the same and the response was read completely. On a read timeout, returns 0
+// with errno set to EAGAIN, as on target
+#ifndef HOST_ESP_HTTP_CLIENT_H
+#define HOST_ESP_HTTP_CLIENT_H
+#include <string>
+#include <vector>
+#include <utility>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "esp_err.h"
+
+typedef enum {
+    HTTP_EVENT_ERROR, HTTP_EVENT_ON_CONNECTED, HTTP_EVENT_HEADERS_SENT, HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA, HTTP_EVENT_ON_FINISH, HTTP_EVENT_DISCONNECTED
+} esp_http_client_event_id_t;
+typedef enum { HTTP_METHOD_GET } esp_http_client_method_t;
+struct esp_http_client;
+typedef esp_http_client* esp_http_client_handle_t;
+typedef struct {
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t client;
+    void* data;
+    int data_len;
+    void* user_data;
+    char* header_key;
+    char* header_value;
+} esp_http_client_event_t;
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t* evt);
+typedef struct {
+    const char* url;
+    http_event_handle_cb event_handler;
+    void* user_data;
+    int timeout_ms;
+    int buffer_size;
+    esp_http_client_method_t method;
+} esp_http_client_config_t;
+
+struct esp_http_client
+{
+    std::string url;
+    http_event_handle_cb handler;
+    void* userData;
+    int timeoutMs;
+    int fd = -1;
+    std::string connHostPort; // of the connection on fd
+    bool keepAlive = false; // the server keeps the connection open after the response
+    std::vector<std::pair<std::string, std::string>> reqHeaders;
+    std::string rxBuf; // received after the headers, not yet read
+    std::string location;
+    int status = -1;
+    int64_t contentLen = 0;
+    int64_t bytesRead = 0;
+    int lastErrno = 0;
+};
+
+inline esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* cfg)
+{
+    auto client = new esp_http_client;
+    client->url = cfg->url;
+    client->handler = cfg->event_handler;
+    client->userData = cfg->user_data;
+    client->timeoutMs = cfg->timeout_ms ? cfg->timeout_ms : 5000;
+    return client;
+}
+inline esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value)
+{
+    for (auto& hdr: client->reqHeaders) {
+        if (strcasecmp(hdr.first.c_str(), key) == 0) {
+            hdr.second = value;
+            return ESP_OK;
+        }
+    }
+    client->reqHeaders.emplace_back(key, value);
+    return ESP_OK;
+}
+inline esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char* key)
+{
+    for (auto it = client->reqHeaders.begin(); it != client->reqHeaders.end(); it++) {
+        if (strcasecmp(it->first.c_str(), key) == 0) {
+            client->reqHeaders.erase(it);
+            break;
+        }
+    }
+    return ESP_OK;
+}
+inline esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url)
+{
+    if (strncmp(url, "http://", 7) == 0) {
+        client->url = url;
+    }
+    else { // relative to the host
+        auto hostEnd = client->url.find('/', 7);
+        client->url = client->url.substr(0, hostEnd) + (url[0] == '/' ? "" : "/") + url;
+    }
+    return ESP_OK;
+}
+inline esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeoutMs)
+{
+    client->timeoutMs = timeoutMs;
+    if (client->fd >= 0) {
+        timeval tv = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+        setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    return ESP_OK;
+}
+inline esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void* data)
+{
+    client->userData = data;
+    return ESP_OK;
+}
+inline esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    if (client->fd >= 0) {
+        ::close(client->fd);
+        client->fd = -1;
+    }
+    client->rxBuf.clear();
+    return ESP_OK;
+}
+inline esp_err_t esp_http_client_open(esp_http_client_handle_t client, int writeLen)
+{
+    if (client->url.compare(0, 7, "http://") != 0) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    auto pathStart = client->url.find('/', 7);
+    std::string hostPort = client->url.substr(7, pathStart - 7);
+    std::string path = (pathStart == std::string::npos) ? "/" : client->url.substr(pathStart);
+    bool reuse = client->fd >= 0 && client->keepAlive && hostPort == client->connHostPort &&
+        client->contentLen && client->bytesRead >= client->contentLen && client->rxBuf.empty();
+    client->keepAlive = false;
+    if (!reuse) {
+        esp_http_client_close(client);
+        auto colon = hostPort.find(':');
+        std::string host = hostPort.substr(0, colon);
+        std::string port = (colon == std::string::npos) ? "80" : hostPort.substr(colon + 1);
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addr)) {
+            return ESP_FAIL;
+        }
+        client->fd = socket(AF_INET, SOCK_STREAM, 0);
+        bool ok = ::connect(client->fd, addr->ai_addr, addr->ai_addrlen) == 0;
+        freeaddrinfo(addr);
+        if (!ok) {
+            esp_http_client_close(client);
+            return ESP_FAIL;
+        }
+        client->connHostPort = hostPort;
+        esp_http_client_set_timeout_ms(client, client->timeoutMs);
+    }
+    std::string req = "GET " + path + " HTTP/1.0\r\nHost: " + hostPort + "\r\nConnection: keep-alive\r\n";
+    for (auto& hdr: client->reqHeaders) {
+        req += hdr.first + ": " + hdr.second + "\r\n";
+    }
+    req += "\r\n";
+    if (send(client->fd, req.data(), req.size(), MSG_NOSIGNAL) != (ssize_t)req.size()) {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    client->status = -1;
+    client->contentLen = client->bytesRead = 0;
+    client->location.clear();
+    return ESP_OK;
+}
+/** Returns the content length, 0 if not specified, or -1 on error */
+inline int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    std::string& buf = client->rxBuf;
+    size_t end;
+    while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+        char chunk[1024];
+        auto len = recv(client->fd, chunk, sizeof(chunk), 0);
+        if (len <= 0) {
+            client->lastErrno = errno;
+            return -1;
+        }
+        buf.append(chunk, len);
+    }
+    std::string hdrs = buf.substr(0, end + 2);
+    buf.erase(0, end + 4);
+    size_t pos = hdrs.find("\r\n");
+    auto space = hdrs.find(' ');
+    client->status = (space < pos) ? atoi(hdrs.c_str() + space + 1) : -1;
+    for (pos += 2; pos < hdrs.size();) {
+        auto lineEnd = hdrs.find("\r\n", pos);
+        std::string line = hdrs.substr(pos, lineEnd - pos);
+        pos = lineEnd + 2;
+        auto colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, colon);
+        std::string val = line.substr(line.find_first_not_of(' ', colon + 1));
+        if (strcasecmp(key.c_str(), "Content-Length") == 0) {
+            client->contentLen = atoll(val.c_str());
+        }
+        else if (strcasecmp(key.c_str(), "Connection") == 0) {
+            client->keepAlive = strcasecmp(val.c_str(), "keep-alive") == 0;
+        }
+        else if (strcasecmp(key.c_str(), "Location") == 0) {
+            client->location = val;
+        }
+        if (client->handler) {
+            esp_http_client_event_t evt = {};
+            evt.event_id = HTTP_EVENT_ON_HEADER;
+            evt.client = client;
+            evt.user_data = client->userData;
+            evt.header_key = &key[0];
+            evt.header_value = &val[0];
+            client->handler(&evt);
+        }
+    }
+    return client->contentLen;
+}
+inline int esp_http_client_get_status_code(esp_http_client_handle_t client) { return client->status; }
+inline int64_t esp_http_client_get_content_length(esp_http_client_handle_t client) { return client->contentLen; }
+inline int esp_http_client_get_errno(esp_http_client_handle_t client) { return client->lastErrno; }
+inline esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client)
+{
+    if (client->location.empty()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_http_client_set_url(client, client->location.c_str());
+}
+inline bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    return client->contentLen && client->bytesRead >= client->contentLen;
+}
+inline int esp_http_client_read(esp_http_client_handle_t client, char* buf, int len)
+{
+    if (client->contentLen) {
+        len = std::min<int64_t>(len, client->contentLen - client->bytesRead);
+        if (len <= 0) {
+            return 0;
+        }
+    }
+    int rlen;
+    if (!client->rxBuf.empty()) {
+        rlen = std::min<int>(len, client->rxBuf.size());
+        memcpy(buf, client->rxBuf.data(), rlen);
+        client->rxBuf.erase(0, rlen);
+    }
+    else {
+        rlen = recv(client->fd, buf, len, 0);
+        if (rlen < 0) {
+            client->lastErrno = errno;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = EAGAIN;
+                return 0;
+            }
+            return -1;
+        }
+        errno = 0;
+    }
+    client->bytesRead += rlen;
+    return rlen;
+}
+inline esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    delete client;
+    return ESP_OK;
+}
+#endif
@@ -0,0 +1,4 @@
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+#include "esp_err.h"
+#endif
@@ -0,0 +1,12 @@
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+#include <stdint.h>
+#include <time.h>
+/** Microseconds since an unspecified point, as on target */
+inline int64_t esp_timer_get_time()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
@@ -0,0 +1,61 @@
+// Host stand-in for esp32-mylibs EventGroup, based on a condition variable
+#ifndef HOST_EVENTGROUP_HPP
+#define HOST_EVENTGROUP_HPP
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "freertos/FreeRTOS.h"
+
+class EventGroup {
+    mutable std::mutex mMutex;
+    std::condition_variable mCond;
+    EventBits_t mBits;
+public:
+    EventGroup(EventBits_t bits = 0): mBits(bits) {}
+    EventBits_t get() const { std::lock_guard<std::mutex> lock(mMutex); return mBits; }
+    void setBits(EventBits_t bits)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mBits |= bits;
+        }
+        mCond.notify_all();
+    }
+    void clearBits(EventBits_t bits) { std::lock_guard<std::mutex> lock(mMutex); mBits &= ~bits; }
+    /** Returns the bit state at the time of return */
+    EventBits_t waitForOneNoReset(EventBits_t bits, int msTimeout)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        waitLocked(lock, [this, bits]() { return (mBits & bits) != 0; }, msTimeout);
+        return mBits;
+    }
+    /** Returns the bits that were set, which are then cleared, or 0 on timeout */
+    EventBits_t waitForOneAndReset(EventBits_t bits, int msTimeout)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        waitLocked(lock, [this, bits]() { return (mBits & bits) != 0; }, msTimeout);
+        auto ret = mBits & bits;
+        mBits &= ~ret;
+        return ret;
+    }
+    /** Returns the bit state at the time of return */
+    EventBits_t waitForAllNoReset(EventBits_t bits, int msTimeout)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        waitLocked(lock, [this, bits]() { return (mBits & bits) == bits; }, msTimeout);
+        return mBits;
+    }
+protected:
+    template <class P>
+    void waitLocked(std::unique_lock<std::mutex>& lock, P pred, int msTimeout)
+    {
+        if (msTimeout < 0) {
+            mCond.wait(lock, pred);
+        }
+        else {
+            mCond.wait_for(lock, std::chrono::milliseconds(msTimeout), pred);
+        }
+    }
+};
+
+#endif
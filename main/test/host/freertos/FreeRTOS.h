@@ -0,0 +1,24 @@
+// Minimal host (POSIX) stand-in for the FreeRTOS definitions used by the pipeline code
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+#include <stdint.h>
+#include <stddef.h>
+#include <malloc.h>
+
+typedef uint32_t EventBits_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t)-1)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7fffffff
+// Notional heap size, so that free heap deltas reflect allocations. Only the main malloc arena is
+// accounted, programs that measure heap usage of other threads should call mallopt(M_ARENA_MAX, 1)
+#define HOST_HEAP_SIZE (256 * 1024 * 1024)
+inline size_t xPortGetFreeHeapSize()
+{
+    auto info = mallinfo2();
+    return HOST_HEAP_SIZE - info.uordblks - info.hblkhd;
+}
+
+#endif
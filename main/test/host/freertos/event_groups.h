@@ -0,0 +1,2 @@
+// Host stand-in, the FreeRTOS primitives are provided by the C++ wrappers in this directory
+#include "FreeRTOS.h"
@@ -0,0 +1,15 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+#include "FreeRTOS.h"
+#include <thread>
+#include <chrono>
+
+typedef void* TaskHandle_t;
+typedef unsigned UBaseType_t;
+// Stack usage of host threads is not tracked
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 0; }
+inline void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+#endif
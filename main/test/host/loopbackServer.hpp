@@ -0,0 +1,91 @@
+// In-process TCP server on the loopback interface, for the stand-in servers of the host tests.
+// Each accepted connection is served by the handler on a thread of its own. The socket is closed when the
+// handler returns. On destruction, the open connections are shut down and their handlers waited for, so it
+// should be declared after the members that the handler uses
+#ifndef HOST_LOOPBACK_SERVER_HPP
+#define HOST_LOOPBACK_SERVER_HPP
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <set>
+
+class LoopbackServer
+{
+public:
+    typedef std::function<void(int fd)> Handler;
+protected:
+    Handler mHandler;
+    int mListenFd = -1;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::set<int> mConns; // sockets of the connections being served
+    int mNumAccepted = 0;
+    void serve(int fd)
+    {
+        mHandler(fd);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mConns.erase(fd);
+        close(fd);
+        mCond.notify_all();
+    }
+public:
+    LoopbackServer(Handler&& handler): mHandler(std::move(handler)) {}
+    ~LoopbackServer()
+    {
+        if (mListenFd < 0) {
+            return;
+        }
+        shutdown(mListenFd, SHUT_RDWR);
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+        close(mListenFd);
+        dropConnections();
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.wait(lock, [this]() { return mConns.empty(); });
+    }
+    /** Returns the port, or 0 on error */
+    uint16_t start(int backlog = 8)
+    {
+        mListenFd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(mListenFd, (sockaddr*)&addr, sizeof(addr)) || listen(mListenFd, backlog)) {
+            return 0;
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(mListenFd, (sockaddr*)&addr, &len);
+        mThread = std::thread([this]() {
+            for (;;) {
+                int fd = accept(mListenFd, nullptr, nullptr);
+                if (fd < 0) {
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    mConns.insert(fd);
+                    mNumAccepted++;
+                }
+                std::thread(&LoopbackServer::serve, this, fd).detach();
+            }
+        });
+        return ntohs(addr.sin_port);
+    }
+    int numAccepted() { std::lock_guard<std::mutex> lock(mMutex); return mNumAccepted; }
+    /** Shuts down all open connections, as a server that closes them */
+    void dropConnections()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (int fd: mConns) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+};
+#endif
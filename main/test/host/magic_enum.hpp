@@ -0,0 +1,16 @@
+// Host stand-in for magic_enum, only enum_name() is provided and it returns the numeric value
+#ifndef HOST_MAGIC_ENUM_HPP
+#define HOST_MAGIC_ENUM_HPP
+#include <string_view>
+#include <stdio.h>
+
+namespace magic_enum {
+template <class E>
+std::string_view enum_name(E val)
+{
+    static thread_local char buf[16];
+    snprintf(buf, sizeof(buf), "%d", (int)val);
+    return buf;
+}
+}
+#endif
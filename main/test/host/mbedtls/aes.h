@@ -0,0 +1,29 @@
+// Declarations of the AES API of mbedtls 2.28, for linking with the system's libmbedcrypto.so.7, which is
+// installed without headers: g++ ... -l:libmbedcrypto.so.7
+#ifndef MBEDTLS_AES_H
+#define MBEDTLS_AES_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define MBEDTLS_AES_ENCRYPT 1
+#define MBEDTLS_AES_DECRYPT 0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+typedef struct mbedtls_aes_context {
+    int nr;
+    uint32_t* rk;
+    uint32_t buf[68];
+} mbedtls_aes_context;
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx);
+void mbedtls_aes_free(mbedtls_aes_context* ctx);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_crypt_ecb(mbedtls_aes_context* ctx, int mode, const unsigned char input[16], unsigned char output[16]);
+int mbedtls_aes_crypt_ctr(mbedtls_aes_context* ctx, size_t length, size_t* nc_off, unsigned char nonce_counter[16],
+    unsigned char stream_block[16], const unsigned char* input, unsigned char* output);
+#ifdef __cplusplus
+}
+#endif
+#endif
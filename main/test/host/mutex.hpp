@@ -0,0 +1,26 @@
+// Host stand-in for esp32-mylibs mutex.hpp. The target Mutex is recursive
+#ifndef HOST_MUTEX_HPP
+#define HOST_MUTEX_HPP
+#include <mutex>
+
+class Mutex {
+    std::recursive_mutex mMutex;
+public:
+    void lock() { mMutex.lock(); }
+    void unlock() { mMutex.unlock(); }
+    bool tryLock() { return mMutex.try_lock(); }
+};
+class MutexLocker {
+    Mutex& mMutex;
+public:
+    MutexLocker(Mutex& m): mMutex(m) { mMutex.lock(); }
+    ~MutexLocker() { mMutex.unlock(); }
+};
+class MutexUnlocker {
+    Mutex& mMutex;
+public:
+    MutexUnlocker(Mutex& m): mMutex(m) { mMutex.unlock(); }
+    ~MutexUnlocker() { mMutex.lock(); }
+};
+#define LOCK() MutexLocker locker(mMutex)
+#endif
@@ -0,0 +1,73 @@
+// Host stand-in for esp32-mylibs NvsHandle, an in-memory key-value store.
+// Host programs use write() to set options before creating the pipeline nodes
+#ifndef HOST_NVSHANDLE_HPP
+#define HOST_NVSHANDLE_HPP
+#include <string.h>
+#include <string>
+#include <map>
+#include <vector>
+#include <type_traits>
+#include "esp_err.h"
+
+class NvsHandle {
+protected:
+    std::map<std::string, std::vector<uint8_t>> mValues;
+public:
+    NvsHandle(const char* nsName = nullptr, int mode = 0) {}
+    template <typename T>
+    esp_err_t read(const char* key, T& val)
+    {
+        static_assert(std::is_arithmetic<T>::value, "Only scalar types are supported");
+        auto it = mValues.find(key);
+        if (it == mValues.end() || it->second.size() != sizeof(T)) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        memcpy(&val, it->second.data(), sizeof(T));
+        return ESP_OK;
+    }
+    template <typename T>
+    T readDefault(const char* key, T defVal)
+    {
+        T val;
+        return (read(key, val) == ESP_OK) ? val : defVal;
+    }
+    template <typename T>
+    esp_err_t write(const char* key, T val)
+    {
+        static_assert(std::is_arithmetic<T>::value, "Only scalar types are supported");
+        auto& data = mValues[key];
+        data.resize(sizeof(T));
+        memcpy(data.data(), &val, sizeof(T));
+        return ESP_OK;
+    }
+    esp_err_t writeString(const char* key, const char* str) { return writeBlob(key, str, strlen(str) + 1); }
+    esp_err_t writeBlob(const char* key, const void* data, size_t len)
+    {
+        auto& value = mValues[key];
+        value.assign((const uint8_t*)data, (const uint8_t*)data + len);
+        return ESP_OK;
+    }
+    /** On input, len is the buffer size, on output - the size of the value */
+    esp_err_t readBlob(const char* key, void* buf, int& len)
+    {
+        auto it = mValues.find(key);
+        if (it == mValues.end()) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        if ((int)it->second.size() > len) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        len = it->second.size();
+        memcpy(buf, it->second.data(), len);
+        return ESP_OK;
+    }
+    esp_err_t readString(const char* key, char* buf, int& len) { return readBlob(key, buf, len); }
+    int getBlobSize(const char* key)
+    {
+        auto it = mValues.find(key);
+        return (it == mValues.end()) ? -1 : (int)it->second.size();
+    }
+    esp_err_t eraseKey(const char* key) { return mValues.erase(key) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND; }
+    esp_err_t commit() { return ESP_OK; }
+};
+#endif
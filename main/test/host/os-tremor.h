@@ -0,0 +1,24 @@
+// Host stand-in for the Tremor platform header (os.h in the Tremor source tree)
+#ifndef HOST_OS_TREMOR_H
+#define HOST_OS_TREMOR_H
+#include <math.h>
+#include <alloca.h>
+#include <ogg/os_types.h>
+
+#ifndef _V_IFDEFJAIL_H_
+#  define _V_IFDEFJAIL_H_
+#  define STIN static __inline__
+#endif
+#ifndef M_PI
+#  define M_PI (3.1415926536f)
+#endif
+#ifdef USE_MEMORY_H
+#  include <memory.h>
+#endif
+#ifndef min
+#  define min(x,y)  ((x)>(y)?(y):(x))
+#endif
+#ifndef max
+#  define max(x,y)  ((x)<(y)?(y):(x))
+#endif
+#endif
@@ -0,0 +1,47 @@
+// Host stand-in for esp32-mylibs Queue, a fixed-size blocking message queue
+#ifndef HOST_QUEUE_HPP
+#define HOST_QUEUE_HPP
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+
+template <class T, int N>
+class Queue {
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<T> mItems;
+    template <class P>
+    bool wait(std::unique_lock<std::mutex>& lock, P pred, int msTimeout)
+    {
+        if (msTimeout < 0) {
+            mCond.wait(lock, pred);
+            return true;
+        }
+        return mCond.wait_for(lock, std::chrono::milliseconds(msTimeout), pred);
+    }
+public:
+    /** Constructs the item from the arguments, waits while the queue is full */
+    template <typename... Args>
+    bool post(Args&&... args)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        wait(lock, [this]() { return mItems.size() < N; }, -1);
+        mItems.emplace_back(std::forward<Args>(args)...);
+        mCond.notify_all();
+        return true;
+    }
+    bool get(T& item, int msTimeout)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (!wait(lock, [this]() { return !mItems.empty(); }, msTimeout)) {
+            return false;
+        }
+        item = mItems.front();
+        mItems.pop_front();
+        mCond.notify_all();
+        return true;
+    }
+    int numMessages() { std::lock_guard<std::mutex> lock(mMutex); return mItems.size(); }
+};
+#endif
@@ -0,0 +1,49 @@
+// Host stand-in for esp32-mylibs RingQueue: fixed-capacity, non-thread-safe circular queue
+#ifndef HOST_RINGQUEUE_HPP
+#define HOST_RINGQUEUE_HPP
+#include <utility>
+
+template <typename T, int N>
+class RingQueue {
+protected:
+    T mItems[N];
+    int mHead = 0;
+    int mCount = 0;
+    int idx(int i) const { i += mHead; return (i >= N) ? i - N : i; }
+public:
+    static constexpr int capacity() { return N; }
+    int size() const { return mCount; }
+    bool empty() const { return mCount == 0; }
+    bool full() const { return mCount >= N; }
+    template <typename... Args>
+    bool emplaceBack(Args&&... args)
+    {
+        if (full()) {
+            return false;
+        }
+        mItems[idx(mCount++)] = T(std::forward<Args>(args)...);
+        return true;
+    }
+    T* front() { return empty() ? nullptr : &mItems[mHead]; }
+    bool popFront()
+    {
+        if (empty()) {
+            return false;
+        }
+        mHead = idx(1);
+        mCount--;
+        return true;
+    }
+    void clear() { mHead = mCount = 0; }
+    // cb returns false to stop iteration
+    template <class CB>
+    void iterate(CB&& cb)
+    {
+        for (int i = 0; i < mCount; i++) {
+            if (!cb(mItems[idx(i)])) {
+                return;
+            }
+        }
+    }
+};
+#endif
@@ -0,0 +1,38 @@
+// Host stand-in for esp32-mylibs Task, based on std::thread. Stack size, priority and core are ignored
+#ifndef HOST_TASK_HPP
+#define HOST_TASK_HPP
+#include <thread>
+#include <atomic>
+#include <pthread.h>
+
+class Task {
+protected:
+    std::thread mThread;
+    std::atomic<bool> mRunning = {false};
+public:
+    typedef void(*TaskFunc)(void*);
+    bool createTask(const char* name, bool psramStack, uint32_t stackSize, int core, int prio,
+        void* arg, TaskFunc func)
+    {
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+        mRunning = true;
+        mThread = std::thread([this, arg, func]() {
+            func(arg);
+            mRunning = false;
+        });
+        pthread_setname_np(mThread.native_handle(), name);
+        return true;
+    }
+    /** Non-null while the task is running, as the FreeRTOS task handle on target */
+    void* handle() const { return mRunning ? (void*)this : nullptr; }
+    void waitToEnd()
+    {
+        if (mThread.joinable() && mThread.get_id() != std::this_thread::get_id()) {
+            mThread.join();
+        }
+    }
+    ~Task() { waitToEnd(); }
+};
+#endif
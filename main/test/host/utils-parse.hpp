@@ -0,0 +1,111 @@
+#ifndef HOST_UTILS_PARSE_HPP
+#define HOST_UTILS_PARSE_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <vector>
+
+inline char* binToHex(const uint8_t* data, size_t len, char* str, char delim=' ')
+{
+    static const char digits[] = "0123456789abcdef";
+    char* wptr = str;
+    for (size_t i = 0; i < len; i++) {
+        *wptr++ = digits[data[i] >> 4];
+        *wptr++ = digits[data[i] & 0x0f];
+        if (delim && i + 1 < len) {
+            *wptr++ = delim;
+        }
+    }
+    *wptr = 0;
+    return str;
+}
+struct Substring
+{
+    char* str = nullptr;
+    size_t len = 0;
+    Substring() {}
+    Substring(char* aStr, size_t aLen): str(aStr), len(aLen) {}
+    explicit operator bool() const { return str != nullptr; }
+};
+/** Parses key-value pairs in place, the keys and values are null-terminated in the buffer */
+class KeyValParser
+{
+public:
+    enum: uint8_t { kTrimSpaces = 1, kUrlUnescape = 2, kKeysToLower = 4 };
+    struct KeyVal { Substring key; Substring val; };
+protected:
+    char* mBuf;
+    size_t mSize;
+    bool mOwnBuf;
+    std::vector<KeyVal> mKeyVals;
+    static char* trim(char* str, char*& end)
+    {
+        while (str < end && isspace((unsigned char)*str)) {
+            str++;
+        }
+        while (end > str && isspace((unsigned char)end[-1])) {
+            end--;
+        }
+        *end = 0;
+        return str;
+    }
+public:
+    KeyValParser(char* buf, size_t size, bool ownBuf = false): mBuf(buf), mSize(size), mOwnBuf(ownBuf) {}
+    ~KeyValParser() { if (mOwnBuf) free(mBuf); }
+    bool parse(char pairDelim, char keyValDelim, uint8_t flags = 0)
+    {
+        char* end = mBuf + strnlen(mBuf, mSize);
+        for (char* pos = mBuf; pos < end;) {
+            char* pairEnd = (char*)memchr(pos, pairDelim, end - pos);
+            if (!pairEnd) {
+                pairEnd = end;
+            }
+            *pairEnd = 0;
+            char* keyEnd = (char*)memchr(pos, keyValDelim, pairEnd - pos);
+            char* val = keyEnd ? keyEnd + 1 : pairEnd;
+            char* valEnd = pairEnd;
+            if (!keyEnd) {
+                keyEnd = pairEnd;
+            }
+            char* key = pos;
+            if (flags & kTrimSpaces) {
+                key = trim(key, keyEnd);
+                val = trim(val, valEnd);
+            }
+            *keyEnd = 0;
+            if (flags & kKeysToLower) {
+                for (char* ch = key; *ch; ch++) {
+                    *ch = tolower((unsigned char)*ch);
+                }
+            }
+            if (*key) {
+                mKeyVals.push_back(KeyVal{Substring(key, keyEnd - key), Substring(val, valEnd - val)});
+            }
+            pos = pairEnd + 1;
+        }
+        return true;
+    }
+    Substring strVal(const char* key) const
+    {
+        for (auto& kv: mKeyVals) {
+            if (strcmp(kv.key.str, key) == 0) {
+                return kv.val;
+            }
+        }
+        return Substring();
+    }
+    long intVal(const char* key, long defVal) const
+    {
+        auto val = strVal(key);
+        if (!val) {
+            return defVal;
+        }
+        char* end;
+        auto ret = strtol(val.str, &end, 10);
+        return (end == val.str) ? defVal : ret;
+    }
+};
+#endif
@@ -0,0 +1,46 @@
+// Host stand-in for the subset of esp32-mylibs utils.hpp used by the pipeline code
+#ifndef HOST_UTILS_HPP
+#define HOST_UTILS_HPP
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <assert.h>
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+struct FreeDeleter { void operator()(const void* ptr) const { free((void*)ptr); } };
+template <typename T>
+using unique_ptr_mfree = std::unique_ptr<T, FreeDeleter>;
+
+namespace utils {
+inline bool haveSpiRam() { return true; }
+}
+class ElapsedTimer {
+    int64_t mTsStart;
+public:
+    ElapsedTimer(): mTsStart(esp_timer_get_time()) {}
+    void reset() { mTsStart = esp_timer_get_time(); }
+    int64_t usElapsed() const { return esp_timer_get_time() - mTsStart; }
+    int msElapsed() const { return (usElapsed() + 500) / 1000; }
+};
+template <typename T>
+std::enable_if_t<std::is_arithmetic<T>::value, void> appendAny(std::string& str, T val) { str += std::to_string(+val); }
+inline void appendAny(std::string& str, const char* val) { str += val; }
+
+#define MY_ESP_ERRCHECK(expr, tag, msg, action) \
+    do { \
+        esp_err_t err = (expr); \
+        if (err != ESP_OK) { \
+            ESP_LOGE(tag, "Error %s: %s", msg, esp_err_to_name(err)); \
+            action; \
+        } \
+    } while(0)
+
+#define myassert(cond) if (!(cond)) { fprintf(stderr, "Assertion failed: %s at %s:%d\n", #cond, __FILE__, __LINE__); abort(); }
+#endif
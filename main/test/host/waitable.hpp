@@ -0,0 +1,39 @@
+// Host stand-in for esp32-mylibs Waitable
+#ifndef HOST_WAITABLE_HPP
+#define HOST_WAITABLE_HPP
+#include "eventGroup.hpp"
+
+class Waitable {
+protected:
+    EventGroup mEvents;
+public:
+    enum: EventBits_t {
+        kFlagStop = 1, kFlagHasItems = 2, kFlagIsEmpty = 4, kFlagHasSpace = 8,
+        kFlagReadOp = 16, kFlagWriteOp = 32, kFlagLast = kFlagWriteOp
+    };
+    Waitable(): mEvents(kFlagIsEmpty | kFlagHasSpace) {}
+    void setStopSignal() { mEvents.setBits(kFlagStop); }
+    void clearStopSignal() { mEvents.clearBits(kFlagStop); }
+    /** @returns -1 on stop signal, 0 on timeout, 1 if any of the flags is set */
+    int8_t waitFor(EventBits_t flags, int msTimeout)
+    {
+        auto ret = mEvents.waitForOneNoReset(flags | kFlagStop, msTimeout);
+        return (ret & kFlagStop) ? -1 : ((ret & flags) ? 1 : 0);
+    }
+    int8_t waitForItems(int msTimeout) { return waitFor(kFlagHasItems, msTimeout); }
+    int8_t waitForEmpty(int msTimeout) { return waitFor(kFlagIsEmpty, msTimeout); }
+    int8_t waitForSpace(int msTimeout) { return waitFor(kFlagHasSpace, msTimeout); }
+    // Read/write op flags are consumed by the waiter
+    int8_t waitForReadOp(int msTimeout) { return waitAndConsume(kFlagReadOp, msTimeout); }
+    int8_t waitForWriteOp(int msTimeout) { return waitAndConsume(kFlagWriteOp, msTimeout); }
+protected:
+    int8_t waitAndConsume(EventBits_t flag, int msTimeout)
+    {
+        auto ret = waitFor(flag, msTimeout);
+        if (ret > 0) {
+            mEvents.clearBits(flag);
+        }
+        return ret;
+    }
+};
+#endif
@@ -0,0 +1,158 @@
+// Host build of the audio pipeline: FileInputNode -> DecoderNode -> EqualizerNode -> HostSinkNode
+// Decodes a file through the same node, decoder and EQ code as the firmware, and writes the
+// output to a WAV file, or discards it. Used for debugging and profiling the pipeline off-target.
+// Build (from this directory):
+// C=../../../../components; for l in mad aac ogg tremor flac opus; do mkdir -p obj/$l; done
+// (cd obj/mad && gcc -O2 -w -c -DFPM_DEFAULT -DSIZEOF_INT=4 -I$C/libmad $C/libmad/*.c)
+// (cd obj/aac && gcc -O2 -w -c -DUSE_DEFAULT_STDLIB -DHELIX_FEATURE_AUDIO_CODEC_AAC_SBR=1 $C/libhelix-aac/*.c)
+// (cd obj/ogg && gcc -O2 -w -c -DNDEBUG=1 -I$C/libogg/include $C/libogg/*.c)
+// (cd obj/tremor && gcc -O2 -w -c -fsigned-char -D_REENTRANT -DUSE_MEMORY_H -I../../host -I$C/tremor -I$C/libogg/include $(ls $C/tremor/*.c | grep -v example))
+// (cd obj/flac && gcc -O2 -w -c -DHAVE_CONFIG_H=1 -I$C/libFLAC -I$C/libFLAC/include -I$C/libogg/include $(ls $C/libFLAC/*.c | grep -v encoder))
+// (cd obj/opus && O=$C/libopus/opus && gcc -O2 -w -c -DOPUS_BUILD -DFIXED_POINT=1 -DDISABLE_FLOAT_API -DVAR_ARRAYS=1 -DHAVE_LRINT=1 -DHAVE_LRINTF=1 \
+//   -I$O/include -I$O -I$O/celt -I$O/silk -I$O/silk/fixed $(ls $O/celt/*.c $O/silk/*.c $O/silk/fixed/*.c | grep -v _demo) $O/src/opus.c $O/src/opus_decoder.c $(ls $O/src/extensions.c 2>/dev/null))
+// C=../../components
+// g++ -std=gnu++17 -O2 -o hostPlayer hostPlayer.cpp fileInputNode.cpp hostSinkNode.cpp \
+//   ../streamDefs.cpp ../packetPool.cpp ../nodeProfiler.cpp ../audioNode.cpp ../byteRing.cpp ../decoderNode.cpp \
+//   ../decoderMp3.cpp ../decoderAac.cpp ../decoderFlac.cpp ../decoderWav.cpp ../decoderVorbis.cpp ../decoderOpus.cpp \
+//   ../decoderFlacMt.cpp ../decoderMp4.cpp ../alacDecoder.cpp \
+//   ../eqCores.cpp ../equalizerNode.cpp $C/myeq/equalizer.cpp obj/*/*.o -DHELIX_FEATURE_AUDIO_CODEC_AAC_SBR=1 \
+//   -I ./host -I .. -I $C/myeq -I $C/libmad -I $C/libhelix-aac -I $C/libFLAC/include -I $C/tremor -I $C/libogg/include -I $C/libopus/opus/include -lpthread
+// Usage: hostPlayer [-o out.wav] [-t content-type] [-g gain,gain,...] [-b] [-i] [-r] [-p] <file|->
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <buffer.hpp>
+#include <nvsHandle.hpp>
+#include <eventGroup.hpp>
+#include "fileInputNode.hpp"
+#include "hostSinkNode.hpp"
+#include "decoderNode.hpp"
+#include "equalizerNode.hpp"
+
+static const char* TAG = "hostplayer";
+
+class HostPipeline: public IAudioPipeline
+{
+public:
+    enum: EventBits_t { kFlagStreamEnd = 1, kFlagError = 2 };
+    EventGroup mEvents;
+    virtual bool onNodeEvent(AudioNode& node, uint32_t type, size_t numArg, uintptr_t arg) override
+    {
+        if (type == AudioNode::kEventStreamEnd) {
+            mEvents.setBits(kFlagStreamEnd);
+        }
+        else if (type == AudioNode::kEventPlaying) {
+            ESP_LOGI(TAG, "Playing");
+        }
+        return true;
+    }
+    virtual void onNodeError(AudioNode& node, int error, uintptr_t arg) override
+    {
+        ESP_LOGE(TAG, "Error %d from node %s", error, node.tag());
+        mEvents.setBits(kFlagError);
+    }
+    virtual void onNeedLargeMemory(int32_t amountHint) override {}
+};
+static void usage()
+{
+    fprintf(stderr, "Usage: hostPlayer [-o out.wav] [-t content-type] [-g gain,gain,...] [-b] [-i] [-r] [-p] <file|->\n"
+        "  -o  write output to a WAV file, otherwise output is discarded\n"
+        "  -t  content type of the input, by default derived from the file extension\n"
+        "  -g  comma-separated EQ band gains in dB\n"
+        "  -b  bypass the EQ filters, only convert the sample format and apply volume\n"
+        "  -i  disable in-place EQ processing in the packet buffer\n"
+        "  -r  pace output to the sample rate\n"
+        "  -p  print per-node profiling stats as JSON to stdout\n");
+}
+static void noopLevelCb(void*) {}
+
+int main(int argc, char* argv[])
+{
+    const char* outPath = nullptr;
+    const char* contentType = nullptr;
+    const char* gains = nullptr;
+    bool realtime = false;
+    bool printPerf = false;
+    bool bypass = false;
+    bool inPlace = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:t:g:birp")) != -1) {
+        switch (opt) {
+            case 'o': outPath = optarg; break;
+            case 't': contentType = optarg; break;
+            case 'g': gains = optarg; break;
+            case 'b': bypass = true; break;
+            case 'i': inPlace = false; break;
+            case 'r': realtime = true; break;
+            case 'p': printPerf = true; break;
+            default: usage(); return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+    NvsHandle nvs;
+    nvs.write("eq.useEsp", (uint8_t)0);
+    nvs.write("eq.inPlace", (uint8_t)inPlace);
+    HostPipeline pipeline;
+    FileInputNode input(pipeline);
+    DecoderNode decoder(pipeline);
+    decoder.linkToPrev(&input);
+    EqualizerNode eq(pipeline, nvs);
+    eq.linkToPrev(&decoder);
+    eq.setVolume(100);
+    eq.disable(bypass);
+    eq.volEnableLevel(noopLevelCb, nullptr, 0xff);
+    if (gains) {
+        int band = 0;
+        for (const char* p = gains; *p; band++) {
+            eq.setBandGain(band, atoi(p));
+            p = strchr(p, ',');
+            if (!p) {
+                break;
+            }
+            p++;
+        }
+        eq.saveGains(); // the EQ core is re-created on stream start, and loads the gains from NVS
+    }
+    HostSinkNode sink(pipeline, outPath, realtime);
+    sink.linkToPrev(&eq);
+
+    input.setFile(argv[optind], contentType);
+    auto tsStart = esp_timer_get_time();
+    input.run();
+    decoder.run();
+    sink.run();
+    auto bits = pipeline.mEvents.waitForOneNoReset(HostPipeline::kFlagStreamEnd | HostPipeline::kFlagError, -1);
+    auto elapsedUs = esp_timer_get_time() - tsStart;
+    // stop from the source, so that each node's consumer is unblocked by the stop signal
+    input.terminate(true);
+    decoder.terminate(true);
+    sink.terminate(true);
+
+    auto fmt = sink.format();
+    auto samples = sink.sampleCount();
+    double audioSec = fmt.sampleRate() ? (double)samples / fmt.sampleRate() : 0;
+    ESP_LOGI(TAG, "%s: %llu samples (%.2f s of audio) in %.2f s, %.1fx realtime",
+        (bits & HostPipeline::kFlagError) ? "Stopped on error" : "Done",
+        (unsigned long long)samples, audioSec, elapsedUs / 1000000.0, elapsedUs ? audioSec * 1000000 / elapsedUs : 0);
+    if (sink.ptsErrors()) {
+        ESP_LOGE(TAG, "%lu timestamp discontinuities in the output", (unsigned long)sink.ptsErrors());
+    }
+    if (printPerf) {
+        DynBuffer buf(1024);
+        buf.printf("[");
+        AudioNode* nodes[] = { &input, &decoder, &eq };
+        for (int i = 0; i < (int)(sizeof(nodes) / sizeof(nodes[0])); i++) {
+            if (i) {
+                buf.printf(",");
+            }
+            nodes[i]->perfToJson(buf);
+        }
+        buf.printf("]\n");
+        fputs(buf.buf(), stdout);
+    }
+    return (bits & HostPipeline::kFlagError) ? 1 : 0;
+}
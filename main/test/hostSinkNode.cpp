@@ -0,0 +1,163 @@
+#include "hostSinkNode.hpp"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <magic_enum.hpp>
+
+static const char* TAG = "node-sink";
+
+HostSinkNode::HostSinkNode(IAudioPipeline& parent, const char* path, bool realtime)
+: AudioNodeWithTask(parent, TAG, false, kStackSize), mFormat(44100, 16, 2), mRealtime(realtime)
+{
+    if (path) {
+        mPath = path;
+    }
+}
+bool HostSinkNode::openFile()
+{
+    closeFile();
+    if (mPath.empty()) {
+        return true;
+    }
+    mFile = fopen(mPath.c_str(), "wb");
+    if (!mFile) {
+        ESP_LOGE(TAG, "Error creating '%s': %s", mPath.c_str(), strerror(errno));
+        return false;
+    }
+    mDataBytes = 0;
+    writeWavHeader();
+    return true;
+}
+void HostSinkNode::closeFile()
+{
+    if (!mFile) {
+        return;
+    }
+    writeWavHeader();
+    fclose(mFile);
+    mFile = nullptr;
+}
+static void put16(uint8_t*& p, uint16_t val) { *p++ = val; *p++ = val >> 8; }
+static void put32(uint8_t*& p, uint32_t val) { put16(p, val); put16(p, val >> 16); }
+
+void HostSinkNode::writeWavHeader()
+{
+    uint8_t hdr[kWavHeaderSize];
+    uint8_t* p = hdr;
+    uint8_t containerBits = (mBytesPerSample / mFormat.numChannels()) * 8;
+    memcpy(p, "RIFF", 4); p += 4;
+    put32(p, mDataBytes + kWavHeaderSize - 8);
+    memcpy(p, "WAVEfmt ", 8); p += 8;
+    put32(p, 16);
+    put16(p, 1); // PCM
+    put16(p, mFormat.numChannels());
+    put32(p, mFormat.sampleRate());
+    put32(p, mFormat.sampleRate() * mBytesPerSample);
+    put16(p, mBytesPerSample);
+    put16(p, containerBits);
+    memcpy(p, "data", 4); p += 4;
+    put32(p, mDataBytes);
+    auto pos = ftell(mFile);
+    fseek(mFile, 0, SEEK_SET);
+    fwrite(hdr, 1, sizeof(hdr), mFile);
+    if (pos > kWavHeaderSize) {
+        fseek(mFile, pos, SEEK_SET);
+    }
+}
+bool HostSinkNode::setFormat(StreamFormat fmt)
+{
+    auto bps = fmt.bitsPerSample();
+    if (bps != 16 && bps != 24 && bps != 32) {
+        ESP_LOGE(TAG, "Unsupported output sample format: %d bits", bps);
+        return false;
+    }
+    ESP_LOGW(TAG, "Setting output mode to %u-bit %s, %lu Hz", bps, fmt.isStereo() ? "stereo" : "mono", fmt.sampleRate());
+    mFormat = fmt;
+    mBytesPerSample = fmt.numChannels() * (bps == 16 ? 2 : 4);
+    return openFile();
+}
+void HostSinkNode::nodeThreadFunc()
+{
+    for (;;) {
+        setState(kStateStopped);
+        processMessages();
+        if (mTerminate) {
+            return;
+        }
+        myassert(mState == kStateRunning);
+        while (!mTerminate && (mCmdQueue.numMessages() == 0)) {
+            PacketResult dpr;
+            PacketBatch batch;
+            auto evt = mPrev->pullBatchProfiled(dpr, batch, kPullBatchSize);
+            if (evt) {
+                if (evt < 0) {
+                    ESP_LOGI(mTag, "Got stream error %s", magic_enum::enum_name(evt).data());
+                    plSendError(evt, dpr.streamId);
+                    break;
+                }
+                else if (evt == kEvtStreamChanged) {
+                    auto& pkt = dpr.newStreamEvent();
+                    ESP_LOGI(mTag, "Got start of new stream with streamId %lu", (unsigned long)pkt.streamId);
+                    if (!mBytesPerSample || pkt.fmt != mFormat) {
+                        if (!setFormat(pkt.fmt)) {
+                            plSendError(kErrStreamFmt, 0);
+                            break;
+                        }
+                    }
+                    mSampleCtr = 0;
+                    mNextPts = (uint64_t)pkt.seekTime * pkt.fmt.sampleRate() / 1000;
+                    mStreamId = pkt.streamId;
+                    mTsStart = esp_timer_get_time();
+                    plSendEvent(kEventNewStream, 0, (uintptr_t)dpr.packet.get());
+                }
+                else if (evt == kEvtStreamEnd) {
+                    if (mFile) {
+                        writeWavHeader();
+                        fflush(mFile);
+                    }
+                    plSendEvent(kEventStreamEnd, dpr.genericEvent().streamId);
+                }
+                continue;
+            }
+            if (!mStreamId) {
+                continue;
+            }
+            if (!writeBatch(batch)) {
+                plSendError(kErrStreamStopped, mStreamId);
+                break;
+            }
+        }
+    }
+}
+bool HostSinkNode::writeBatch(PacketBatch& batch)
+{
+    for (int i = 0; i < batch.count; i++) {
+        auto& pkt = batch[i];
+        myassert(pkt.dataLen);
+        if (pkt.pts != mNextPts) {
+            ESP_LOGW(TAG, "Timestamp discontinuity: expected %lu, got %lu",
+                (unsigned long)mNextPts, (unsigned long)pkt.pts);
+            mPtsErrors++;
+        }
+        mNextPts = pkt.pts + pkt.dataLen / mBytesPerSample;
+        if (mFile) {
+            if (fwrite(pkt.data, 1, pkt.dataLen, mFile) != pkt.dataLen) {
+                ESP_LOGE(TAG, "Error writing output file: %s", strerror(errno));
+                return false;
+            }
+            mDataBytes += pkt.dataLen;
+        }
+    }
+    if (!mSampleCtr) {
+        plSendEvent(kEventPlaying);
+    }
+    mSampleCtr += batch.dataSize() / mBytesPerSample;
+    if (mRealtime) {
+        int64_t dueUs = mSampleCtr * 1000000 / mFormat.sampleRate();
+        int64_t aheadUs = dueUs - (esp_timer_get_time() - mTsStart);
+        if (aheadUs > 0) {
+            usleep(aheadUs);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef HOST_SINK_NODE_HPP
+#define HOST_SINK_NODE_HPP
+#include "audioNode.hpp"
+#include <stdio.h>
+#include <string>
+
+/** Host stand-in for I2sOutputNode. Pulls from the previous node in its own thread, like the I2S
+ * node does, and writes the PCM data to a WAV file, or discards it if no file is set (null sink).
+ * Samples wider than 16 bits are left-aligned in 32-bit words by the pipeline, and are written as
+ * 32-bit PCM. The WAV header is patched with the data length when the stream ends.
+ * In realtime mode, output is paced to the sample rate, to mimic the backpressure of the I2S DMA
+ */
+class HostSinkNode: public AudioNodeWithTask
+{
+protected:
+    enum { kStackSize = 8192, kWavHeaderSize = 44, kPullBatchSize = 4 };
+    std::string mPath;
+    FILE* mFile = nullptr;
+    StreamFormat mFormat;
+    StreamId mStreamId = 0;
+    uint64_t mSampleCtr = 0;
+    uint32_t mNextPts = 0; // expected timestamp of the next packet
+    uint32_t mPtsErrors = 0;
+    uint32_t mDataBytes = 0;
+    uint8_t mBytesPerSample = 0; // all channels
+    bool mRealtime = false;
+    int64_t mTsStart = 0;
+    virtual void nodeThreadFunc() override;
+    bool setFormat(StreamFormat fmt);
+    bool openFile();
+    void closeFile();
+    void writeWavHeader();
+    bool writeBatch(PacketBatch& batch);
+public:
+    HostSinkNode(IAudioPipeline& parent, const char* path = nullptr, bool realtime = false);
+    virtual ~HostSinkNode() { terminate(true); closeFile(); }
+    virtual Type type() const override { return kTypeI2sOut; }
+    virtual StreamEvent pullData(PacketResult& pr) override { return kErrStreamStopped; }
+    uint64_t sampleCount() const { return mSampleCtr; }
+    uint32_t ptsErrors() const { return mPtsErrors; }
+    StreamFormat format() const { return mFormat; }
+};
+
+#endif
@@ -0,0 +1,92 @@
+// Host microbenchmark: mutex-based StreamRingQueue vs lock-free SpscStreamQueue
+// g++ -std=c++17 -O2 -o queueBench ./queueBench.cpp ../packetPool.cpp -I ./host -I .. -lpthread
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+#include "streamRingQueue.hpp"
+#include "spscStreamQueue.hpp"
+
+enum { kQueueLen = 24, kDefaultNumPackets = 1000000, kPacketSize = 64 };
+
+static int64_t usNow()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// Every 64th packet is an event packet, to exercise the non-data path as the real pipeline does
+static StreamPacket* makePacket(int seq)
+{
+    if ((seq & 63) == 63) {
+        return new GenericEvent(kEvtStreamEnd, 0, 0);
+    }
+    auto pkt = DataPacket::create<true>(kPacketSize, 0);
+    pkt->dataLen = kPacketSize;
+    memcpy(pkt->data, &seq, sizeof(seq));
+    return pkt;
+}
+template <class Q>
+bool runBench(Q& queue, const char* name, int numPackets, int consumerDelayUs)
+{
+    queue.clearStopSignal();
+    bool ok = true;
+    auto tsStart = usNow();
+    std::thread consumer([&]() {
+        for (int i = 0; i < numPackets; i++) {
+            StreamPacket::unique_ptr pkt(queue.popFront());
+            if (!pkt) {
+                printf("%s: unexpected null packet at %d\n", name, i);
+                ok = false;
+                return;
+            }
+            if (pkt->type == kEvtData) {
+                int seq;
+                memcpy(&seq, pkt.as<DataPacket>().data, sizeof(seq));
+                if (seq != i) {
+                    printf("%s: out of order packet: expected %d, got %d\n", name, i, seq);
+                    ok = false;
+                    return;
+                }
+            }
+            if (consumerDelayUs) {
+                std::this_thread::sleep_for(std::chrono::microseconds(consumerDelayUs));
+            }
+        }
+    });
+    for (int i = 0; i < numPackets; i++) {
+        if (!queue.pushBack(makePacket(i))) {
+            printf("%s: pushBack failed\n", name);
+            ok = false;
+            break;
+        }
+    }
+    consumer.join();
+    auto elapsed = usNow() - tsStart;
+    printf("%-16s consumer delay %4d us: %8d packets in %8.3f ms, %7.1f ns/packet, remaining data: %d\n",
+        name, consumerDelayUs, numPackets, elapsed / 1000.0, elapsed * 1000.0 / numPackets, queue.dataSize());
+    return ok && queue.dataSize() == 0;
+}
+int main(int argc, char** argv)
+{
+    int numPackets = (argc > 1) ? atoi(argv[1]) : kDefaultNumPackets;
+    bool ok = true;
+    for (int delay: {0, 20}) {
+        // the delayed runs simulate an I2S consumer and are kept short
+        int n = delay ? numPackets / 100 : numPackets;
+        {
+            StreamRingQueue<kQueueLen> queue;
+            ok &= runBench(queue, "StreamRingQueue", n, delay);
+        }
+        {
+            SpscStreamQueue<kQueueLen> queue;
+            ok &= runBench(queue, "SpscStreamQueue", n, delay);
+        }
+        {
+            SpscStreamQueue<kQueueLen> queue;
+            queue.setWakeLevels(1, kQueueLen / 4);
+            ok &= runBench(queue, "SpscStreamQueue/4", n, delay);
+        }
+    }
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
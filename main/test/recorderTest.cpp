@@ -0,0 +1,213 @@
+// Host test of the write-behind TrackRecorder with a deliberately slow file sink. A producer thread feeds
+// stream data in network-sized chunks at a fixed rate, as HttpNode::recv() does, and starts a new track
+// every third of the run. The sink adds a delay to each write according to a given throughput, and
+// periodically stalls, as an SD card does when it erases blocks.
+// Checks that onData() never waits for the sink, that the recorded tracks contain exactly the fed data
+// if nothing was dropped, that the fed bytes are accounted for by the tracks and the drop counter
+// otherwise, and that the writes are aligned to the write chunk size.
+// Reports, as one JSON object per line: the sink model, max onData() time, max sink write time (which is
+// how long the receive loop was blocked with the synchronous recorder), dropped bytes and write counts.
+// g++ -std=gnu++17 -O2 -pthread -o recorderTest recorderTest.cpp ../recorder.cpp ../streamDefs.cpp -I ./host -I ..
+// Usage: recorderTest [run seconds, default 3]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "recorder.hpp"
+
+enum { kFeedRate = 400 * 1024, kChunkSize = 2920, kNumTracks = 3 };
+
+struct SinkModel
+{
+    const char* name;
+    int bytesPerSec; // 0 for no delay
+    int stallMs; // every kStallEvery writes
+    bool expectDrops;
+};
+enum { kStallEvery = 8 };
+
+static void usSleep(int64_t us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+static uint8_t patternByte(uint32_t pos)
+{
+    return (pos * 7 + (pos >> 11)) & 0xff;
+}
+class SlowRecorder: public TrackRecorder
+{
+public:
+    const SinkModel& mModel;
+    int mNumWrites = 0;
+    int mNumUnaligned = 0;
+    int64_t mMaxWriteUs = 0;
+    SlowRecorder(const char* root, const SinkModel& model): TrackRecorder(root), mModel(model) {}
+    ~SlowRecorder() { stopWriter(); }
+protected:
+    virtual int fileWrite(const void* data, int len) override
+    {
+        auto tsStart = esp_timer_get_time();
+        // only the last write of a track may end off a chunk boundary
+        if (ftell(mSinkFile) % mWriteChunkSize) {
+            mNumUnaligned++;
+        }
+        if (mModel.bytesPerSec) {
+            usSleep((int64_t)len * 1000000 / mModel.bytesPerSec);
+        }
+        mNumWrites++;
+        if (mModel.stallMs && (mNumWrites % kStallEvery) == 0) {
+            usSleep(mModel.stallMs * 1000);
+        }
+        int ret = TrackRecorder::fileWrite(data, len);
+        mMaxWriteUs = std::max(mMaxWriteUs, esp_timer_get_time() - tsStart);
+        return ret;
+    }
+};
+static std::string trackName(int idx)
+{
+    return "Track " + std::to_string(idx);
+}
+static bool fileSize(const std::string& path, int64_t& size)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info)) {
+        return false;
+    }
+    size = info.st_size;
+    return true;
+}
+static bool checkContents(const std::string& path, uint32_t streamPos, int64_t size)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    std::vector<uint8_t> buf(size);
+    bool ok = fread(buf.data(), 1, size, f) == (size_t)size;
+    fclose(f);
+    for (int64_t i = 0; ok && i < size; i++) {
+        ok = buf[i] == patternByte(streamPos + i);
+    }
+    return ok;
+}
+static bool runModel(const SinkModel& model, int runSec)
+{
+    char root[] = "/tmp/recorderTestXXXXXX";
+    if (!mkdtemp(root)) {
+        perror("mkdtemp");
+        exit(2);
+    }
+    std::string staDir = std::string(root) + "/sta";
+    bool ok = true;
+    int64_t maxOnDataUs = 0;
+    int64_t trackStart[kNumTracks + 1];
+    uint32_t dropped;
+    int numWrites, numUnaligned;
+    int64_t maxWriteUs;
+    {
+        SlowRecorder rec(root, model);
+        rec.setStation("sta");
+        int64_t totalBytes = (int64_t)kFeedRate * runSec;
+        int64_t trackLen = totalBytes / kNumTracks;
+        std::vector<uint8_t> chunk(kChunkSize);
+        auto tsStart = esp_timer_get_time();
+        int track = 0;
+        for (int64_t pos = 0; pos < totalBytes; pos += kChunkSize) {
+            if (track < kNumTracks && pos >= track * trackLen) {
+                trackStart[track] = pos;
+                rec.onNewTrack(trackName(track).c_str(), Codec::kCodecMp3);
+                track++;
+            }
+            for (int i = 0; i < kChunkSize; i++) {
+                chunk[i] = patternByte(pos + i);
+            }
+            auto ts = esp_timer_get_time();
+            rec.onData(chunk.data(), kChunkSize);
+            maxOnDataUs = std::max(maxOnDataUs, esp_timer_get_time() - ts);
+            // pace to the feed rate
+            int64_t due = tsStart + (pos + kChunkSize) * 1000000 / kFeedRate;
+            auto now = esp_timer_get_time();
+            if (due > now) {
+                usSleep(due - now);
+            }
+        }
+        trackStart[kNumTracks] = ((totalBytes + kChunkSize - 1) / kChunkSize) * kChunkSize;
+        // the last track is saved when the next one starts
+        rec.onNewTrack("end", Codec::kCodecMp3);
+        int64_t size;
+        for (int i = 0; i < 6000 && (rec.backlog() || !fileSize(staDir + "/" + trackName(kNumTracks - 1) + ".mp3", size)); i++) {
+            usSleep(10000);
+        }
+        dropped = rec.droppedBytes();
+        numWrites = rec.mNumWrites;
+        numUnaligned = rec.mNumUnaligned;
+        maxWriteUs = rec.mMaxWriteUs;
+    }
+    int64_t recorded = 0;
+    for (int i = 0; i < kNumTracks; i++) {
+        auto path = staDir + "/" + trackName(i) + ".mp3";
+        int64_t size;
+        if (!fileSize(path, size)) {
+            printf("FAIL: %s: track %d was not saved\n", model.name, i);
+            ok = false;
+            continue;
+        }
+        recorded += size;
+        if (!dropped) {
+            if (size != trackStart[i + 1] - trackStart[i] || !checkContents(path, trackStart[i], size)) {
+                printf("FAIL: %s: track %d has wrong size or contents\n", model.name, i);
+                ok = false;
+            }
+        }
+        remove(path.c_str());
+    }
+    remove((std::string(root) + "/stream.dat").c_str());
+    rmdir(staDir.c_str());
+    rmdir(root);
+    printf("{\"sink\":\"%s\",\"sinkKBps\":%d,\"stallMs\":%d,\"maxOnDataUs\":%d,\"maxSinkWriteMs\":%d,"
+        "\"fedBytes\":%lld,\"recordedBytes\":%lld,\"droppedBytes\":%u,\"writes\":%d,\"unalignedWrites\":%d}\n",
+        model.name, model.bytesPerSec / 1024, model.stallMs, (int)maxOnDataUs, (int)(maxWriteUs / 1000),
+        (long long)trackStart[kNumTracks], (long long)recorded, (unsigned)dropped, numWrites, numUnaligned);
+    fflush(stdout);
+    if (recorded + dropped != trackStart[kNumTracks]) {
+        printf("FAIL: %s: recorded + dropped bytes don't add up to the fed bytes\n", model.name);
+        ok = false;
+    }
+    if ((dropped != 0) != model.expectDrops) {
+        printf("FAIL: %s: %s\n", model.name, dropped ? "unexpected drops" : "expected drops");
+        ok = false;
+    }
+    if (maxOnDataUs > 20000) {
+        printf("FAIL: %s: onData() blocked for %d ms\n", model.name, (int)(maxOnDataUs / 1000));
+        ok = false;
+    }
+    if (numUnaligned) {
+        printf("FAIL: %s: %d unaligned writes\n", model.name, numUnaligned);
+        ok = false;
+    }
+    return ok;
+}
+int main(int argc, char* argv[])
+{
+    int runSec = (argc > 1) ? atoi(argv[1]) : 3;
+    if (runSec <= 0) {
+        fprintf(stderr, "Usage: recorderTest [run seconds]\n");
+        return 1;
+    }
+    static const SinkModel models[] = {
+        { "fast", 0, 0, false },
+        { "stalls", 4 * 1024 * 1024, 150, false }, // fast on average, but blocks for longer than a recv cycle
+        { "tooSlow", kFeedRate / 2, 0, true } // can't keep up
+    };
+    int numFailed = 0;
+    for (auto& model: models) {
+        numFailed += !runModel(model, runSec);
+    }
+    return numFailed ? 1 : 0;
+}
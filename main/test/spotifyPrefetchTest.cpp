@@ -0,0 +1,433 @@
+// Host test of the silence between Spotify tracks, with and without SpotifyPrefetcher.
+// A stand-in CDN runs in-process on the loopback interface. It serves the tracks with byte ranges, adds a
+// delay to each request, as the TLS handshake and the first byte from the CDN, and sends the data of all
+// connections through one link of limited rate, as the WiFi link is shared by the current download and
+// the prefetch. A stand-in for the access point, as cspot's TrackQueue uses it, resolves the key and CDN
+// url of the next track a while after the current one starts.
+// SpotifyNode can't be built on the host, so its download loop is modelled here: the ring queue of the
+// node as a byte budget, a download from the CDN per track with the same requests as the node's, the
+// prefetch requested when the download is kPrefetchLeadMs from its end, and taken when the next track
+// starts. A player consumes the ring queue in realtime at the track bitrate, after the prefill.
+// Reports, as one JSON object per line, for each track boundary: the time from the end of the download
+// of a track to the first data of the next one, and the silence played at the boundary. Then the totals
+// of the run. Also the silence after skipping to the next track, from the skip to the prefill of the new
+// stream. Fails if the prefetch doesn't shorten the download stall or the silence after a skip, or if it
+// plays more silence at the boundaries.
+// g++ -std=gnu++17 -O2 -pthread -o spotifyPrefetchTest spotifyPrefetchTest.cpp ../spotifyPrefetcher.cpp -I ./host -I ..
+// Usage: spotifyPrefetchTest [request delay ms, default 1500]
+// Takes about 1.5 minutes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <loopbackServer.hpp>
+#include "spotifyPrefetcher.hpp"
+
+enum {
+    kTimeScale = 6, // the test runs this many times faster than realtime, all times are reported unscaled
+    kByteRate = 20000, // 160 kbps, the OGG_VORBIS_160 format
+    kTrackMs = 30000, kNumTracks = 3,
+    kTrackSize = kByteRate / 1000 * kTrackMs,
+    kRecvSize = 4096, kRingPackets = 100, // as SpotifyNode
+    kPrefill = (160 * 1024 * 3) >> 4, // StreamFormat::prefillAmount() for Vorbis
+    kPrefetchLeadMs = 10000, // as SpotifyNode
+    kApDelayMs = 800, // for the key and the CDN url of a track
+    kPlayTickMs = 30
+};
+typedef std::chrono::steady_clock Clock;
+static int64_t msNow()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count() * kTimeScale;
+}
+static void msSleep(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(ms * 1000LL / kTimeScale));
+}
+
+// A link of limited rate, shared by all connections
+class Link
+{
+    std::mutex mMutex;
+    Clock::time_point mTsFree = Clock::now();
+public:
+    int rate = 0; // bytes/sec
+    void send(int fd, const uint8_t* data, size_t len)
+    {
+        Clock::time_point ts;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTsFree = std::max(mTsFree, Clock::now()) + std::chrono::microseconds(len * 1000000 / rate / kTimeScale);
+            ts = mTsFree;
+        }
+        std::this_thread::sleep_until(ts);
+        ::send(fd, data, len, MSG_NOSIGNAL);
+    }
+};
+// Serves /track<n> with byte ranges, one thread per connection
+class CdnServer
+{
+protected:
+    std::vector<uint8_t> mData; // the same content for all tracks, it's not decoded
+    void serve(int fd)
+    {
+        std::string req;
+        char buf[1024];
+        while (req.find("\r\n\r\n") == std::string::npos) {
+            auto len = recv(fd, buf, sizeof(buf), 0);
+            if (len <= 0) {
+                return;
+            }
+            req.append(buf, len);
+        }
+        msSleep(delayMs);
+        size_t start = 0, end = mData.size() - 1;
+        auto range = req.find("Range: bytes=");
+        if (range != std::string::npos) {
+            start = strtoul(req.c_str() + range + 13, nullptr, 10);
+            auto dash = req.c_str() + req.find('-', range + 13);
+            if (isdigit(dash[1])) {
+                end = std::min(end, (size_t)strtoul(dash + 1, nullptr, 10));
+            }
+        }
+        snprintf(buf, sizeof(buf), "HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\n"
+            "Content-Range: bytes %zu-%zu/%zu\r\nConnection: close\r\n\r\n", end + 1 - start, start, end, mData.size());
+        ::send(fd, buf, strlen(buf), MSG_NOSIGNAL);
+        for (size_t pos = start; pos <= end; pos += kRecvSize) {
+            link.send(fd, mData.data() + pos, std::min((size_t)kRecvSize, end + 1 - pos));
+        }
+    }
+public:
+    Link link;
+    int delayMs = 0;
+    CdnServer(): mData(kTrackSize), mServer([this](int fd) { serve(fd); })
+    {
+        for (auto& byte: mData) {
+            byte = rand();
+        }
+    }
+    uint16_t start() { return mServer.start(); }
+protected:
+    LoopbackServer mServer;
+};
+static CdnServer sCdn;
+static uint16_t sPort;
+static std::string trackUrl(int idx)
+{
+    return "http://127.0.0.1:" + std::to_string(sPort) + "/track" + std::to_string(idx);
+}
+// As TrackQueue: when a track becomes the current one, the info of the next one is loaded from the access point
+class MockTrackQueue
+{
+    int64_t mTsLoaded[kNumTracks] = {};
+public:
+    void setCurrent(int idx)
+    {
+        if (idx == 0) {
+            mTsLoaded[0] = msNow() + kApDelayMs;
+        }
+        if (idx + 1 < kNumTracks) {
+            mTsLoaded[idx + 1] = msNow() + kApDelayMs;
+        }
+    }
+    /** As currentTrack(), waits for the info to be loaded */
+    std::string current(int idx)
+    {
+        msSleep(std::max<int64_t>(0, mTsLoaded[idx] - msNow()));
+        return trackUrl(idx);
+    }
+    /** As peekNextTrack() */
+    std::string peekNext(int idx)
+    {
+        return (idx + 1 < kNumTracks && mTsLoaded[idx + 1] && msNow() >= mTsLoaded[idx + 1]) ? trackUrl(idx + 1) : "";
+    }
+};
+// SpotifyNode's ring queue, counted in bytes per track
+class Ring
+{
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<std::pair<int, int>> mChunks; // track, bytes
+    int mPackets = 0;
+    int mBytes = 0;
+    int mMinTrack = 0; // data of earlier tracks is dropped, after a skip
+public:
+    void push(int track, int len)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.wait(lock, [this]() { return mPackets < kRingPackets; });
+        if (track < mMinTrack) {
+            return;
+        }
+        mChunks.emplace_back(track, len);
+        mPackets++;
+        mBytes += len;
+    }
+    void clear(int minTrack)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mChunks.clear();
+        mPackets = mBytes = 0;
+        mMinTrack = minTrack;
+        mCond.notify_all();
+    }
+    int bytes() { std::lock_guard<std::mutex> lock(mMutex); return mBytes; }
+    int packets() { std::lock_guard<std::mutex> lock(mMutex); return mPackets; }
+    /** Consumes up to \c len bytes, of one track. Returns the bytes consumed, 0 if empty */
+    int pop(int len, int& track)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mChunks.empty()) {
+            return 0;
+        }
+        auto& chunk = mChunks.front();
+        track = chunk.first;
+        len = std::min(len, chunk.second);
+        chunk.second -= len;
+        mBytes -= len;
+        if (!chunk.second) {
+            mChunks.pop_front();
+            mPackets--;
+            mCond.notify_all();
+        }
+        return len;
+    }
+};
+struct TrackStats
+{
+    int64_t tsDownloadEnd = 0;
+    int64_t tsFirstData = 0;
+    int prefetched = 0;
+    int silenceMs = 0; // played before the track's first sample, after the previous track
+    int underrunMs = 0; // played within the track
+};
+struct Run
+{
+    Ring ring;
+    MockTrackQueue queue;
+    TrackStats tracks[kNumTracks];
+    std::unique_ptr<SpotifyPrefetcher> prefetcher;
+    int skipAtMs; // into the first track, 0 if not skipping
+    std::atomic<bool> skipReq = {false};
+    int skipSilenceMs = -1;
+    int skippedTo = 0;
+    // SpotifyNode::startCurrentTrack(), connect() and recv(). Returns false if a skip was requested
+    bool downloadTrack(int idx, bool flushed)
+    {
+        queue.setCurrent(idx);
+        auto url = queue.current(idx);
+        auto& stats = tracks[idx];
+        int32_t pos = 0, fileSize = 0;
+        if (prefetcher) {
+            unique_ptr_mfree<uint8_t> data;
+            // the Spotify header is not part of the prefill
+            int len = prefetcher->take(url.c_str(), data, fileSize,
+                flushed ? kPrefill + 167 : (int)SpotifyPrefetcher::kPrefetchSize);
+            if (len > 0) {
+                stats.tsFirstData = msNow();
+                stats.prefetched = len;
+                for (int ofs = 0; ofs < len; ofs += kRecvSize) {
+                    ring.push(idx, std::min((int)kRecvSize, len - ofs));
+                }
+                pos = len;
+            }
+        }
+        bool prefetchRequested = false;
+        while (!fileSize || pos < fileSize) {
+            esp_http_client_config_t cfg = {};
+            cfg.url = url.c_str();
+            cfg.timeout_ms = 5000;
+            auto client = esp_http_client_init(&cfg);
+            auto range = "bytes=" + std::to_string(pos) + "-";
+            esp_http_client_set_header(client, "Range", range.c_str());
+            int64_t contentLen = -1;
+            if (esp_http_client_open(client, 0) == ESP_OK) {
+                contentLen = esp_http_client_fetch_headers(client);
+            }
+            if (contentLen <= 0) {
+                esp_http_client_cleanup(client);
+                continue;
+            }
+            fileSize = pos + contentLen;
+            char buf[kRecvSize];
+            while (pos < fileSize) {
+                int rlen = esp_http_client_read(client, buf, std::min((int)kRecvSize, fileSize - pos));
+                if (rlen <= 0) {
+                    break;
+                }
+                if (!stats.tsFirstData) {
+                    stats.tsFirstData = msNow();
+                }
+                ring.push(idx, rlen);
+                pos += rlen;
+                if (skipReq) {
+                    esp_http_client_cleanup(client);
+                    return false;
+                }
+                if (prefetcher && !prefetchRequested && ring.packets() * 2 >= kRingPackets &&
+                    fileSize - pos <= (int64_t)fileSize * kPrefetchLeadMs / kTrackMs) {
+                    auto next = queue.peekNext(idx);
+                    if (!next.empty()) {
+                        prefetchRequested = true;
+                        prefetcher->prefetch(next.c_str());
+                    }
+                }
+            }
+            esp_http_client_cleanup(client);
+        }
+        stats.tsDownloadEnd = msNow();
+        return true;
+    }
+    void download()
+    {
+        bool flushed = true;
+        for (int idx = 0; idx < kNumTracks; idx++) {
+            flushed = !downloadTrack(idx, flushed);
+            if (flushed) {
+                skippedTo = idx + 1;
+                ring.clear(skippedTo);
+            }
+            skipReq = false;
+        }
+    }
+    // The player: waits for the prefill, then plays in realtime. Silence is played when the queue is empty.
+    // With skipAtMs, skips to the next track after that much of the first one, and returns when the prefill
+    // of that track is complete
+    void play()
+    {
+        while (ring.bytes() < kPrefill) {
+            msSleep(kPlayTickMs);
+        }
+        int curTrack = 0;
+        int played[kNumTracks] = {};
+        auto tsTick = Clock::now();
+        while (played[kNumTracks - 1] < kTrackSize) {
+            tsTick += std::chrono::microseconds(kPlayTickMs * 1000 / kTimeScale);
+            std::this_thread::sleep_until(tsTick);
+            if (skipAtMs && played[0] >= kByteRate / 1000 * skipAtMs) {
+                // the node flushes the queue, the player waits for the prefill of the new stream
+                auto tsSkip = msNow();
+                skipReq = true;
+                ring.clear(kNumTracks); // until the node starts the next track
+                while (ring.bytes() < kPrefill) {
+                    msSleep(5);
+                }
+                skipSilenceMs = msNow() - tsSkip;
+                return;
+            }
+            int want = kByteRate * kPlayTickMs / 1000;
+            while (want) {
+                int track;
+                int len = ring.pop(want, track);
+                if (!len) {
+                    break;
+                }
+                curTrack = track;
+                played[track] += len;
+                want -= len;
+            }
+            if (!want) {
+                continue;
+            }
+            if (played[curTrack] >= kTrackSize && curTrack + 1 < kNumTracks) {
+                tracks[curTrack + 1].silenceMs += want * 1000 / kByteRate;
+            }
+            else {
+                tracks[curTrack].underrunMs += want * 1000 / kByteRate;
+            }
+        }
+    }
+    Run(bool usePrefetch, int skipMs): skipAtMs(skipMs)
+    {
+        if (usePrefetch) {
+            prefetcher.reset(new SpotifyPrefetcher());
+        }
+    }
+};
+struct Totals
+{
+    int stallMs = 0;
+    int silenceMs = 0; // at the boundaries and within the tracks, or after the skip
+    int prefetched = 0;
+};
+static Totals runOnce(int linkRate, bool usePrefetch, int skipAtMs)
+{
+    sCdn.link.rate = linkRate;
+    Run run(usePrefetch, skipAtMs);
+    std::thread downloader(&Run::download, &run);
+    run.play();
+    if (skipAtMs) {
+        run.ring.clear(kNumTracks); // let the download finish without waiting for the player
+    }
+    downloader.join();
+    Totals totals;
+    if (skipAtMs) {
+        totals.silenceMs = run.skipSilenceMs;
+        totals.prefetched = run.tracks[run.skippedTo].prefetched;
+        printf("{\"linkKBps\":%d,\"prefetch\":%d,\"delayMs\":%d,\"skipAtMs\":%d,\"toTrack\":%d,\"prefetched\":%d,"
+            "\"skipSilenceMs\":%d}\n", linkRate / 1000, usePrefetch, sCdn.delayMs, skipAtMs, run.skippedTo,
+            totals.prefetched, totals.silenceMs);
+        fflush(stdout);
+        return totals;
+    }
+    for (auto& stats: run.tracks) {
+        totals.silenceMs += stats.underrunMs;
+    }
+    for (int idx = 1; idx < kNumTracks; idx++) {
+        auto& stats = run.tracks[idx];
+        int stallMs = std::max<int64_t>(0, stats.tsFirstData - run.tracks[idx - 1].tsDownloadEnd);
+        printf("{\"linkKBps\":%d,\"prefetch\":%d,\"track\":%d,\"prefetched\":%d,\"stallMs\":%d,\"silenceMs\":%d,"
+            "\"underrunMs\":%d}\n", linkRate / 1000, usePrefetch, idx, stats.prefetched, stallMs, stats.silenceMs,
+            stats.underrunMs);
+        fflush(stdout);
+        totals.stallMs += stallMs;
+        totals.silenceMs += stats.silenceMs;
+        totals.prefetched += stats.prefetched;
+    }
+    printf("{\"linkKBps\":%d,\"prefetch\":%d,\"delayMs\":%d,\"totalStallMs\":%d,\"totalSilenceMs\":%d}\n",
+        linkRate / 1000, usePrefetch, sCdn.delayMs, totals.stallMs, totals.silenceMs);
+    fflush(stdout);
+    return totals;
+}
+int main(int argc, char* argv[])
+{
+    sCdn.delayMs = (argc > 1) ? atoi(argv[1]) : 1500;
+    sPort = sCdn.start();
+    if (!sPort) {
+        fprintf(stderr, "Error starting server\n");
+        return 1;
+    }
+    int numFailed = 0;
+    auto check = [&numFailed](bool ok, const char* what, int rate) {
+        if (!ok) {
+            printf("FAIL: %s at %d kB/s\n", what, rate / 1000);
+            numFailed++;
+        }
+    };
+    // a link barely faster than the bitrate, where the queue doesn't fill up, and a normal one.
+    // One tick of silence is tolerated, for the timing jitter of the test
+    static const int linkRates[] = { kByteRate * 21 / 20, kByteRate * 4 };
+    for (auto rate: linkRates) {
+        auto without = runOnce(rate, false, 0);
+        auto with = runOnce(rate, true, 0);
+        check(with.silenceMs <= without.silenceMs + kPlayTickMs, "more silence with prefetch", rate);
+        check(!with.prefetched || with.stallMs < without.stallMs, "prefetch didn't shorten the stall", rate);
+    }
+    // skips while the prefetch is in progress, and after it is complete
+    int rate = kByteRate * 4;
+    for (int skipAtMs: { 6000, 8500 }) {
+        auto without = runOnce(rate, false, skipAtMs);
+        auto with = runOnce(rate, true, skipAtMs);
+        check(with.prefetched && with.silenceMs < without.silenceMs, "prefetch didn't shorten the silence after a skip", rate);
+    }
+    return numFailed ? 1 : 0;
+}
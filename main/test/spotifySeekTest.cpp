@@ -0,0 +1,372 @@
+// Host test of seeking in Spotify tracks with OggSeeker. An Ogg Vorbis file is prefixed with 167 bytes, as
+// Spotify's header, and encrypted with AES-128-CTR, as the CDN serves it. A local HTTP server serves it with
+// byte ranges, adding a delay to each request, as the round trip of a normal link, and limiting the rate.
+// The reader does what SpotifyNode does: ranged GET requests, decrypting with the counter derived from the
+// offset.
+// For a set of targets, with the headers once read by the seek and once captured from the stream start:
+// - the page found must contain the target sample, its start granule must be that of the previous page,
+//   and the data returned and then read on must be the plaintext file at that offset,
+// - the headers plus the data from the page, decoded with tremor, must give the same samples as decoding
+//   the whole file, at most a few Vorbis blocks after the page start.
+// Reports, as one JSON object per line: the target, the page start time, the number of requests, the
+// bytes received, the seek time, and the offset of the first decoded sample from the page start time,
+// which is the timestamp error of the stream started there.
+// Build (from this directory):
+// C=../../../../components; for l in ogg tremor; do mkdir -p obj/$l; done
+// (cd obj/ogg && gcc -O2 -w -c -DNDEBUG=1 -I$C/libogg/include $C/libogg/*.c)
+// (cd obj/tremor && gcc -O2 -w -c -fsigned-char -D_REENTRANT -DUSE_MEMORY_H -I../../host -I$C/tremor -I$C/libogg/include $(ls $C/tremor/*.c | grep -v example))
+// g++ -std=gnu++17 -O2 -pthread -o spotifySeekTest spotifySeekTest.cpp ../oggSeeker.cpp obj/tremor/*.o obj/ogg/*.o -I ./host -I .. -I ../../components/tremor -I ../../components/libogg/include -lcrypto
+// Usage: spotifySeekTest <file.ogg> [request delay ms, default 40] [rate kB/s, default 1000]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <openssl/evp.h>
+#include <algorithm>
+#include <esp_timer.h>
+#include <utils.hpp>
+#include <loopbackServer.hpp>
+#include "oggSeeker.hpp"
+#include "vorbisHighLevel.hpp"
+
+enum { kSpotifyHeaderSize = 167 };
+static const uint8_t kAesIv[16] = {
+    0x72, 0xe0, 0x67, 0xfb, 0xdd, 0xcb, 0xcf, 0x77, 0xeb, 0xe8, 0xbc, 0x64, 0x3f, 0x63, 0x0d, 0x93
+};
+static const uint8_t kAesKey[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+
+// En/decrypts data at a file offset that is a multiple of 16, with the counter IV + offset / 16
+static void aesCtr(uint8_t* data, int len, uint32_t offset)
+{
+    uint8_t iv[16];
+    memcpy(iv, kAesIv, 16);
+    uint32_t carry = offset >> 4;
+    for (int i = 15; i >= 0 && carry; i--) {
+        carry += iv[i];
+        iv[i] = carry & 0xff;
+        carry >>= 8;
+    }
+    auto ctx = EVP_CIPHER_CTX_new();
+    EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), nullptr, kAesKey, iv);
+    int outLen;
+    EVP_EncryptUpdate(ctx, data, &outLen, data, len);
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+// Serves a file with byte ranges, one thread per connection
+class FileServer
+{
+protected:
+    const std::vector<uint8_t>& mData;
+    int mDelayMs;
+    int mRateKBps;
+    LoopbackServer mServer;
+    void serve(int fd)
+    {
+        std::string req;
+        char buf[1024];
+        while (req.find("\r\n\r\n") == std::string::npos) {
+            auto len = recv(fd, buf, sizeof(buf), 0);
+            if (len <= 0) {
+                return;
+            }
+            req.append(buf, len);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(mDelayMs));
+        size_t start = 0, end = mData.size() - 1;
+        auto range = req.find("Range: bytes=");
+        if (range != std::string::npos) {
+            start = strtoul(req.c_str() + range + 13, nullptr, 10);
+            auto dash = req.c_str() + req.find('-', range + 13);
+            if (isdigit(dash[1])) {
+                end = std::min(end, (size_t)strtoul(dash + 1, nullptr, 10));
+            }
+        }
+        snprintf(buf, sizeof(buf), "HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\n"
+            "Content-Range: bytes %zu-%zu/%zu\r\nConnection: close\r\n\r\n", end + 1 - start, start, end, mData.size());
+        send(fd, buf, strlen(buf), MSG_NOSIGNAL);
+        enum { kChunk = 8192 };
+        auto tsStart = std::chrono::steady_clock::now();
+        for (size_t pos = start, sent = 0; pos <= end; pos += kChunk, sent += kChunk) {
+            auto len = std::min((size_t)kChunk, end + 1 - pos);
+            if (send(fd, mData.data() + pos, len, MSG_NOSIGNAL) != (ssize_t)len) {
+                break; // the client closed the connection
+            }
+            std::this_thread::sleep_until(tsStart + std::chrono::microseconds((sent + len) * 1000 / mRateKBps));
+        }
+    }
+public:
+    FileServer(const std::vector<uint8_t>& data, int delayMs, int rateKBps)
+    : mData(data), mDelayMs(delayMs), mRateKBps(rateKBps), mServer([this](int fd) { serve(fd); }) {}
+    uint16_t start() { return mServer.start(); }
+    int numRequests() { return mServer.numAccepted(); } // each request is on a new connection
+};
+// What SpotifyNode does via HttpClient and the AES-CTR of cspot
+class HttpReader: public OggSeeker::IReader
+{
+protected:
+    uint16_t mPort;
+    int mFd = -1;
+    uint32_t mPos = 0;
+    void closeConn()
+    {
+        if (mFd >= 0) {
+            close(mFd);
+            mFd = -1;
+        }
+    }
+public:
+    uint32_t bytesReceived = 0;
+    HttpReader(uint16_t port): mPort(port) {}
+    ~HttpReader() { closeConn(); }
+    virtual int32_t open(uint32_t offset) override
+    {
+        closeConn();
+        mFd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(mPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(mFd, (sockaddr*)&addr, sizeof(addr))) {
+            return -1;
+        }
+        char req[128];
+        snprintf(req, sizeof(req), "GET /track HTTP/1.1\r\nHost: localhost\r\nRange: bytes=%u-\r\n\r\n", offset);
+        send(mFd, req, strlen(req), MSG_NOSIGNAL);
+        // read the headers byte by byte, so that no body data is consumed
+        std::string hdrs;
+        char ch;
+        while (hdrs.size() < 4 || hdrs.compare(hdrs.size() - 4, 4, "\r\n\r\n")) {
+            if (recv(mFd, &ch, 1, 0) != 1) {
+                return -1;
+            }
+            hdrs += ch;
+        }
+        auto cl = hdrs.find("Content-Length: ");
+        if (strncmp(hdrs.c_str(), "HTTP/1.1 206", 12) || cl == std::string::npos) {
+            return -1;
+        }
+        mPos = offset;
+        return atoi(hdrs.c_str() + cl + 16);
+    }
+    virtual int32_t read(uint8_t* buf, int32_t len) override
+    {
+        int32_t total = 0;
+        while (total < len) {
+            auto n = recv(mFd, buf + total, len - total, 0);
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            total += n;
+        }
+        bytesReceived += total;
+        aesCtr(buf, total, mPos);
+        mPos += total;
+        return total;
+    }
+};
+
+struct PageInfo
+{
+    uint32_t offset;
+    int64_t granule;
+};
+// Feeds the decoder in chunks, as DecoderVorbis does: it reads all pages that are in its buffer before
+// decoding their packets, and would stop at the end-of-stream page
+static std::vector<int16_t> decodeAll(const uint8_t* data, size_t len, int& channels, int& rate)
+{
+    enum { kInitSize = 16384, kChunkSize = 4096 };
+    VorbisDecoder dec;
+    size_t pos = std::min(len, (size_t)kInitSize);
+    dec.write((const char*)data, pos);
+    std::vector<int16_t> out;
+    if (dec.init() <= 0) {
+        return out;
+    }
+    channels = dec.streamInfo().channels;
+    rate = dec.streamInfo().rate;
+    int16_t buf[4096];
+    for (;;) {
+        int ret = dec.decode();
+        if (ret < 0) {
+            break;
+        }
+        if (ret == 0) {
+            if (pos >= len) {
+                break;
+            }
+            auto chunk = std::min(len - pos, (size_t)kChunkSize);
+            dec.write((const char*)data + pos, chunk);
+            pos += chunk;
+            continue;
+        }
+        int n;
+        while ((n = dec.getSamples<int16_t, 16>(buf, 4096)) > 0) {
+            out.insert(out.end(), buf, buf + n);
+        }
+    }
+    return out;
+}
+
+static int numFailed = 0;
+static void fail(uint32_t targetMs, const char* what)
+{
+    printf("FAIL: target %u ms: %s\n", targetMs, what);
+    numFailed++;
+}
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: spotifySeekTest <file.ogg> [request delay ms] [rate kB/s]\n");
+        return 1;
+    }
+    int delayMs = (argc > 2) ? atoi(argv[2]) : 40;
+    int rateKBps = (argc > 3) ? atoi(argv[3]) : 1000;
+    FILE* f = fopen(argv[1], "rb");
+    if (!f) {
+        fprintf(stderr, "Can't open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> plain(kSpotifyHeaderSize);
+    for (int i = 0; i < kSpotifyHeaderSize; i++) {
+        plain[i] = i * 7;
+    }
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        plain.insert(plain.end(), buf, buf + n);
+    }
+    fclose(f);
+    auto encrypted = plain;
+    aesCtr(encrypted.data(), encrypted.size(), 0);
+
+    // reference: the pages, and the samples of the whole file
+    std::vector<PageInfo> pages;
+    for (size_t pos = kSpotifyHeaderSize; pos < plain.size();) {
+        int size = OggSeeker::pageSize(plain.data() + pos, plain.size() - pos);
+        if (size <= 0) {
+            fprintf(stderr, "Invalid page at %zu\n", pos);
+            return 1;
+        }
+        pages.push_back(PageInfo{(uint32_t)pos, OggSeeker::pageGranule(plain.data() + pos)});
+        pos += size;
+    }
+    int channels = 0, rate = 0;
+    auto ref = decodeAll(plain.data() + kSpotifyHeaderSize, plain.size() - kSpotifyHeaderSize, channels, rate);
+    if (ref.empty()) {
+        fprintf(stderr, "Can't decode %s\n", argv[1]);
+        return 1;
+    }
+    uint32_t durationMs = (uint64_t)pages.back().granule * 1000 / rate;
+
+    FileServer server(encrypted, delayMs, rateKBps);
+    auto port = server.start();
+    if (!port) {
+        fprintf(stderr, "Can't start the file server\n");
+        return 1;
+    }
+    std::vector<uint32_t> targets = { 0, 150, 1234, durationMs / 4, durationMs / 2, durationMs * 3 / 4, durationMs - 1500 };
+    uint32_t seed = 1;
+    for (int i = 0; i < 8; i++) {
+        seed = seed * 1103515245 + 12345;
+        targets.push_back((seed >> 8) % durationMs);
+    }
+    int maxSeekMs = 0;
+    for (int warm = 0; warm < 2; warm++) {
+        for (auto targetMs: targets) {
+            // the duration from the track metadata is in whole seconds
+            OggSeeker seeker(kSpotifyHeaderSize, durationMs / 1000 * 1000);
+            HttpReader reader(port);
+            if (warm) { // as when the track was played from the start
+                for (uint32_t pos = 0; !seeker.captureHeaders(pos, plain.data() + pos, 4096); pos += 4096);
+                seeker.setFileSize(encrypted.size());
+            }
+            int reqBefore = server.numRequests();
+            OggSeeker::Result res;
+            ElapsedTimer timer;
+            bool ok = seeker.seek(reader, targetMs, res);
+            // as SpotifyNode, read one more chunk before the stream can start
+            uint8_t next[OggSeeker::kReadChunk];
+            int32_t nextLen = ok ? reader.read(next, sizeof(next)) : -1;
+            int seekMs = timer.msElapsed();
+            maxSeekMs = std::max(maxSeekMs, seekMs);
+            if (!ok || nextLen < 0) {
+                fail(targetMs, "seek failed");
+                continue;
+            }
+            uint64_t target = (uint64_t)std::min(targetMs, durationMs / 1000 * 1000 - 1000) * rate / 1000;
+            auto it = std::find_if(pages.begin(), pages.end(), [&res](const PageInfo& p) { return p.offset == res.pageOffset; });
+            if (it == pages.end()) {
+                fail(targetMs, "result is not a page start");
+                continue;
+            }
+            int64_t prevGranule = 0;
+            for (auto p = it; p != pages.begin();) {
+                --p;
+                if (p->granule > 0 || p->offset == pages[0].offset) {
+                    prevGranule = std::max<int64_t>(p->granule, 0);
+                    break;
+                }
+            }
+            if ((int64_t)res.granule != prevGranule) {
+                fail(targetMs, "start granule is not that of the previous page");
+            }
+            if (res.granule > target || (uint64_t)it->granule <= target) {
+                fail(targetMs, "page doesn't contain the target");
+            }
+            if (res.readPos % OggSeeker::kAlign || res.readPos != res.pageOffset + res.data.size()
+                || memcmp(res.data.data(), plain.data() + res.pageOffset, res.data.size())
+                || memcmp(next, plain.data() + res.readPos, nextLen)) {
+                fail(targetMs, "data doesn't match the file");
+            }
+            // decode from the page, with the headers before it
+            std::string stream = seeker.headers() + res.data;
+            stream.append((const char*)next, nextLen);
+            size_t end = std::min(plain.size(), (size_t)res.readPos + nextLen + 256 * 1024);
+            stream.append((const char*)plain.data() + res.readPos + nextLen, end - res.readPos - nextLen);
+            int ch, r;
+            auto out = decodeAll((const uint8_t*)stream.data(), stream.size(), ch, r);
+            enum { kCompare = 4096 };
+            int64_t firstSample = -1;
+            int64_t from = res.granule * channels;
+            for (int64_t pos = from; out.size() >= kCompare && pos < from + 16384 * channels
+                    && pos + kCompare <= (int64_t)ref.size(); pos += channels) {
+                if (memcmp(&ref[pos], out.data(), kCompare * 2) == 0) {
+                    firstSample = pos / channels;
+                    break;
+                }
+            }
+            double tsErrMs = (firstSample - (int64_t)res.granule) * 1000.0 / rate;
+            printf("{\"headers\":\"%s\",\"targetMs\":%u,\"pageMs\":%.1f,\"requests\":%d,\"probes\":%d,\"bytes\":%u,"
+                "\"seekMs\":%d,\"decodeMatch\":%s,\"tsErrorMs\":%.1f}\n", warm ? "captured" : "read", targetMs,
+                res.granule * 1000.0 / rate, server.numRequests() - reqBefore, res.numProbes, reader.bytesReceived, seekMs,
+                firstSample >= 0 ? "true" : "false", tsErrMs);
+            fflush(stdout);
+            if (firstSample < 0) {
+                fail(targetMs, "decoded output doesn't match the full decode");
+            }
+            else if (tsErrMs > 100) {
+                fail(targetMs, "decoding starts too far after the page start");
+            }
+            if (warm && res.numProbes > 2) {
+                fail(targetMs, "more than two requests with the headers known");
+            }
+        }
+    }
+    printf("{\"maxSeekMs\":%d,\"delayMs\":%d,\"rateKBps\":%d}\n", maxSeekMs, delayMs, rateKBps);
+    if (maxSeekMs >= 1000) {
+        printf("FAIL: seek took a second or more\n");
+        numFailed++;
+    }
+    return numFailed ? 1 : 0;
+}
@@ -0,0 +1,262 @@
+// Host benchmark of station switching: time from the switch to having the prefill amount of stream data,
+// which is when HttpNode lets the pipeline start playing. Compares a new connection, with the same request
+// sequence as HttpNode::connect(), to taking over a connection kept by StationPrewarmer.
+// A stand-in Icecast-like server runs in-process on the loopback interface. It adds a fixed latency to
+// each response, to model the network round trips and the server, and sends 128 kbps MP3-like data
+// with ICY metadata, in realtime. The stations are reached directly, via a redirect, and via an m3u
+// playlist, in turn. Each switch goes to the next station, after dwelling on the current one for the
+// given time, during which its neighbours are kept warm.
+// Reports, as one JSON object per line: server latency, initial burst size, switch times for a new
+// and a pre-connected connection, and the data buffered in the latter at the switch.
+// g++ -std=gnu++17 -O2 -pthread -o zapBench zapBench.cpp ../stationPrewarmer.cpp ../hlsPlaylist.cpp ../icyParser.cpp ../playlist.cpp ../streamDefs.cpp -I ./host -I ..
+// Usage: zapBench [dwell seconds, default 4]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <loopbackServer.hpp>
+#include "stationPrewarmer.hpp"
+
+enum {
+    kNumStations = 6, kByteRate = 16000, kIcyInterval = 8192,
+    kSendIntervalMs = 100, kReadChunk = 2048,
+    kPrewarmSessions = 2, kPrewarmBudget = 96 * 1024 // the firmware defaults
+};
+static std::atomic<bool> sTerminate(false);
+static int sPort;
+static int sLatencyMs;
+static int sBurstBytes;
+
+static void msSleep(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+static int64_t msNow()
+{
+    return esp_timer_get_time() / 1000;
+}
+static std::string baseUrl()
+{
+    return "http://127.0.0.1:" + std::to_string(sPort);
+}
+static std::string stationUrl(int idx)
+{
+    switch (idx % 3) {
+        case 0: return baseUrl() + "/live" + std::to_string(idx);
+        case 1: return baseUrl() + "/sta" + std::to_string(idx); // redirects
+        default: return baseUrl() + "/sta" + std::to_string(idx) + ".m3u";
+    }
+}
+static bool sendAll(int fd, const char* data, int len)
+{
+    while (len > 0) {
+        auto sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+static void sendStream(int fd, int idx)
+{
+    std::string hdr = "HTTP/1.0 200 OK\r\nContent-Type: audio/mpeg\r\nicy-metaint: " + std::to_string(kIcyInterval) +
+        "\r\nicy-br: 128\r\nicy-name: Station " + std::to_string(idx) + "\r\n\r\n";
+    if (!sendAll(fd, hdr.data(), hdr.size())) {
+        return;
+    }
+    std::string data;
+    int icyCtr = 0;
+    int64_t sent = 0;
+    auto tsStart = msNow();
+    while (!sTerminate) {
+        // the burst, then the data that is due at the stream rate
+        int64_t due = sBurstBytes + (msNow() - tsStart) * kByteRate / 1000;
+        data.clear();
+        for (; sent < due; sent++) {
+            data += (char)(0xa0 + (sent & 0x0f));
+            if (++icyCtr == kIcyInterval) {
+                icyCtr = 0;
+                char meta[33] = "\x02StreamTitle='Title';";
+                data.append(meta, 33);
+            }
+        }
+        if (!sendAll(fd, data.data(), data.size())) {
+            return;
+        }
+        msSleep(kSendIntervalMs);
+    }
+}
+static void serveClient(int fd)
+{
+    std::string req;
+    char buf[512];
+    while (req.find("\r\n\r\n") == std::string::npos) {
+        auto len = recv(fd, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            return;
+        }
+        req.append(buf, len);
+    }
+    std::string path = req.substr(4, req.find(' ', 4) - 4);
+    msSleep(sLatencyMs);
+    int idx = atoi(path.c_str() + path.find_first_of("0123456789"));
+    std::string resp;
+    if (path.compare(0, 5, "/live") == 0) {
+        sendStream(fd, idx);
+    }
+    else if (path.find(".m3u") != std::string::npos) {
+        std::string body = "#EXTM3U\n" + baseUrl() + "/live" + std::to_string(idx) + "\n";
+        resp = "HTTP/1.0 200 OK\r\nContent-Type: audio/x-mpegurl\r\nContent-Length: " + std::to_string(body.size()) +
+            "\r\n\r\n" + body;
+    }
+    else {
+        resp = "HTTP/1.0 302 Found\r\nLocation: /live" + std::to_string(idx) + "\r\n\r\n";
+    }
+    if (!resp.empty()) {
+        sendAll(fd, resp.data(), resp.size());
+    }
+}
+static void setHeaders(esp_http_client_handle_t client)
+{
+    esp_http_client_set_header(client, "Icy-MetaData", "1");
+}
+// Reads until the prefill amount is buffered, stripping the ICY metadata as HttpNode does
+static bool readToPrefill(esp_http_client_handle_t client, IcyParser& icy, int buffered)
+{
+    int prefill = StreamFormat(Codec::kCodecMp3).prefillAmount();
+    char buf[kReadChunk];
+    while (buffered < prefill) {
+        int rlen = esp_http_client_read(client, buf, sizeof(buf));
+        if (rlen < 0 || (rlen == 0 && errno != EAGAIN)) {
+            return false;
+        }
+        if (icy.icyInterval()) {
+            icy.processRecvData(buf, rlen);
+        }
+        buffered += rlen;
+    }
+    return true;
+}
+// The request sequence of HttpNode::connect(): redirects and playlists are followed on the same client
+static int coldSwitchMs(const std::string& url)
+{
+    auto tsStart = msNow();
+    Mutex mutex;
+    IcyParser icy(mutex);
+    StreamFormat fmt;
+    esp_http_client_config_t cfg = {};
+    cfg.url = url.c_str();
+    cfg.timeout_ms = 10000;
+    cfg.event_handler = [](esp_http_client_event_t* evt) {
+        if (evt->event_id == HTTP_EVENT_ON_HEADER) {
+            auto& icy = *static_cast<IcyParser*>(evt->user_data);
+            icy.parseHeader(evt->header_key, evt->header_value);
+        }
+        return ESP_OK;
+    };
+    cfg.user_data = &icy;
+    auto client = esp_http_client_init(&cfg);
+    setHeaders(client);
+    Playlist playlist;
+    bool ok = false;
+    for (int tries = 0; tries < 4; tries++) {
+        if (esp_http_client_open(client, 0) != ESP_OK) {
+            break;
+        }
+        auto contentLen = esp_http_client_fetch_headers(client);
+        auto status = esp_http_client_get_status_code(client);
+        if (status == 302) {
+            esp_http_client_set_redirection(client);
+            continue;
+        }
+        if (contentLen > 0) { // the playlist
+            std::unique_ptr<char[]> body(new char[contentLen + 1]);
+            int rlen = esp_http_client_read(client, body.get(), contentLen);
+            body[std::max(rlen, 0)] = 0;
+            playlist.load(body.get());
+            esp_http_client_set_url(client, playlist.getNextTrack());
+            continue;
+        }
+        ok = readToPrefill(client, icy, 0);
+        break;
+    }
+    esp_http_client_cleanup(client);
+    return ok ? msNow() - tsStart : -1;
+}
+static int warmSwitchMs(StationPrewarmer& prewarmer, const std::string& url, int& buffered)
+{
+    auto tsStart = msNow();
+    auto session = prewarmer.take(url.c_str());
+    if (!session) {
+        buffered = 0;
+        return coldSwitchMs(url);
+    }
+    buffered = session->dataSize();
+    auto client = session->releaseClient();
+    esp_http_client_set_timeout_ms(client, 10000);
+    Mutex mutex;
+    IcyParser icy(mutex);
+    icy.takeStreamState(session->icyParser());
+    bool ok = readToPrefill(client, icy, buffered);
+    esp_http_client_cleanup(client);
+    return ok ? msNow() - tsStart : -1;
+}
+static void setNeighbours(StationPrewarmer& prewarmer, int current)
+{
+    std::string next = stationUrl((current + 1) % kNumStations);
+    std::string prev = stationUrl((current + kNumStations - 1) % kNumStations);
+    const char* urls[] = { next.c_str(), prev.c_str() };
+    prewarmer.setStations(urls, 2);
+}
+int main(int argc, char* argv[])
+{
+    int dwellSec = (argc > 1) ? atoi(argv[1]) : 4;
+    if (dwellSec <= 0) {
+        fprintf(stderr, "Usage: zapBench [dwell seconds]\n");
+        return 1;
+    }
+    LoopbackServer server(serveClient);
+    sPort = server.start(16);
+    if (!sPort) {
+        perror("bind");
+        return 2;
+    }
+    static const int latencies[] = { 50, 300 };
+    static const int bursts[] = { 0, 32768 };
+    int numSlower = 0;
+    for (auto latency: latencies) {
+        for (auto burst: bursts) {
+            sLatencyMs = latency;
+            sBurstBytes = burst;
+            int64_t totalCold = 0, totalWarm = 0;
+            StationPrewarmer prewarmer(kPrewarmSessions, kPrewarmBudget, setHeaders);
+            for (int sta = 0; sta < kNumStations; sta++) {
+                setNeighbours(prewarmer, sta);
+                msSleep(dwellSec * 1000);
+                auto url = stationUrl((sta + 1) % kNumStations);
+                int buffered;
+                int warmMs = warmSwitchMs(prewarmer, url, buffered);
+                int coldMs = coldSwitchMs(url);
+                printf("{\"latencyMs\":%d,\"burst\":%d,\"station\":\"%s\",\"coldMs\":%d,\"warmMs\":%d,\"warmBuffered\":%d}\n",
+                    latency, burst, url.c_str() + baseUrl().size(), coldMs, warmMs, buffered);
+                fflush(stdout);
+                totalCold += coldMs;
+                totalWarm += warmMs;
+            }
+            printf("{\"latencyMs\":%d,\"burst\":%d,\"avgColdMs\":%d,\"avgWarmMs\":%d}\n", latency, burst,
+                (int)(totalCold / kNumStations), (int)(totalWarm / kNumStations));
+            if (totalWarm > totalCold) {
+                numSlower++;
+            }
+        }
+    }
+    sTerminate = true;
+    return numSlower ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+#include "tsDemuxer.hpp"
+#include <string.h>
+#include <algorithm>
+#include <esp_log.h>
+
+static const char* TAG = "ts-demux";
+
+void TsDemuxer::reset()
+{
+    mPacketLen = 0;
+    mPmtPid = mAudioPid = -1;
+    mStreamType = 0;
+    mPesHdrSkip = 0;
+}
+Codec TsDemuxer::codec() const
+{
+    switch (mStreamType) {
+    case kStreamTypeAdts:
+        return Codec::kCodecAac;
+    case kStreamTypeMpeg1Audio:
+    case kStreamTypeMpeg2Audio:
+        return Codec::kCodecMp3;
+    default:
+        return Codec::kCodecUnknown;
+    }
+}
+int TsDemuxer::demux(const uint8_t* data, int len, uint8_t* out)
+{
+    int outLen = 0;
+    if (mPacketLen) { // complete the packet that started in the previous chunk
+        int n = std::min(len, kPacketSize - mPacketLen);
+        memcpy(mPacket + mPacketLen, data, n);
+        mPacketLen += n;
+        data += n;
+        len -= n;
+        if (mPacketLen < kPacketSize) {
+            return 0;
+        }
+        outLen += processPacket(mPacket, out);
+        mPacketLen = 0;
+    }
+    while (len > 0) {
+        if (*data != kSyncByte) { // lost sync, skip to the next sync byte
+            auto sync = (const uint8_t*)memchr(data, kSyncByte, len);
+            if (!sync) {
+                return outLen;
+            }
+            ESP_LOGW(TAG, "Lost sync, skipping %d bytes", (int)(sync - data));
+            len -= sync - data;
+            data = sync;
+        }
+        if (len < kPacketSize) {
+            memcpy(mPacket, data, len);
+            mPacketLen = len;
+            break;
+        }
+        outLen += processPacket(data, out + outLen);
+        data += kPacketSize;
+        len -= kPacketSize;
+    }
+    return outLen;
+}
+int TsDemuxer::processPacket(const uint8_t* pkt, uint8_t* out)
+{
+    bool unitStart = pkt[1] & 0x40;
+    int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+    uint8_t adaptCtrl = (pkt[3] >> 4) & 0x03;
+    if (!(adaptCtrl & 0x01)) { // no payload
+        return 0;
+    }
+    const uint8_t* payload = pkt + 4;
+    if (adaptCtrl & 0x02) {
+        payload += 1 + payload[0];
+    }
+    int len = pkt + kPacketSize - payload;
+    if (len <= 0) {
+        return 0;
+    }
+    if (pid == mAudioPid) {
+        if (unitStart) {
+            // PES header: start code prefix, stream id, packet length, flags, header data length
+            if (len < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1) {
+                ESP_LOGW(TAG, "Invalid PES header");
+                return 0;
+            }
+            mPesHdrSkip = 9 + payload[8];
+        }
+        int skip = std::min(mPesHdrSkip, len);
+        mPesHdrSkip -= skip;
+        len -= skip;
+        memcpy(out, payload + skip, len);
+        return len;
+    }
+    if (!unitStart || (pid != 0 && pid != mPmtPid)) {
+        return 0;
+    }
+    // PSI section, after the pointer field. Sections of PAT and PMT for a single program fit in a packet
+    len -= 1 + payload[0];
+    payload += 1 + payload[0];
+    if (len < 3) {
+        return 0;
+    }
+    int sectionLen = std::min(((payload[1] & 0x0f) << 8) | payload[2], len - 3);
+    if (pid == 0 && payload[0] == 0x00) {
+        parsePat(payload + 3, sectionLen);
+    }
+    else if (pid == mPmtPid && payload[0] == 0x02) {
+        parsePmt(payload + 3, sectionLen);
+    }
+    return 0;
+}
+void TsDemuxer::parsePat(const uint8_t* data, int len)
+{
+    // transport stream id, version, section numbers, then program entries, the CRC at the end
+    for (int pos = 5; pos + 4 <= len - 4; pos += 4) {
+        int program = (data[pos] << 8) | data[pos + 1];
+        if (program != 0) { // 0 is the network PID
+            mPmtPid = ((data[pos + 2] & 0x1f) << 8) | data[pos + 3];
+            return;
+        }
+    }
+}
+void TsDemuxer::parsePmt(const uint8_t* data, int len)
+{
+    if (len < 9) {
+        return;
+    }
+    // program number, version, section numbers, PCR PID, program info
+    int pos = 9 + (((data[7] & 0x0f) << 8) | data[8]);
+    for (; pos + 5 <= len - 4; pos += 5 + (((data[pos + 3] & 0x0f) << 8) | data[pos + 4])) {
+        uint8_t type = data[pos];
+        if (type != kStreamTypeAdts && type != kStreamTypeMpeg1Audio && type != kStreamTypeMpeg2Audio) {
+            continue;
+        }
+        int pid = ((data[pos + 1] & 0x1f) << 8) | data[pos + 2];
+        if (pid != mAudioPid) {
+            ESP_LOGI(TAG, "Audio stream type 0x%02x on PID %d", type, pid);
+            mAudioPid = pid;
+            mStreamType = type;
+            mPesHdrSkip = 0;
+        }
+        return;
+    }
+    if (mAudioPid < 0) {
+        ESP_LOGW(TAG, "No supported audio stream in the program");
+    }
+}
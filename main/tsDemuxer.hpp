@@ -0,0 +1,35 @@
+#ifndef TS_DEMUXER_HPP
+#define TS_DEMUXER_HPP
+#include <stdint.h>
+#include "streamDefs.hpp"
+
+/** Extracts the elementary stream of the first audio program of an MPEG transport stream, as HLS
+ * segments carry it: the PAT and PMT are parsed to find the audio PID, and the PES headers are stripped
+ * from its packets. ADTS AAC and MPEG audio are supported. The data can be fed in chunks of any size
+ */
+class TsDemuxer
+{
+public:
+    enum { kPacketSize = 188, kSyncByte = 0x47 };
+protected:
+    enum: uint8_t { kStreamTypeMpeg1Audio = 0x03, kStreamTypeMpeg2Audio = 0x04, kStreamTypeAdts = 0x0f };
+    uint8_t mPacket[kPacketSize]; // a packet split across chunks
+    int mPacketLen = 0;
+    int mPmtPid = -1;
+    int mAudioPid = -1;
+    uint8_t mStreamType = 0;
+    int mPesHdrSkip = 0; // bytes of a PES header that continues in the next packet
+    int processPacket(const uint8_t* pkt, uint8_t* out);
+    void parsePat(const uint8_t* data, int len);
+    void parsePmt(const uint8_t* data, int len);
+public:
+    /** Forgets the stream, for the start of a new segment */
+    void reset();
+    /** Demuxes \c len bytes of the transport stream and writes the audio elementary stream data in them
+     * to \c out, which must have room for len + kPacketSize bytes. Returns the number of bytes written */
+    int demux(const uint8_t* data, int len, uint8_t* out);
+    /** The codec of the audio stream, unknown until the PMT is received */
+    Codec codec() const;
+};
+
+#endif